@@ -0,0 +1,63 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * Helpers shared by the bench programs: a monotonic clock and the
+ * simulator image fixture.  Linked into every bench/ target.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define IMAGE_SLAVES	{ 0x2c, 0x2d, 0x2e, 0x2f }	/* Every slave in boards.c */
+
+/*
+ * Function prototypes
+ */
+double		now(void);
+void		write_image(FILE *);
+
+
+/*
+ * now(void)
+ *
+ * Returns the monotonic clock, in seconds.
+ */
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+
+/*
+ * write_image(FILE *fp)
+ *
+ * fp = Stream to write to
+ *
+ * Writes a simulator image file (see smbus_sim.c) with random registers
+ * for every slave address any built-in board uses.
+ */
+void
+write_image(FILE *fp)
+{
+	const int slaves[] = IMAGE_SLAVES;
+	size_t i, row, col;
+
+	for (i = 0; i < sizeof(slaves) / sizeof(slaves[0]); ++i) {
+		fprintf(fp, "slave 0x%02x\n", slaves[i]);
+		for (row = 0; row < 256; row += 16) {
+			fprintf(fp, "%02zx:", row);
+			for (col = 0; col < 16; ++col) {
+				fprintf(fp, " %02lx", (u_long)(random() % 256));
+			}
+			fprintf(fp, "\n");
+		}
+	}
+}
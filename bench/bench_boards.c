@@ -0,0 +1,360 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_boards: the memory footprint of the built-in board table (struct
+ * boardtab; see global.h) against boardlist[] itself, the pointer-based
+ * layout it's generated from and which bsdhwmon used to search:
+ *
+ *  - bytes of board structs, pin lists, and strings;
+ *  - distinct cache lines touched finding a board (its record, maker,
+ *    and product; the index is the same either way) and walking its
+ *    pins and labels, as output.c does, averaged over every board, and
+ *    for every board at once (-l, or a whole board database);
+ *  - ns per walk of a board's pins and labels.
+ *
+ * Cache lines are counted from the addresses the linker actually gave
+ * everything, LINE bytes each, so they shift from one build to the next
+ * as unrelated changes move the tables about: a per-board figure can
+ * change by a whole line.  Compare layouts within one build only.
+ *
+ * Usage: bench_boards [walks]
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+
+#define LINE		64		/* Cache line size, in bytes */
+#define MAXLINES	4096		/* Most distinct lines one count can hold */
+#define NWALKS		2000000		/* Timed walks per layout */
+
+/*
+ * Distinct cache lines touched so far
+ */
+struct lines {
+	uintptr_t	line[MAXLINES];
+	size_t		n;
+};
+
+/*
+ * Function prototypes
+ */
+static int	first_seen(const void *);
+static void	touch(struct lines *, const void *, const size_t);
+static void	touch_string(struct lines *, const char *);
+static void	old_lines(struct lines *, const struct boarddef *, const int);
+static void	new_lines(struct lines *, const struct board *, const int);
+static size_t	old_walk(const struct boarddef *);
+static size_t	new_walk(const struct board *);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+
+/*
+ * External functions (lookup.c)
+ */
+extern const struct boardtab *	board_table(void);
+
+/*
+ * External variables (boards.c)
+ */
+extern const struct boarddef	boardlist[];
+
+/*
+ * Global variables
+ */
+int f_verbose = 0;	/* Referenced by global.h */
+static volatile size_t sink;	/* Keeps walks from being optimised out */
+static const void *seen[MAXLINES];	/* See first_seen() */
+static size_t nseen;
+
+
+/*
+ * first_seen(const void *p)
+ *
+ * p = Object in boardlist[]'s layout
+ *
+ * Returns non-zero the first time it's called with p, zero after.
+ */
+static int
+first_seen(const void *p)
+{
+	size_t i;
+
+	for (i = 0; i < nseen; ++i) {
+		if (seen[i] == p) {
+			return (0);
+		}
+	}
+	if (nseen == MAXLINES) {
+		errx(EX_SOFTWARE, "more than %d distinct objects", MAXLINES);
+	}
+	seen[nseen++] = p;
+	return (1);
+}
+
+
+/*
+ * touch(struct lines *l, const void *p, const size_t len)
+ * touch_string(struct lines *l, const char *s)
+ *
+ *   l = Lines touched so far; updated
+ *   p = Start of an object read
+ * len = Its size
+ *   s = String read, up to and including its NUL
+ *
+ * Adds the cache lines an object (or string) lies in to l.
+ */
+static void
+touch(struct lines *l, const void *p, const size_t len)
+{
+	uintptr_t a, end = ((uintptr_t)p + len - 1) / LINE;
+	size_t i;
+
+	for (a = (uintptr_t)p / LINE; a <= end; ++a) {
+		for (i = 0; i < l->n && l->line[i] != a; ++i)
+			;
+		if (i == l->n) {
+			if (l->n == MAXLINES) {
+				errx(EX_SOFTWARE, "more than %d lines", MAXLINES);
+			}
+			l->line[l->n++] = a;
+		}
+	}
+}
+
+static void
+touch_string(struct lines *l, const char *s)
+{
+	touch(l, s, strlen(s) + 1);
+}
+
+
+/*
+ * old_lines(struct lines *l, const struct boarddef *d, const int pins)
+ * new_lines(struct lines *l, const struct board *b, const int pins)
+ *
+ *    l = Lines touched so far; updated
+ * d, b = Board, in one layout or the other
+ * pins = Non-zero to add the lines its pins and labels are in, as well
+ *        as those a lookup reads
+ */
+static void
+old_lines(struct lines *l, const struct boarddef *d, const int pins)
+{
+	const struct pindef *defs[BOARD_KINDS] = { d->voltages, d->temps, d->fans };
+	size_t k, i;
+
+	touch(l, d, sizeof(*d));
+	touch_string(l, d->maker);
+	touch_string(l, d->product);
+	if (!pins) {
+		return;
+	}
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		for (i = 0; defs[k][i].label != NULL; ++i) {
+			touch(l, &defs[k][i], sizeof(defs[k][i]));
+			touch_string(l, defs[k][i].label);
+		}
+		touch(l, &defs[k][i], sizeof(defs[k][i]));	/* Terminator */
+	}
+}
+
+static void
+new_lines(struct lines *l, const struct board *b, const int pins)
+{
+	const struct pinmap *p;
+	int kind;
+	size_t i;
+
+	touch(l, b, sizeof(*b));
+	touch(l, b->tab, sizeof(*b->tab));
+	touch_string(l, BOARD_MAKER(b));
+	touch_string(l, BOARD_PRODUCT(b));
+	if (!pins) {
+		return;
+	}
+	for (kind = SENSOR_VOLT; kind <= SENSOR_FAN; ++kind) {
+		p = BOARD_PINS(b, kind);
+		for (i = 0; i < BOARD_NPINS(b, kind); ++i) {
+			touch(l, &p[i], sizeof(p[i]));
+			touch_string(l, BOARD_LABEL(b, &p[i]));
+		}
+	}
+}
+
+
+/*
+ * old_walk(const struct boarddef *d)
+ * new_walk(const struct board *b)
+ *
+ * d, b = Board, in one layout or the other
+ *
+ * Reads every pin and the first byte of every label, as output.c does
+ * when compiling an output format.
+ *
+ * Returns something depending on all of it.
+ */
+static size_t
+old_walk(const struct boarddef *d)
+{
+	const struct pindef *defs[BOARD_KINDS] = { d->voltages, d->temps, d->fans };
+	size_t k, i, sum = 0;
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		for (i = 0; defs[k][i].label != NULL; ++i) {
+			sum += defs[k][i].index + (u_char)defs[k][i].label[0];
+		}
+	}
+	return (sum);
+}
+
+static size_t
+new_walk(const struct board *b)
+{
+	const struct pinmap *p;
+	int kind;
+	size_t i, sum = 0;
+
+	for (kind = SENSOR_VOLT; kind <= SENSOR_FAN; ++kind) {
+		p = BOARD_PINS(b, kind);
+		for (i = 0; i < BOARD_NPINS(b, kind); ++i) {
+			sum += p[i].index + (u_char)BOARD_LABEL(b, &p[i])[0];
+		}
+	}
+	return (sum);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	static struct lines l, all_old, all_new;
+	const struct boardtab *t = board_table();
+	const struct pindef *defs[BOARD_KINDS];
+	const struct board *b;
+	const struct pinmap *p;
+	int kind;
+	size_t nwalks = NWALKS;
+	size_t i, k, n;
+	size_t pindefs = 0, strbytes = 0, strsize = 0, npins = 0, nvcoefs = 0;
+	size_t old_bytes, new_bytes;
+	size_t sum_old[2] = { 0, 0 }, sum_new[2] = { 0, 0 };
+	double t0, t_old, t_new;
+
+	if (argc > 1 && (nwalks = strtoul(argv[1], NULL, 10)) == 0) {
+		errx(EX_USAGE, "walks must be a positive number");
+	}
+
+	/*
+	 * Bytes.  boardlist[] shares pin lists between boards by pointer,
+	 * and strings by the compiler merging identical literals, so each
+	 * distinct one is counted once.  The pools are sized from the
+	 * furthest any board reaches into them.
+	 */
+	for (i = 0; i < t->nboards; ++i) {
+		defs[0] = boardlist[i].voltages;
+		defs[1] = boardlist[i].temps;
+		defs[2] = boardlist[i].fans;
+		if (first_seen(boardlist[i].maker)) {
+			strbytes += strlen(boardlist[i].maker) + 1;
+		}
+		if (first_seen(boardlist[i].product)) {
+			strbytes += strlen(boardlist[i].product) + 1;
+		}
+		for (k = 0; k < BOARD_KINDS; ++k) {
+			if (!first_seen(defs[k])) {
+				continue;
+			}
+			for (n = 0; defs[k][n].label != NULL; ++n) {
+				if (first_seen(defs[k][n].label)) {
+					strbytes += strlen(defs[k][n].label) + 1;
+				}
+			}
+			pindefs += n + 1;	/* Terminator too */
+		}
+
+		b = &t->boards[i];
+		strsize = MAX(strsize, (size_t)b->maker + strlen(BOARD_MAKER(b)) + 1);
+		strsize = MAX(strsize, (size_t)b->product + strlen(BOARD_PRODUCT(b)) + 1);
+		for (kind = SENSOR_VOLT; kind <= SENSOR_FAN; ++kind) {
+			p = BOARD_PINS(b, kind);
+			for (n = 0; n < BOARD_NPINS(b, kind); ++n) {
+				strsize = MAX(strsize,
+				    (size_t)p[n].label + strlen(BOARD_LABEL(b, &p[n])) + 1);
+			}
+			npins = MAX(npins, (size_t)(p - t->pins) + n);
+		}
+		nvcoefs = MAX(nvcoefs, (size_t)b->vcoef + b->nvcoef);
+	}
+
+	old_bytes = t->nboards * sizeof(struct boarddef) + pindefs * sizeof(struct pindef) + strbytes;
+	new_bytes = sizeof(*t) + t->nboards * sizeof(struct board) +
+	    npins * sizeof(struct pinmap) + nvcoefs * sizeof(struct vcoef) + strsize;
+
+	printf("%u boards\n\n", t->nboards);
+	printf("%-24s  %10s  %10s\n", "bytes", "boardlist", "boardtab");
+	printf("%-24s  %10zu  %10zu\n", "boards",
+	    t->nboards * sizeof(struct boarddef), sizeof(*t) + t->nboards * sizeof(struct board));
+	printf("%-24s  %10zu  %10zu\n", "pin lists",
+	    pindefs * sizeof(struct pindef), npins * sizeof(struct pinmap));
+	printf("%-24s  %10d  %10zu\n", "vcoef lists", 0, nvcoefs * sizeof(struct vcoef));
+	printf("%-24s  %10zu  %10zu\n", "strings", strbytes, strsize);
+	printf("%-24s  %10zu  %10zu\n\n", "total", old_bytes, new_bytes);
+
+	/*
+	 * Cache lines, per board and for every board
+	 */
+	for (i = 0; i < t->nboards; ++i) {
+		for (k = 0; k < 2; ++k) {
+			l.n = 0;
+			old_lines(&l, &boardlist[i], (int)k);
+			sum_old[k] += l.n;
+			l.n = 0;
+			new_lines(&l, &t->boards[i], (int)k);
+			sum_new[k] += l.n;
+		}
+		old_lines(&all_old, &boardlist[i], 1);
+		new_lines(&all_new, &t->boards[i], 1);
+	}
+	printf("%-24s  %10s  %10s\n", "cache lines", "boardlist", "boardtab");
+	printf("%-24s  %10.2f  %10.2f\n", "lookup, per board",
+	    (double)sum_old[0] / t->nboards, (double)sum_new[0] / t->nboards);
+	printf("%-24s  %10.2f  %10.2f\n", "lookup+pins, per board",
+	    (double)sum_old[1] / t->nboards, (double)sum_new[1] / t->nboards);
+	printf("%-24s  %10zu  %10zu\n\n", "lookup+pins, all boards", all_old.n, all_new.n);
+
+	/*
+	 * Time: walk every board's pins and labels, round and round
+	 */
+	t0 = now();
+	for (i = 0, n = 0; i < nwalks; ++i) {
+		n += old_walk(&boardlist[i % t->nboards]);
+	}
+	t_old = now() - t0;
+	sink = n;
+
+	t0 = now();
+	for (i = 0, n = 0; i < nwalks; ++i) {
+		n += new_walk(&t->boards[i % t->nboards]);
+	}
+	t_new = now() - t0;
+	sink = n;
+
+	printf("%-24s  %10s  %10s\n", "ns per walk", "boardlist", "boardtab");
+	printf("%-24s  %10.1f  %10.1f\n", "pins and labels",
+	    t_old * 1e9 / (double)nwalks, t_new * 1e9 / (double)nwalks);
+	return (EX_OK);
+}
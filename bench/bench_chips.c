@@ -0,0 +1,301 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_chips: numbers for the whole sample path, so a change to it can
+ * be judged on them:
+ *
+ *  - the chip routines' conversion functions, in ns per call;
+ *  - hwmon_sample() of every built-in board against a simulated
+ *    register image, in ns, bus transactions and allocations per sample;
+ *  - sensors_render() in each output format, over every board, in ns,
+ *    bytes and allocations per sample.
+ *
+ * Allocations are counted by wrapping malloc(3), calloc(3) and
+ * realloc(3) at link time (ld --wrap; see the Makefile), so calls made
+ * by bsdhwmon itself are counted, but not those made inside libc.
+ *
+ * Usage: bench_chips [samples]
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+#include "hwmon.h"
+
+#define NCALLS		10000000	/* Calls per conversion function */
+#define NSAMPLES	20000		/* Samples per board and format */
+
+/*
+ * Function prototypes
+ */
+void *		__real_malloc(size_t);
+void *		__real_calloc(size_t, size_t);
+void *		__real_realloc(void *, size_t);
+void *		__wrap_malloc(size_t);
+void *		__wrap_calloc(size_t, size_t);
+void *		__wrap_realloc(void *, size_t);
+static void	bench_conv(void);
+static void	bench_collect(const char *, struct sensors *, const size_t);
+static void	bench_render(const struct sensors *, const size_t);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+extern void	write_image(FILE *);
+
+/*
+ * External functions (chip_w83792d.c)
+ */
+extern uint8_t	w83792d_divisor(const uint8_t);
+extern uint32_t	w83792d_rpmconv(const uint8_t, const uint8_t);
+
+/*
+ * External functions (chip_w83793g.c)
+ */
+extern uint32_t	w83793g_rpmconv(const uint16_t);
+extern uint8_t	w83793g_tempadj(const uint8_t);
+
+/*
+ * Global variables
+ */
+static u_long	nallocs;		/* malloc/calloc/realloc calls so far */
+static const struct board *boards;	/* The built-in board table's */
+static size_t	nboards;
+static const char *formats[] = { "text", "delim", "json", "openmetrics" };
+static volatile uint32_t sink;		/* Keeps conversions from being optimised out */
+
+
+/*
+ * __wrap_malloc(size_t size), __wrap_calloc(size_t n, size_t size),
+ * __wrap_realloc(void *p, size_t size)
+ *
+ * Count the call, then hand it to the real function.
+ */
+void *
+__wrap_malloc(size_t size)
+{
+	++nallocs;
+	return (__real_malloc(size));
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+	++nallocs;
+	return (__real_calloc(n, size));
+}
+
+void *
+__wrap_realloc(void *p, size_t size)
+{
+	++nallocs;
+	return (__real_realloc(p, size));
+}
+
+
+/*
+ * bench_conv(void)
+ *
+ * Times each conversion function over every input it can be given,
+ * round and round, for NCALLS calls.
+ */
+static void
+bench_conv(void)
+{
+	uint32_t acc = 0;
+	size_t i;
+	double t;
+
+	printf("%-24s  %10s\n", "conversion", "ns/call");
+
+	t = now();
+	for (i = 0; i < NCALLS; ++i) {
+		acc += w83792d_divisor((uint8_t)(i & 0x0f));
+	}
+	printf("%-24s  %10.2f\n", "w83792d_divisor()", (now() - t) * 1e9 / NCALLS);
+
+	t = now();
+	for (i = 0; i < NCALLS; ++i) {
+		acc += w83792d_rpmconv((uint8_t)i, (uint8_t)(1 << ((i >> 8) & 0x07)));
+	}
+	printf("%-24s  %10.2f\n", "w83792d_rpmconv()", (now() - t) * 1e9 / NCALLS);
+
+	t = now();
+	for (i = 0; i < NCALLS; ++i) {
+		acc += w83793g_rpmconv((uint16_t)(i & 0x0fff));
+	}
+	printf("%-24s  %10.2f\n", "w83793g_rpmconv()", (now() - t) * 1e9 / NCALLS);
+
+	t = now();
+	for (i = 0; i < NCALLS; ++i) {
+		acc += w83793g_tempadj((uint8_t)i);
+	}
+	printf("%-24s  %10.2f\n", "w83793g_tempadj()", (now() - t) * 1e9 / NCALLS);
+
+	sink = acc;
+	printf("\n");
+}
+
+
+/*
+ * bench_collect(const char *device, struct sensors *s, const size_t n)
+ *
+ * device = Simulated bus to sample (e.g. "sim:FILE")
+ *      s = Array of one sensors struct per board, filled in with the
+ *          last sample of each
+ *      n = Samples per board
+ *
+ * Samples each board n times on a context of its own, after one sample
+ * to compile the register plan, and prints the cost per sample.
+ */
+static void
+bench_collect(const char *device, struct sensors *s, const size_t n)
+{
+	const struct board *b;
+	struct hwmon *h;
+	u_long xfers, allocs;
+	size_t i, k;
+	double t;
+
+	printf("%-20s  %-18s  %10s  %8s  %8s\n", "board", "chip", "ns/sample",
+	    "xfers", "allocs");
+
+	for (k = 0; k < nboards; ++k) {
+		b = &boards[k];
+		if ((h = hwmon_open(device, b)) == NULL ||
+		    hwmon_sample(h, &s[k]) == -1) {
+			err(EX_SOFTWARE, "%s %s", BOARD_MAKER(b), BOARD_PRODUCT(b));
+		}
+
+		xfers = hwmon_xfers(h);
+		allocs = nallocs;
+		t = now();
+		for (i = 0; i < n; ++i) {
+			if (hwmon_sample(h, &s[k]) == -1) {
+				err(EX_SOFTWARE, "%s %s", BOARD_MAKER(b), BOARD_PRODUCT(b));
+			}
+		}
+		t = now() - t;
+
+		printf("%-20.20s  %-18.18s  %10.1f  %8.1f  %8.2f\n", BOARD_PRODUCT(b),
+		    get_chip_string(b->chip), t * 1e9 / (double)n,
+		    (double)(hwmon_xfers(h) - xfers) / (double)n,
+		    (double)(nallocs - allocs) / (double)n);
+		hwmon_close(h);
+	}
+	printf("\n");
+}
+
+
+/*
+ * bench_render(const struct sensors *s, const size_t n)
+ *
+ * s = Array of one sample per board, from bench_collect()
+ * n = Renders per board and format
+ *
+ * Renders each board's sample n times in every output format, after one
+ * render to size the output buffer, and prints the cost per sample
+ * averaged over all boards.
+ */
+static void
+bench_render(const struct sensors *s, const size_t n)
+{
+	struct outfmt **of;
+	u_long allocs;
+	size_t format, i, k, len, bytes;
+	double t, total;
+
+	if ((of = calloc(nboards, sizeof(*of))) == NULL) {
+		err(EX_OSERR, "calloc");
+	}
+
+	printf("%-12s  %10s  %8s  %8s  %10s\n", "format", "ns/sample", "bytes",
+	    "allocs", "MB/s");
+
+	for (format = 0; format < sizeof(formats) / sizeof(formats[0]); ++format) {
+		for (k = 0; k < nboards; ++k) {
+			if ((of[k] = outfmt_new(&boards[k], (int)format)) == NULL) {
+				err(EX_SOFTWARE, "outfmt_new");
+			}
+			sensors_render(of[k], &s[k], 0, &len);
+		}
+
+		allocs = nallocs;
+		bytes = 0;
+		total = 0.0;
+		for (k = 0; k < nboards; ++k) {
+			t = now();
+			for (i = 0; i < n; ++i) {
+				sensors_render(of[k], &s[k], 0, &len);
+			}
+			total += now() - t;
+			bytes += len * n;
+		}
+
+		printf("%-12s  %10.1f  %8.1f  %8.2f  %10.1f\n", formats[format],
+		    total * 1e9 / (double)(n * nboards),
+		    (double)bytes / (double)(n * nboards),
+		    (double)(nallocs - allocs) / (double)(n * nboards),
+		    (double)bytes / total / 1e6);
+
+		for (k = 0; k < nboards; ++k) {
+			outfmt_free(of[k]);
+		}
+	}
+	free(of);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	char path[] = "/tmp/bench_chips.XXXXXX";
+	char device[1100];
+	struct sensors *s;
+	size_t nsamples = NSAMPLES;
+	FILE *fp;
+	int fd;
+
+	if (argc > 1 && (nsamples = strtoul(argv[1], NULL, 10)) == 0) {
+		errx(EX_USAGE, "samples must be a positive number");
+	}
+
+	srandom(1);
+	if ((fd = mkstemp(path)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		err(EX_CANTCREAT, "%s", path);
+	}
+	write_image(fp);
+	if (fclose(fp) == EOF) {
+		unlink(path);
+		err(EX_IOERR, "%s", path);
+	}
+	snprintf(device, sizeof(device), "sim:%s", path);
+
+	boards = board_table()->boards;
+	nboards = board_table()->nboards;
+	if ((s = calloc(nboards, sizeof(*s))) == NULL) {
+		unlink(path);
+		err(EX_OSERR, "calloc");
+	}
+
+	printf("%zu boards, %zu samples per board and format\n\n", nboards,
+	    nsamples);
+	bench_conv();
+	bench_collect(device, s, nsamples);
+	bench_render(s, nsamples);
+
+	unlink(path);
+	free(s);
+	return (EX_OK);
+}
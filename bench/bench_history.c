@@ -0,0 +1,396 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_history: time history_append() (history.c), then check what
+ * history_read() gets back: every sample still in the file, and every
+ * 1-minute and 1-hour rollup, against what they must be.  Then time
+ * reading the whole sample ring while a writer process appends as fast as
+ * it can, checking every sample and rollup read is consistent.
+ *
+ * Sample k is taken k seconds after an hour boundary, and has every
+ * sensor at k (modulo WRAP, which a period never straddles), except that
+ * the fans only have a reading in odd samples.  So a period's minimum,
+ * maximum, and mean follow from its first and last samples, and a torn
+ * read shows up as a mismatch.
+ *
+ * Usage: bench_history [appends]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <paths.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+
+#define NAPPENDS	1000000		/* Timed appends */
+#define NREADS		200		/* Timed reads of the sample ring */
+#define T0		((int64_t)1704067200 * 1000000000)	/* 2024-01-01T00:00:00Z */
+#define WRAP		(3600 * 250)	/* Sensor values wrap here, on an hour */
+#define NS		((int64_t)1000000000)
+
+/*
+ * Function prototypes
+ */
+static void	sample(struct sensors *, const uint64_t);
+static void	writer(struct history *);
+static int32_t	expect(const uint64_t, const uint64_t, const int, const int, int *);
+static size_t	check_samples(const struct sensors *, const size_t);
+static size_t	check_rollups(const struct sensors *, const size_t, const int,
+		    const int, const uint64_t);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+
+/*
+ * External functions (history.c)
+ */
+extern struct history *	history_open(const char *, const struct board *);
+extern void	history_append(struct history *, const struct sensors *);
+extern struct history *	history_map(const char *);
+extern ssize_t	history_read(const struct history *, const int, const int,
+		    const int64_t, const int64_t, struct sensors **);
+extern void	history_close(struct history *);
+
+/*
+ * External functions (lookup.c)
+ */
+extern const struct boardtab *	board_table(void);
+
+/*
+ * Global variables
+ */
+int f_verbose = 0;	/* Referenced by global.h */
+static const char *stats[] = { "mean", "min", "max" };
+
+
+/*
+ * sample(struct sensors *s, const uint64_t k)
+ *
+ * s = Filled in with sample k
+ * k = Sample number
+ */
+static void
+sample(struct sensors *s, const uint64_t k)
+{
+	int32_t v = (int32_t)(k % WRAP);
+	size_t i;
+
+	memset(s, 0, sizeof(*s));
+	s->time = T0 + (int64_t)k * NS;
+	for (i = 0; i < VOLT_MAX; ++i) {
+		s->voltages[i] = v;
+		SENSORS_SET(s, SENSOR_VOLT, i);
+	}
+	for (i = 0; i < TEMP_MAX; ++i) {
+		s->temps[i] = v;
+		SENSORS_SET(s, SENSOR_TEMP, i);
+	}
+	for (i = 0; k % 2 == 1 && i < FAN_MAX; ++i) {
+		s->fans[i] = (uint32_t)v;
+		SENSORS_SET(s, SENSOR_FAN, i);
+	}
+}
+
+
+/*
+ * writer(struct history *h)
+ *
+ * h = History file to append to
+ *
+ * Appends samples 0, 1, ... back to back until killed.
+ */
+static void
+writer(struct history *h)
+{
+	struct sensors s;
+	uint64_t k;
+
+	for (k = 0; ; ++k) {
+		sample(&s, k);
+		history_append(h, &s);
+	}
+}
+
+
+/*
+ * expect(const uint64_t k0, const uint64_t k1, const int kind,
+ *        const int stat, int *valid)
+ *
+ *    k0 = First sample of a period
+ *    k1 = Last sample of it so far
+ *  kind = One of sensor_kinds_e
+ *  stat = One of hist_stats_e
+ * valid = Set to whether the period has any readings of kind
+ *
+ * Returns what stat of kind must be over samples k0 to k1.
+ */
+static int32_t
+expect(const uint64_t k0, const uint64_t k1, const int kind, const int stat,
+    int *valid)
+{
+	uint64_t first = k0, last = k1, n;
+	int64_t sum;
+
+	if (kind == SENSOR_FAN) {
+		first = k0 | 1;
+		last = (k1 % 2 == 1 ? k1 : k1 - 1);
+	}
+	*valid = (first <= last && last <= k1);
+	if (!*valid) {
+		return (0);
+	}
+
+	first %= WRAP;
+	last %= WRAP;
+	n = (kind == SENSOR_FAN ? (last - first) / 2 + 1 : last - first + 1);
+	sum = (int64_t)(first + last) * (int64_t)n / 2;
+
+	switch (stat) {
+		case HIST_MIN:
+			return ((int32_t)first);
+		case HIST_MAX:
+			return ((int32_t)last);
+	}
+	return ((int32_t)((sum + (int64_t)n / 2) / (int64_t)n));
+}
+
+
+/*
+ * check_samples(const struct sensors *s, const size_t n)
+ *
+ * s = Samples read back, oldest first
+ * n = Number of them
+ *
+ * Exits if any sample isn't what sample() made it.
+ *
+ * Returns n.
+ */
+static size_t
+check_samples(const struct sensors *s, const size_t n)
+{
+	struct sensors want;
+	size_t j;
+
+	for (j = 0; j < n; ++j) {
+		sample(&want, (uint64_t)((s[j].time - T0) / NS));
+		if (memcmp(&s[j], &want, sizeof(want)) != 0) {
+			errx(EX_SOFTWARE, "torn sample at %" PRId64, s[j].time);
+		}
+		if (j > 0 && s[j].time <= s[j - 1].time) {
+			errx(EX_SOFTWARE, "samples out of order at %" PRId64, s[j].time);
+		}
+	}
+	return (n);
+}
+
+
+/*
+ * check_rollups(const struct sensors *s, const size_t n, const int ring,
+ *               const int stat, const uint64_t last)
+ *
+ *    s = Rollups read back, oldest first
+ *    n = Number of them
+ * ring = HIST_MINUTES or HIST_HOURS
+ * stat = One of hist_stats_e
+ * last = Last sample appended, or 0 if it's not known (the writer is still
+ *        going); then only the minimum can be checked, since the latest
+ *        period may have gained samples since
+ *
+ * Exits if any rollup isn't what it must be.
+ *
+ * Returns n.
+ */
+static size_t
+check_rollups(const struct sensors *s, const size_t n, const int ring,
+    const int stat, const uint64_t last)
+{
+	const int64_t period = (ring == HIST_MINUTES ? 60 : 3600);
+	uint64_t k0, k1;
+	int32_t want;
+	size_t j, i;
+	int valid;
+
+	for (j = 0; j < n; ++j) {
+		k0 = (uint64_t)((s[j].time - T0) / NS);
+		k1 = k0 + (uint64_t)period - 1;
+		if (last == 0 && stat != HIST_MIN) {
+			continue;
+		}
+		if (last == 0) {
+			k1 = k0 + 1;	/* All the minimum depends on */
+		} else if (k1 > last) {
+			k1 = last;
+		}
+
+		want = expect(k0, k1, SENSOR_TEMP, stat, &valid);
+		for (i = 0; i < TEMP_MAX; ++i) {
+			if (!SENSORS_VALID(&s[j], SENSOR_TEMP, i) || s[j].temps[i] != want) {
+				errx(EX_SOFTWARE, "%s rollup at %" PRId64 ": temps[%zu] = %" PRId32 ", not %" PRId32,
+				    stats[stat], s[j].time, i, s[j].temps[i], want);
+			}
+		}
+		want = expect(k0, k1, SENSOR_VOLT, stat, &valid);
+		for (i = 0; i < VOLT_MAX; ++i) {
+			if (!SENSORS_VALID(&s[j], SENSOR_VOLT, i) || s[j].voltages[i] != want) {
+				errx(EX_SOFTWARE, "%s rollup at %" PRId64 ": voltages[%zu] = %" PRId32 ", not %" PRId32,
+				    stats[stat], s[j].time, i, s[j].voltages[i], want);
+			}
+		}
+		want = expect(k0, k1, SENSOR_FAN, stat, &valid);
+		if (last == 0 && !SENSORS_VALID(&s[j], SENSOR_FAN, 0)) {
+			valid = 0;	/* Sample k0 + 1 may not be in yet */
+		}
+		for (i = 0; valid && i < FAN_MAX; ++i) {
+			if (!SENSORS_VALID(&s[j], SENSOR_FAN, i) || s[j].fans[i] != (uint32_t)want) {
+				errx(EX_SOFTWARE, "%s rollup at %" PRId64 ": fans[%zu] = %" PRIu32 ", not %" PRId32,
+				    stats[stat], s[j].time, i, s[j].fans[i], want);
+			}
+		}
+	}
+	return (n);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	const struct boardtab *t = board_table();
+	const struct board *b;
+	struct history *h, *r;
+	struct sensors s;
+	struct sensors *out;
+	struct stat st;
+	char path[] = _PATH_TMP "bench_history.XXXXXX";
+	size_t nappends = NAPPENDS;
+	size_t i, full, nread[HIST_RINGS];
+	ssize_t n;
+	double t0, elapsed;
+	int fd, ring, which;
+	pid_t pid;
+
+	if (argc > 1 && (nappends = strtoul(argv[1], NULL, 10)) < 2) {
+		errx(EX_USAGE, "appends must be a number above 1");
+	}
+
+	b = &t->boards[0];
+	for (i = 0; i < t->nboards; ++i) {
+		if (strcmp(BOARD_PRODUCT(&t->boards[i]), "X7DBP") == 0) {
+			b = &t->boards[i];
+		}
+	}
+
+	if ((fd = mkstemp(path)) == -1) {
+		err(EX_OSERR, "%s", path);
+	}
+	close(fd);
+	if ((h = history_open(path, b)) == NULL || (r = history_map(path)) == NULL ||
+	    stat(path, &st) == -1) {
+		unlink(path);
+		err(EX_OSERR, "%s", path);
+	}
+
+	printf("board %s %s, %jd byte history file, %zu appends\n",
+	    BOARD_MAKER(b), BOARD_PRODUCT(b), (intmax_t)st.st_size, nappends);
+
+	/*
+	 * Time: appends, one sample a second (in sample time)
+	 */
+	t0 = now();
+	for (i = 0; i < nappends; ++i) {
+		sample(&s, i);
+		history_append(h, &s);
+	}
+	elapsed = now() - t0;
+	printf("%-14s  %8.1f ns/append (sample() included)\n", "append", elapsed * 1e9 / (double)nappends);
+
+	/*
+	 * Check: everything that's still in the file
+	 */
+	for (ring = HIST_SAMPLES; ring < HIST_RINGS; ++ring) {
+		for (which = HIST_MEAN; which <= (ring == HIST_SAMPLES ? HIST_MEAN : HIST_MAX); ++which) {
+			if ((n = history_read(r, ring, which, 0, INT64_MAX, &out)) == -1) {
+				err(EX_OSERR, "history_read");
+			}
+			nread[ring] = (ring == HIST_SAMPLES ? check_samples(out, (size_t)n) :
+			    check_rollups(out, (size_t)n, ring, which, nappends - 1));
+			free(out);
+		}
+	}
+	printf("%-14s  %zu samples, %zu minutes, %zu hours read back and correct\n", "idle writer",
+	    nread[HIST_SAMPLES], nread[HIST_MINUTES], nread[HIST_HOURS]);
+
+	/*
+	 * Time: reads of the whole sample ring (and check the minute
+	 * rollups) while a writer process appends, starting over in an empty
+	 * file
+	 */
+	history_close(h);
+	if (truncate(path, 0) == -1 || (h = history_open(path, b)) == NULL) {
+		unlink(path);
+		err(EX_OSERR, "%s", path);
+	}
+	history_close(r);
+	if ((r = history_map(path)) == NULL) {
+		unlink(path);
+		err(EX_OSERR, "%s", path);
+	}
+	if ((pid = fork()) == -1) {
+		unlink(path);
+		err(EX_OSERR, "fork");
+	}
+	if (pid == 0) {
+		writer(h);
+		_exit(0);
+	}
+
+	/* Let the writer fill the sample ring before timing reads of it */
+	full = nread[HIST_SAMPLES];
+	do {
+		if ((n = history_read(r, HIST_SAMPLES, HIST_MEAN, 0, INT64_MAX, &out)) == -1) {
+			err(EX_OSERR, "history_read");
+		}
+		free(out);
+	} while ((size_t)n < full);
+
+	memset(nread, 0, sizeof(nread));
+	elapsed = 0;
+	for (i = 0; i < NREADS; ++i) {
+		t0 = now();
+		if ((n = history_read(r, HIST_SAMPLES, HIST_MEAN, 0, INT64_MAX, &out)) == -1) {
+			err(EX_OSERR, "history_read");
+		}
+		elapsed += now() - t0;
+		nread[HIST_SAMPLES] += check_samples(out, (size_t)n);
+		free(out);
+
+		if ((n = history_read(r, HIST_MINUTES, HIST_MIN, 0, INT64_MAX, &out)) == -1) {
+			err(EX_OSERR, "history_read");
+		}
+		nread[HIST_MINUTES] += check_rollups(out, (size_t)n, HIST_MINUTES, HIST_MIN, 0);
+		free(out);
+	}
+	printf("%-14s  %8.1f us/read  %8.1f samples/read  %6.1f minutes/read, all consistent\n",
+	    "busy writer", elapsed * 1e6 / NREADS, (double)nread[HIST_SAMPLES] / NREADS,
+	    (double)nread[HIST_MINUTES] / NREADS);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	history_close(r);
+	history_close(h);
+	unlink(path);
+	return (EX_OK);
+}
@@ -0,0 +1,191 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_lookup: compare the perfect hash board index (boardidx.c)
+ * against the linear strncmp() scan board_lookup() used to do, over a
+ * synthetic board list of NBOARDS entries.
+ *
+ * Usage: bench_lookup [nboards]
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+
+#define KENV_MVALLEN	128		/* See <kenv.h> on FreeBSD */
+#define NBOARDS		10000
+#define NMAKERS		16
+#define HASH_ROUNDS	1000000		/* Lookups per hashed run */
+#define LINEAR_ROUNDS	20000		/* Lookups per linear run */
+
+/*
+ * Function prototypes
+ */
+static size_t	hashed_find(const struct boardidx *, const struct boarddef *,
+		    const char *, const char *);
+static size_t	linear_find(const struct boarddef *, const size_t, const char *,
+		    const char *);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+
+/*
+ * External functions (boardidx.c)
+ */
+extern int	boardidx_build(const struct boarddef *, const size_t, int32_t *,
+		    const uint32_t, uint32_t *);
+extern size_t	boardidx_probe(const struct boardidx *, const char *,
+		    const char *);
+
+/*
+ * Global variables
+ */
+int f_verbose = 0;	/* Referenced by global.h */
+static volatile size_t sink;	/* Keeps lookups from being optimised out */
+
+
+/*
+ * hashed_find(const struct boardidx *ix, const struct boarddef *list,
+ *             const char *maker, const char *product)
+ *
+ * board_lookup(): probe the index, then compare the one candidate.
+ */
+static size_t
+hashed_find(const struct boardidx *ix, const struct boarddef *list,
+    const char *maker, const char *product)
+{
+	size_t i = boardidx_probe(ix, maker, product);
+
+	if (i != BOARDIDX_NONE &&
+	    strncmp(maker, list[i].maker, KENV_MVALLEN) == 0 &&
+	    strncmp(product, list[i].product, KENV_MVALLEN) == 0) {
+		return (i);
+	}
+	return (BOARDIDX_NONE);
+}
+
+
+/*
+ * linear_find(const struct boarddef *list, const size_t n,
+ *             const char *maker, const char *product)
+ *
+ * The pre-index board_lookup() loop, for comparison.
+ */
+static size_t
+linear_find(const struct boarddef *list, const size_t n, const char *maker,
+    const char *product)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (strncmp(maker, list[i].maker, KENV_MVALLEN) == 0) {
+			if (strncmp(product, list[i].product, KENV_MVALLEN) == 0) {
+				return (i);
+			}
+		}
+	}
+	return (BOARDIDX_NONE);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	static char makers[NMAKERS][32];
+	struct boarddef *list;
+	char (*products)[32];
+	struct boardidx ix;
+	int32_t *disp;
+	uint32_t *slot;
+	size_t n = NBOARDS;
+	size_t i, k;
+	double t0, t_build, t_hash, t_linear, t_miss;
+
+	if (argc > 1) {
+		n = strtoul(argv[1], NULL, 10);
+		if (n == 0 || n > UINT32_MAX) {
+			errx(EX_USAGE, "nboards must be between 1 and %" PRIu32, UINT32_MAX);
+		}
+	}
+
+	list = calloc(n, sizeof(*list));
+	products = calloc(n, sizeof(*products));
+	disp = calloc(n, sizeof(*disp));
+	slot = calloc(n, sizeof(*slot));
+	if (list == NULL || products == NULL || disp == NULL || slot == NULL) {
+		err(EX_OSERR, "calloc");
+	}
+
+	/*
+	 * Maker names repeat heavily and product names differ only in a
+	 * few trailing characters, as in the real boardlist[].
+	 */
+	for (k = 0; k < NMAKERS; ++k) {
+		snprintf(makers[k], sizeof(makers[k]), "Maker %zu Computer Inc.", k);
+	}
+	for (i = 0; i < n; ++i) {
+		snprintf(products[i], sizeof(products[i]), "X%zuDVA-%zu", i % 10, i);
+		list[i].maker = makers[i % NMAKERS];
+		list[i].product = products[i];
+	}
+
+	t0 = now();
+	if (boardidx_build(list, n, disp, (uint32_t)n, slot) == -1) {
+		err(EX_SOFTWARE, "boardidx_build");
+	}
+	t_build = now() - t0;
+
+	ix.nkeys = (uint32_t)n;
+	ix.nbuckets = (uint32_t)n;
+	ix.fingerprint = 0;
+	ix.disp = disp;
+	ix.slot = slot;
+
+	for (i = 0; i < n; ++i) {
+		if (hashed_find(&ix, list, list[i].maker, list[i].product) != i) {
+			errx(EX_SOFTWARE, "entry %zu not found", i);
+		}
+	}
+
+	/* Stride through the list so successive lookups don't share lines */
+	t0 = now();
+	for (i = 0, k = 0; i < HASH_ROUNDS; ++i, k = (k + 7919) % n) {
+		sink = hashed_find(&ix, list, list[k].maker, list[k].product);
+	}
+	t_hash = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < HASH_ROUNDS; ++i) {
+		sink = hashed_find(&ix, list, "No Such Maker", "No Such Product");
+	}
+	t_miss = now() - t0;
+
+	t0 = now();
+	for (i = 0, k = 0; i < LINEAR_ROUNDS; ++i, k = (k + 7919) % n) {
+		sink = linear_find(list, n, list[k].maker, list[k].product);
+	}
+	t_linear = now() - t0;
+
+	printf("boards:            %zu\n", n);
+	printf("index build:       %.3f ms\n", t_build * 1e3);
+	printf("hashed lookup:     %.1f ns\n", t_hash * 1e9 / HASH_ROUNDS);
+	printf("hashed miss:       %.1f ns\n", t_miss * 1e9 / HASH_ROUNDS);
+	printf("linear lookup:     %.1f ns\n", t_linear * 1e9 / LINEAR_ROUNDS);
+
+	free(list);
+	free(products);
+	free(disp);
+	free(slot);
+	return (EX_OK);
+}
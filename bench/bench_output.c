@@ -0,0 +1,294 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_output: compare rendering samples through a compiled outfmt
+ * (output.c; one write(2) per sample) against the printf(3)-per-sensor
+ * renderers output.c used to have, walking boardlist[] itself, for
+ * every board in the built-in board table and every output format.
+ * Before timing anything, the output of both is checked to be
+ * byte-for-byte identical over many random samples.
+ *
+ * Usage: bench_output [samples]
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+
+#define NSAMPLES	200000		/* Timed samples per path */
+#define NCHECK		2000		/* Checked samples per board and format */
+
+/*
+ * Function prototypes
+ */
+static void	random_sensors(struct sensors *);
+static void	old_output(FILE *, const struct boarddef *, const struct sensors *,
+		    const int);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+
+/*
+ * External functions (output.c)
+ */
+extern struct outfmt *	outfmt_new(const struct board *, const int);
+extern void	outfmt_free(struct outfmt *);
+extern const char *	sensors_render(struct outfmt *, const struct sensors *,
+		    const int, size_t *);
+extern int	sensors_output(struct outfmt *, const struct sensors *,
+		    const int, const int);
+
+/*
+ * External functions (lookup.c)
+ */
+extern const struct boardtab *	board_table(void);
+
+/*
+ * External variables (boards.c)
+ */
+extern const struct boarddef	boardlist[];
+
+/*
+ * Global variables
+ */
+int f_verbose = 0;	/* Referenced by global.h */
+static const char *formats[] = { "text", "delim", "json" };
+
+
+/*
+ * random_sensors(struct sensors *s)
+ *
+ * Fills in s with values in the ranges the chip routines produce,
+ * including negative voltages and voltages which are register values
+ * times the chips' LSB sizes in millivolts.  Stopped fans and one
+ * temperature in eight have no reading.
+ */
+static void
+random_sensors(struct sensors *s)
+{
+	size_t i;
+	long r;
+
+	memset(s->valid, 0, sizeof(s->valid));
+	for (i = 0; i < TEMP_MAX; ++i) {
+		s->temps[i] = TEMP_MDEG(random() % 256);
+		if (random() % 8 != 0) {
+			SENSORS_SET(s, SENSOR_TEMP, i);
+		}
+	}
+	for (i = 0; i < FAN_MAX; ++i) {
+		s->fans[i] = (uint32_t)(random() % 2) ? (uint32_t)(1350000 / (random() % 4096 + 1)) : 0;
+		if (s->fans[i] != 0) {
+			SENSORS_SET(s, SENSOR_FAN, i);
+		}
+	}
+	for (i = 0; i < VOLT_MAX; ++i) {
+		r = random();
+		switch (r % 4) {
+			case 0:
+				s->voltages[i] = (int32_t)(random() % 1024) * 2;
+				break;
+			case 1:
+				s->voltages[i] = (int32_t)(random() % 256) * 16;
+				break;
+			case 2:
+				s->voltages[i] = -(int32_t)(random() % 1024) * 16;
+				break;
+			default:
+				s->voltages[i] = (int32_t)(((double)(r / 4) / (RAND_MAX / 4) - 0.5) * 40000.0);
+		}
+		SENSORS_SET(s, SENSOR_VOLT, i);
+	}
+}
+
+
+/*
+ * old_output(FILE *fp, const struct boarddef *b, const struct sensors *s,
+ *            const int format)
+ *
+ * sensors_output(), sensors_output_delim(), and sensors_output_json() as
+ * they were before output formats were compiled, writing to fp; values
+ * s doesn't have are printed as output.c's absent[] token for format.
+ */
+static void
+old_output(FILE *fp, const struct boarddef *b, const struct sensors *s,
+    const int format)
+{
+	const char *na = (format == OUTPUT_DELIM ? "" : "N/A");
+	char v[32];
+	size_t i;
+
+	if (format == OUTPUT_JSON) {
+		fprintf(fp, "{\n");
+		fprintf(fp, "\t\"temps\": {\n");
+		for (i = 0; b->temps[i].label != NULL; ++i) {
+			if (SENSORS_VALID(s, SENSOR_TEMP, b->temps[i].index)) {
+				snprintf(v, sizeof(v), "%" PRId32, s->temps[b->temps[i].index] / 1000);
+			}
+			fprintf(fp, "\t\t\"%s\": \"%s C\"%s\n", b->temps[i].label,
+				(SENSORS_VALID(s, SENSOR_TEMP, b->temps[i].index) ? v : na),
+				(b->temps[i+1].label == NULL ? "" : ","));
+		}
+		fprintf(fp, "\t},\n");
+		fprintf(fp, "\t\"fans\": {\n");
+		for (i = 0; b->fans[i].label != NULL; ++i) {
+			if (SENSORS_VALID(s, SENSOR_FAN, b->fans[i].index)) {
+				snprintf(v, sizeof(v), "%" PRIu32, s->fans[b->fans[i].index]);
+			}
+			fprintf(fp, "\t\t\"%s\": \"%s RPM\"%s\n", b->fans[i].label,
+				(SENSORS_VALID(s, SENSOR_FAN, b->fans[i].index) ? v : na),
+				(b->fans[i+1].label == NULL ? "" : ","));
+		}
+		fprintf(fp, "\t},\n");
+		fprintf(fp, "\t\"voltages\": {\n");
+		for (i = 0; b->voltages[i].label != NULL; ++i) {
+			if (SENSORS_VALID(s, SENSOR_VOLT, b->voltages[i].index)) {
+				snprintf(v, sizeof(v), "%.3f", s->voltages[b->voltages[i].index] / 1000.0);
+			}
+			fprintf(fp, "\t\t\"%s\": \"%s V\"%s\n", b->voltages[i].label,
+				(SENSORS_VALID(s, SENSOR_VOLT, b->voltages[i].index) ? v : na),
+				(b->voltages[i+1].label == NULL ? "" : ","));
+		}
+		fprintf(fp, "\t}\n");
+		fprintf(fp, "}\n");
+		return;
+	}
+
+	for (i = 0; b->temps[i].label != NULL; ++i) {
+		if (SENSORS_VALID(s, SENSOR_TEMP, b->temps[i].index)) {
+			snprintf(v, sizeof(v), "%" PRId32, s->temps[b->temps[i].index] / 1000);
+		}
+		fprintf(fp, format == OUTPUT_DELIM ? "%s,%s,C\n" : "%-20s %8s C\n",
+			b->temps[i].label, (SENSORS_VALID(s, SENSOR_TEMP, b->temps[i].index) ? v : na));
+	}
+	for (i = 0; b->fans[i].label != NULL; ++i) {
+		if (SENSORS_VALID(s, SENSOR_FAN, b->fans[i].index)) {
+			snprintf(v, sizeof(v), "%" PRIu32, s->fans[b->fans[i].index]);
+		}
+		fprintf(fp, format == OUTPUT_DELIM ? "%s,%s,RPM\n" : "%-20s %8s RPM\n",
+			b->fans[i].label, (SENSORS_VALID(s, SENSOR_FAN, b->fans[i].index) ? v : na));
+	}
+	for (i = 0; b->voltages[i].label != NULL; ++i) {
+		if (SENSORS_VALID(s, SENSOR_VOLT, b->voltages[i].index)) {
+			snprintf(v, sizeof(v), "%.3f", s->voltages[b->voltages[i].index] / 1000.0);
+		}
+		fprintf(fp, format == OUTPUT_DELIM ? "%s,%s,V\n" : "%-20s %8s V\n",
+			b->voltages[i].label, (SENSORS_VALID(s, SENSOR_VOLT, b->voltages[i].index) ? v : na));
+	}
+}
+
+
+int
+main(int argc, char **argv)
+{
+	static char ref[65536];
+	struct sensors s;
+	struct outfmt *of;
+	const struct boardtab *t = board_table();
+	const struct board *b;
+	const struct boarddef *d;
+	const char *p;
+	FILE *fp;
+	size_t nsamples = NSAMPLES;
+	size_t len, i, j;
+	double t0, t_old, t_new;
+	int format, fd;
+
+	if (argc > 1 && (nsamples = strtoul(argv[1], NULL, 10)) == 0) {
+		errx(EX_USAGE, "samples must be a positive number");
+	}
+
+	srandom(1);
+
+	/*
+	 * Check: identical output for every board, format, and a lot of
+	 * random values.
+	 */
+	for (i = 0; i < t->nboards; ++i) {
+		b = &t->boards[i];
+		d = &boardlist[i];
+		for (format = OUTPUT_TEXT; format <= OUTPUT_JSON; ++format) {
+			if ((of = outfmt_new(b, format)) == NULL) {
+				err(EX_SOFTWARE, "outfmt_new(%s, %s)", BOARD_PRODUCT(b), formats[format]);
+			}
+			for (j = 0; j < NCHECK; ++j) {
+				random_sensors(&s);
+				if ((fp = fmemopen(ref, sizeof(ref), "w")) == NULL) {
+					err(EX_OSERR, "fmemopen");
+				}
+				old_output(fp, d, &s, format);
+				fflush(fp);
+				p = sensors_render(of, &s, 0, &len);
+				if ((long)len != ftell(fp) || memcmp(p, ref, len) != 0) {
+					errx(EX_SOFTWARE, "%s %s: output differs:\n%.*s\nvs. expected:\n%.*s",
+					    BOARD_PRODUCT(b), formats[format], (int)len, p,
+					    (int)ftell(fp), ref);
+				}
+				fclose(fp);
+			}
+			outfmt_free(of);
+		}
+	}
+	printf("output identical for all boards and formats (%d samples each)\n", NCHECK);
+
+	/*
+	 * Time: one sample per iteration to /dev/null, flushed each time
+	 * as interval mode does.
+	 */
+	if ((fd = open("/dev/null", O_WRONLY)) == -1 ||
+	    (fp = fdopen(fd, "w")) == NULL) {
+		err(EX_OSERR, "/dev/null");
+	}
+	b = &t->boards[0];
+	d = &boardlist[0];
+	for (i = 0; i < t->nboards; ++i) {
+		if (strcmp(BOARD_PRODUCT(&t->boards[i]), "X7DBP") == 0) {
+			b = &t->boards[i];
+			d = &boardlist[i];
+		}
+	}
+	random_sensors(&s);
+
+	printf("board %s %s, %zu samples\n", BOARD_MAKER(b), BOARD_PRODUCT(b), nsamples);
+	printf("%-6s  %14s  %14s\n", "format", "printf ns/smp", "render ns/smp");
+	for (format = OUTPUT_TEXT; format <= OUTPUT_JSON; ++format) {
+		if ((of = outfmt_new(b, format)) == NULL) {
+			err(EX_SOFTWARE, "outfmt_new");
+		}
+
+		t0 = now();
+		for (i = 0; i < nsamples; ++i) {
+			old_output(fp, d, &s, format);
+			fflush(fp);
+		}
+		t_old = now() - t0;
+
+		t0 = now();
+		for (i = 0; i < nsamples; ++i) {
+			if (sensors_output(of, &s, fd, 0) == -1) {
+				err(EX_IOERR, "sensors_output");
+			}
+		}
+		t_new = now() - t0;
+
+		printf("%-6s  %14.1f  %14.1f\n", formats[format],
+		    t_old * 1e9 / (double)nsamples, t_new * 1e9 / (double)nsamples);
+		outfmt_free(of);
+	}
+
+	fclose(fp);
+	return (EX_OK);
+}
@@ -0,0 +1,237 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_shm: time bsdhwmon_shm_read() (bsdhwmon_shm.h) against a
+ * snapshot published by shmsnap.c, first with an idle writer (the normal
+ * case: one sample every few seconds), then with a writer process
+ * publishing as fast as it can.  Every sample read is checked to be
+ * consistent: the writer stores the same number, its sample count, in
+ * every sensor, and marks the fans valid in odd samples only, so a torn
+ * read shows up as a mismatch.
+ *
+ * Usage: bench_shm [reads]
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+#include "bsdhwmon_shm.h"
+
+#define NREADS		2000000		/* Timed reads per run */
+#define SHM_WRAP	1000000		/* Temperature and voltage values wrap here */
+
+/*
+ * Function prototypes
+ */
+static void	writer(struct shmsnap *);
+static void	sample(struct sensors *, const uint32_t);
+static void	run(const char *, const struct bsdhwmon_shm *, const size_t);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+
+/*
+ * External functions (shmsnap.c)
+ */
+extern struct shmsnap *	shmsnap_create(const char *, const struct board *, const long);
+extern void	shmsnap_publish(struct shmsnap *, const struct sensors *);
+extern void	shmsnap_close(struct shmsnap *);
+
+/*
+ * External functions (lookup.c)
+ */
+extern const struct boardtab *	board_table(void);
+
+/*
+ * Global variables
+ */
+int f_verbose = 0;	/* Referenced by global.h */
+
+
+/*
+ * writer(struct shmsnap *ss)
+ *
+ * ss = Snapshot to publish to
+ *
+ * Publishes samples back to back until killed; sample n has every
+ * sensor published as n (modulo SHM_WRAP, for temperatures and
+ * voltages, which are kept in thousandths), except that the fans only
+ * have a reading in odd samples.
+ */
+static void
+writer(struct shmsnap *ss)
+{
+	struct sensors s;
+	uint32_t n;
+
+	memset(&s, 0, sizeof(s));
+	for (n = 1; ; ++n) {
+		sample(&s, n);
+		shmsnap_publish(ss, &s);
+	}
+}
+
+
+/*
+ * sample(struct sensors *s, const uint32_t n)
+ *
+ * s = Filled in with sample n, as writer() publishes it
+ * n = Sample number
+ */
+static void
+sample(struct sensors *s, const uint32_t n)
+{
+	size_t i;
+
+	memset(s->valid, 0, sizeof(s->valid));
+	for (i = 0; i < TEMP_MAX; ++i) {
+		s->temps[i] = (int32_t)(n % SHM_WRAP) * 1000;
+		SENSORS_SET(s, SENSOR_TEMP, i);
+	}
+	for (i = 0; i < FAN_MAX; ++i) {
+		s->fans[i] = (n % 2 == 1 ? n : 0);
+		if (n % 2 == 1) {
+			SENSORS_SET(s, SENSOR_FAN, i);
+		}
+	}
+	for (i = 0; i < VOLT_MAX; ++i) {
+		s->voltages[i] = (int32_t)(n % SHM_WRAP) * 1000;
+		SENSORS_SET(s, SENSOR_VOLT, i);
+	}
+}
+
+
+/*
+ * run(const char *what, const struct bsdhwmon_shm *shm, const size_t nreads)
+ *
+ *   what = Name of the run, for the report
+ *    shm = Reader mapping
+ * nreads = Number of reads to time
+ */
+static void
+run(const char *what, const struct bsdhwmon_shm *shm, const size_t nreads)
+{
+	struct bsdhwmon_shm_data d;
+	uint64_t first = 0, last = 0;
+	size_t i, j, retries = 0;
+	double t0, t;
+
+	t0 = now();
+	for (i = 0; i < nreads; ++i) {
+		while (bsdhwmon_shm_read(shm, &d) == -1) {
+			++retries;
+		}
+		for (j = 0; j < d.ntemps; ++j) {
+			if ((uint64_t)d.temps[j].value != d.samples % SHM_WRAP) {
+				errx(EX_SOFTWARE, "torn read: temps[%zu] = %.0f in sample %ju",
+				    j, d.temps[j].value, (uintmax_t)d.samples);
+			}
+		}
+		for (j = 0; j < d.nfans; ++j) {
+			if ((uint64_t)d.fans[j].value != (d.samples % 2 == 1 ? d.samples : 0) ||
+			    ((d.fans_valid >> j) & 1) != d.samples % 2) {
+				errx(EX_SOFTWARE, "torn read: fans[%zu] = %.0f in sample %ju",
+				    j, d.fans[j].value, (uintmax_t)d.samples);
+			}
+		}
+		for (j = 0; j < d.nvoltages; ++j) {
+			if ((uint64_t)d.voltages[j].value != d.samples % SHM_WRAP) {
+				errx(EX_SOFTWARE, "torn read: voltages[%zu] = %.0f in sample %ju",
+				    j, d.voltages[j].value, (uintmax_t)d.samples);
+			}
+		}
+		if (i == 0) {
+			first = d.samples;
+		}
+		last = d.samples;
+	}
+	t = now() - t0;
+
+	printf("%-14s  %8.1f ns/read  %8ju samples seen  %6zu EAGAIN\n", what,
+	    t * 1e9 / (double)nreads, (uintmax_t)(last - first + 1), retries);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	const struct bsdhwmon_shm *shm;
+	const struct boardtab *t = board_table();
+	struct shmsnap *ss;
+	struct sensors s;
+	const struct board *b;
+	char name[64];
+	size_t nreads = NREADS;
+	size_t i;
+	pid_t pid;
+
+	if (argc > 1 && (nreads = strtoul(argv[1], NULL, 10)) == 0) {
+		errx(EX_USAGE, "reads must be a positive number");
+	}
+
+	b = &t->boards[0];
+	for (i = 0; i < t->nboards; ++i) {
+		if (strcmp(BOARD_PRODUCT(&t->boards[i]), "X7DBP") == 0) {
+			b = &t->boards[i];
+		}
+	}
+
+	snprintf(name, sizeof(name), "/bsdhwmon-bench-%ld", (long)getpid());
+	if ((ss = shmsnap_create(name, b, 1)) == NULL) {
+		err(EX_OSERR, "shmsnap_create(%s)", name);
+	}
+	if ((shm = bsdhwmon_shm_attach(name)) == NULL) {
+		shm_unlink(name);
+		err(EX_OSERR, "bsdhwmon_shm_attach(%s)", name);
+	}
+
+	printf("board %s %s, %zu bytes mapped, %zu reads per run\n",
+	    BOARD_MAKER(b), BOARD_PRODUCT(b), sizeof(*shm), nreads);
+
+	/* Sample 1, as writer() would have it */
+	memset(&s, 0, sizeof(s));
+	sample(&s, 1);
+	shmsnap_publish(ss, &s);
+	run("idle writer", shm, nreads);
+
+	/*
+	 * The writer process starts over at sample 1 in a fresh snapshot,
+	 * so sample counts and sensor values keep matching.
+	 */
+	shmsnap_close(ss);
+	if ((ss = shmsnap_create(name, b, 1)) == NULL) {
+		shm_unlink(name);
+		err(EX_OSERR, "shmsnap_create(%s)", name);
+	}
+	if ((pid = fork()) == -1) {
+		shm_unlink(name);
+		err(EX_OSERR, "fork");
+	}
+	if (pid == 0) {
+		writer(ss);
+		_exit(0);
+	}
+	run("busy writer", shm, nreads);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	shmsnap_close(ss);
+	bsdhwmon_shm_detach(shm);
+	shm_unlink(name);
+	return (EX_OK);
+}
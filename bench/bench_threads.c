@@ -0,0 +1,271 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * bench_threads: stress libbsdhwmon (hwmon.h) from several threads at
+ * once.  Every thread opens its own simulated bus and sampling context
+ * for each board in the built-in board table, then samples the boards round-robin,
+ * checking every sample's rendered output against a reference taken
+ * beforehand from a single thread.  State shared between contexts (a
+ * static buffer, a register plan compiled for some other board) shows
+ * up as a mismatch; build with -fsanitize=thread to have data races
+ * reported as well.
+ *
+ * The same run is timed with one thread and with all of them.  With a
+ * per-transaction latency (as on a real SMBus controller), samples on
+ * separate buses should proceed in parallel.
+ *
+ * Usage: bench_threads [threads [samples [latency_us]]]
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+#include "hwmon.h"
+
+#define NTHREADS	8		/* Threads sampling at once */
+#define NSAMPLES	20000		/* Samples per thread */
+
+struct worker {
+	pthread_t	tid;
+	size_t		id;
+	size_t		nsamples;
+	size_t		mismatches;
+	int		error;		/* errno of a failed call, or 0 */
+	const char	*what;		/* Name of the failed call */
+};
+
+/*
+ * Function prototypes
+ */
+static void *	worker(void *);
+static size_t	run(const size_t, const size_t);
+int		main(int, char **);
+
+/*
+ * External functions (bench/bench.c)
+ */
+extern double	now(void);
+extern void	write_image(FILE *);
+
+/*
+ * Global variables; all set up before any thread starts, and only read
+ * by the workers.
+ */
+static char	device[1100];		/* "sim:FILE,latency=USEC" */
+static const struct board *boards;	/* The built-in board table's */
+static size_t	nboards;
+static char	**refs;			/* Per board: reference output */
+static size_t	*reflens;
+
+
+/*
+ * worker(void *arg)
+ *
+ * arg = struct worker to run
+ *
+ * Opens a context and an output format per board, then takes nsamples
+ * samples, moving on to the next board after each one.  Threads start
+ * at different boards, so at any moment they're sampling different
+ * chips.
+ */
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	struct hwmon **hw;
+	struct outfmt **of;
+	struct sensors *s;
+	const char *p;
+	size_t i, b, len;
+
+	hw = calloc(nboards, sizeof(*hw));
+	of = calloc(nboards, sizeof(*of));
+	s = calloc(nboards, sizeof(*s));
+	if (hw == NULL || of == NULL || s == NULL) {
+		w->error = errno;
+		w->what = "calloc";
+		goto out;
+	}
+
+	for (b = 0; b < nboards; ++b) {
+		if ((hw[b] = hwmon_open(device, &boards[b])) == NULL) {
+			w->error = errno;
+			w->what = "hwmon_open";
+			goto out;
+		}
+		if ((of[b] = outfmt_new(&boards[b], OUTPUT_DELIM)) == NULL) {
+			w->error = errno;
+			w->what = "outfmt_new";
+			goto out;
+		}
+	}
+
+	for (i = 0; i < w->nsamples; ++i) {
+		b = (i + w->id) % nboards;
+		if (hwmon_sample(hw[b], &s[b]) == -1) {
+			w->error = errno;
+			w->what = "hwmon_sample";
+			goto out;
+		}
+		p = sensors_render(of[b], &s[b], 0, &len);
+		if (len != reflens[b] || memcmp(p, refs[b], len) != 0) {
+			++w->mismatches;
+		}
+	}
+
+out:
+	for (b = 0; hw != NULL && b < nboards; ++b) {
+		hwmon_close(hw[b]);
+	}
+	for (b = 0; of != NULL && b < nboards; ++b) {
+		outfmt_free(of[b]);
+	}
+	free(s);
+	free(of);
+	free(hw);
+	return (NULL);
+}
+
+
+/*
+ * run(const size_t nthreads, const size_t nsamples)
+ *
+ * nthreads = Number of threads to sample with
+ * nsamples = Samples per thread
+ *
+ * Returns the number of samples which didn't match the reference.
+ */
+static size_t
+run(const size_t nthreads, const size_t nsamples)
+{
+	struct worker *w;
+	size_t i, mismatches = 0;
+	double t0, t;
+
+	if ((w = calloc(nthreads, sizeof(*w))) == NULL) {
+		err(EX_OSERR, "calloc");
+	}
+
+	t0 = now();
+	for (i = 0; i < nthreads; ++i) {
+		w[i].id = i;
+		w[i].nsamples = nsamples;
+		if ((errno = pthread_create(&w[i].tid, NULL, worker, &w[i])) != 0) {
+			err(EX_OSERR, "pthread_create");
+		}
+	}
+	for (i = 0; i < nthreads; ++i) {
+		pthread_join(w[i].tid, NULL);
+	}
+	t = now() - t0;
+
+	for (i = 0; i < nthreads; ++i) {
+		if (w[i].error != 0) {
+			errno = w[i].error;
+			err(EX_SOFTWARE, "thread %zu: %s", i, w[i].what);
+		}
+		mismatches += w[i].mismatches;
+	}
+
+	printf("%3zu thread(s)  %10.1f ns/sample  %12.0f samples/s  %zu mismatches\n",
+	    nthreads, t * 1e9 / (double)(nthreads * nsamples),
+	    (double)(nthreads * nsamples) / t, mismatches);
+	free(w);
+	return (mismatches);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	char path[] = "/tmp/bench_threads.XXXXXX";
+	struct hwmon *h;
+	struct outfmt *of;
+	struct sensors s;
+	const char *p;
+	size_t nthreads = NTHREADS;
+	size_t nsamples = NSAMPLES;
+	size_t mismatches;
+	long latency = 0;
+	size_t b;
+	FILE *fp;
+	int fd;
+
+	if (argc > 1 && (nthreads = strtoul(argv[1], NULL, 10)) == 0) {
+		errx(EX_USAGE, "threads must be a positive number");
+	}
+	if (argc > 2 && (nsamples = strtoul(argv[2], NULL, 10)) == 0) {
+		errx(EX_USAGE, "samples must be a positive number");
+	}
+	if (argc > 3 && (latency = strtol(argv[3], NULL, 10)) < 0) {
+		errx(EX_USAGE, "latency must not be negative");
+	}
+
+	srandom(1);
+	if ((fd = mkstemp(path)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		err(EX_CANTCREAT, "%s", path);
+	}
+	write_image(fp);
+	if (fclose(fp) == EOF) {
+		unlink(path);
+		err(EX_IOERR, "%s", path);
+	}
+	snprintf(device, sizeof(device), "sim:%s,latency=%ld", path, latency);
+
+	/*
+	 * References: one sample per board, one board at a time.
+	 */
+	boards = board_table()->boards;
+	nboards = board_table()->nboards;
+	refs = calloc(nboards, sizeof(*refs));
+	reflens = calloc(nboards, sizeof(*reflens));
+	if (refs == NULL || reflens == NULL) {
+		unlink(path);
+		err(EX_OSERR, "calloc");
+	}
+	for (b = 0; b < nboards; ++b) {
+		memset(&s, 0, sizeof(s));
+		if ((h = hwmon_open(device, &boards[b])) == NULL ||
+		    hwmon_sample(h, &s) == -1 ||
+		    (of = outfmt_new(&boards[b], OUTPUT_DELIM)) == NULL) {
+			unlink(path);
+			err(EX_SOFTWARE, "%s %s", BOARD_MAKER(&boards[b]), BOARD_PRODUCT(&boards[b]));
+		}
+		p = sensors_render(of, &s, 0, &reflens[b]);
+		if ((refs[b] = malloc(reflens[b])) == NULL) {
+			unlink(path);
+			err(EX_OSERR, "malloc");
+		}
+		memcpy(refs[b], p, reflens[b]);
+		outfmt_free(of);
+		hwmon_close(h);
+	}
+
+	printf("%zu boards, %zu samples per thread, latency %ld us per transaction\n",
+	    nboards, nsamples, latency);
+	mismatches = run(1, nsamples);
+	mismatches += run(nthreads, nsamples);
+
+	unlink(path);
+	for (b = 0; b < nboards; ++b) {
+		free(refs[b]);
+	}
+	free(refs);
+	free(reflens);
+
+	if (mismatches != 0) {
+		errx(EX_SOFTWARE, "%zu samples differ from the reference", mismatches);
+	}
+	return (EX_OK);
+}
@@ -0,0 +1,1232 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#if defined(__FreeBSD__)
+#include <kenv.h>
+#else
+#define KENV_MVALLEN	128		/* See <kenv.h> on FreeBSD */
+#endif
+#include "global.h"
+#include "hwmon.h"
+
+/*
+ * Board database: boardlist[] (see boards.c) in a file, so boards and
+ * their labels can be added or changed without rebuilding bsdhwmon.
+ *
+ * The database is written as text (see boards.conf for the syntax) and
+ * compiled with "bsdhwmon --compile-db" into a binary image (see struct
+ * bdb_header in global.h), which is what's normally loaded.  The image
+ * is mmap()ed read-only and used in place: opening it costs an open(2),
+ * an fstat(2), and an mmap(2), and finding a board only touches the
+ * header, the index, the board's record, and its pins and strings.  A
+ * text file can be opened too; it's compiled into an image in memory.
+ *
+ * The image's pools are those of a struct boardtab as they are, so the
+ * first time a board is asked for, its record is checked and copied
+ * into a struct board of that table, and kept until boarddb_close();
+ * nothing else can tell where a board came from.
+ */
+#define BDB_FIELDS	6		/* Most fields on a line of text */
+
+#ifndef nitems
+#define nitems(x)	(sizeof((x)) / sizeof((x)[0]))	/* See <sys/param.h> on FreeBSD */
+#endif
+
+struct boarddb {
+	void			*img;		/* The image */
+	size_t			size;
+	int			mapped;		/* img is mmap()ed, else malloc()ed */
+	const struct bdb_header	*h;
+	const int32_t		*disp;
+	const uint32_t		*slot;
+	const struct bdb_board	*records;
+	struct boardtab		tab;		/* Pools in the image, and boards[] */
+	struct board		*boards;	/* By index; tab is NULL until asked for */
+	int			filled;		/* Every board asked for */
+};
+
+/*
+ * An image being compiled from text
+ */
+struct bdb_build {
+	struct bdb_board	*boards;
+	size_t			nboards, maxboards;
+	struct pinmap		*pins;
+	size_t			npins, maxpins;
+	struct vcoef		*vcoefs;
+	size_t			nvcoefs, maxvcoefs;
+	char			*strings;
+	size_t			strsize, maxstrings;
+	struct pinmap		cur[BOARD_KINDS][VOLT_MAX];	/* Pins of the board being read */
+	size_t			ncur[BOARD_KINDS];
+	struct vcoef		curv[VOLT_MAX];		/* Its vcoef corrections */
+	size_t			ncurv;
+};
+
+/*
+ * Names used in the text form, per chips_e, voltages_e, temps_e, and
+ * fans_e
+ */
+static const char *const chip_names[] = {
+	[CUSTOM_X6DVA]		= "X6DVA",
+	[WINBOND_W83792D]	= "W83792D",
+	[WINBOND_W83793G]	= "W83793G",
+};
+static const char *const volt_names[VOLT_MAX] = {
+	[VOLT_VCOREA]	= "VCOREA",
+	[VOLT_VCOREB]	= "VCOREB",
+	[VOLT_VTT]	= "VTT",
+	[VOLT_VSEN1]	= "VSEN1",
+	[VOLT_VSEN2]	= "VSEN2",
+	[VOLT_3VSEN]	= "3VSEN",
+	[VOLT_12VSEN]	= "12VSEN",
+	[VOLT_5VSB]	= "5VSB",
+	[VOLT_5VCC]	= "5VCC",
+	[VOLT_5VDD]	= "5VDD",
+	[VOLT_VBAT]	= "VBAT",
+	[VOLT_VIN0]	= "VIN0",
+	[VOLT_VIN1]	= "VIN1",
+	[VOLT_VIN2]	= "VIN2",
+	[VOLT_VIN3]	= "VIN3",
+};
+static const char *const temp_names[TEMP_MAX] = {
+	[TEMP_TD1]	= "TD1",
+	[TEMP_TD2]	= "TD2",
+	[TEMP_TD3]	= "TD3",
+	[TEMP_TD4]	= "TD4",
+	[TEMP_TR1]	= "TR1",
+	[TEMP_TR2]	= "TR2",
+};
+static const char *const fan_names[FAN_MAX] = {
+	[FAN_FAN1]	= "FAN1",
+	[FAN_FAN2]	= "FAN2",
+	[FAN_FAN3]	= "FAN3",
+	[FAN_FAN4]	= "FAN4",
+	[FAN_FAN5]	= "FAN5",
+	[FAN_FAN6]	= "FAN6",
+	[FAN_FAN7]	= "FAN7",
+	[FAN_FAN8]	= "FAN8",
+	[FAN_FAN9]	= "FAN9",
+	[FAN_FAN10]	= "FAN10",
+	[FAN_FAN11]	= "FAN11",
+	[FAN_FAN12]	= "FAN12",
+};
+
+/*
+ * Per kind of pin (the pins[]/npins[] index of struct board): keyword,
+ * names, and most pins a board can have
+ */
+static const struct {
+	const char		*keyword;
+	const char *const	*names;
+	size_t			max;
+} pin_kinds[BOARD_KINDS] = {
+	{ "volt",	volt_names,	VOLT_MAX },
+	{ "temp",	temp_names,	TEMP_MAX },
+	{ "fan",	fan_names,	FAN_MAX },
+};
+
+/*
+ * Function prototypes (the rest are in hwmon.h)
+ */
+static void	bdb_error(char *, const size_t, const char *, ...)
+		    __attribute__((format(printf, 3, 4)));
+static void *	bdb_grow(void *, size_t *, const size_t, const size_t);
+static size_t	bdb_name(const char *const *, const size_t, const char *);
+static int	bdb_token(char **, char **);
+static int	bdb_number(const char *, const long, const long, long *);
+static int	bdb_string(struct bdb_build *, const char *, uint16_t *);
+static void *	bdb_run(void *, size_t *, size_t *, const void *, const size_t,
+		    const size_t, uint16_t *);
+static int	bdb_endboard(struct bdb_build *);
+static int	bdb_line(struct bdb_build *, char **, const size_t, char *,
+		    const size_t);
+static void *	bdb_compile(FILE *, const char *, size_t *, char *, const size_t);
+static int	bdb_attach(struct boarddb *, const char *, char *, const size_t);
+static int	bdb_section(const struct bdb_header *, const uint32_t,
+		    const uint32_t, const size_t);
+const struct board *	boarddb_board(struct boarddb *, const size_t);
+uint32_t	boarddb_fingerprint(const struct boarddb *);
+size_t		boarddb_count(const struct boarddb *);
+
+/*
+ * External functions (boardidx.c)
+ */
+extern uint32_t	board_hash(const char *, const char *, const uint32_t);
+extern int	boardidx_build(const struct boarddef *, const size_t, int32_t *,
+		    const uint32_t, uint32_t *);
+extern uint32_t	boardidx_fingerprint(const struct boarddef *, const size_t);
+
+/*
+ * External functions (lookup.c)
+ */
+extern void	board_trace(const struct board *);
+
+
+/*
+ * bdb_error(char *err, const size_t errlen, const char *fmt, ...)
+ *
+ *    err = Buffer for the message, or NULL
+ * errlen = Size of err
+ *    fmt = printf(3) format of the message
+ *
+ * Writes an error message for the caller of one of the boarddb_*()
+ * functions to print.
+ */
+static void
+bdb_error(char *err, const size_t errlen, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (err == NULL || errlen == 0) {
+		return;
+	}
+	va_start(ap, fmt);
+	vsnprintf(err, errlen, fmt, ap);
+	va_end(ap);
+}
+
+
+/*
+ * bdb_grow(void *p, size_t *max, const size_t n, const size_t size)
+ *
+ *    p = Array of *max entries (NULL if *max is 0)
+ *  max = Entries allocated; updated
+ *    n = Entries needed
+ * size = Size of one entry
+ *
+ * Returns the array, moved if it had to grow to hold n entries, or NULL
+ * with errno set (p is then untouched).
+ */
+static void *
+bdb_grow(void *p, size_t *max, const size_t n, const size_t size)
+{
+	size_t newmax;
+
+	if (n <= *max) {
+		return (p);
+	}
+	newmax = (*max == 0 ? 64 : *max * 2);
+	while (newmax < n) {
+		newmax *= 2;
+	}
+	if ((p = realloc(p, newmax * size)) != NULL) {
+		*max = newmax;
+	}
+	return (p);
+}
+
+
+/*
+ * bdb_name(const char *const *names, const size_t n, const char *s)
+ *
+ * names = Array of n names
+ *     s = Name to find
+ *
+ * Returns the index of s in names, or n if it isn't there.
+ */
+static size_t
+bdb_name(const char *const *names, const size_t n, const char *s)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (names[i] != NULL && strcmp(names[i], s) == 0) {
+			break;
+		}
+	}
+	return (i);
+}
+
+
+/*
+ * bdb_token(char **pp, char **tok)
+ *
+ *  pp = Pointer into a line of text; advanced past the token
+ * tok = Set to the token, NUL-terminated in place
+ *
+ * A token is a run of non-blank characters, or a string in double
+ * quotes, in which \" and \\ stand for " and \.  A # outside of quotes
+ * starts a comment, which runs to the end of the line.
+ *
+ * Returns 1 if a token was found, 0 at the end of the line, or -1 for
+ * an unterminated string.
+ */
+static int
+bdb_token(char **pp, char **tok)
+{
+	char *p = *pp;
+	char *q;
+
+	while (isspace((u_char)*p)) {
+		++p;
+	}
+	if (*p == '\0' || *p == '#') {
+		*pp = p;
+		return (0);
+	}
+
+	if (*p != '"') {
+		*tok = p;
+		while (*p != '\0' && !isspace((u_char)*p) && *p != '#') {
+			++p;
+		}
+		if (*p == '#') {
+			*p = '\0';
+			*pp = p;		/* Comment: nothing follows */
+		} else if (*p != '\0') {
+			*p = '\0';
+			*pp = p + 1;
+		} else {
+			*pp = p;
+		}
+		return (1);
+	}
+
+	*tok = q = ++p;
+	for (; *p != '"'; ++p) {
+		if (*p == '\0' || *p == '\n') {
+			return (-1);
+		}
+		if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+			++p;
+		}
+		*q++ = *p;
+	}
+	*q = '\0';
+	*pp = p + 1;
+	return (1);
+}
+
+
+/*
+ * bdb_number(const char *s, const long min, const long max, long *n)
+ *
+ *   s = Decimal, or hexadecimal with 0x
+ * min = Smallest acceptable value
+ * max = Largest acceptable value
+ *   n = Set to the number
+ *
+ * Returns 0 on success, or -1 if s isn't a number from min to max.
+ */
+static int
+bdb_number(const char *s, const long min, const long max, long *n)
+{
+	char *ep;
+
+	errno = 0;
+	*n = strtol(s, &ep, 0);
+	if (errno != 0 || ep == s || *ep != '\0' || *n < min || *n > max) {
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * bdb_string(struct bdb_build *bb, const char *s, uint16_t *off)
+ *
+ *  bb = Image being compiled
+ *   s = String to add
+ * off = Set to its offset in the strings section
+ *
+ * Strings are stored once; adding one which is already there gives the
+ * offset of the first.
+ *
+ * Returns 0 on success, or -1 with errno set (EFBIG if the strings
+ * section would outgrow BOARD_POOL_MAX).
+ */
+static int
+bdb_string(struct bdb_build *bb, const char *s, uint16_t *off)
+{
+	size_t i, len = strlen(s);
+	char *p;
+
+	for (i = 0; i < bb->strsize; i += strlen(bb->strings + i) + 1) {
+		if (strcmp(bb->strings + i, s) == 0) {
+			*off = (uint16_t)i;
+			return (0);
+		}
+	}
+
+	if (bb->strsize + len + 1 > BOARD_POOL_MAX) {
+		errno = EFBIG;
+		return (-1);
+	}
+	if ((p = bdb_grow(bb->strings, &bb->maxstrings, bb->strsize + len + 1, 1)) == NULL) {
+		return (-1);
+	}
+	bb->strings = p;
+	memcpy(bb->strings + bb->strsize, s, len + 1);
+	*off = (uint16_t)bb->strsize;
+	bb->strsize += len + 1;
+	return (0);
+}
+
+
+/*
+ * bdb_run(void *pool, size_t *npool, size_t *max, const void *run,
+ *         const size_t n, const size_t size, uint16_t *first)
+ *
+ *  pool = Array of *max entries, *npool of them used (NULL if *max is 0)
+ * npool = Entries used; updated
+ *   max = Entries allocated; updated
+ *   run = Entries to add
+ *     n = Number of entries in run (at least 1)
+ *  size = Size of one entry
+ * first = Set to the index of the run in pool
+ *
+ * Adds a run of entries to a pool, unless the pool already has it, in
+ * which case the run is shared.  Entries are compared byte for byte, so
+ * they must have been zeroed before being filled in.
+ *
+ * Returns the pool, moved if it had to grow, or NULL with errno set
+ * (EFBIG if it would outgrow BOARD_POOL_MAX; pool is then untouched).
+ */
+static void *
+bdb_run(void *pool, size_t *npool, size_t *max, const void *run,
+    const size_t n, const size_t size, uint16_t *first)
+{
+	u_char *p = pool;
+	size_t i;
+
+	for (i = 0; i + n <= *npool; ++i) {
+		if (memcmp(p + i * size, run, n * size) == 0) {
+			*first = (uint16_t)i;
+			return (pool);
+		}
+	}
+
+	if (*npool + n > BOARD_POOL_MAX) {
+		errno = EFBIG;
+		return (NULL);
+	}
+	if ((p = bdb_grow(pool, max, *npool + n, size)) == NULL) {
+		return (NULL);
+	}
+	memcpy(p + *npool * size, run, n * size);
+	*first = (uint16_t)*npool;
+	*npool += n;
+	return (p);
+}
+
+
+/*
+ * bdb_endboard(struct bdb_build *bb)
+ *
+ * bb = Image being compiled
+ *
+ * Adds the pins and vcoef corrections read for the last board to the
+ * image.  A run identical to one some earlier board has is shared with
+ * that board.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+bdb_endboard(struct bdb_build *bb)
+{
+	struct bdb_board *b;
+	void *p;
+	size_t k;
+
+	if (bb->nboards == 0) {
+		return (0);
+	}
+	b = &bb->boards[bb->nboards - 1];
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		b->npins[k] = (uint8_t)bb->ncur[k];
+		if (bb->ncur[k] == 0) {
+			continue;
+		}
+		if ((p = bdb_run(bb->pins, &bb->npins, &bb->maxpins, bb->cur[k],
+		    bb->ncur[k], sizeof(bb->cur[k][0]), &b->pins[k])) == NULL) {
+			return (-1);
+		}
+		bb->pins = p;
+		bb->ncur[k] = 0;
+	}
+
+	b->nvcoef = (uint8_t)bb->ncurv;
+	if (bb->ncurv > 0) {
+		if ((p = bdb_run(bb->vcoefs, &bb->nvcoefs, &bb->maxvcoefs, bb->curv,
+		    bb->ncurv, sizeof(bb->curv[0]), &b->vcoef)) == NULL) {
+			return (-1);
+		}
+		bb->vcoefs = p;
+		bb->ncurv = 0;
+	}
+	return (0);
+}
+
+
+/*
+ * bdb_line(struct bdb_build *bb, char **tok, const size_t ntok,
+ *          char *err, const size_t errlen)
+ *
+ *     bb = Image being compiled
+ *    tok = Fields of a line of text
+ *   ntok = Number of fields (at least 1)
+ *    err = Buffer for an error message
+ * errlen = Size of err
+ *
+ * Adds one line of the text form to the image:
+ *
+ *   board MAKER PRODUCT CHIP SLAVE
+ *   volt PIN LABEL [SCALE OFFSET]
+ *   temp PIN LABEL
+ *   fan PIN LABEL
+ *
+ * Returns 0 on success, or -1 with errno set (EINVAL for a mistake in
+ * the line, with err saying what).
+ */
+static int
+bdb_line(struct bdb_build *bb, char **tok, const size_t ntok, char *err,
+    const size_t errlen)
+{
+	struct bdb_board *b;
+	struct pinmap *p;
+	struct vcoef *v;
+	size_t k, idx;
+	long n, scale = 0, offset = 0;
+
+	if (strcmp(tok[0], "board") == 0) {
+		if (ntok != 5) {
+			bdb_error(err, errlen, "usage: board MAKER PRODUCT CHIP SLAVE");
+			goto invalid;
+		}
+		if (tok[1][0] == '\0' || strlen(tok[1]) >= KENV_MVALLEN ||
+		    tok[2][0] == '\0' || strlen(tok[2]) >= KENV_MVALLEN) {
+			bdb_error(err, errlen, "maker and product must be 1-%d characters",
+			    KENV_MVALLEN - 1);
+			goto invalid;
+		}
+		if ((idx = bdb_name(chip_names, nitems(chip_names), tok[3])) == nitems(chip_names)) {
+			bdb_error(err, errlen, "unknown chip \"%s\"", tok[3]);
+			goto invalid;
+		}
+		if (strcmp(tok[4], "custom") == 0) {
+			n = -1;
+		} else if (bdb_number(tok[4], 0, 0x7f, &n) == -1) {
+			bdb_error(err, errlen, "slave must be 0x00-0x7f, or custom");
+			goto invalid;
+		}
+
+		if (bdb_endboard(bb) == -1 ||
+		    (b = bdb_grow(bb->boards, &bb->maxboards, bb->nboards + 1, sizeof(*b))) == NULL) {
+			return (-1);
+		}
+		bb->boards = b;
+		b = &bb->boards[bb->nboards++];
+		memset(b, 0, sizeof(*b));
+		b->chip = (uint8_t)idx;
+		b->slave = (int8_t)n;
+		if (bdb_string(bb, tok[1], &b->maker) == -1 ||
+		    bdb_string(bb, tok[2], &b->product) == -1) {
+			return (-1);
+		}
+		return (0);
+	}
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		if (strcmp(tok[0], pin_kinds[k].keyword) == 0) {
+			break;
+		}
+	}
+	if (k == BOARD_KINDS) {
+		bdb_error(err, errlen, "unknown keyword \"%s\"", tok[0]);
+		goto invalid;
+	}
+
+	if (bb->nboards == 0) {
+		bdb_error(err, errlen, "\"%s\" before the first board", tok[0]);
+		goto invalid;
+	}
+	if (ntok != 3 && !(k == 0 && ntok == 5)) {
+		bdb_error(err, errlen, "usage: %s PIN LABEL%s", tok[0],
+		    (k == 0 ? " [SCALE OFFSET]" : ""));
+		goto invalid;
+	}
+	if ((idx = bdb_name(pin_kinds[k].names, pin_kinds[k].max, tok[1])) == pin_kinds[k].max) {
+		bdb_error(err, errlen, "unknown %s pin \"%s\"", tok[0], tok[1]);
+		goto invalid;
+	}
+	if (tok[2][0] == '\0') {
+		bdb_error(err, errlen, "empty label");
+		goto invalid;
+	}
+	if (ntok == 5 &&
+	    (bdb_number(tok[3], -1000000, 1000000, &scale) == -1 || scale == 0 ||
+	    bdb_number(tok[4], -1000000, 1000000, &offset) == -1)) {
+		bdb_error(err, errlen, "SCALE (mV per count, not 0) and OFFSET (mV) must be -1000000-1000000");
+		goto invalid;
+	}
+	if (bb->ncur[k] == pin_kinds[k].max) {
+		bdb_error(err, errlen, "more than %zu %s pins on one board",
+		    pin_kinds[k].max, tok[0]);
+		goto invalid;
+	}
+
+	if (scale != 0) {
+		v = &bb->curv[bb->ncurv++];
+		memset(v, 0, sizeof(*v));
+		v->index = (uint8_t)idx;
+		v->scale = (int32_t)scale;
+		v->offset = (int32_t)offset;
+	}
+	p = &bb->cur[k][bb->ncur[k]++];
+	memset(p, 0, sizeof(*p));
+	p->index = (uint8_t)idx;
+	return (bdb_string(bb, tok[2], &p->label));
+
+invalid:
+	errno = EINVAL;
+	return (-1);
+}
+
+
+/*
+ * bdb_compile(FILE *fp, const char *path, size_t *size, char *err,
+ *             const size_t errlen)
+ *
+ *     fp = Text form of a board database
+ *   path = Its name, for error messages
+ *   size = Set to the size of the image
+ *    err = Buffer for an error message
+ * errlen = Size of err
+ *
+ * Reads a board database in its text form (see bdb_line()) and compiles
+ * it into an image.
+ *
+ * Returns the image, to be free()d, or NULL with errno set and err
+ * saying what went wrong (errno is EINVAL for a mistake in the text).
+ */
+static void *
+bdb_compile(FILE *fp, const char *path, size_t *size, char *err,
+    const size_t errlen)
+{
+	struct bdb_build bb;
+	struct bdb_header h;
+	struct boarddef *list = NULL;
+	char *line = NULL;
+	char *p, *tok[BDB_FIELDS + 1];
+	char msg[256];
+	u_char *img = NULL;
+	size_t linecap = 0, lineno = 0, ntok, i;
+	int r, saved;
+
+	memset(&bb, 0, sizeof(bb));
+	memset(&h, 0, sizeof(h));
+	bdb_error(err, errlen, "%s", "");
+
+	while (getline(&line, &linecap, fp) != -1) {
+		++lineno;
+		p = line;
+		for (ntok = 0; ntok <= BDB_FIELDS && (r = bdb_token(&p, &tok[ntok])) == 1; ++ntok)
+			;
+		if (r == -1 || ntok > BDB_FIELDS) {
+			bdb_error(err, errlen, "%s:%zu: %s", path, lineno,
+			    (r == -1 ? "unterminated string" : "too many fields"));
+			errno = EINVAL;
+			goto fail;
+		}
+		if (ntok == 0) {
+			continue;
+		}
+		if (bdb_line(&bb, tok, ntok, msg, sizeof(msg)) == -1) {
+			if (errno == EINVAL) {
+				bdb_error(err, errlen, "%s:%zu: %s", path, lineno, msg);
+			}
+			goto fail;
+		}
+	}
+	if (ferror(fp)) {
+		bdb_error(err, errlen, "%s: %s", path, strerror(errno));
+		goto fail;
+	}
+	if (bb.nboards == 0) {
+		bdb_error(err, errlen, "%s: no boards", path);
+		errno = EINVAL;
+		goto fail;
+	}
+	if (bdb_endboard(&bb) == -1) {
+		goto fail;
+	}
+
+	/*
+	 * Lay the image out: header, index, pins, vcoefs, boards, and
+	 * strings, each section 4-byte aligned
+	 */
+	memcpy(h.magic, BDB_MAGIC, sizeof(h.magic));
+	h.version = BDB_VERSION;
+	h.byteorder = BDB_BYTEORDER;
+	h.nboards = (uint32_t)bb.nboards;
+	h.npins = (uint32_t)bb.npins;
+	h.nvcoefs = (uint32_t)bb.nvcoefs;
+	h.strsize = (uint32_t)bb.strsize;
+	h.disp = sizeof(h);
+	h.slot = h.disp + h.nboards * sizeof(int32_t);
+	h.pins = h.slot + h.nboards * sizeof(uint32_t);
+	h.vcoefs = h.pins + h.npins * sizeof(struct pinmap);
+	h.boards = h.vcoefs + h.nvcoefs * sizeof(struct vcoef);
+	h.strings = (h.boards + h.nboards * sizeof(struct bdb_board) + 3) & ~3U;
+	h.size = (h.strings + h.strsize + 3) & ~3U;
+
+	if ((img = calloc(1, h.size)) == NULL ||
+	    (list = calloc(bb.nboards, sizeof(*list))) == NULL) {
+		goto fail;
+	}
+
+	/*
+	 * The index is built over a struct boarddef list with just enough
+	 * filled in for boardidx_build() and boardidx_fingerprint().
+	 */
+	for (i = 0; i < bb.nboards; ++i) {
+		list[i].maker = bb.strings + bb.boards[i].maker;
+		list[i].product = bb.strings + bb.boards[i].product;
+		list[i].chip = bb.boards[i].chip;
+		list[i].slave = bb.boards[i].slave;
+	}
+	if (boardidx_build(list, bb.nboards, (void *)(img + h.disp), h.nboards,
+	    (void *)(img + h.slot)) == -1) {
+		if (errno == EEXIST) {
+			bdb_error(err, errlen, "%s: a board is listed twice", path);
+			errno = EINVAL;
+		} else {
+			bdb_error(err, errlen, "%s: can't index boards: %s", path, strerror(errno));
+		}
+		goto fail;
+	}
+	h.fingerprint = boardidx_fingerprint(list, bb.nboards);
+
+	memcpy(img, &h, sizeof(h));
+	if (bb.npins > 0) {
+		memcpy(img + h.pins, bb.pins, bb.npins * sizeof(*bb.pins));
+	}
+	if (bb.nvcoefs > 0) {
+		memcpy(img + h.vcoefs, bb.vcoefs, bb.nvcoefs * sizeof(*bb.vcoefs));
+	}
+	memcpy(img + h.boards, bb.boards, bb.nboards * sizeof(*bb.boards));
+	memcpy(img + h.strings, bb.strings, bb.strsize);
+	*size = h.size;
+
+	free(list);
+	free(line);
+	free(bb.boards);
+	free(bb.pins);
+	free(bb.vcoefs);
+	free(bb.strings);
+	return (img);
+
+fail:
+	saved = errno;
+	if (saved == EFBIG) {
+		bdb_error(err, errlen, "%s: more than %d pins, vcoef corrections, or bytes of strings",
+		    path, BOARD_POOL_MAX);
+	} else if (err != NULL && errlen > 0 && saved != EINVAL && err[0] == '\0') {
+		bdb_error(err, errlen, "%s: %s", path, strerror(saved));
+	}
+	free(img);
+	free(list);
+	free(line);
+	free(bb.boards);
+	free(bb.pins);
+	free(bb.vcoefs);
+	free(bb.strings);
+	errno = saved;
+	return (NULL);
+}
+
+
+/*
+ * bdb_section(const struct bdb_header *h, const uint32_t off,
+ *             const uint32_t count, const size_t elemsize)
+ *
+ *        h = Header of an image of h->size bytes
+ *      off = Offset of a section
+ *    count = Number of entries in it
+ * elemsize = Size of one entry
+ *
+ * Returns 0 if the section is aligned and lies between the header and
+ * the end of the image, or -1 if not.
+ */
+static int
+bdb_section(const struct bdb_header *h, const uint32_t off,
+    const uint32_t count, const size_t elemsize)
+{
+	if ((off & 3) != 0 || off < sizeof(*h) ||
+	    (uint64_t)off + (uint64_t)count * elemsize > h->size) {
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * bdb_attach(struct boarddb *db, const char *path, char *err,
+ *            const size_t errlen)
+ *
+ *     db = Database with img and size set
+ *   path = File the image came from, for error messages
+ *    err = Buffer for an error message
+ * errlen = Size of err
+ *
+ * Checks that the image's header and section table make sense, so that
+ * nothing outside of the image is ever read, and points db at the
+ * sections.  Records within the sections are checked as they're used
+ * (see boarddb_board()).
+ *
+ * Returns 0 on success, or -1 with errno set (EINVAL if the image isn't
+ * usable, with err saying why).
+ */
+static int
+bdb_attach(struct boarddb *db, const char *path, char *err,
+    const size_t errlen)
+{
+	const struct bdb_header *h = db->img;
+
+	if (db->size < sizeof(*h) ||
+	    memcmp(h->magic, BDB_MAGIC, sizeof(h->magic)) != 0) {
+		bdb_error(err, errlen, "%s: not a board database", path);
+		goto invalid;
+	}
+	if (h->byteorder != BDB_BYTEORDER || h->version != BDB_VERSION) {
+		bdb_error(err, errlen, "%s: compiled by another version of bsdhwmon, or on another kind of host; recompile it",
+		    path);
+		goto invalid;
+	}
+	if (h->size != db->size || h->nboards == 0 || h->strsize == 0 ||
+	    h->npins > BOARD_POOL_MAX || h->nvcoefs > BOARD_POOL_MAX ||
+	    h->strsize > BOARD_POOL_MAX ||
+	    bdb_section(h, h->disp, h->nboards, sizeof(*db->disp)) == -1 ||
+	    bdb_section(h, h->slot, h->nboards, sizeof(*db->slot)) == -1 ||
+	    bdb_section(h, h->pins, h->npins, sizeof(struct pinmap)) == -1 ||
+	    bdb_section(h, h->vcoefs, h->nvcoefs, sizeof(struct vcoef)) == -1 ||
+	    bdb_section(h, h->boards, h->nboards, sizeof(*db->records)) == -1 ||
+	    bdb_section(h, h->strings, h->strsize, 1) == -1 ||
+	    ((const char *)db->img)[h->strings + h->strsize - 1] != '\0') {
+		bdb_error(err, errlen, "%s: corrupt board database", path);
+		goto invalid;
+	}
+
+	if ((db->boards = calloc(h->nboards, sizeof(*db->boards))) == NULL) {
+		return (-1);
+	}
+
+	db->h = h;
+	db->disp = (const void *)((const char *)db->img + h->disp);
+	db->slot = (const void *)((const char *)db->img + h->slot);
+	db->records = (const void *)((const char *)db->img + h->boards);
+	db->tab.strings = (const char *)db->img + h->strings;
+	db->tab.pins = (const void *)((const char *)db->img + h->pins);
+	db->tab.vcoefs = (const void *)((const char *)db->img + h->vcoefs);
+	db->tab.boards = db->boards;
+	db->tab.nboards = h->nboards;
+	db->tab.fingerprint = h->fingerprint;
+	return (0);
+
+invalid:
+	errno = EINVAL;
+	return (-1);
+}
+
+
+/*
+ * boarddb_open(const char *path, char *err, const size_t errlen)
+ *
+ *   path = Board database; compiled, or text
+ *    err = Buffer for an error message
+ * errlen = Size of err
+ *
+ * Opens a board database.  A compiled one is mmap()ed and used in place;
+ * a text one is compiled into memory first.  Since bsdhwmon may be
+ * setuid root and the board picks which chip registers get touched, the
+ * file must be a regular file owned by root or the effective user and
+ * writable by nobody else.
+ *
+ * Returns the database, or NULL with errno set (ENOENT if there's no
+ * such file, EPERM if its ownership or mode is wrong, EINVAL if it's not
+ * a usable database) and err saying what went wrong.
+ */
+struct boarddb *
+boarddb_open(const char *path, char *err, const size_t errlen)
+{
+	struct boarddb *db;
+	struct stat st;
+	char magic[sizeof(((struct bdb_header *)0)->magic)];
+	FILE *fp;
+	int fd = -1, saved;
+
+	VERBOSE("boarddb_open(path = %s)\n", path);
+
+	bdb_error(err, errlen, "%s", "");
+	if ((db = calloc(1, sizeof(*db))) == NULL) {
+		goto fail;
+	}
+
+	if ((fd = open(path, O_RDONLY|O_NOFOLLOW)) == -1 || fstat(fd, &st) == -1) {
+		goto fail;
+	}
+	if (!S_ISREG(st.st_mode) || (st.st_uid != 0 && st.st_uid != geteuid()) ||
+	    (st.st_mode & (S_IWGRP|S_IWOTH)) != 0) {
+		bdb_error(err, errlen, "%s: not a regular file owned by root or uid %u, mode 0644 or stricter",
+		    path, (u_int)geteuid());
+		errno = EPERM;
+		goto fail;
+	}
+
+	if (st.st_size >= (off_t)sizeof(magic) &&
+	    pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+	    memcmp(magic, BDB_MAGIC, sizeof(magic)) == 0) {
+		if (st.st_size > UINT32_MAX) {
+			errno = EFBIG;
+			goto fail;
+		}
+		db->size = (size_t)st.st_size;
+		if ((db->img = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			db->img = NULL;
+			goto fail;
+		}
+		db->mapped = 1;
+		close(fd);
+	} else {
+		if ((fp = fdopen(fd, "r")) == NULL) {
+			goto fail;
+		}
+		db->img = bdb_compile(fp, path, &db->size, err, errlen);
+		saved = errno;
+		fclose(fp);
+		errno = saved;
+		if (db->img == NULL) {
+			boarddb_close(db);
+			errno = saved;
+			return (NULL);
+		}
+	}
+	fd = -1;
+
+	if (bdb_attach(db, path, err, errlen) == -1) {
+		goto fail;
+	}
+
+	VERBOSE("boarddb_open() returning %p (%s, %" PRIu32 " boards, %zu bytes)\n",
+		db, (db->mapped ? "mapped" : "compiled"), db->h->nboards, db->size);
+	return (db);
+
+fail:
+	saved = errno;
+	if (err != NULL && errlen > 0 && err[0] == '\0') {
+		bdb_error(err, errlen, "%s: %s", path, strerror(saved));
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	boarddb_close(db);
+	errno = saved;
+	return (NULL);
+}
+
+
+/*
+ * boarddb_lookup(struct boarddb *db, const char *maker, const char *product)
+ *
+ *      db = Database from boarddb_open()
+ *   maker = ASCII string; smbios.planar.maker kenv(2)
+ * product = ASCII string; smbios.planar.product kenv(2)
+ *
+ * board_lookup() for a board database: the same perfect hash, read from
+ * the image (see boardidx_probe() in boardidx.c, which this can't use:
+ * the index in an image isn't trusted).
+ *
+ * Returns the board, or NULL if there's no match (or its record is
+ * corrupt; errno is then EINVAL).
+ */
+const struct board *
+boarddb_lookup(struct boarddb *db, const char *maker, const char *product)
+{
+	const struct bdb_board *r;
+	const struct board *b;
+	uint32_t n = db->h->nboards;
+	uint32_t s;
+	int32_t d;
+
+	VERBOSE("boarddb_lookup(db = %p, maker = %p, product = %p)\n", db, maker, product);
+
+	VERBOSE("\tmaker   = %s\n", maker);
+	VERBOSE("\tproduct = %s\n", product);
+
+	d = db->disp[board_hash(maker, product, 0) % n];
+	if (d < 0) {
+		s = (uint32_t)(-(d + 1));
+	} else {
+		s = board_hash(maker, product, (uint32_t)d) % n;
+	}
+
+	if (s >= n || db->slot[s] >= n) {
+		errno = EINVAL;
+		VERBOSE("boarddb_lookup() returning NULL (corrupt index)\n");
+		return (NULL);
+	}
+	r = &db->records[db->slot[s]];
+	if (r->maker >= db->h->strsize || r->product >= db->h->strsize ||
+	    strncmp(maker, db->tab.strings + r->maker, KENV_MVALLEN) != 0 ||
+	    strncmp(product, db->tab.strings + r->product, KENV_MVALLEN) != 0) {
+		VERBOSE("boarddb_lookup() returning NULL\n");
+		return (NULL);
+	}
+
+	if ((b = boarddb_board(db, db->slot[s])) == NULL) {
+		VERBOSE("boarddb_lookup() returning NULL (corrupt board %" PRIu32 ")\n",
+			db->slot[s]);
+		return (NULL);
+	}
+	board_trace(b);
+
+	VERBOSE("boarddb_lookup() returning %p\n", b);
+	return (b);
+}
+
+
+/*
+ * boarddb_board(struct boarddb *db, const size_t bidx)
+ *
+ *   db = Database from boarddb_open()
+ * bidx = Index of a board in the image
+ *
+ * Checks the image's board bidx, the first time it's asked for, and
+ * copies it into db's board table.  Once a board has been checked,
+ * nothing it refers to can be outside of the image.
+ *
+ * Returns the board, or NULL with errno set (EINVAL if bidx is out of
+ * range or the board's record is corrupt).
+ */
+const struct board *
+boarddb_board(struct boarddb *db, const size_t bidx)
+{
+	const struct bdb_board *r;
+	const struct pinmap *p;
+	const struct vcoef *v;
+	struct board *b;
+	size_t k, i;
+
+	if (bidx >= db->h->nboards) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	b = &db->boards[bidx];
+	if (b->tab != NULL) {
+		return (b);
+	}
+
+	r = &db->records[bidx];
+	if (r->maker >= db->h->strsize || r->product >= db->h->strsize ||
+	    r->chip >= nitems(chip_names) || r->slave < -1 ||
+	    r->nvcoef > VOLT_MAX || (uint32_t)r->vcoef + r->nvcoef > db->h->nvcoefs) {
+		goto invalid;
+	}
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		if (r->npins[k] > pin_kinds[k].max ||
+		    (uint32_t)r->pins[k] + r->npins[k] > db->h->npins) {
+			goto invalid;
+		}
+		for (i = 0; i < r->npins[k]; ++i) {
+			p = &db->tab.pins[r->pins[k] + i];
+			if (p->index >= pin_kinds[k].max || p->label >= db->h->strsize) {
+				goto invalid;
+			}
+		}
+	}
+	for (i = 0; i < r->nvcoef; ++i) {
+		v = &db->tab.vcoefs[r->vcoef + i];
+		if (v->index >= VOLT_MAX || v->scale == 0) {
+			goto invalid;
+		}
+	}
+
+	b->maker = r->maker;
+	b->product = r->product;
+	memcpy(b->pins, r->pins, sizeof(b->pins));
+	b->vcoef = r->vcoef;
+	memcpy(b->npins, r->npins, sizeof(b->npins));
+	b->nvcoef = r->nvcoef;
+	b->chip = r->chip;
+	b->slave = r->slave;
+	b->tab = &db->tab;
+	return (b);
+
+invalid:
+	errno = EINVAL;
+	return (NULL);
+}
+
+
+/*
+ * boarddb_fingerprint(const struct boarddb *db)
+ *
+ * db = Database from boarddb_open()
+ *
+ * Returns the fingerprint of the database's board list, computed the
+ * same way as the built-in one's (see boardidx_fingerprint()).
+ */
+uint32_t
+boarddb_fingerprint(const struct boarddb *db)
+{
+	return (db->h->fingerprint);
+}
+
+
+/*
+ * boarddb_count(const struct boarddb *db)
+ *
+ * db = Database from boarddb_open()
+ *
+ * Returns the number of boards in the database.
+ */
+size_t
+boarddb_count(const struct boarddb *db)
+{
+	return (db->h->nboards);
+}
+
+
+/*
+ * boarddb_table(struct boarddb *db)
+ *
+ * db = Database from boarddb_open()
+ *
+ * Checks every board in the database (see boarddb_board()).
+ *
+ * Returns the database's board table (for list_models()), or NULL with
+ * errno set.  The table belongs to db.
+ */
+const struct boardtab *
+boarddb_table(struct boarddb *db)
+{
+	size_t i;
+
+	for (i = 0; !db->filled && i < db->h->nboards; ++i) {
+		if (boarddb_board(db, i) == NULL) {
+			return (NULL);
+		}
+	}
+	db->filled = 1;
+	return (&db->tab);
+}
+
+
+/*
+ * boarddb_compile(const char *text, const char *out, char *err,
+ *                 const size_t errlen)
+ *
+ *   text = Board database in its text form
+ *    out = Compiled database to (re)write
+ *    err = Buffer for an error message
+ * errlen = Size of err
+ *
+ * Compiles text and writes the image to a temporary file next to out,
+ * then renames it into place, so boarddb_open() sees either the old or
+ * the new database, never a partial one.  A process which has the old
+ * one mapped keeps using it.
+ *
+ * Returns the size of the image, or -1 with errno set (EINVAL for a
+ * mistake in the text) and err saying what went wrong.
+ */
+ssize_t
+boarddb_compile(const char *text, const char *out, char *err,
+    const size_t errlen)
+{
+	char tmp[PATH_MAX];
+	void *img;
+	size_t size;
+	ssize_t len = -1;
+	FILE *fp;
+	int fd, saved;
+
+	VERBOSE("boarddb_compile(text = %s, out = %s)\n", text, out);
+
+	bdb_error(err, errlen, "%s", "");
+	if ((fp = fopen(text, "r")) == NULL) {
+		saved = errno;
+		bdb_error(err, errlen, "%s: %s", text, strerror(saved));
+		errno = saved;
+		return (-1);
+	}
+	img = bdb_compile(fp, text, &size, err, errlen);
+	saved = errno;
+	fclose(fp);
+	if (img == NULL) {
+		errno = saved;
+		return (-1);
+	}
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", out) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		goto fail;
+	}
+	if ((fd = mkstemp(tmp)) == -1) {
+		goto fail;
+	}
+	if (fchmod(fd, 0644) == -1 ||
+	    (len = write(fd, img, size)) != (ssize_t)size) {
+		saved = (len >= 0 ? EIO : errno);
+		close(fd);
+		unlink(tmp);
+		errno = saved;
+		goto fail;
+	}
+	if (close(fd) == -1 || rename(tmp, out) == -1) {
+		saved = errno;
+		unlink(tmp);
+		errno = saved;
+		goto fail;
+	}
+
+	free(img);
+	return ((ssize_t)size);
+
+fail:
+	saved = errno;
+	bdb_error(err, errlen, "%s: %s", out, strerror(saved));
+	free(img);
+	errno = saved;
+	return (-1);
+}
+
+
+/*
+ * boarddb_close(struct boarddb *db)
+ *
+ * db = Database from boarddb_open(), or NULL
+ *
+ * Unmaps or frees the image, and the board table over it.
+ */
+void
+boarddb_close(struct boarddb *db)
+{
+	if (db == NULL) {
+		return;
+	}
+	free(db->boards);
+	if (db->mapped) {
+		munmap(db->img, db->size);
+	} else {
+		free(db->img);
+	}
+	free(db);
+}
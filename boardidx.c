@@ -0,0 +1,288 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/types.h>
+#if defined(__FreeBSD__)
+#include <kenv.h>
+#else
+#define KENV_MVALLEN	128		/* See <kenv.h> on FreeBSD */
+#endif
+#include "global.h"
+
+/*
+ * This file must not depend on anything but the C library: it is linked
+ * into mkboardidx (the build-time index generator) and the lookup
+ * benchmark as well as bsdhwmon itself.
+ */
+
+/*
+ * Function prototypes
+ */
+uint32_t	board_hash(const char *, const char *, const uint32_t);
+int		boardidx_build(const struct boarddef *, const size_t, int32_t *,
+		    const uint32_t, uint32_t *);
+uint32_t	boardidx_fingerprint(const struct boarddef *, const size_t);
+size_t		boardidx_probe(const struct boardidx *, const char *,
+		    const char *);
+
+#define FNV32_BASIS	0x811c9dc5U
+#define FNV32_PRIME	0x01000193U
+
+
+/*
+ * board_hash(const char *maker, const char *product, const uint32_t seed)
+ *
+ *   maker = ASCII string; smbios.planar.maker kenv(2)
+ * product = ASCII string; smbios.planar.product kenv(2)
+ *    seed = Selects one hash function out of the family
+ *
+ * FNV-1a over maker, a NUL separator, and product (each bounded by
+ * KENV_MVALLEN, same as the strncmp() in board_lookup()), perturbed by
+ * seed and finished with the MurmurHash3 32-bit mixer so that nearby
+ * seeds give unrelated values.
+ */
+uint32_t
+board_hash(const char *maker, const char *product, const uint32_t seed)
+{
+	uint32_t h = (FNV32_BASIS ^ seed) * FNV32_PRIME;
+	size_t i;
+
+	for (i = 0; i < KENV_MVALLEN && maker[i] != '\0'; ++i) {
+		h = (h ^ (u_char)maker[i]) * FNV32_PRIME;
+	}
+	h *= FNV32_PRIME;		/* Separator: "ab","c" != "a","bc" */
+	for (i = 0; i < KENV_MVALLEN && product[i] != '\0'; ++i) {
+		h = (h ^ (u_char)product[i]) * FNV32_PRIME;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return (h);
+}
+
+
+/*
+ * boardidx_build(const struct boarddef *list, const size_t n, int32_t *disp,
+ *                const uint32_t nbuckets, uint32_t *slot)
+ *
+ *     list = Board list to index (need not be NULL-terminated)
+ *        n = Number of entries in list
+ *     disp = Array of nbuckets entries, filled in
+ * nbuckets = Number of buckets; n is a good choice
+ *     slot = Array of n entries, filled in
+ *
+ * Builds a minimal perfect hash over the (maker, product) pairs of list
+ * using hash-and-displace: keys are grouped into buckets by
+ * board_hash(.., 0), then, largest bucket first, each bucket is given
+ * the first seed which places all its keys into unused slots.  Buckets
+ * holding a single key are placed last, directly into whatever slots
+ * remain.  See struct boardidx in global.h for how the result is read.
+ *
+ * Returns 0 on success, or -1 with errno set: EEXIST if list has two
+ * identical (maker, product) pairs, ENOMEM, or EINVAL.
+ */
+int
+boardidx_build(const struct boarddef *list, const size_t n, int32_t *disp,
+    const uint32_t nbuckets, uint32_t *slot)
+{
+	uint32_t *count = NULL;		/* Keys per bucket */
+	uint32_t *start = NULL;		/* First key of each bucket in member[] */
+	uint32_t *member = NULL;	/* Keys, grouped by bucket */
+	uint32_t *order = NULL;		/* Buckets, largest first */
+	uint32_t *try = NULL;		/* Candidate slots of one bucket */
+	u_char *used = NULL;		/* Slots taken */
+	uint32_t b, i, j, k, c, free_slot, maxcount, norder;
+	int32_t seed;
+	int ret = -1;
+
+	if (n == 0 || n > INT32_MAX || nbuckets == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	count  = calloc(nbuckets, sizeof(*count));
+	start  = calloc(nbuckets + 1, sizeof(*start));
+	member = calloc(n, sizeof(*member));
+	order  = calloc(nbuckets, sizeof(*order));
+	used   = calloc(n, sizeof(*used));
+	if (count == NULL || start == NULL || member == NULL ||
+	    order == NULL || used == NULL) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * Group keys by bucket (counting sort), then order buckets by
+	 * size, largest first, again with a counting sort over sizes.
+	 */
+	maxcount = 0;
+	for (i = 0; i < n; ++i) {
+		b = board_hash(list[i].maker, list[i].product, 0) % nbuckets;
+		if (++count[b] > maxcount) {
+			maxcount = count[b];
+		}
+	}
+	for (b = 0; b < nbuckets; ++b) {
+		start[b + 1] = start[b] + count[b];
+	}
+	for (i = 0; i < n; ++i) {
+		b = board_hash(list[i].maker, list[i].product, 0) % nbuckets;
+		member[start[b + 1] - count[b]--] = i;
+	}
+	for (norder = 0, c = maxcount; c > 0; --c) {
+		for (b = 0; b < nbuckets; ++b) {
+			if (start[b + 1] - start[b] == c) {
+				order[norder++] = b;
+			}
+		}
+	}
+
+	if ((try = calloc(maxcount, sizeof(*try))) == NULL) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	for (b = 0; b < nbuckets; ++b) {
+		disp[b] = 0;
+	}
+
+	free_slot = 0;
+	for (k = 0; k < norder; ++k) {
+		b = order[k];
+		c = start[b + 1] - start[b];
+
+		if (c == 1) {
+			while (used[free_slot]) {
+				++free_slot;
+			}
+			used[free_slot] = 1;
+			slot[free_slot] = member[start[b]];
+			disp[b] = -(int32_t)free_slot - 1;
+			continue;
+		}
+
+		/*
+		 * Identical keys hash identically under every seed; catch
+		 * them here rather than searching forever.
+		 */
+		for (i = start[b]; i < start[b + 1]; ++i) {
+			for (j = i + 1; j < start[b + 1]; ++j) {
+				if (strncmp(list[member[i]].maker, list[member[j]].maker, KENV_MVALLEN) == 0 &&
+				    strncmp(list[member[i]].product, list[member[j]].product, KENV_MVALLEN) == 0) {
+					errno = EEXIST;
+					goto out;
+				}
+			}
+		}
+
+		for (seed = 1; seed < INT32_MAX; ++seed) {
+			for (i = 0; i < c; ++i) {
+				const struct boarddef *e = &list[member[start[b] + i]];
+
+				try[i] = board_hash(e->maker, e->product, (uint32_t)seed) % n;
+				if (used[try[i]]) {
+					break;
+				}
+				for (j = 0; j < i; ++j) {
+					if (try[j] == try[i]) {
+						break;
+					}
+				}
+				if (j < i) {
+					break;
+				}
+			}
+			if (i == c) {
+				break;
+			}
+		}
+		if (seed == INT32_MAX) {
+			errno = EINVAL;
+			goto out;
+		}
+
+		disp[b] = seed;
+		for (i = 0; i < c; ++i) {
+			used[try[i]] = 1;
+			slot[try[i]] = member[start[b] + i];
+		}
+	}
+	ret = 0;
+
+out:
+	free(count);
+	free(start);
+	free(member);
+	free(order);
+	free(try);
+	free(used);
+	return (ret);
+}
+
+
+/*
+ * boardidx_fingerprint(const struct boarddef *list, const size_t n)
+ *
+ * list = Board list (need not be NULL-terminated)
+ *    n = Number of entries in list
+ *
+ * Returns a hash over the maker, product, chip, and slave of every board
+ * in list, in order; see struct boardidx in global.h.
+ */
+uint32_t
+boardidx_fingerprint(const struct boarddef *list, const size_t n)
+{
+	uint32_t fingerprint = (uint32_t)n;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		fingerprint = board_hash(list[i].maker, list[i].product,
+		    fingerprint ^ (uint32_t)(list[i].chip << 8) ^ (uint32_t)list[i].slave);
+	}
+	return (fingerprint);
+}
+
+
+/*
+ * boardidx_probe(const struct boardidx *ix, const char *maker,
+ *                const char *product)
+ *
+ *      ix = Index (see boardidx_build())
+ *   maker = ASCII string; smbios.planar.maker kenv(2)
+ * product = ASCII string; smbios.planar.product kenv(2)
+ *
+ * The hash only tells us which entry *could* match; the caller has to
+ * compare that entry's maker and product, the same way the old linear
+ * scan in board_lookup() did.
+ *
+ * Returns the index into the board list of the only board which could
+ * match, or BOARDIDX_NONE if the index is empty.
+ */
+size_t
+boardidx_probe(const struct boardidx *ix, const char *maker,
+    const char *product)
+{
+	int32_t d;
+	uint32_t s;
+
+	if (ix->nkeys == 0) {
+		return (BOARDIDX_NONE);
+	}
+
+	d = ix->disp[board_hash(maker, product, 0) % ix->nbuckets];
+	if (d < 0) {
+		s = (uint32_t)(-(d + 1));
+	} else {
+		s = board_hash(maker, product, (uint32_t)d) % ix->nkeys;
+	}
+	return (ix->slot[s]);
+}
@@ -0,0 +1,188 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * Reader side of the bsdhwmon shared memory snapshot (--shm).
+ *
+ * A bsdhwmon running with --shm NAME publishes every sample into the
+ * POSIX shared memory object NAME, laid out as struct bsdhwmon_shm
+ * below.  Readers map it read-only once with bsdhwmon_shm_attach(),
+ * then call bsdhwmon_shm_read() as often as they like: each call copies
+ * out one consistent sample without any system call, and without any
+ * lock the writer could be held up by.
+ *
+ * Consistency comes from a sequence lock: the writer makes seq odd,
+ * updates data, then makes seq even again.  A reader which sees the
+ * same even seq before and after its copy got a sample nobody wrote to
+ * in between; otherwise it retries.
+ *
+ * This file is self-contained (C11, POSIX) so it can be copied into
+ * other programs; it doesn't use global.h.
+ */
+
+#ifndef BSDHWMON_SHM_H
+#define BSDHWMON_SHM_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BSDHWMON_SHM_MAGIC	"BHWMSHM1"
+#define BSDHWMON_SHM_VERSION	2
+#define BSDHWMON_SHM_STRLEN	128	/* KENV_MVALLEN on FreeBSD */
+#define BSDHWMON_SHM_LABELLEN	32	/* Longest pinmap label, plus NUL */
+#define BSDHWMON_SHM_SENSORS	16	/* Per kind; >= VOLT_MAX, TEMP_MAX, FAN_MAX */
+#define BSDHWMON_SHM_RETRIES	1000	/* bsdhwmon_shm_read() attempts */
+
+/*
+ * One sensor, in the board's pinmap order, already scaled: degrees
+ * Celsius, RPM, or volts.  Sensors the sample has no reading for (e.g. a
+ * disconnected fan) have their bit clear in the *_valid bitmaps, and a
+ * value of 0.
+ */
+struct bsdhwmon_shm_sensor {
+	char		label[BSDHWMON_SHM_LABELLEN];
+	double		value;
+};
+
+struct bsdhwmon_shm_data {
+	char		maker[BSDHWMON_SHM_STRLEN];	/* Board maker */
+	char		product[BSDHWMON_SHM_STRLEN];	/* Board product */
+	int64_t		time_sec;	/* CLOCK_REALTIME of the sample */
+	int64_t		time_nsec;
+	uint64_t	samples;	/* Samples published by this writer */
+	uint32_t	interval;	/* Seconds between samples */
+	uint32_t	ntemps;
+	uint32_t	nfans;
+	uint32_t	nvoltages;
+	uint32_t	temps_valid;	/* Bit i set: temps[i].value was read */
+	uint32_t	fans_valid;
+	uint32_t	voltages_valid;
+	uint32_t	pad;
+	struct bsdhwmon_shm_sensor	temps[BSDHWMON_SHM_SENSORS];
+	struct bsdhwmon_shm_sensor	fans[BSDHWMON_SHM_SENSORS];
+	struct bsdhwmon_shm_sensor	voltages[BSDHWMON_SHM_SENSORS];
+};
+
+struct bsdhwmon_shm {
+	char		magic[8];	/* BSDHWMON_SHM_MAGIC, not NUL-terminated */
+	uint32_t	version;	/* BSDHWMON_SHM_VERSION */
+	uint32_t	size;		/* sizeof(struct bsdhwmon_shm) */
+	_Atomic uint32_t	seq;	/* Odd while data is being written */
+	uint32_t	pad;
+	struct bsdhwmon_shm_data	data;
+};
+
+
+/*
+ * bsdhwmon_shm_attach(const char *name)
+ *
+ * name = Shared memory object given to bsdhwmon --shm, e.g. "/bsdhwmon"
+ *
+ * Maps the snapshot read-only.  The mapping stays valid (showing the last
+ * sample) even after the writer exits; see time_sec and interval for
+ * telling whether it's still being updated.
+ *
+ * Returns the mapping, or NULL with errno set (EINVAL if name isn't a
+ * bsdhwmon snapshot of this version).
+ */
+static inline const struct bsdhwmon_shm *
+bsdhwmon_shm_attach(const char *name)
+{
+	const struct bsdhwmon_shm *shm;
+	struct stat st;
+	void *p;
+	int fd, saved;
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) == -1) {
+		return (NULL);
+	}
+	if (fstat(fd, &st) == -1) {
+		saved = errno;
+		close(fd);
+		errno = saved;
+		return (NULL);
+	}
+	if (st.st_size < (off_t)sizeof(*shm)) {
+		close(fd);
+		errno = EINVAL;
+		return (NULL);
+	}
+	p = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	saved = errno;
+	close(fd);
+	if (p == MAP_FAILED) {
+		errno = saved;
+		return (NULL);
+	}
+
+	shm = p;
+	if (memcmp(shm->magic, BSDHWMON_SHM_MAGIC, sizeof(shm->magic)) != 0 ||
+	    shm->version != BSDHWMON_SHM_VERSION || shm->size != sizeof(*shm)) {
+		munmap(p, sizeof(*shm));
+		errno = EINVAL;
+		return (NULL);
+	}
+	return (shm);
+}
+
+
+/*
+ * bsdhwmon_shm_read(const struct bsdhwmon_shm *shm,
+ *                   struct bsdhwmon_shm_data *out)
+ *
+ * shm = Mapping returned by bsdhwmon_shm_attach()
+ * out = Filled in with a consistent copy of the latest sample
+ *
+ * No system calls, no locks.  Only spins while the writer is in the
+ * middle of an update (a few hundred nanoseconds).
+ *
+ * Returns 0 on success, or -1 with errno set to EAGAIN if nothing has
+ * been published yet, or no consistent copy could be made in
+ * BSDHWMON_SHM_RETRIES attempts (the writer died mid-update).
+ */
+static inline int
+bsdhwmon_shm_read(const struct bsdhwmon_shm *shm, struct bsdhwmon_shm_data *out)
+{
+	uint32_t s1, s2;
+	int i;
+
+	for (i = 0; i < BSDHWMON_SHM_RETRIES; ++i) {
+		s1 = atomic_load_explicit(&shm->seq, memory_order_acquire);
+		if (s1 & 1) {
+			continue;
+		}
+		memcpy(out, &shm->data, sizeof(*out));
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+		if (s1 == s2) {
+			if (out->samples == 0) {
+				break;
+			}
+			return (0);
+		}
+	}
+	errno = EAGAIN;
+	return (-1);
+}
+
+
+/*
+ * bsdhwmon_shm_detach(const struct bsdhwmon_shm *shm)
+ *
+ * shm = Mapping returned by bsdhwmon_shm_attach()
+ */
+static inline void
+bsdhwmon_shm_detach(const struct bsdhwmon_shm *shm)
+{
+	munmap((void *)(uintptr_t)shm, sizeof(*shm));
+}
+
+#endif /* BSDHWMON_SHM_H */
@@ -0,0 +1,318 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include "global.h"
+
+/*
+ * Reporting of bus transaction statistics (--stats).  The counters are
+ * kept by smbus_io.c; see struct smbus_stats in global.h.  They're shown
+ * either as a table (stats_print(), for one-shot use), or as OpenMetrics
+ * metric families added to a document by output.c (stats_om_render(),
+ * for anything scraping a long-running bsdhwmon):
+ *
+ *   bsdhwmon_smbus_transactions_total      counter
+ *   bsdhwmon_smbus_bytes_total             counter
+ *   bsdhwmon_smbus_failures_total          counter
+ *   bsdhwmon_smbus_latency_seconds         histogram
+ *
+ * each labelled with slave and register (and bus, for several buses).
+ * Only registers which have seen a transaction are listed.
+ */
+#define STATS_LINEMAX	128		/* Longest OpenMetrics line, less labels */
+#define STATS_HDRMAX	1024		/* All TYPE/UNIT/HELP lines */
+
+/*
+ * Function prototypes
+ */
+static uint64_t	stats_bound(const size_t);
+static size_t	stats_quantile(const struct smbus_regstats *, const double);
+static void	stats_total(const struct smbus_stats *, struct smbus_regstats *);
+static int	stats_print_row(FILE *, const char *, const struct smbus_regstats *);
+int		stats_print(FILE *, const struct smbus_stats *, const char *);
+size_t		stats_om_size(const struct smbus_stats *const *,
+		    const char *const *, const size_t);
+char *		stats_om_render(char *, const struct smbus_stats *const *,
+		    const char *const *, const size_t);
+
+
+/*
+ * stats_bound(const size_t b)
+ *
+ * b = Histogram bucket
+ *
+ * Returns the upper bound of bucket b in microseconds (the last bucket
+ * has none; see global.h).
+ */
+static uint64_t
+stats_bound(const size_t b)
+{
+	return (UINT64_C(1) << b);
+}
+
+
+/*
+ * stats_quantile(const struct smbus_regstats *rs, const double q)
+ *
+ * rs = Counters of one register (or a total)
+ *  q = Quantile, e.g. 0.99
+ *
+ * Returns the histogram bucket which the q quantile of latencies falls
+ * in.
+ */
+static size_t
+stats_quantile(const struct smbus_regstats *rs, const double q)
+{
+	u_long seen = 0;
+	size_t b;
+
+	for (b = 0; b < STATS_BUCKETS - 1; ++b) {
+		seen += rs->hist[b];
+		if ((double)seen >= q * (double)rs->xfers) {
+			break;
+		}
+	}
+	return (b);
+}
+
+
+/*
+ * stats_total(const struct smbus_stats *st, struct smbus_regstats *tot)
+ *
+ *  st = Counters of a bus
+ * tot = Filled in with the sum over all its slaves and registers
+ */
+static void
+stats_total(const struct smbus_stats *st, struct smbus_regstats *tot)
+{
+	const struct smbus_regstats *rs;
+	size_t i, r, b;
+
+	memset(tot, 0, sizeof(*tot));
+	for (i = 0; i < st->nslaves; ++i) {
+		for (r = 0; r < 256; ++r) {
+			rs = &st->reg[i][r];
+			tot->xfers += rs->xfers;
+			tot->bytes += rs->bytes;
+			tot->failures += rs->failures;
+			tot->nsec += rs->nsec;
+			for (b = 0; b < STATS_BUCKETS; ++b) {
+				tot->hist[b] += rs->hist[b];
+			}
+		}
+	}
+}
+
+
+/*
+ * stats_print_row(FILE *fp, const char *what, const struct smbus_regstats *rs)
+ *
+ *   fp = Stream to print to
+ * what = First two columns (slave and register)
+ *   rs = Counters to print
+ *
+ * Prints one line of the stats_print() table.  The median and 99th
+ * percentile are only known to within a histogram bucket, so they're
+ * printed as that bucket's bound.
+ *
+ * Returns the fprintf(3) result.
+ */
+static int
+stats_print_row(FILE *fp, const char *what, const struct smbus_regstats *rs)
+{
+	char q[2][16];
+	size_t i, b;
+
+	for (i = 0; i < 2; ++i) {
+		b = stats_quantile(rs, (i == 0 ? 0.5 : 0.99));
+		if (b == STATS_BUCKETS - 1) {
+			snprintf(q[i], sizeof(q[i]), ">=%ju", (uintmax_t)stats_bound(b - 1));
+		} else {
+			snprintf(q[i], sizeof(q[i]), "<%ju", (uintmax_t)stats_bound(b));
+		}
+	}
+
+	return (fprintf(fp, "%-11s  %9lu  %9lu  %8lu  %9.1f  %8s  %8s\n", what,
+	    rs->xfers, rs->bytes, rs->failures,
+	    (double)rs->nsec / 1000.0 / (double)rs->xfers, q[0], q[1]));
+}
+
+
+/*
+ * stats_print(FILE *fp, const struct smbus_stats *st, const char *tag)
+ *
+ *  fp = Stream to print to (e.g. stderr)
+ *  st = Counters of a bus; see smbus_stats_enable()
+ * tag = Name of the bus, for the heading, or NULL
+ *
+ * Prints a table of transactions per slave and register, with their
+ * latencies (in microseconds), followed by the total for the bus.
+ *
+ * Returns 0 on success, or -1 if fp couldn't be written to.
+ */
+int
+stats_print(FILE *fp, const struct smbus_stats *st, const char *tag)
+{
+	struct smbus_regstats tot;
+	const struct smbus_regstats *rs;
+	char what[16];
+	size_t i, r;
+
+	fprintf(fp, "SMBus transactions%s%s:\n", (tag != NULL ? " on " : ""),
+	    (tag != NULL ? tag : ""));
+	fprintf(fp, "%-11s  %9s  %9s  %8s  %9s  %8s  %8s\n", "slave/reg",
+	    "xfers", "bytes", "failures", "avg us", "p50 us", "p99 us");
+
+	for (i = 0; i < st->nslaves; ++i) {
+		for (r = 0; r < 256; ++r) {
+			rs = &st->reg[i][r];
+			if (rs->xfers == 0) {
+				continue;
+			}
+			snprintf(what, sizeof(what), "0x%02x/0x%02zx", st->slave[i], r);
+			stats_print_row(fp, what, rs);
+		}
+	}
+
+	stats_total(st, &tot);
+	if (tot.xfers > 0) {
+		stats_print_row(fp, "total", &tot);
+	}
+	if (st->dropped > 0) {
+		fprintf(fp, "(%lu transactions on further slaves not counted)\n",
+		    st->dropped);
+	}
+
+	fflush(fp);
+	return (ferror(fp) ? -1 : 0);
+}
+
+
+/*
+ * stats_om_size(const struct smbus_stats *const *st,
+ *               const char *const *labels, const size_t n)
+ *
+ *     st = Array of n counters, one per bus
+ * labels = Array of n label strings; see stats_om_render()
+ *      n = Number of buses
+ *
+ * Returns the most stats_om_render() may write with the counters as
+ * they are now.
+ */
+size_t
+stats_om_size(const struct smbus_stats *const *st, const char *const *labels,
+    const size_t n)
+{
+	size_t size = STATS_HDRMAX;
+	size_t i, s, r;
+
+	for (i = 0; i < n; ++i) {
+		for (s = 0; s < st[i]->nslaves; ++s) {
+			for (r = 0; r < 256; ++r) {
+				if (st[i]->reg[s][r].xfers > 0) {
+					size += (STATS_BUCKETS + 5) *
+					    (STATS_LINEMAX + strlen(labels[i]));
+				}
+			}
+		}
+	}
+	return (size);
+}
+
+
+/*
+ * stats_om_render(char *p, const struct smbus_stats *const *st,
+ *                 const char *const *labels, const size_t n)
+ *
+ *      p = Buffer of at least stats_om_size() bytes
+ *     st = Array of n counters, one per bus
+ * labels = Array of n strings added to every sample's labels: either ""
+ *          or a pre-escaped ",bus=\"TAG\""
+ *      n = Number of buses
+ *
+ * Renders the OpenMetrics metric families listed at the top of this
+ * file, every bus's samples of a family together.  The histogram is
+ * cumulative, as OpenMetrics requires, with the last bucket as +Inf.
+ *
+ * Returns a pointer just past what was written.
+ */
+char *
+stats_om_render(char *p, const struct smbus_stats *const *st,
+    const char *const *labels, const size_t n)
+{
+	static const struct {
+		const char	*name;
+		const char	*help;
+	} counters[] = {
+		{ "bsdhwmon_smbus_transactions", "SMBus transactions issued." },
+		{ "bsdhwmon_smbus_bytes", "Bytes transferred by successful SMBus transactions." },
+		{ "bsdhwmon_smbus_failures", "SMBus transactions which failed." },
+	};
+	const char *hist = "bsdhwmon_smbus_latency_seconds";
+	const struct smbus_regstats *rs;
+	char lbl[64];
+	size_t c, i, s, r, b, max;
+	u_long v, cum;
+
+	for (c = 0; c < sizeof(counters) / sizeof(counters[0]); ++c) {
+		p += sprintf(p, "# TYPE %s counter\n", counters[c].name);
+		if (c == 1) {
+			p += sprintf(p, "# UNIT %s bytes\n", counters[c].name);
+		}
+		p += sprintf(p, "# HELP %s %s\n", counters[c].name, counters[c].help);
+
+		for (i = 0; i < n; ++i) {
+			for (s = 0; s < st[i]->nslaves; ++s) {
+				for (r = 0; r < 256; ++r) {
+					rs = &st[i]->reg[s][r];
+					if (rs->xfers == 0) {
+						continue;
+					}
+					v = (c == 0 ? rs->xfers : (c == 1 ? rs->bytes : rs->failures));
+					max = STATS_LINEMAX + strlen(labels[i]);
+					p += snprintf(p, max,
+					    "%s_total{slave=\"0x%02x\",register=\"0x%02zx\"%s} %lu\n",
+					    counters[c].name, st[i]->slave[s], r, labels[i], v);
+				}
+			}
+		}
+	}
+
+	p += sprintf(p, "# TYPE %s histogram\n# UNIT %s seconds\n"
+	    "# HELP %s SMBus transaction latency.\n", hist, hist, hist);
+
+	for (i = 0; i < n; ++i) {
+		max = STATS_LINEMAX + strlen(labels[i]);
+		for (s = 0; s < st[i]->nslaves; ++s) {
+			for (r = 0; r < 256; ++r) {
+				rs = &st[i]->reg[s][r];
+				if (rs->xfers == 0) {
+					continue;
+				}
+				snprintf(lbl, sizeof(lbl), "slave=\"0x%02x\",register=\"0x%02zx\"",
+				    st[i]->slave[s], r);
+				for (cum = 0, b = 0; b < STATS_BUCKETS - 1; ++b) {
+					cum += rs->hist[b];
+					p += snprintf(p, max, "%s_bucket{%s%s,le=\"%ju.%06ju\"} %lu\n",
+					    hist, lbl, labels[i],
+					    (uintmax_t)(stats_bound(b) / 1000000),
+					    (uintmax_t)(stats_bound(b) % 1000000), cum);
+				}
+				p += snprintf(p, max, "%s_bucket{%s%s,le=\"+Inf\"} %lu\n",
+				    hist, lbl, labels[i], rs->xfers);
+				p += snprintf(p, max, "%s_count{%s%s} %lu\n",
+				    hist, lbl, labels[i], rs->xfers);
+				p += snprintf(p, max, "%s_sum{%s%s} %ju.%09ju\n",
+				    hist, lbl, labels[i], (uintmax_t)(rs->nsec / 1000000000),
+				    (uintmax_t)(rs->nsec % 1000000000));
+			}
+		}
+	}
+	return (p);
+}
@@ -8,18 +8,111 @@
 #include <sys/types.h>
 #include "global.h"
 
+/*
+ * Voltage scales, in millivolts per count of each channel's 10-bit
+ * register (the datasheet's LSB times whatever divider Supermicro put in
+ * front of the pin); see w83792d_vcoefs below.
+ */
+#define W83792D_MV_VCORE	2		/* VCOREA, VCOREB */
+#define W83792D_MV_VIN		4		/* VIN0, VIN1 */
+#define W83792D_MV_VIN2		(8 * 12)	/* -12V */
+#define W83792D_MV_VIN3		16
+#define W83792D_MV_5VCC		6
+#define W83792D_MV_5VSB		24		/* 8 bits */
+#define W83792D_MV_VBAT		16		/* 8 bits */
+
 /*
  * Function prototypes
  */
 uint8_t		w83792d_divisor(const uint8_t);
 uint32_t	w83792d_rpmconv(const uint8_t, const uint8_t);
-int		w83792d_main(int, const int, struct sensors *);
+int		w83792d_main(struct smbus *, struct regspans *, const struct board *,
+		    struct regmap *, struct sensors *, struct timings *);
+void		w83792d_decode(const struct regmap *, const struct board *,
+		    struct sensors *);
+
+/*
+ * External functions (timings.c)
+ */
+extern void	timings_mark(struct timings *, const int);
+
+/*
+ * External functions (regplan.c)
+ */
+extern ssize_t	regplan_compile(const struct regplan *, const struct board *,
+		    const size_t, struct regspan *, const size_t);
+extern int	regplan_run(struct smbus *, const struct regspan *, const size_t,
+		    struct regmap *);
+extern const u_char *	regmap_find(const struct regmap *, const int);
+
+/*
+ * External functions (collect.c)
+ */
+extern void	volts_decode(const struct board *, const struct vcoefs *,
+		    const int32_t *, struct sensors *);
 
 /*
- * External functions (smbus_io.c)
+ * Default voltage coefficients; see struct vcoefs in global.h.  The
+ * formulas are suspect (see w83792d_decode()); a board which needs other
+ * ones lists them in its board struct.
+ */
+static const struct vcoefs w83792d_vcoefs = {
+	.scale = {
+		[VOLT_VCOREA]	= W83792D_MV_VCORE,
+		[VOLT_VCOREB]	= W83792D_MV_VCORE,
+		[VOLT_VIN0]	= W83792D_MV_VIN,
+		[VOLT_VIN1]	= W83792D_MV_VIN,
+		[VOLT_VIN2]	= -W83792D_MV_VIN2,	/* VIN2 is a negative voltage */
+		[VOLT_VIN3]	= W83792D_MV_VIN3,
+		[VOLT_5VCC]	= W83792D_MV_5VCC,
+		[VOLT_5VSB]	= W83792D_MV_5VSB,
+		[VOLT_VBAT]	= W83792D_MV_VBAT,
+	},
+};
+
+/*
+ * Registers read on every sample, all in bank 0, and the sensor each one
+ * belongs to.  Registers for sensors the board doesn't wire up are left
+ * out by regplan_compile().  See the comments in w83792d_decode() for
+ * what each register holds.
+ *
+ * NOTE: The FAN4-FAN7 counters (CRB8-CRBA, CRBE) and the FAN7 divisor
+ * (CR9E) have never been read by this routine, so those fans decode as
+ * 0 RPM.  Only their divisor registers are listed here, to keep the
+ * output identical to what it has always been.
  */
-extern uint8_t	read_byte(int, int, const char);
-extern void	write_byte(int, int, const char, const char);
+static const struct regplan w83792d_plan[] = {
+	{ SLAVE_BOARD,	0x20,	1,	SENSOR_VOLT,	VOLT_VCOREA },
+	{ SLAVE_BOARD,	0x3e,	1,	SENSOR_VOLT,	VOLT_VCOREA },	/* Low bits */
+	{ SLAVE_BOARD,	0x21,	1,	SENSOR_VOLT,	VOLT_VCOREB },
+	{ SLAVE_BOARD,	0x3e,	1,	SENSOR_VOLT,	VOLT_VCOREB },	/* Low bits */
+	{ SLAVE_BOARD,	0x22,	1,	SENSOR_VOLT,	VOLT_VIN0 },
+	{ SLAVE_BOARD,	0x3e,	1,	SENSOR_VOLT,	VOLT_VIN0 },	/* Low bits */
+	{ SLAVE_BOARD,	0x23,	1,	SENSOR_VOLT,	VOLT_VIN1 },
+	{ SLAVE_BOARD,	0x3e,	1,	SENSOR_VOLT,	VOLT_VIN1 },	/* Low bits */
+	{ SLAVE_BOARD,	0x24,	1,	SENSOR_VOLT,	VOLT_VIN2 },
+	{ SLAVE_BOARD,	0x3f,	1,	SENSOR_VOLT,	VOLT_VIN2 },	/* Low bits */
+	{ SLAVE_BOARD,	0x25,	1,	SENSOR_VOLT,	VOLT_VIN3 },
+	{ SLAVE_BOARD,	0x3f,	1,	SENSOR_VOLT,	VOLT_VIN3 },	/* Low bits */
+	{ SLAVE_BOARD,	0x26,	1,	SENSOR_VOLT,	VOLT_5VCC },
+	{ SLAVE_BOARD,	0x3f,	1,	SENSOR_VOLT,	VOLT_5VCC },	/* Low bits */
+	{ SLAVE_BOARD,	0xb0,	1,	SENSOR_VOLT,	VOLT_5VSB },
+	{ SLAVE_BOARD,	0xb1,	1,	SENSOR_VOLT,	VOLT_VBAT },
+	{ SLAVE_BOARD,	0x27,	1,	SENSOR_TEMP,	TEMP_TD1 },
+	{ SLAVE_BOARD,	0xc0,	1,	SENSOR_TEMP,	TEMP_TD2 },
+	{ SLAVE_BOARD,	0xc8,	1,	SENSOR_TEMP,	TEMP_TD3 },
+	{ SLAVE_BOARD,	0x28,	1,	SENSOR_FAN,	FAN_FAN1 },
+	{ SLAVE_BOARD,	0x47,	1,	SENSOR_FAN,	FAN_FAN1 },	/* Divisor */
+	{ SLAVE_BOARD,	0x29,	1,	SENSOR_FAN,	FAN_FAN2 },
+	{ SLAVE_BOARD,	0x47,	1,	SENSOR_FAN,	FAN_FAN2 },	/* Divisor */
+	{ SLAVE_BOARD,	0x2a,	1,	SENSOR_FAN,	FAN_FAN3 },
+	{ SLAVE_BOARD,	0x5b,	1,	SENSOR_FAN,	FAN_FAN3 },	/* Divisor */
+	{ SLAVE_BOARD,	0x5b,	1,	SENSOR_FAN,	FAN_FAN4 },	/* Divisor */
+	{ SLAVE_BOARD,	0x5c,	1,	SENSOR_FAN,	FAN_FAN5 },	/* Divisor */
+	{ SLAVE_BOARD,	0x5c,	1,	SENSOR_FAN,	FAN_FAN6 },	/* Divisor */
+	{ SLAVE_BOARD,	0x49,	1,	SENSOR_ANY,	0 },	/* Chip revision */
+	{ 0,		0,	0,	0,		0 }
+};
 
 
 /*
@@ -38,7 +131,7 @@ w83792d_divisor(const uint8_t raw)
 {
 	uint8_t r = 2;
 
-	VERBOSE("w83792d_divisor(raw = 0x%02" PRIx8 ")\n", raw);
+	TRACE(TRACE_IO, "w83792d_divisor(raw = 0x%02" PRIx8 ")\n", raw);
 
 	switch (raw) {
 		case 0x00: r = 1; break;
@@ -50,7 +143,7 @@ w83792d_divisor(const uint8_t raw)
 		case 0x06: r = 64; break;
 		case 0x07: r = 128; break;
 	}
-	VERBOSE("w83792d_divisor() returning 0x%02" PRIx8 "\n", r);
+	TRACE(TRACE_IO, "w83792d_divisor() returning 0x%02" PRIx8 "\n", r);
 	return (r);
 }
 
@@ -70,45 +163,50 @@ w83792d_divisor(const uint8_t raw)
  * make sure count and div are non-zero, ensuring we don't divide by zero.
  *
  * Returns the current revolutions-per-minute (RPM) of the fan.  If
- * the fan is disconnected, or either count or div are zero, return 0.
+ * the fan is disconnected, or either count or div are zero, return 0;
+ * sensors_finish() (see collect.c) takes that as no reading at all.
  */
 uint32_t
 w83792d_rpmconv(const uint8_t count, const uint8_t div)
 {
 	uint32_t r = 0;
 
-	VERBOSE("w83792d_rpmconv(count = 0x%02" PRIx8 ", div = 0x%02" PRIu8 ")\n",
+	TRACE(TRACE_IO, "w83792d_rpmconv(count = 0x%02" PRIx8 ", div = 0x%02" PRIu8 ")\n",
 		count, div);
 
 	if (count != 0xff && count != 0 && div != 0) {
 		r = 1350000 / (count * div);
 	}
 
-	VERBOSE("w83792d_rpmconv() returning 0x%08" PRIx32 "\n", r);
+	TRACE(TRACE_IO, "w83792d_rpmconv() returning 0x%08" PRIx32 "\n", r);
 	return (r);
 }
 
 
 /*
- * w83792d_main(int fd, const int slave, struct sensors *s)
+ * w83792d_main(struct smbus *bus, struct regspans *plan,
+ *              const struct board *b, struct regmap *rm, struct sensors *s,
+ *              struct timings *tm)
  *
- *    fd = Descriptor return from open() on a /dev/smbX device
- * slave = SMBus slave address; see boardlist[] in boards.c
- *     s = Pointer to sensors struct; see global.h for a definition
+ *  bus = Bus returned by smbus_open()
+ * plan = Compiled plan, kept by the caller between samples; (re)compiled
+ *        here whenever it was compiled for some other board (or none)
+ *    b = Pointer to board struct; see boards.c
+ *   rm = Pointer to regmap struct to read the registers into
+ *    s = Pointer to sensors struct; see global.h for a definition
+ *   tm = Phase timings to mark (--timings), or NULL
  *
  * Winbond W83792D register reading subroutine.  This does the bulk of
  * the work.  Any board which uses the W83792D will use this routine to
  * read a series of registers (called "CRxx") off the SMBus.
  *
  * The registers we're interested in are scattered all over the place,
- * which makes writing a clean-looking function very difficult.  There
- * are probably better ways to do this (such as contain a map of all
- * the registers).  At least they're all in Bank 0!  Here's the list:
+ * so they're listed in w83792d_plan[] above and left to regplan_compile()
+ * to batch up.  At least they're all in Bank 0!  Here's the list:
  *
  *   CR20-CR2A
  *   CR3E-CR3F
- *   CR47
- *   CR49      (chip revision)
+ *   CR47-CR49 (CR49 is the chip revision; CR48 is read to join the two)
  *   CR58-CR5C
  *   CRB0-CRB1
  *   CRC0
@@ -120,34 +218,54 @@ w83792d_rpmconv(const uint8_t count, const uint8_t div)
  * below comments, for quick reference/debugging.
  */
 int
-w83792d_main(int fd, const int slave, struct sensors *s)
+w83792d_main(struct smbus *bus, struct regspans *plan, const struct board *b,
+    struct regmap *rm, struct sensors *s, struct timings *tm)
 {
-	static u_char regmap[256];
-	uint8_t i;
-	uint8_t fandiv;
+	ssize_t n;
 
-	VERBOSE("w83792d_main(f = %d, slave = 0x%02x, s = %p)\n",
-		fd, slave, s);
+	VERBOSE("w83792d_main(bus = %p, plan = %p, b = %p, rm = %p, s = %p)\n",
+		bus, plan, b, rm, s);
 
-	memset(&regmap, 0, sizeof(regmap));
+	if (plan->board != b) {
+		if ((n = regplan_compile(w83792d_plan, b, 1, plan->span, REGSPAN_MAX)) == -1) {
+			return (-1);
+		}
+		plan->n = (size_t)n;
+		plan->board = b;
+	}
+	timings_mark(tm, PHASE_PLAN);
 
-	for (i = 0x20; i <= 0x2a; ++i) {
-		regmap[i] = read_byte(fd, slave, i);
+	if (regplan_run(bus, plan->span, plan->n, rm) == -1) {
+		return (-1);
 	}
+	timings_mark(tm, PHASE_COLLECT);
 
-	regmap[0x3e] = read_byte(fd, slave, 0x3e);
-	regmap[0x3f] = read_byte(fd, slave, 0x3f);
-	regmap[0x47] = read_byte(fd, slave, 0x47);
-	regmap[0x49] = read_byte(fd, slave, 0x49);
+	w83792d_decode(rm, b, s);
+	timings_mark(tm, PHASE_DECODE);
 
-	for (i = 0x58; i <= 0x5c; ++i) {
-		regmap[i] = read_byte(fd, slave, i);
-	}
+	VERBOSE("w83792d_main() returning\n");
+	return (0);
+}
 
-	regmap[0xb0] = read_byte(fd, slave, 0xb0);
-	regmap[0xb1] = read_byte(fd, slave, 0xb1);
-	regmap[0xc0] = read_byte(fd, slave, 0xc0);
-	regmap[0xc8] = read_byte(fd, slave, 0xc8);
+
+/*
+ * w83792d_decode(const struct regmap *rm, const struct board *b,
+ *                struct sensors *s)
+ *
+ * rm = Pointer to regmap struct filled in by w83792d_main(), or
+ *      read back from a dump file
+ *  b = Pointer to board struct; see boards.c
+ *  s = Pointer to sensors struct; see global.h for a definition
+ *
+ * Converts the raw W83792D registers into voltages, temperatures, and
+ * fan RPMs.  No bus access is done here.
+ */
+void
+w83792d_decode(const struct regmap *rm, const struct board *b, struct sensors *s)
+{
+	const u_char *regmap = regmap_find(rm, b->slave);
+	int32_t raw[VOLT_MAX] = { 0 };
+	uint8_t fandiv;
 
 	/*
 	 * Winbond pin    Indexes used
@@ -165,9 +283,9 @@ w83792d_main(int fd, const int slave, struct sensors *s)
 	 *
 	 * The bits used for CR3E (VCOREB) are undocumented; I assume 3-2.
 	 *
-	 * The calculation formulas used below are suspect.  The formulas given in
-	 * the W83792D data sheet are either incorrect, or Supermicro chose to use
-	 * different resistors than what Winbond did.
+	 * The calculation formulas (w83792d_vcoefs) are suspect.  The formulas
+	 * given in the W83792D data sheet are either incorrect, or Supermicro chose
+	 * to use different resistors than what Winbond did.
 	 *
 	 * The problematic one appears to be VIN1, which on my systems shows up as
 	 * 3.040V or so, which definitely is wrong.
@@ -176,16 +294,16 @@ w83792d_main(int fd, const int slave, struct sensors *s)
 	 * anything about 5VSB or VBAT, but they're shown in the BIOS, and testing
 	 * shows they're connected.
 	 */
-	s->voltages[VOLT_VCOREA].value = ((regmap[0x20] << 2) + (regmap[0x3e] & 0x03)) * 0.002;
-	s->voltages[VOLT_VCOREB].value = ((regmap[0x21] << 2) + ((regmap[0x3e] & 0x0c) >> 2)) * 0.002;
-	s->voltages[VOLT_VIN0].value = ((regmap[0x22] << 2) + ((regmap[0x3e] & 0x30) >> 4)) * 0.004;
-	s->voltages[VOLT_VIN1].value = ((regmap[0x23] << 2) + ((regmap[0x3e] & 0xc0) >> 6)) * 0.004;
-	s->voltages[VOLT_VIN2].value = ((regmap[0x24] << 2) + (regmap[0x3f] & 0x03)) * 0.008 * 12;
-	s->voltages[VOLT_VIN2].value *= -1;		/* VIN2 is a negative voltage */
-	s->voltages[VOLT_VIN3].value = ((regmap[0x25] << 2) + ((regmap[0x3f] & 0x0c) >> 2)) * 0.016;
-	s->voltages[VOLT_5VCC].value = ((regmap[0x26] << 2) + ((regmap[0x3f] & 0x30) >> 4)) * 0.006;
-	s->voltages[VOLT_5VSB].value = regmap[0xb0] * 0.024;
-	s->voltages[VOLT_VBAT].value = regmap[0xb1] * 0.016;
+	raw[VOLT_VCOREA] = (regmap[0x20] << 2) + (regmap[0x3e] & 0x03);
+	raw[VOLT_VCOREB] = (regmap[0x21] << 2) + ((regmap[0x3e] & 0x0c) >> 2);
+	raw[VOLT_VIN0]   = (regmap[0x22] << 2) + ((regmap[0x3e] & 0x30) >> 4);
+	raw[VOLT_VIN1]   = (regmap[0x23] << 2) + ((regmap[0x3e] & 0xc0) >> 6);
+	raw[VOLT_VIN2]   = (regmap[0x24] << 2) + (regmap[0x3f] & 0x03);
+	raw[VOLT_VIN3]   = (regmap[0x25] << 2) + ((regmap[0x3f] & 0x0c) >> 2);
+	raw[VOLT_5VCC]   = (regmap[0x26] << 2) + ((regmap[0x3f] & 0x30) >> 4);
+	raw[VOLT_5VSB]   = regmap[0xb0];
+	raw[VOLT_VBAT]   = regmap[0xb1];
+	volts_decode(b, &w83792d_vcoefs, raw, s);
 
 	/*
 	 * Winbond pin    Indexes used
@@ -200,9 +318,12 @@ w83792d_main(int fd, const int slave, struct sensors *s)
 	 * bother to follow any of this, and instead use and instead made all the values
 	 * raw 8-bit.  This is why we don't read CRC1 or CRC9.
 	 */
-	s->temps[TEMP_TD1].value = regmap[0x27];
-	s->temps[TEMP_TD2].value = regmap[0xc0];
-	s->temps[TEMP_TD3].value = regmap[0xc8];
+	s->temps[TEMP_TD1] = TEMP_MDEG(regmap[0x27]);
+	s->temps[TEMP_TD2] = TEMP_MDEG(regmap[0xc0]);
+	s->temps[TEMP_TD3] = TEMP_MDEG(regmap[0xc8]);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TD1);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TD2);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TD3);
 
 	/*
 	 * Winbond pin    Indexes used
@@ -217,27 +338,24 @@ w83792d_main(int fd, const int slave, struct sensors *s)
 	 * ------------   ---------------------
 	 */
 	fandiv = w83792d_divisor(regmap[0x47] & 0x07);
-	s->fans[FAN_FAN1].value = w83792d_rpmconv(regmap[0x28], fandiv);
+	s->fans[FAN_FAN1] = w83792d_rpmconv(regmap[0x28], fandiv);
 
 	fandiv = w83792d_divisor((regmap[0x47] & 0x70) >> 4);
-	s->fans[FAN_FAN2].value = w83792d_rpmconv(regmap[0x29], fandiv);
+	s->fans[FAN_FAN2] = w83792d_rpmconv(regmap[0x29], fandiv);
 
 	fandiv = w83792d_divisor(regmap[0x5b] & 0x07);
-	s->fans[FAN_FAN3].value = w83792d_rpmconv(regmap[0x2a], fandiv);
+	s->fans[FAN_FAN3] = w83792d_rpmconv(regmap[0x2a], fandiv);
 
 	fandiv = w83792d_divisor((regmap[0x5b] & 0x70) >> 4);
-	s->fans[FAN_FAN4].value = w83792d_rpmconv(regmap[0xb8], fandiv);
+	s->fans[FAN_FAN4] = w83792d_rpmconv(regmap[0xb8], fandiv);
 
 	fandiv = w83792d_divisor(regmap[0x5c] & 0x07);
-	s->fans[FAN_FAN5].value = w83792d_rpmconv(regmap[0xb9], fandiv);
+	s->fans[FAN_FAN5] = w83792d_rpmconv(regmap[0xb9], fandiv);
 
 	fandiv = w83792d_divisor((regmap[0x5c] & 0x70) >> 4);
-	s->fans[FAN_FAN6].value = w83792d_rpmconv(regmap[0xba], fandiv);
+	s->fans[FAN_FAN6] = w83792d_rpmconv(regmap[0xba], fandiv);
 
 	fandiv = w83792d_divisor(regmap[0x9e] & 0x07);
-	s->fans[FAN_FAN7].value = w83792d_rpmconv(regmap[0xbe], fandiv);
-
-	VERBOSE("w83792d_main() returning\n");
-	return (0);
+	s->fans[FAN_FAN7] = w83792d_rpmconv(regmap[0xbe], fandiv);
 }
 
@@ -8,18 +8,113 @@
 #include <sys/types.h>
 #include "global.h"
 
+/*
+ * Voltage scales, in millivolts per count of each channel's register
+ * (the datasheet's LSB times whatever divider Supermicro put in front of
+ * the pin), and offsets in millivolts; see w83793g_vcoefs below.
+ */
+#define W83793G_MV_VCORE	2		/* VCOREA, VCOREB, VTT (10 bits) */
+#define W83793G_MV_VSEN1	(32 * 12)	/* -12V */
+#define W83793G_MV_VSEN		16		/* VSEN2, 3VSEN, VBAT */
+#define W83793G_MV_12VSEN	(8 * 12)
+#define W83793G_MV_5V		24		/* 5VDD, 5VSB */
+#define W83793G_MV_5V_OFFSET	150
+
+#define W83793G_TEMP_NONE	0x80		/* TD sign bit: nothing there; see w83793g_tempadj() */
+
 /*
  * Function prototypes
  */
-static uint32_t	w83793g_rpmconv(const uint16_t);
-static uint8_t	w83793g_tempadj(const uint8_t);
-int		w83793g_main(int, const int, struct sensors *);
+uint32_t	w83793g_rpmconv(const uint16_t);
+uint8_t		w83793g_tempadj(const uint8_t);
+int		w83793g_main(struct smbus *, struct regspans *, const struct board *,
+		    struct regmap *, struct sensors *, struct timings *);
+void		w83793g_decode(const struct regmap *, const struct board *,
+		    struct sensors *);
+
+/*
+ * External functions (timings.c)
+ */
+extern void	timings_mark(struct timings *, const int);
+
+/*
+ * External functions (regplan.c)
+ */
+extern ssize_t	regplan_compile(const struct regplan *, const struct board *,
+		    const size_t, struct regspan *, const size_t);
+extern int	regplan_run(struct smbus *, const struct regspan *, const size_t,
+		    struct regmap *);
+extern const u_char *	regmap_find(const struct regmap *, const int);
 
 /*
- * External functions (smbus_io.c)
+ * External functions (collect.c)
  */
-extern uint8_t	read_byte(int, int, const char);
-extern void	write_byte(int, int, const char, const char);
+extern void	volts_decode(const struct board *, const struct vcoefs *,
+		    const int32_t *, struct sensors *);
+
+/*
+ * Default voltage coefficients; see struct vcoefs in global.h.  The
+ * formulas are suspect (see w83793g_decode()); a board which needs other
+ * ones lists them in its board struct.
+ */
+static const struct vcoefs w83793g_vcoefs = {
+	.scale = {
+		[VOLT_VCOREA]	= W83793G_MV_VCORE,
+		[VOLT_VCOREB]	= W83793G_MV_VCORE,
+		[VOLT_VTT]	= W83793G_MV_VCORE,
+		[VOLT_VSEN1]	= -W83793G_MV_VSEN1,	/* VSEN1 is a negative voltage */
+		[VOLT_VSEN2]	= W83793G_MV_VSEN,
+		[VOLT_3VSEN]	= W83793G_MV_VSEN,
+		[VOLT_12VSEN]	= W83793G_MV_12VSEN,
+		[VOLT_5VDD]	= W83793G_MV_5V,
+		[VOLT_5VSB]	= W83793G_MV_5V,
+		[VOLT_VBAT]	= W83793G_MV_VSEN,
+	},
+	.offset = {
+		[VOLT_5VDD]	= W83793G_MV_5V_OFFSET,
+		[VOLT_5VSB]	= W83793G_MV_5V_OFFSET,
+	},
+};
+
+/*
+ * Registers read on every sample, all in bank 0, and the sensor each one
+ * belongs to.  Registers for sensors the board doesn't wire up are left
+ * out by regplan_compile().
+ */
+static const struct regplan w83793g_plan[] = {
+	{ SLAVE_BOARD,	0x10,	1,	SENSOR_VOLT,	VOLT_VCOREA },
+	{ SLAVE_BOARD,	0x1b,	1,	SENSOR_VOLT,	VOLT_VCOREA },	/* Low bits */
+	{ SLAVE_BOARD,	0x11,	1,	SENSOR_VOLT,	VOLT_VCOREB },
+	{ SLAVE_BOARD,	0x1b,	1,	SENSOR_VOLT,	VOLT_VCOREB },	/* Low bits */
+	{ SLAVE_BOARD,	0x12,	1,	SENSOR_VOLT,	VOLT_VTT },
+	{ SLAVE_BOARD,	0x1b,	1,	SENSOR_VOLT,	VOLT_VTT },	/* Low bits */
+	{ SLAVE_BOARD,	0x14,	1,	SENSOR_VOLT,	VOLT_VSEN1 },
+	{ SLAVE_BOARD,	0x15,	1,	SENSOR_VOLT,	VOLT_VSEN2 },
+	{ SLAVE_BOARD,	0x16,	1,	SENSOR_VOLT,	VOLT_3VSEN },
+	{ SLAVE_BOARD,	0x17,	1,	SENSOR_VOLT,	VOLT_12VSEN },
+	{ SLAVE_BOARD,	0x18,	1,	SENSOR_VOLT,	VOLT_5VDD },
+	{ SLAVE_BOARD,	0x19,	1,	SENSOR_VOLT,	VOLT_5VSB },
+	{ SLAVE_BOARD,	0x1a,	1,	SENSOR_VOLT,	VOLT_VBAT },
+	{ SLAVE_BOARD,	0x1c,	1,	SENSOR_TEMP,	TEMP_TD1 },
+	{ SLAVE_BOARD,	0x1d,	1,	SENSOR_TEMP,	TEMP_TD2 },
+	{ SLAVE_BOARD,	0x1e,	1,	SENSOR_TEMP,	TEMP_TD3 },
+	{ SLAVE_BOARD,	0x1f,	1,	SENSOR_TEMP,	TEMP_TD4 },
+	{ SLAVE_BOARD,	0x20,	1,	SENSOR_TEMP,	TEMP_TR1 },
+	{ SLAVE_BOARD,	0x21,	1,	SENSOR_TEMP,	TEMP_TR2 },
+	{ SLAVE_BOARD,	0x23,	2,	SENSOR_FAN,	FAN_FAN1 },
+	{ SLAVE_BOARD,	0x25,	2,	SENSOR_FAN,	FAN_FAN2 },
+	{ SLAVE_BOARD,	0x27,	2,	SENSOR_FAN,	FAN_FAN3 },
+	{ SLAVE_BOARD,	0x29,	2,	SENSOR_FAN,	FAN_FAN4 },
+	{ SLAVE_BOARD,	0x2b,	2,	SENSOR_FAN,	FAN_FAN5 },
+	{ SLAVE_BOARD,	0x2d,	2,	SENSOR_FAN,	FAN_FAN6 },
+	{ SLAVE_BOARD,	0x2f,	2,	SENSOR_FAN,	FAN_FAN7 },
+	{ SLAVE_BOARD,	0x31,	2,	SENSOR_FAN,	FAN_FAN8 },
+	{ SLAVE_BOARD,	0x33,	2,	SENSOR_FAN,	FAN_FAN9 },
+	{ SLAVE_BOARD,	0x35,	2,	SENSOR_FAN,	FAN_FAN10 },
+	{ SLAVE_BOARD,	0x37,	2,	SENSOR_FAN,	FAN_FAN11 },
+	{ SLAVE_BOARD,	0x39,	2,	SENSOR_FAN,	FAN_FAN12 },
+	{ 0,		0,	0,	0,		0 }
+};
 
 
 /*
@@ -46,20 +141,21 @@ extern void	write_byte(int, int, const char, const char);
  * make sure count is non-zero, ensuring we don't divide by zero.
  *
  * Returns the current revolutions-per-minute (RPM) of the fan.  If
- * the fan is disconnected, or count is 0, return 0.
+ * the fan is disconnected, or count is 0, return 0; sensors_finish()
+ * (see collect.c) takes that as no reading at all.
  */
-static uint32_t
+uint32_t
 w83793g_rpmconv(const uint16_t count)
 {
 	uint32_t r = 0;
 
-	VERBOSE("w83793g_rpmconv(count = 0x%04" PRIx16 ")\n", count);
+	TRACE(TRACE_IO, "w83793g_rpmconv(count = 0x%04" PRIx16 ")\n", count);
 
 	if (count != 0x0fff && count != 0) {
 		r = 1350000 / count;
 	}
 
-	VERBOSE("w83793g_rpmconv() returning 0x%08" PRIx32 "\n", r);
+	TRACE(TRACE_IO, "w83793g_rpmconv() returning 0x%08" PRIx32 "\n", r);
 	return (r);
 }
 
@@ -93,34 +189,41 @@ w83793g_rpmconv(const uint16_t count)
  * Returns the value passed to the function, but only if the MSB isn't
  * set.  If the MSB is set, return 0.
  */
-static uint8_t
+uint8_t
 w83793g_tempadj(const uint8_t raw)
 {
 	uint8_t r = raw;
 
-	VERBOSE("w83793g_tempadj(raw = 0x%02" PRIx8 ")\n", raw);
+	TRACE(TRACE_IO, "w83793g_tempadj(raw = 0x%02" PRIx8 ")\n", raw);
 
-	if ((raw & 0x80) == 0x80) {
+	if ((raw & W83793G_TEMP_NONE) != 0) {
 		r = 0;
 	}
 
-	VERBOSE("w83793g_tempadj() returning 0x%02" PRIx8 "\n", r);
+	TRACE(TRACE_IO, "w83793g_tempadj() returning 0x%02" PRIx8 "\n", r);
 	return (r);
 }
 
 
 /*
- * w83793g_main(int fd, const int slave, struct sensors *s)
+ * w83793g_main(struct smbus *bus, struct regspans *plan,
+ *              const struct board *b, struct regmap *rm, struct sensors *s,
+ *              struct timings *tm)
  *
- *    fd = Descriptor return from open() on a /dev/smbX device
- * slave = SMBus slave address; see boardlist[] in boards.c
- *     s = Pointer to sensors struct; see global.h for a definition
+ *  bus = Bus returned by smbus_open()
+ * plan = Compiled plan, kept by the caller between samples; (re)compiled
+ *        here whenever it was compiled for some other board (or none)
+ *    b = Pointer to board struct; see boards.c
+ *   rm = Pointer to regmap struct to read the registers into
+ *    s = Pointer to sensors struct; see global.h for a definition
+ *   tm = Phase timings to mark (--timings), or NULL
  *
  * Winbond W83793G register reading subroutine.  This does the bulk of
  * the work.  Any board which uses the W83793G will use this routine to
  * read a series of registers (called "CRxx") off the SMBus.
  *
- * The registers we're interested in are CR10 through CR3A in bank 0.
+ * The registers we're interested in are CR10 through CR3A in bank 0;
+ * see w83793g_plan[] above.
  *
  * For details of what register serves what purpose, refer to the
  * official Winbond W83793G documentation (December 11, 2006; rev 1.0).
@@ -128,19 +231,53 @@ w83793g_tempadj(const uint8_t raw)
  * below comments, for quick reference/debugging.
  */
 int
-w83793g_main(int fd, const int slave, struct sensors *s)
+w83793g_main(struct smbus *bus, struct regspans *plan, const struct board *b,
+    struct regmap *rm, struct sensors *s, struct timings *tm)
 {
-	static u_char regmap[256];
-	uint8_t i;
+	ssize_t n;
 
-	VERBOSE("w83793g_main(fd = %d, slave = 0x%02x, s = %p)\n",
-		fd, slave, s);
+	VERBOSE("w83793g_main(bus = %p, plan = %p, b = %p, rm = %p, s = %p)\n",
+		bus, plan, b, rm, s);
 
-	memset(&regmap, 0, sizeof(regmap));
+	if (plan->board != b) {
+		if ((n = regplan_compile(w83793g_plan, b, 1, plan->span, REGSPAN_MAX)) == -1) {
+			return (-1);
+		}
+		plan->n = (size_t)n;
+		plan->board = b;
+	}
+	timings_mark(tm, PHASE_PLAN);
 
-	for (i = 0x10; i <= 0x3a; ++i) {
-		regmap[i] = read_byte(fd, slave, i);
+	if (regplan_run(bus, plan->span, plan->n, rm) == -1) {
+		return (-1);
 	}
+	timings_mark(tm, PHASE_COLLECT);
+
+	w83793g_decode(rm, b, s);
+	timings_mark(tm, PHASE_DECODE);
+
+	VERBOSE("w83793g_main() returning\n");
+	return (0);
+}
+
+
+/*
+ * w83793g_decode(const struct regmap *rm, const struct board *b,
+ *                struct sensors *s)
+ *
+ * rm = Pointer to regmap struct filled in by w83793g_main(), or
+ *      read back from a dump file
+ *  b = Pointer to board struct; see boards.c
+ *  s = Pointer to sensors struct; see global.h for a definition
+ *
+ * Converts the raw W83793G registers into voltages, temperatures, and
+ * fan RPMs.  No bus access is done here.
+ */
+void
+w83793g_decode(const struct regmap *rm, const struct board *b, struct sensors *s)
+{
+	const u_char *regmap = regmap_find(rm, b->slave);
+	int32_t raw[VOLT_MAX] = { 0 };
 
 	/*
 	 * Winbond pin    Registers used
@@ -157,23 +294,23 @@ w83793g_main(int fd, const int slave, struct sensors *s)
 	 * VBAT           0x1a
 	 * ------------   ---------------------
 	 *
-	 * The calculation formulas used below are suspect.  The formulas given in
-	 * the W83793G data sheet are either incorrect, or Supermicro chose to use
-	 * adifferent resistors than what Winbond did.
+	 * The calculation formulas (w83793g_vcoefs) are suspect.  The formulas
+	 * given in the W83793G data sheet are either incorrect, or Supermicro chose
+	 * to use different resistors than what Winbond did.
 	 *
 	 * Thanks to Jim Perry for helping with some of the calculations.
 	 */
-	s->voltages[VOLT_VCOREA].value = ((regmap[0x10] << 2) + (regmap[0x1b] & 0x03)) * 0.002;
-	s->voltages[VOLT_VCOREB].value = ((regmap[0x11] << 2) + ((regmap[0x1b] & 0x0c) >> 2)) * 0.002;
-	s->voltages[VOLT_VTT].value    = ((regmap[0x12] << 2) + ((regmap[0x1b] & 0x30) >> 4)) * 0.002;
-	s->voltages[VOLT_VSEN1].value  = regmap[0x14] * 0.032 * 12;
-	s->voltages[VOLT_VSEN1].value  *= -1;		/* VSEN1 is a negative voltage */
-	s->voltages[VOLT_VSEN2].value  = regmap[0x15] * 0.016;
-	s->voltages[VOLT_3VSEN].value  = regmap[0x16] * 0.016;
-	s->voltages[VOLT_12VSEN].value = regmap[0x17] * 0.008 * 12;
-	s->voltages[VOLT_5VDD].value   = (regmap[0x18] * 0.024) + 0.15;
-	s->voltages[VOLT_5VSB].value   = (regmap[0x19] * 0.024) + 0.15;
-	s->voltages[VOLT_VBAT].value   = regmap[0x1a] * 0.016;
+	raw[VOLT_VCOREA] = (regmap[0x10] << 2) + (regmap[0x1b] & 0x03);
+	raw[VOLT_VCOREB] = (regmap[0x11] << 2) + ((regmap[0x1b] & 0x0c) >> 2);
+	raw[VOLT_VTT]    = (regmap[0x12] << 2) + ((regmap[0x1b] & 0x30) >> 4);
+	raw[VOLT_VSEN1]  = regmap[0x14];
+	raw[VOLT_VSEN2]  = regmap[0x15];
+	raw[VOLT_3VSEN]  = regmap[0x16];
+	raw[VOLT_12VSEN] = regmap[0x17];
+	raw[VOLT_5VDD]   = regmap[0x18];
+	raw[VOLT_5VSB]   = regmap[0x19];
+	raw[VOLT_VBAT]   = regmap[0x1a];
+	volts_decode(b, &w83793g_vcoefs, raw, s);
 
 	/*
 	 * Winbond pin    Registers used
@@ -189,34 +326,46 @@ w83793g_main(int fd, const int slave, struct sensors *s)
 	 * TD temperatures are 10 bits: 1 sign bit (MSB), 7 data bits, and 2 decimal
 	 * bits.  We're not interested in the decimal portion, but we are interested
 	 * in the integer portion.  tempadj() checks the MSB (sign bit) and if it's
-	 * set, makes the assumption that there's no wire/tie-in.
+	 * set, makes the assumption that there's no wire/tie-in, so the reading is
+	 * left invalid rather than passed off as 0C.
 	 *
 	 * TR temperatures are 1 sign bit (MSB), 7 data bits.
 	 */
-	s->temps[TEMP_TD1].value = w83793g_tempadj(regmap[0x1c]);
-	s->temps[TEMP_TD2].value = w83793g_tempadj(regmap[0x1d]);
-	s->temps[TEMP_TD3].value = w83793g_tempadj(regmap[0x1e]);
-	s->temps[TEMP_TD4].value = w83793g_tempadj(regmap[0x1f]);
-	s->temps[TEMP_TR1].value = regmap[0x20];
-	s->temps[TEMP_TR2].value = regmap[0x21];
+	s->temps[TEMP_TD1] = TEMP_MDEG(w83793g_tempadj(regmap[0x1c]));
+	s->temps[TEMP_TD2] = TEMP_MDEG(w83793g_tempadj(regmap[0x1d]));
+	s->temps[TEMP_TD3] = TEMP_MDEG(w83793g_tempadj(regmap[0x1e]));
+	s->temps[TEMP_TD4] = TEMP_MDEG(w83793g_tempadj(regmap[0x1f]));
+	s->temps[TEMP_TR1] = TEMP_MDEG(regmap[0x20]);
+	s->temps[TEMP_TR2] = TEMP_MDEG(regmap[0x21]);
+	if ((regmap[0x1c] & W83793G_TEMP_NONE) == 0) {
+		SENSORS_SET(s, SENSOR_TEMP, TEMP_TD1);
+	}
+	if ((regmap[0x1d] & W83793G_TEMP_NONE) == 0) {
+		SENSORS_SET(s, SENSOR_TEMP, TEMP_TD2);
+	}
+	if ((regmap[0x1e] & W83793G_TEMP_NONE) == 0) {
+		SENSORS_SET(s, SENSOR_TEMP, TEMP_TD3);
+	}
+	if ((regmap[0x1f] & W83793G_TEMP_NONE) == 0) {
+		SENSORS_SET(s, SENSOR_TEMP, TEMP_TD4);
+	}
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TR1);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TR2);
 
 	/*
 	 * See the official W83793G specification sheet for these
 	 */
-	s->fans[FAN_FAN1].value = w83793g_rpmconv((regmap[0x23] << 8) | regmap[0x24]);
-	s->fans[FAN_FAN2].value = w83793g_rpmconv((regmap[0x25] << 8) | regmap[0x26]);
-	s->fans[FAN_FAN3].value = w83793g_rpmconv((regmap[0x27] << 8) | regmap[0x28]);
-	s->fans[FAN_FAN4].value = w83793g_rpmconv((regmap[0x29] << 8) | regmap[0x2a]);
-	s->fans[FAN_FAN5].value = w83793g_rpmconv((regmap[0x2b] << 8) | regmap[0x2c]);
-	s->fans[FAN_FAN6].value = w83793g_rpmconv((regmap[0x2d] << 8) | regmap[0x2e]);
-	s->fans[FAN_FAN7].value = w83793g_rpmconv((regmap[0x2f] << 8) | regmap[0x30]);
-	s->fans[FAN_FAN8].value = w83793g_rpmconv((regmap[0x31] << 8) | regmap[0x32]);
-	s->fans[FAN_FAN9].value = w83793g_rpmconv((regmap[0x33] << 8) | regmap[0x34]);
-	s->fans[FAN_FAN10].value = w83793g_rpmconv((regmap[0x35] << 8) | regmap[0x36]);
-	s->fans[FAN_FAN11].value = w83793g_rpmconv((regmap[0x37] << 8) | regmap[0x38]);
-	s->fans[FAN_FAN12].value = w83793g_rpmconv((regmap[0x39] << 8) | regmap[0x3a]);
-
-	VERBOSE("w83793g_main() returning\n");
-	return (0);
+	s->fans[FAN_FAN1] = w83793g_rpmconv((regmap[0x23] << 8) | regmap[0x24]);
+	s->fans[FAN_FAN2] = w83793g_rpmconv((regmap[0x25] << 8) | regmap[0x26]);
+	s->fans[FAN_FAN3] = w83793g_rpmconv((regmap[0x27] << 8) | regmap[0x28]);
+	s->fans[FAN_FAN4] = w83793g_rpmconv((regmap[0x29] << 8) | regmap[0x2a]);
+	s->fans[FAN_FAN5] = w83793g_rpmconv((regmap[0x2b] << 8) | regmap[0x2c]);
+	s->fans[FAN_FAN6] = w83793g_rpmconv((regmap[0x2d] << 8) | regmap[0x2e]);
+	s->fans[FAN_FAN7] = w83793g_rpmconv((regmap[0x2f] << 8) | regmap[0x30]);
+	s->fans[FAN_FAN8] = w83793g_rpmconv((regmap[0x31] << 8) | regmap[0x32]);
+	s->fans[FAN_FAN9] = w83793g_rpmconv((regmap[0x33] << 8) | regmap[0x34]);
+	s->fans[FAN_FAN10] = w83793g_rpmconv((regmap[0x35] << 8) | regmap[0x36]);
+	s->fans[FAN_FAN11] = w83793g_rpmconv((regmap[0x37] << 8) | regmap[0x38]);
+	s->fans[FAN_FAN12] = w83793g_rpmconv((regmap[0x39] << 8) | regmap[0x3a]);
 }
 
@@ -11,13 +11,30 @@
 /*
  * Function prototypes
  */
-int		x6dva_main(int, struct sensors *);
+int		x6dva_main(struct smbus *, struct regspans *, const struct board *,
+		    struct regmap *, struct sensors *, struct timings *);
+void		x6dva_decode(const struct regmap *, const struct board *,
+		    struct sensors *);
 
 /*
- * External funcions (smbus_io.c)
+ * External functions (timings.c)
  */
-extern uint8_t	read_byte(int, int, const char);
-extern void	write_byte(int, int, const char, const char);
+extern void	timings_mark(struct timings *, const int);
+
+/*
+ * External functions (regplan.c)
+ */
+extern ssize_t	regplan_compile(const struct regplan *, const struct board *,
+		    const size_t, struct regspan *, const size_t);
+extern int	regplan_run(struct smbus *, const struct regspan *, const size_t,
+		    struct regmap *);
+extern const u_char *	regmap_find(const struct regmap *, const int);
+
+/*
+ * External functions (collect.c)
+ */
+extern void	volts_decode(const struct board *, const struct vcoefs *,
+		    const int32_t *, struct sensors *);
 
 /*
  * External functions (chip_w83792d.c)
@@ -26,12 +43,83 @@ extern void	write_byte(int, int, const char, const char);
 extern uint8_t	w83792d_divisor(const uint8_t);
 extern uint32_t	w83792d_rpmconv(const uint8_t, const uint8_t);
 
+/*
+ * SMBus slave addresses of the two chips; see x6dva_main()
+ */
+#define W83627HF_SLAVE	0x2c
+#define W83792D_SLAVE	0x2f
+
+/*
+ * Voltage scales, in millivolts per count; see x6dva_vcoefs below.  The
+ * W83627HF registers are shown as they are, in volts.
+ */
+#define X6DVA_MV_W83627HF	1000
+#define X6DVA_MV_VCORE		2		/* W83792D VCOREA, VCOREB */
+
+/*
+ * Default voltage coefficients; see struct vcoefs in global.h
+ */
+static const struct vcoefs x6dva_vcoefs = {
+	.scale = {
+		[VOLT_VIN0]	= X6DVA_MV_W83627HF,
+		[VOLT_VIN1]	= X6DVA_MV_W83627HF,
+		[VOLT_VIN2]	= X6DVA_MV_W83627HF,
+		[VOLT_VIN3]	= X6DVA_MV_W83627HF,
+		[VOLT_12VSEN]	= X6DVA_MV_W83627HF,
+		[VOLT_VSEN1]	= -X6DVA_MV_W83627HF,	/* VSEN1 is a negative voltage */
+		[VOLT_VCOREA]	= X6DVA_MV_VCORE,
+		[VOLT_VCOREB]	= X6DVA_MV_VCORE,
+	},
+};
+
+/*
+ * Registers read on every sample, and the sensor each one belongs to.
+ * Unlike the stock W83792D routine, we never read anything which isn't
+ * listed here, so this plan is compiled with a maxgap of 0 (see
+ * regplan_compile()).
+ */
+static const struct regplan x6dva_plan[] = {
+	{ W83627HF_SLAVE,	0x20,	1,	SENSOR_VOLT,	VOLT_VIN0 },
+	{ W83627HF_SLAVE,	0x21,	1,	SENSOR_VOLT,	VOLT_VIN1 },
+	{ W83627HF_SLAVE,	0x22,	1,	SENSOR_VOLT,	VOLT_VIN2 },
+	{ W83627HF_SLAVE,	0x23,	1,	SENSOR_VOLT,	VOLT_VIN3 },
+	{ W83627HF_SLAVE,	0x24,	1,	SENSOR_VOLT,	VOLT_12VSEN },
+	{ W83627HF_SLAVE,	0x25,	1,	SENSOR_VOLT,	VOLT_VSEN1 },
+	{ W83627HF_SLAVE,	0x27,	1,	SENSOR_TEMP,	TEMP_TD1 },
+	{ W83792D_SLAVE,	0x20,	1,	SENSOR_VOLT,	VOLT_VCOREA },
+	{ W83792D_SLAVE,	0x3e,	1,	SENSOR_VOLT,	VOLT_VCOREA },	/* Low bits */
+	{ W83792D_SLAVE,	0x21,	1,	SENSOR_VOLT,	VOLT_VCOREB },
+	{ W83792D_SLAVE,	0x3e,	1,	SENSOR_VOLT,	VOLT_VCOREB },	/* Low bits */
+	{ W83792D_SLAVE,	0xc0,	1,	SENSOR_TEMP,	TEMP_TD2 },
+	{ W83792D_SLAVE,	0xc8,	1,	SENSOR_TEMP,	TEMP_TD3 },
+	{ W83792D_SLAVE,	0x28,	1,	SENSOR_FAN,	FAN_FAN1 },
+	{ W83792D_SLAVE,	0x47,	1,	SENSOR_FAN,	FAN_FAN1 },	/* Divisor */
+	{ W83792D_SLAVE,	0x29,	1,	SENSOR_FAN,	FAN_FAN2 },
+	{ W83792D_SLAVE,	0x47,	1,	SENSOR_FAN,	FAN_FAN2 },	/* Divisor */
+	{ W83792D_SLAVE,	0x2a,	1,	SENSOR_FAN,	FAN_FAN3 },
+	{ W83792D_SLAVE,	0x5b,	1,	SENSOR_FAN,	FAN_FAN3 },	/* Divisor */
+	{ W83792D_SLAVE,	0xb8,	1,	SENSOR_FAN,	FAN_FAN4 },
+	{ W83792D_SLAVE,	0x5b,	1,	SENSOR_FAN,	FAN_FAN4 },	/* Divisor */
+	{ W83792D_SLAVE,	0xb9,	1,	SENSOR_FAN,	FAN_FAN5 },
+	{ W83792D_SLAVE,	0x5c,	1,	SENSOR_FAN,	FAN_FAN5 },	/* Divisor */
+	{ W83792D_SLAVE,	0xba,	1,	SENSOR_FAN,	FAN_FAN6 },
+	{ W83792D_SLAVE,	0x5c,	1,	SENSOR_FAN,	FAN_FAN6 },	/* Divisor */
+	{ 0,			0,	0,	0,		0 }
+};
+
 
 /*
- * x6dva_main(int fd, struct sensors *)
+ * x6dva_main(struct smbus *bus, struct regspans *plan,
+ *            const struct board *b, struct regmap *rm, struct sensors *s,
+ *            struct timings *tm)
  *
- * fd = Descriptor return from open() on a /dev/smbX device
- *  s = Pointer to sensors struct; see global.h for a definition
+ *  bus = Bus returned by smbus_open()
+ * plan = Compiled plan, kept by the caller between samples; (re)compiled
+ *        here whenever it was compiled for some other board (or none)
+ *    b = Pointer to board struct; see boards.c
+ *   rm = Pointer to regmap struct to read the registers into
+ *    s = Pointer to sensors struct; see global.h for a definition
+ *   tm = Phase timings to mark (--timings), or NULL
  *
  * Supermicro X6DVA / X6DVL / X6DAL register reading subroutine.
  *
@@ -44,7 +132,7 @@ extern uint32_t	w83792d_rpmconv(const uint8_t, const uint8_t);
  * put system stability at risk.
  *
  * The SMBus slave addresses are 0x2c for the W83627HF, and 0x2f for the
- * W83792D.  These are assumed/hard-coded in the below function, rather
+ * W83792D.  These are assumed/hard-coded in x6dva_plan[] above, rather
  * than passed in via boardlist[].
  *
  * The registers we care about are:
@@ -55,15 +143,54 @@ extern uint32_t	w83792d_rpmconv(const uint8_t, const uint8_t);
  *     CR20-CR21, CR28-CR2A, CR3E, CR47, CR5B-5C, CRB8-CRBA, CRC0, CRC8
  */
 int
-x6dva_main(int fd, struct sensors *s)
+x6dva_main(struct smbus *bus, struct regspans *plan, const struct board *b,
+    struct regmap *rm, struct sensors *s, struct timings *tm)
 {
-	static u_char regmap[256];
-	int w83627hf_slave = 0x2c;
-	int w83792d_slave  = 0x2f;
-	uint8_t fandiv;
+	ssize_t n;
+
+	VERBOSE("x6dva_main(bus = %p, plan = %p, b = %p, rm = %p, s = %p)\n",
+		bus, plan, b, rm, s);
 
-	VERBOSE("x6dva_main(fd = %d, s = %p)\n", fd, s);
-	memset(&regmap, 0, sizeof(regmap));
+	if (plan->board != b) {
+		if ((n = regplan_compile(x6dva_plan, b, 0, plan->span, REGSPAN_MAX)) == -1) {
+			return (-1);
+		}
+		plan->n = (size_t)n;
+		plan->board = b;
+	}
+	timings_mark(tm, PHASE_PLAN);
+
+	if (regplan_run(bus, plan->span, plan->n, rm) == -1) {
+		return (-1);
+	}
+	timings_mark(tm, PHASE_COLLECT);
+
+	x6dva_decode(rm, b, s);
+	timings_mark(tm, PHASE_DECODE);
+
+	VERBOSE("x6dva_main() returning\n");
+	return (0);
+}
+
+
+/*
+ * x6dva_decode(const struct regmap *rm, const struct board *b,
+ *              struct sensors *s)
+ *
+ * rm = Pointer to regmap struct filled in by x6dva_main(), or
+ *      read back from a dump file
+ *  b = Pointer to board struct; see boards.c
+ *  s = Pointer to sensors struct; see global.h for a definition
+ *
+ * Converts the raw W83627HF and W83792D registers into voltages,
+ * temperatures, and fan RPMs.  No bus access is done here.
+ */
+void
+x6dva_decode(const struct regmap *rm, const struct board *b, struct sensors *s)
+{
+	const u_char *regmap;
+	int32_t raw[VOLT_MAX] = { 0 };
+	uint8_t fandiv;
 
 	/*
 	 * Winbond W83627HF portion
@@ -79,34 +206,16 @@ x6dva_main(int fd, struct sensors *s)
 	 * CR27          TD1
 	 * -----------   ----------
 	 */
-	regmap[0x20] = read_byte(fd, w83627hf_slave, 0x20);
-	regmap[0x21] = read_byte(fd, w83627hf_slave, 0x21);
-	regmap[0x22] = read_byte(fd, w83627hf_slave, 0x22);
-	regmap[0x23] = read_byte(fd, w83627hf_slave, 0x23);
-	regmap[0x24] = read_byte(fd, w83627hf_slave, 0x24);
-	regmap[0x25] = read_byte(fd, w83627hf_slave, 0x25);
-	regmap[0x25] = read_byte(fd, w83627hf_slave, 0x25);
-	regmap[0x27] = read_byte(fd, w83627hf_slave, 0x27);
+	regmap = regmap_find(rm, W83627HF_SLAVE);
 
-	/*
-	 * Now calculate voltages and temperatures which use the populated
-	 * regmap[] array.  We do this BEFORE the Winbond W83792D reads,
-	 * since regmap[] is re-used and overwrites some of the registers
-	 * we use here (i.e. 0x20).
-	 */
-	s->voltages[VOLT_VIN0].value   = regmap[0x20];
-	s->voltages[VOLT_VIN1].value   = regmap[0x21];
-	s->voltages[VOLT_VIN2].value   = regmap[0x22];
-	s->voltages[VOLT_VIN3].value   = regmap[0x23];
-	s->voltages[VOLT_12VSEN].value = regmap[0x24];
-	s->voltages[VOLT_VSEN1].value  = regmap[0x25];
-	s->voltages[VOLT_VSEN1].value  *= -1;		/* VSEN1 is a negative voltage */
-	s->temps[TEMP_TD1].value       = regmap[0x27];
-
-	/*
-	 * Zero out regmap[] as a precaution, since we do re-use it below.
-	 */
-	memset(&regmap, 0, sizeof(regmap));
+	raw[VOLT_VIN0]   = regmap[0x20];
+	raw[VOLT_VIN1]   = regmap[0x21];
+	raw[VOLT_VIN2]   = regmap[0x22];
+	raw[VOLT_VIN3]   = regmap[0x23];
+	raw[VOLT_12VSEN] = regmap[0x24];
+	raw[VOLT_VSEN1]  = regmap[0x25];
+	s->temps[TEMP_TD1] = TEMP_MDEG(regmap[0x27]);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TD1);
 
 	/*
 	 * Winbond W83792D portion
@@ -136,46 +245,32 @@ x6dva_main(int fd, struct sensors *s)
 	 *    doesn't appear that Supermicro wired these up, instead sticking
 	 *    to raw 8-bit values.  This is why we don't read/use CRC1 or CRC9.
 	 */
-	regmap[0x20] = read_byte(fd, w83792d_slave, 0x20);
-	regmap[0x21] = read_byte(fd, w83792d_slave, 0x21);
-	regmap[0x28] = read_byte(fd, w83792d_slave, 0x28);
-	regmap[0x29] = read_byte(fd, w83792d_slave, 0x29);
-	regmap[0x2a] = read_byte(fd, w83792d_slave, 0x2a);
-	regmap[0x3e] = read_byte(fd, w83792d_slave, 0x3e);
-	regmap[0x47] = read_byte(fd, w83792d_slave, 0x47);
-	regmap[0x5b] = read_byte(fd, w83792d_slave, 0x5b);
-	regmap[0x5c] = read_byte(fd, w83792d_slave, 0x5c);
-	regmap[0xb8] = read_byte(fd, w83792d_slave, 0xb8);
-	regmap[0xb9] = read_byte(fd, w83792d_slave, 0xb9);
-	regmap[0xba] = read_byte(fd, w83792d_slave, 0xba);
-	regmap[0xc0] = read_byte(fd, w83792d_slave, 0xc0);
-	regmap[0xc8] = read_byte(fd, w83792d_slave, 0xc8);
-
-	s->voltages[VOLT_VCOREA].value = ((regmap[0x20] << 2) + (regmap[0x3e] & 0x03)) * 0.002;
-	s->voltages[VOLT_VCOREB].value = ((regmap[0x21] << 2) + ((regmap[0x3e] & 0x0c) >> 2)) * 0.002;
-
-	s->temps[TEMP_TD2].value = regmap[0xc0];
-	s->temps[TEMP_TD3].value = regmap[0xc8];
+	regmap = regmap_find(rm, W83792D_SLAVE);
+
+	raw[VOLT_VCOREA] = (regmap[0x20] << 2) + (regmap[0x3e] & 0x03);
+	raw[VOLT_VCOREB] = (regmap[0x21] << 2) + ((regmap[0x3e] & 0x0c) >> 2);
+	volts_decode(b, &x6dva_vcoefs, raw, s);
+
+	s->temps[TEMP_TD2] = TEMP_MDEG(regmap[0xc0]);
+	s->temps[TEMP_TD3] = TEMP_MDEG(regmap[0xc8]);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TD2);
+	SENSORS_SET(s, SENSOR_TEMP, TEMP_TD3);
 
 	fandiv = w83792d_divisor(regmap[0x47] & 0x07);
-	s->fans[FAN_FAN1].value = w83792d_rpmconv(regmap[0x28], fandiv);
+	s->fans[FAN_FAN1] = w83792d_rpmconv(regmap[0x28], fandiv);
 
 	fandiv = w83792d_divisor((regmap[0x47] & 0x70) >> 4);
-	s->fans[FAN_FAN2].value = w83792d_rpmconv(regmap[0x29], fandiv);
+	s->fans[FAN_FAN2] = w83792d_rpmconv(regmap[0x29], fandiv);
 
 	fandiv = w83792d_divisor(regmap[0x5b] & 0x07);
-	s->fans[FAN_FAN3].value = w83792d_rpmconv(regmap[0x2a], fandiv);
+	s->fans[FAN_FAN3] = w83792d_rpmconv(regmap[0x2a], fandiv);
 
 	fandiv = w83792d_divisor((regmap[0x5b] & 0x70) >> 4);
-	s->fans[FAN_FAN4].value = w83792d_rpmconv(regmap[0xb8], fandiv);
+	s->fans[FAN_FAN4] = w83792d_rpmconv(regmap[0xb8], fandiv);
 
 	fandiv = w83792d_divisor(regmap[0x5c] & 0x07);
-	s->fans[FAN_FAN5].value = w83792d_rpmconv(regmap[0xb9], fandiv);
+	s->fans[FAN_FAN5] = w83792d_rpmconv(regmap[0xb9], fandiv);
 
 	fandiv = w83792d_divisor((regmap[0x5c] & 0x70) >> 4);
-	s->fans[FAN_FAN6].value = w83792d_rpmconv(regmap[0xba], fandiv);
-
-	VERBOSE("x6dva_main() returning\n");
-	return (0);
+	s->fans[FAN_FAN6] = w83792d_rpmconv(regmap[0xba], fandiv);
 }
-
@@ -0,0 +1,436 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include "global.h"
+#include "hwmon.h"
+
+/*
+ * Sampling contexts; see hwmon.h.  A struct hwmon holds everything one
+ * board's samples need between calls: the bus, the register plan
+ * compiled for the board (so it's compiled once, on the first sample),
+ * and the raw registers of the latest sample (for --dump).
+ */
+struct hwmon {
+	struct smbus		*bus;
+	const struct board	*board;
+	struct regspans		plan;
+	struct regmap		regmap;
+	struct timings		*timings;	/* --timings, or NULL */
+};
+
+/*
+ * Function prototypes (the rest are in hwmon.h)
+ */
+static int	hwmon_chip_known(const size_t);
+static void	sensors_finish(const struct board *, struct sensors *);
+void		volts_decode(const struct board *, const struct vcoefs *,
+		    const int32_t *, struct sensors *);
+
+/*
+ * External functions (chip_XXX.c)
+ */
+extern int	w83792d_main(struct smbus *, struct regspans *, const struct board *,
+		    struct regmap *, struct sensors *, struct timings *);
+extern int	w83793g_main(struct smbus *, struct regspans *, const struct board *,
+		    struct regmap *, struct sensors *, struct timings *);
+extern int	x6dva_main(struct smbus *, struct regspans *, const struct board *,
+		    struct regmap *, struct sensors *, struct timings *);
+extern void	w83792d_decode(const struct regmap *, const struct board *,
+		    struct sensors *);
+extern void	w83793g_decode(const struct regmap *, const struct board *,
+		    struct sensors *);
+extern void	x6dva_decode(const struct regmap *, const struct board *,
+		    struct sensors *);
+
+/*
+ * External functions (smbus_io.c)
+ */
+extern struct smbus *	smbus_open(const char *);
+extern void	smbus_close(struct smbus *);
+extern u_long	smbus_xfers(const struct smbus *);
+extern int	smbus_stats_enable(struct smbus *);
+extern const struct smbus_stats *	smbus_stats(const struct smbus *);
+
+/*
+ * Global variables
+ */
+int		f_verbose = 0;		/* See TRACE() in global.h */
+
+
+/*
+ * hwmon_chip_known(const size_t chip)
+ *
+ * chip = One of chips_e; see global.h
+ *
+ * Returns 1 if there's a chip routine for chip, otherwise 0.
+ */
+static int
+hwmon_chip_known(const size_t chip)
+{
+	switch (chip) {
+		case CUSTOM_X6DVA:
+		case WINBOND_W83792D:
+		case WINBOND_W83793G:
+			return (1);
+	}
+	return (0);
+}
+
+
+/*
+ * hwmon_open(const char *device, const struct board *mb)
+ *
+ * device = SMBus device path, as given with "-f"; see smbus_open()
+ *     mb = Pointer to board struct returned by board_lookup()
+ *
+ * Opens device and sets up a context for sampling mb on it.  For
+ * /dev/smbX this takes an exclusive lock; see smb_open() in smbus_smb.c.
+ *
+ * Returns the context, or NULL with errno set on failure (EOPNOTSUPP if
+ * the board refers to an unknown chip).
+ */
+struct hwmon *
+hwmon_open(const char *device, const struct board *mb)
+{
+	struct hwmon *h;
+	int saved;
+
+	VERBOSE("hwmon_open(device = %s, mb = %p)\n", device, mb);
+
+	if (!hwmon_chip_known(mb->chip)) {
+		errno = EOPNOTSUPP;
+		return (NULL);
+	}
+	if ((h = calloc(1, sizeof(*h))) == NULL) {
+		return (NULL);
+	}
+	if ((h->bus = smbus_open(device)) == NULL) {
+		saved = errno;
+		free(h);
+		errno = saved;
+		return (NULL);
+	}
+	h->board = mb;
+	return (h);
+}
+
+
+/*
+ * hwmon_sample(struct hwmon *h, struct sensors *s)
+ *
+ * h = Context returned by hwmon_open()
+ * s = Pointer to sensors struct; see global.h for a definition
+ *
+ * Runs the chip-specific register reading subroutine for the board,
+ * and stamps the sample with the time.  The sensors struct is filled in
+ * place, which allows it to be re-used from one sample to the next (see
+ * -i).  Only h is touched besides s, so samples may be taken on
+ * different contexts at the same time.
+ *
+ * Returns 0 on success.  Otherwise returns -1 with errno set: ENXIO if
+ * chip validation failed, ENOSPC if the board's registers can't be
+ * planned (see regplan_compile()), or whatever the bus reported (s is
+ * then left as it was).
+ */
+int
+hwmon_sample(struct hwmon *h, struct sensors *s)
+{
+	u_long xfers = smbus_xfers(h->bus);
+	struct sensors tmp;
+	struct timespec ts;
+	int r = -1;
+
+	/*
+	 * Decode into a fresh record, so a failed sample leaves the
+	 * previous one intact for the caller, and nothing is left over
+	 * from it in channels this one doesn't read.
+	 */
+	memset(&tmp, 0, sizeof(tmp));
+
+	switch (h->board->chip) {
+		case CUSTOM_X6DVA:
+			r = x6dva_main(h->bus, &h->plan, h->board, &h->regmap, &tmp,
+			    h->timings);
+			break;
+		case WINBOND_W83792D:
+			r = w83792d_main(h->bus, &h->plan, h->board, &h->regmap, &tmp,
+			    h->timings);
+			break;
+		case WINBOND_W83793G:
+			r = w83793g_main(h->bus, &h->plan, h->board, &h->regmap, &tmp,
+			    h->timings);
+			break;
+	}
+
+	VERBOSE("hwmon_sample() used %lu SMBus transactions\n",
+		smbus_xfers(h->bus) - xfers);
+
+	if (r > 0) {
+		errno = ENXIO;
+		return (-1);
+	}
+	if (r == -1) {
+		return (-1);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	tmp.time = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	sensors_finish(h->board, &tmp);
+	*s = tmp;
+	return (0);
+}
+
+
+/*
+ * hwmon_regmap(const struct hwmon *h)
+ *
+ * h = Context returned by hwmon_open()
+ *
+ * Returns the raw chip registers read by the last hwmon_sample() (e.g.
+ * for dump_write()); only meaningful if that sample succeeded.
+ */
+const struct regmap *
+hwmon_regmap(const struct hwmon *h)
+{
+	return (&h->regmap);
+}
+
+
+/*
+ * hwmon_board(const struct hwmon *h)
+ *
+ * h = Context returned by hwmon_open()
+ *
+ * Returns the board h samples.
+ */
+const struct board *
+hwmon_board(const struct hwmon *h)
+{
+	return (h->board);
+}
+
+
+/*
+ * hwmon_xfers(const struct hwmon *h)
+ *
+ * h = Context returned by hwmon_open()
+ *
+ * Returns the number of SMBus transactions issued through h so far.
+ */
+u_long
+hwmon_xfers(const struct hwmon *h)
+{
+	return (smbus_xfers(h->bus));
+}
+
+
+/*
+ * hwmon_stats_enable(struct hwmon *h)
+ *
+ * h = Context returned by hwmon_open()
+ *
+ * Starts keeping per-register transaction counts and latencies for h's
+ * bus (--stats); see smbus_stats_enable().
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+hwmon_stats_enable(struct hwmon *h)
+{
+	return (smbus_stats_enable(h->bus));
+}
+
+
+/*
+ * hwmon_stats(const struct hwmon *h)
+ *
+ * h = Context returned by hwmon_open()
+ *
+ * Returns the transaction counters of h's bus, or NULL if
+ * hwmon_stats_enable() wasn't called.  They're updated by hwmon_sample(),
+ * so must not be read while it's running in another thread.
+ */
+const struct smbus_stats *
+hwmon_stats(const struct hwmon *h)
+{
+	return (smbus_stats(h->bus));
+}
+
+
+/*
+ * hwmon_timings(struct hwmon *h, struct timings *t)
+ *
+ * h = Context returned by hwmon_open()
+ * t = Timings to mark from now on (see timings_start()), or NULL to stop
+ *
+ * Has every hwmon_sample() through h charge its plan, collect, and
+ * decode phases to t (--timings).
+ */
+void
+hwmon_timings(struct hwmon *h, struct timings *t)
+{
+	h->timings = t;
+}
+
+
+/*
+ * hwmon_close(struct hwmon *h)
+ *
+ * h = Context returned by hwmon_open(), or NULL
+ *
+ * Closes the bus (releasing the lock on /dev/smbX) and frees h.
+ */
+void
+hwmon_close(struct hwmon *h)
+{
+	if (h == NULL) {
+		return;
+	}
+	smbus_close(h->bus);
+	free(h);
+}
+
+
+/*
+ * sensors_decode(const struct board *mb, const struct regmap *rm,
+ *                struct sensors *s)
+ *
+ * mb = Pointer to board struct returned by board_lookup()
+ * rm = Pointer to regmap struct holding raw chip registers
+ *  s = Pointer to sensors struct; see global.h for a definition
+ *
+ * Same as hwmon_sample(), but only runs the chip-specific decode
+ * routine over registers which have already been read (i.e. --replay).
+ * s->time is left 0: only the caller knows when that was.
+ *
+ * Returns 0 on success, or -1 if the board refers to an unknown chip.
+ */
+int
+sensors_decode(const struct board *mb, const struct regmap *rm,
+    struct sensors *s)
+{
+	memset(s, 0, sizeof(*s));
+
+	switch (mb->chip) {
+		case CUSTOM_X6DVA:
+			x6dva_decode(rm, mb, s);
+			break;
+		case WINBOND_W83792D:
+			w83792d_decode(rm, mb, s);
+			break;
+		case WINBOND_W83793G:
+			w83793g_decode(rm, mb, s);
+			break;
+		default:
+			return (-1);
+	}
+	sensors_finish(mb, s);
+	return (0);
+}
+
+
+/*
+ * sensors_finish(const struct board *b, struct sensors *s)
+ *
+ * b = Pointer to board struct the sample is of
+ * s = Sample just decoded by a chip routine
+ *
+ * Completes the valid[] bitmaps of a sample (see struct sensors in
+ * global.h).  The chip routines mark the voltages and temperatures
+ * they have; a fan is valid if its RPM is non-zero, as every chip's
+ * rpmconv() returns 0 for a fan it has no count for (disconnected,
+ * stopped, or too slow for its divisor), and never for a real reading.
+ * Then anything the board doesn't wire up is dropped, and its value
+ * zeroed: the chip routine may not even have read its registers (see
+ * regplan.c).
+ */
+static void
+sensors_finish(const struct board *b, struct sensors *s)
+{
+	const struct pinmap *p;
+	uint16_t wired;
+	int kind;
+	size_t i;
+
+	for (i = 0; i < FAN_MAX; ++i) {
+		if (s->fans[i] != 0) {
+			SENSORS_SET(s, SENSOR_FAN, i);
+		}
+	}
+
+	for (kind = SENSOR_VOLT; kind <= SENSOR_FAN; ++kind) {
+		p = BOARD_PINS(b, kind);
+		wired = 0;
+		for (i = 0; i < BOARD_NPINS(b, kind); ++i) {
+			wired |= SENSORS_BIT(p[i].index);
+		}
+		s->valid[kind - SENSOR_VOLT] &= wired;
+	}
+
+	for (i = 0; i < VOLT_MAX; ++i) {
+		if (!SENSORS_VALID(s, SENSOR_VOLT, i)) {
+			s->voltages[i] = 0;
+		}
+	}
+	for (i = 0; i < TEMP_MAX; ++i) {
+		if (!SENSORS_VALID(s, SENSOR_TEMP, i)) {
+			s->temps[i] = 0;
+		}
+	}
+	for (i = 0; i < FAN_MAX; ++i) {
+		if (!SENSORS_VALID(s, SENSOR_FAN, i)) {
+			s->fans[i] = 0;
+		}
+	}
+}
+
+
+/*
+ * volts_decode(const struct board *b, const struct vcoefs *def,
+ *              const int32_t *raw, struct sensors *s)
+ *
+ *   b = Pointer to board struct; its vcoef corrections (if any) are
+ *       applied over def
+ * def = The chip's default coefficients
+ * raw = Array of VOLT_MAX raw counts, indexed by voltages_e (0 for
+ *       channels the chip doesn't have)
+ *   s = Pointer to sensors struct; see global.h for a definition
+ *
+ * Converts every voltage channel's raw count into millivolts; see struct
+ * vcoefs in global.h.  Channels with a scale are marked valid; the rest
+ * aren't on the chip.  Called by the chip decode routines.
+ */
+void
+volts_decode(const struct board *b, const struct vcoefs *def,
+    const int32_t *raw, struct sensors *s)
+{
+	struct vcoefs fixed;
+	const struct vcoefs *c = def;
+	const struct vcoef *f = BOARD_VCOEF(b);
+	size_t i;
+
+	if (b->nvcoef > 0) {
+		fixed = *def;
+		for (i = 0; i < b->nvcoef; ++i) {
+			fixed.scale[f[i].index] = f[i].scale;
+			fixed.offset[f[i].index] = f[i].offset;
+		}
+		c = &fixed;
+	}
+
+	for (i = 0; i < VOLT_MAX; ++i) {
+		s->voltages[i] = raw[i] * c->scale[i] + c->offset[i];
+	}
+	for (i = 0; i < VOLT_MAX; ++i) {
+		if (c->scale[i] != 0) {
+			SENSORS_SET(s, SENSOR_VOLT, i);
+		}
+	}
+}
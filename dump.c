@@ -0,0 +1,245 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "global.h"
+
+/*
+ * Function prototypes
+ */
+static int	dump_header_ok(const struct dump_header *);
+int		dump_open(const char *);
+int		dump_write(int, const char *, const char *, const struct regmap *);
+const struct dump_record *	dump_map(const char *, size_t *, size_t *);
+void		dump_unmap(const struct dump_record *, size_t);
+
+
+/*
+ * dump_header_ok(const struct dump_header *h)
+ *
+ * h = Pointer to the header at the start of a dump file
+ *
+ * Returns 1 if h describes a dump file this version of bsdhwmon can
+ * read, otherwise 0 (with errno set to EFTYPE or EINVAL).
+ */
+static int
+dump_header_ok(const struct dump_header *h)
+{
+	if (memcmp(h->magic, DUMP_MAGIC, sizeof(h->magic)) != 0) {
+#if defined(EFTYPE)
+		errno = EFTYPE;
+#else
+		errno = EINVAL;
+#endif
+		return (0);
+	}
+
+	if (h->version != DUMP_VERSION || h->byteorder != DUMP_BYTEORDER ||
+	    h->recsize != sizeof(struct dump_record)) {
+		errno = EINVAL;
+		return (0);
+	}
+	return (1);
+}
+
+
+/*
+ * dump_open(const char *path)
+ *
+ * path = Dump file to append to; created if it doesn't exist
+ *
+ * Opens a dump file for appending.  A new (empty) file gets a header
+ * written to it; an existing one has its header checked, so that we
+ * never append records to something which isn't a dump file, or was
+ * written by a different version/architecture.
+ *
+ * path is the user's choice, so nothing is opened (let alone created)
+ * when bsdhwmon is setuid, i.e. the effective user isn't the real one.
+ *
+ * Returns a file descriptor for dump_write(), or -1 with errno set on
+ * failure (EPERM if setuid).
+ */
+int
+dump_open(const char *path)
+{
+	struct dump_header h;
+	struct stat st;
+	int fd;
+
+	VERBOSE("dump_open(path = %s)\n", path);
+
+	if (geteuid() != getuid()) {
+		errno = EPERM;
+		return (-1);
+	}
+
+	if ((fd = open(path, O_RDWR|O_APPEND|O_CREAT, 0644)) == -1) {
+		return (-1);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		goto fail;
+	}
+
+	if (st.st_size == 0) {
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, DUMP_MAGIC, sizeof(h.magic));
+		h.version = DUMP_VERSION;
+		h.byteorder = DUMP_BYTEORDER;
+		h.recsize = sizeof(struct dump_record);
+
+		if (write(fd, &h, sizeof(h)) != sizeof(h)) {
+			goto fail;
+		}
+	} else {
+		if (pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+			errno = EINVAL;
+			goto fail;
+		}
+		if (!dump_header_ok(&h)) {
+			goto fail;
+		}
+	}
+
+	VERBOSE("dump_open() returning %d\n", fd);
+	return (fd);
+
+fail:
+	close(fd);
+	return (-1);
+}
+
+
+/*
+ * dump_write(int fd, const char *maker, const char *product,
+ *            const struct regmap *rm)
+ *
+ *      fd = Descriptor returned by dump_open()
+ *   maker = smbios.planar.maker of the board
+ * product = smbios.planar.product of the board
+ *      rm = Pointer to regmap struct filled in by a chip routine
+ *
+ * Appends one record (the raw register images of every slave in rm,
+ * plus the board and the current time) to a dump file.  The record goes
+ * out in a single write(2).
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
+ */
+int
+dump_write(int fd, const char *maker, const char *product,
+    const struct regmap *rm)
+{
+	struct dump_record r;
+	struct timespec ts;
+	size_t i;
+
+	memset(&r, 0, sizeof(r));
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	r.sec = ts.tv_sec;
+	r.nsec = ts.tv_nsec;
+	r.nslaves = rm->nslaves;
+	strncpy(r.maker, maker, sizeof(r.maker) - 1);
+	strncpy(r.product, product, sizeof(r.product) - 1);
+
+	for (i = 0; i < rm->nslaves; ++i) {
+		r.slave[i] = rm->slave[i];
+		memcpy(r.regs[i], rm->regs[i], sizeof(r.regs[i]));
+	}
+
+	if (write(fd, &r, sizeof(r)) != sizeof(r)) {
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * dump_map(const char *path, size_t *nrecs, size_t *maplen)
+ *
+ *   path = Dump file to read
+ *  nrecs = Set to the number of records in the file
+ * maplen = Set to the length of the mapping (for dump_unmap())
+ *
+ * Maps a dump file read-only.  A partially-written record at the end
+ * of the file (e.g. from a dump still being written to) is ignored.
+ *
+ * Returns a pointer to the first record, or NULL with errno set on
+ * failure.  A file with no records returns a non-NULL pointer and an
+ * nrecs of 0.
+ */
+const struct dump_record *
+dump_map(const char *path, size_t *nrecs, size_t *maplen)
+{
+	const struct dump_header *h;
+	struct stat st;
+	void *p;
+	int fd;
+	int e;
+
+	VERBOSE("dump_map(path = %s)\n", path);
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return (NULL);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		e = errno;
+		close(fd);
+		errno = e;
+		return (NULL);
+	}
+
+	if ((size_t) st.st_size < sizeof(struct dump_header)) {
+		close(fd);
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	e = errno;
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		errno = e;
+		return (NULL);
+	}
+
+	h = p;
+	if (!dump_header_ok(h)) {
+		e = errno;
+		munmap(p, st.st_size);
+		errno = e;
+		return (NULL);
+	}
+
+	*maplen = st.st_size;
+	*nrecs = (st.st_size - sizeof(struct dump_header)) / sizeof(struct dump_record);
+
+	VERBOSE("dump_map() returning %zu records\n", *nrecs);
+	return ((const struct dump_record *) (h + 1));
+}
+
+
+/*
+ * dump_unmap(const struct dump_record *recs, size_t maplen)
+ *
+ *   recs = Pointer returned by dump_map()
+ * maplen = Length returned by dump_map()
+ */
+void
+dump_unmap(const struct dump_record *recs, size_t maplen)
+{
+	munmap((void *) ((const struct dump_header *) recs - 1), maplen);
+}
@@ -3,17 +3,40 @@
  */
 
 /*
- * External variables (main.c)
+ * External variables (collect.c)
  */
 extern int f_verbose;
 
 
 /*
- * VERBOSE() is mainly used for debugging.  Use of the "-v" flag will
- * cause underlying functions to call VERBOSE() with all sorts of
- * information.
+ * External functions (trace.c)
  */
-#define VERBOSE(fmt, args...) if (f_verbose) { printf("==> " fmt, ## args); }
+extern void	trace(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+
+/*
+ * TRACE() is mainly used for debugging.  Each "-v" flag raises f_verbose
+ * by one, and underlying functions call TRACE() with all sorts of
+ * information at one of these levels:
+ *
+ *   TRACE_INFO   -v: opening things, detection, once-per-sample steps
+ *   TRACE_IO     -vv: every SMBus transaction and register conversion
+ *
+ * The trace is printed to stdout, or kept in a ring buffer (see trace.c).
+ * Levels above TRACE_LEVEL are compiled out altogether, arguments and
+ * all; build with -DTRACE_LEVEL=0 for a bsdhwmon with no tracing in it.
+ * VERBOSE() is shorthand for TRACE(TRACE_INFO, ...).
+ */
+#define TRACE_INFO	1
+#define TRACE_IO	2
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL	TRACE_IO
+#endif
+
+#define TRACE(level, fmt, args...) \
+	do { if ((level) <= TRACE_LEVEL && f_verbose >= (level)) { trace(fmt, ## args); } } while (0)
+#define VERBOSE(fmt, args...)	TRACE(TRACE_INFO, fmt, ## args)
 
 
 /*
@@ -85,50 +108,486 @@ enum fans_e {
 
 
 /*
- * The pinmap struct defines two pieces of information: an index value
+ * The pindef struct defines two pieces of information: an index value
  * (which refers to one of the above enums), and an ASCII character string
  * (which is what's printed to the user).
  *
- * The pinmap struct is used heavily in boards.c for declaring multiple
+ * The pindef struct is used heavily in boards.c for declaring multiple
  * "types" of boards.  For example, FAN_FAN1 might be populated/assigned
  * inside of collect.c, but it might actually be wired to "FAN2" according
  * to the BIOS.  This provides a string-to-wire/pin mapping structure.
  *
- * It's also used in the boards struct; see further down...
+ * It's also used in the boarddef struct; see further down...
  */
-struct pinmap {
+struct pindef {
 	size_t		index;		/* One of the above enums */
 	const char	*label;		/* Name of pinmap (ASCII) */
 };
 
-struct voltages_data {
-	size_t		index;		/* One of the above enums */
-	double		value;
-};
+/*
+ * One sample of a board's sensors.  Values are integers: voltages in
+ * millivolts and temperatures in millidegrees Celsius, so decoding them
+ * is integer arithmetic, and the three decimals printed are exact.  Each
+ * kind is a plain array indexed by its enum above.
+ *
+ * A channel's bit in valid[] (see SENSORS_VALID()) is set only if it was
+ * actually read: the chip has it, the board wires it up, and the chip
+ * didn't report it as missing (e.g. a disconnected fan, or a W83793G
+ * diode with its sign bit set).  Otherwise its value is 0, which outputs
+ * must not mistake for a reading.  time is when the registers were read.
+ */
+#define TEMP_MDEG(c)	((int32_t)(c) * 1000)	/* Whole degrees C to millidegrees */
+#define BOARD_KINDS	3		/* Voltages, temps, and fans */
 
-struct temps_data {
-	size_t		index;		/* One of the above enums */
-	size_t		value;
+struct sensors {
+	int64_t		time;			/* CLOCK_REALTIME, in nanoseconds */
+	int32_t		voltages[VOLT_MAX];	/* Millivolts */
+	int32_t		temps[TEMP_MAX];	/* Millidegrees C */
+	uint32_t	fans[FAN_MAX];		/* RPM */
+	uint16_t	valid[BOARD_KINDS];	/* Per kind - SENSOR_VOLT; *_MAX <= 16 */
 };
 
-struct fans_data {
-	size_t		index;		/* One of the above enums */
-	uint32_t	value;
+/*
+ * s is a struct sensors *; kind is one of SENSOR_VOLT, SENSOR_TEMP, or
+ * SENSOR_FAN (see sensor_kinds_e), and i one of its enum
+ */
+#define SENSORS_BIT(i)			((uint16_t)(1U << (i)))
+#define SENSORS_VALID(s, kind, i)	(((s)->valid[(kind) - SENSOR_VOLT] & SENSORS_BIT(i)) != 0)
+#define SENSORS_SET(s, kind, i)		((s)->valid[(kind) - SENSOR_VOLT] |= SENSORS_BIT(i))
+
+/*
+ * Voltage conversion coefficients.  A chip routine only reduces each
+ * voltage channel to a raw count from its registers; volts_decode() (see
+ * collect.c) then converts every channel in one loop:
+ *
+ *   millivolts = count * scale + offset
+ *
+ * scale is in millivolts per count (the datasheet's LSB times whatever
+ * divider is in front of the pin), and is negative for a negative rail;
+ * offset is in millivolts.  Each chip has a struct vcoefs of defaults,
+ * laid out as arrays so the loop vectorizes.  A board wired differently
+ * (e.g. other resistors on a +5V pin) lists its corrections as struct
+ * vcoef entries in its boarddef, terminated by a scale of 0.
+ */
+struct vcoefs {
+	int32_t		scale[VOLT_MAX];	/* Millivolts per count */
+	int32_t		offset[VOLT_MAX];	/* Millivolts */
 };
 
-struct sensors {
-	struct voltages_data	voltages[VOLT_MAX];
-	struct temps_data	temps[TEMP_MAX];
-	struct fans_data	fans[FAN_MAX];
+struct vcoef {
+	uint8_t		index;		/* One of voltages_e */
+	int32_t		scale;		/* Millivolts per count; < 0 for a negative rail */
+	int32_t		offset;		/* Millivolts */
 };
 
-struct board {
+/*
+ * A board as written in boards.c: NULL-terminated pindef lists and a
+ * vcoef list terminated by a scale of 0 (or NULL for none).  Only
+ * mkboardidx reads these; see struct board.
+ */
+struct boarddef {
 	const char		*maker;
 	const char		*product;
 	size_t			chip;
 	int			slave;
-	const struct pinmap	*voltages;
-	const struct pinmap	*temps;
-	const struct pinmap	*fans;
+	const struct pindef	*voltages;
+	const struct pindef	*temps;
+	const struct pindef	*fans;
+	const struct vcoef	*vcoef;		/* Corrections to the chip's vcoefs, or NULL */
+};
+
+/*
+ * Board tables.  What board_lookup() and boarddb_lookup() hand out is a
+ * struct board, the compact form of a boarddef: a board table (struct
+ * boardtab) keeps every string once in a pool, every pin once in a pool,
+ * and every vcoef correction once in a pool, and a board refers to them
+ * by 16-bit offset and 8-bit count.  A board is half a cache line, a
+ * pin is 4 bytes, and boards wired alike share their pins.
+ *
+ * The built-in table is generated from boardlist[] by mkboardidx and
+ * compiled in (boardidx.h); a board database's is its image (see
+ * boarddb.c).  Use the BOARD_*() macros rather than the offsets.
+ */
+#define BOARD_POOL_MAX	0xffff		/* Largest offset into a pool */
+
+struct pinmap {
+	uint8_t		index;		/* One of the above enums */
+	uint16_t	label;		/* Offset of its name in the strings pool */
+};
+
+struct boardtab {
+	const char		*strings;	/* String pool; NUL-terminated strings */
+	const struct pinmap	*pins;		/* Pin pool */
+	const struct vcoef	*vcoefs;	/* vcoef pool */
+	const struct board	*boards;	/* nboards boards */
+	uint32_t		nboards;
+	uint32_t		fingerprint;	/* See struct boardidx */
+};
+
+struct board {
+	const struct boardtab	*tab;		/* Table the offsets below are into */
+	uint16_t	maker;		/* Offset into tab->strings */
+	uint16_t	product;	/* Offset into tab->strings */
+	uint16_t	pins[BOARD_KINDS];	/* First of tab->pins for voltages, temps, fans */
+	uint16_t	vcoef;		/* First of tab->vcoefs */
+	uint8_t		npins[BOARD_KINDS];	/* Number of each */
+	uint8_t		nvcoef;		/* Corrections to the chip's vcoefs */
+	uint8_t		chip;		/* One of chips_e */
+	int8_t		slave;		/* SMBus slave address, or -1 for custom */
+};
+
+/*
+ * b is a const struct board *; kind is one of SENSOR_VOLT, SENSOR_TEMP,
+ * or SENSOR_FAN (see sensor_kinds_e)
+ */
+#define BOARD_STR(b, off)	((b)->tab->strings + (off))
+#define BOARD_MAKER(b)		BOARD_STR((b), (b)->maker)
+#define BOARD_PRODUCT(b)	BOARD_STR((b), (b)->product)
+#define BOARD_PINS(b, kind)	(&(b)->tab->pins[(b)->pins[(kind) - SENSOR_VOLT]])
+#define BOARD_NPINS(b, kind)	((b)->npins[(kind) - SENSOR_VOLT])
+#define BOARD_LABEL(b, p)	BOARD_STR((b), (p)->label)
+#define BOARD_VCOEF(b)		(&(b)->tab->vcoefs[(b)->vcoef])
+
+
+/*
+ * Board index: a minimal perfect hash over (maker, product) pairs of a
+ * board list, built by boardidx_build() (see boardidx.c).  For the
+ * built-in boardlist[] the index is generated at build time by
+ * mkboardidx and compiled in (boardidx.h), so board_lookup() costs two
+ * hashes and one comparison regardless of how many boards are listed.
+ * boardidx_probe() does the hashing; the comparison is up to the caller,
+ * since only it knows where the strings are.
+ *
+ * Keys are hashed into nbuckets buckets; disp[] holds, per bucket, either
+ * a seed (>= 0) which rehashes the key into slot[], or -(slot + 1) for a
+ * bucket holding a single key placed directly.  slot[] has one entry per
+ * key, holding the key's index into the board list.
+ *
+ * fingerprint is a hash over the maker, product, chip, and slave of every
+ * board, in order; it changes whenever boardlist[] does (see the board
+ * cache in lookup.c).
+ */
+#define BOARDIDX_NONE	((size_t)-1)	/* boardidx_probe(): empty index */
+
+struct boardidx {
+	uint32_t	nkeys;		/* Number of slots (boards) */
+	uint32_t	nbuckets;	/* Number of disp[] entries */
+	uint32_t	fingerprint;	/* Hash of the whole board list */
+	const int32_t	*disp;		/* Per-bucket seed or direct slot */
+	const uint32_t	*slot;		/* Per-slot board list index */
+};
+
+
+/*
+ * Output formats (see outfmt_new() in output.c).  struct outfmt is the
+ * per-board compiled form of one of these and is private to output.c.
+ */
+enum output_formats_e {
+	OUTPUT_TEXT,	/* Default: aligned columns */
+	OUTPUT_DELIM,	/* -c: comma-delimited */
+	OUTPUT_JSON,	/* -J */
+	OUTPUT_OPENMETRICS	/* --openmetrics, --textfile */
+};
+
+struct outfmt;
+
+
+/*
+ * Shared memory snapshot writer (see shmsnap.c; the layout readers see
+ * is in bsdhwmon_shm.h).
+ */
+struct shmsnap;
+
+
+/*
+ * Sample history files (see history.c): a fixed-size ring of samples,
+ * plus rings of 1-minute and 1-hour rollups of them.  struct history is
+ * one mapped by its writer (--history-log) or a reader (--history), and
+ * is private to history.c.
+ */
+enum hist_periods_e {
+	HIST_SAMPLES,	/* Every sample, as it was taken */
+	HIST_MINUTES,	/* 1-minute rollups */
+	HIST_HOURS,	/* 1-hour rollups */
+	HIST_RINGS
+};
+
+enum hist_stats_e {
+	HIST_MEAN,	/* Of a rollup's period; also what a sample is */
+	HIST_MIN,
+	HIST_MAX
+};
+
+struct history;
+
+
+/*
+ * Board detection cache (see board_cache_load() in lookup.c).  Holds the
+ * result of SMBIOS probing and board_lookup(), plus what's needed to tell
+ * whether that result still applies: the board list it indexes into, and
+ * the boot it was made during (hardware doesn't change without a reboot).
+ */
+#define BCACHE_MAGIC	"BHWMBCAC"
+#define BCACHE_VERSION	1
+#define BCACHE_STRLEN	128		/* KENV_MVALLEN on FreeBSD */
+
+struct bcache {
+	char		magic[8];		/* BCACHE_MAGIC, not NUL-terminated */
+	uint32_t	version;		/* BCACHE_VERSION */
+	uint32_t	fingerprint;		/* struct boardidx fingerprint */
+	int64_t		boot_sec;		/* kern.boottime */
+	int64_t		boot_usec;
+	uint32_t	bidx;			/* Index into struct boardtab boards[] */
+	uint32_t	pad;
+	char		maker[BCACHE_STRLEN];	/* BOARD_MAKER(&boards[bidx]) */
+	char		product[BCACHE_STRLEN];	/* BOARD_PRODUCT(&boards[bidx]) */
+};
+
+
+/*
+ * Compiled board database (see boarddb.c).  An image is a bdb_header
+ * followed by its sections, each at a 4-byte aligned offset given in the
+ * header, in the byte order of the host which compiled it.  Everything
+ * refers to everything else by index or by offset into the strings
+ * section, never by pointer, so an image is mmap()ed and used in place.
+ *
+ * disp[] and slot[] are a struct boardidx over the boards.  pins[],
+ * vcoefs[], and strings[] are the pools of a struct boardtab, used as
+ * they are, and each of boards[] is a struct board without its tab.
+ */
+#define BDB_MAGIC	"BHWMBRDB"
+#define BDB_VERSION	2
+#define BDB_BYTEORDER	0x01020304	/* Reads back differently if swapped */
+
+struct bdb_header {
+	char		magic[8];	/* BDB_MAGIC, not NUL-terminated */
+	uint32_t	version;	/* BDB_VERSION */
+	uint32_t	byteorder;	/* BDB_BYTEORDER */
+	uint32_t	size;		/* Of the whole image, in bytes */
+	uint32_t	fingerprint;	/* As struct boardidx's */
+	uint32_t	nboards;	/* Entries in disp[], slot[], and boards[] */
+	uint32_t	npins;		/* Entries in pins[] */
+	uint32_t	nvcoefs;	/* Entries in vcoefs[] */
+	uint32_t	strsize;	/* Bytes in strings[] */
+	uint32_t	disp;		/* Offset of int32_t disp[nboards] */
+	uint32_t	slot;		/* Offset of uint32_t slot[nboards] */
+	uint32_t	pins;		/* Offset of struct pinmap pins[npins] */
+	uint32_t	vcoefs;		/* Offset of struct vcoef vcoefs[nvcoefs] */
+	uint32_t	boards;		/* Offset of struct bdb_board boards[nboards] */
+	uint32_t	strings;	/* Offset of char strings[strsize] */
+};
+
+struct bdb_board {
+	uint16_t	maker;		/* As struct board's */
+	uint16_t	product;
+	uint16_t	pins[BOARD_KINDS];
+	uint16_t	vcoef;
+	uint8_t		npins[BOARD_KINDS];
+	uint8_t		nvcoef;
+	uint8_t		chip;
+	int8_t		slave;
+};
+
+struct boarddb;
+
+
+/*
+ * Sensor kinds, used by register plans (see below) to say which of the
+ * voltages, temps, or fans pinmaps a register belongs to.
+ */
+enum sensor_kinds_e {
+	SENSOR_ANY,	/* Always read, regardless of board */
+	SENSOR_VOLT,	/* index is one of voltages_e */
+	SENSOR_TEMP,	/* index is one of temps_e */
+	SENSOR_FAN	/* index is one of fans_e */
+};
+
+/*
+ * A register plan is a static, declarative list of the registers a chip
+ * routine needs on every sample: which SMBus slave they live on, the
+ * first index/register, how many consecutive registers make up the
+ * value (e.g. 2 for a 16-bit fan counter), and which sensor the value
+ * belongs to.  Plans are terminated with an entry whose width is 0.
+ * SLAVE_BOARD refers to the slave address given in boardlist[] (see
+ * boards.c).
+ *
+ * A register shared by several sensors (e.g. a fan divisor register
+ * covering two fans) is listed once per sensor.
+ *
+ * regplan_compile() (see regplan.c) turns a plan into a list of regspans:
+ * the fewest runs of consecutive registers, per slave, that cover every
+ * register in the plan exactly once.  Registers belonging to a sensor
+ * which isn't in the board's pinmaps are left out.  Each regspan is then
+ * fetched with a single read_block() call.
+ */
+#define SLAVE_BOARD	-1
+
+struct regplan {
+	int		slave;		/* SMBus slave address, or SLAVE_BOARD */
+	uint8_t		reg;		/* First index/register */
+	uint8_t		width;		/* Number of consecutive registers */
+	uint8_t		kind;		/* One of sensor_kinds_e */
+	uint8_t		index;		/* One of the voltages/temps/fans enums */
+};
+
+struct regspan {
+	int		slave;		/* SMBus slave address */
+	uint8_t		reg;		/* First index/register */
+	size_t		count;		/* Number of consecutive registers */
+};
+
+#define REGSPAN_MAX	32		/* Max regspans per compiled plan */
+
+/*
+ * A compiled plan, as kept between samples by whoever calls a chip
+ * routine (see struct hwmon in collect.c).  board says which board the
+ * spans were compiled for; the chip routine recompiles when it changes.
+ */
+struct regspans {
+	const struct board	*board;		/* Board compiled for, or NULL */
+	size_t		n;		/* Number of span[] in use */
+	struct regspan	span[REGSPAN_MAX];
+};
+
+/*
+ * The regmap struct holds the 256-register image of every slave a chip
+ * routine talks to (the X6DVA uses two).  It is filled in by regplan_run()
+ * and handed to the chip's decode routine.
+ */
+#define REGMAP_SLAVES	2
+
+struct regmap {
+	size_t		nslaves;
+	int		slave[REGMAP_SLAVES];
+	u_char		regs[REGMAP_SLAVES][256];
+};
+
+/*
+ * An open SMBus, as returned by smbus_open() (see smbus_io.c).  Everything
+ * about a bus lives in here rather than in globals, so any number of
+ * buses can be open at once, each used by its own thread.  A single
+ * struct smbus must not be used by two threads at the same time.
+ */
+#define BUS_MAX		8		/* Most buses sampled at once (-f) */
+#define BREAD_SLAVES	4		/* Slaves whose block reads are checked */
+
+struct smbus_backend;
+struct smbus_stats;
+
+struct smbus {
+	const struct smbus_backend	*backend;
+	int		fd;		/* Backend descriptor, or -1 */
+	void		*priv;		/* Backend state, e.g. simulator images */
+	int		bread_ok;	/* read_block() usable on this bus */
+	size_t		nbread;
+	int		bread_slave[BREAD_SLAVES];	/* Block reads checked */
+	u_long		xfers;		/* Bus transactions issued */
+	int		probe;		/* Timed/-v path; see read_byte() */
+	struct smbus_stats	*stats;	/* --stats counters, or NULL */
 };
 
+/*
+ * Bus transaction statistics (--stats), kept by smbus_io.c per slave
+ * address and register, and reported by busstats.c.  Latencies go into
+ * log2 buckets: bucket b counts transactions which took less than 2^b
+ * microseconds (bucket 0 less than 1us), and the last bucket everything
+ * slower.  A block read counts once, against its first register.
+ */
+#define STATS_SLAVES	4		/* Slave addresses kept apart per bus */
+#define STATS_BUCKETS	20		/* Last bound: 2^18us, about 262ms */
+
+struct smbus_regstats {
+	u_long		xfers;		/* Transactions, failed ones included */
+	u_long		bytes;		/* Bytes transferred by successful ones */
+	u_long		failures;
+	uint64_t	nsec;		/* Total latency */
+	uint32_t	hist[STATS_BUCKETS];
+};
+
+struct smbus_stats {
+	size_t		nslaves;
+	int		slave[STATS_SLAVES];
+	u_long		dropped;	/* Transactions on slaves past STATS_SLAVES */
+	struct smbus_regstats	reg[STATS_SLAVES][256];
+};
+
+/*
+ * Phase timings of a one-shot run (--timings; see timings.c).  main()
+ * and the chip routines call timings_mark() at the end of each phase,
+ * which charges the time since the previous mark to that phase.  A NULL
+ * struct timings makes timings_mark() do nothing.
+ */
+enum timing_phases_e {
+	PHASE_ARGS,			/* Command line and backend checks */
+	PHASE_SMBIOS,			/* kenv(2) lookups */
+	PHASE_LOOKUP,			/* board_lookup(), --cache */
+	PHASE_ALLOC,			/* calloc(), outfmt_new(), threads */
+	PHASE_OPEN,			/* Opening (and locking) the devices */
+	PHASE_PLAN,			/* regplan_compile() */
+	PHASE_COLLECT,			/* Register reads */
+	PHASE_DECODE,			/* Registers to sensor values */
+	PHASE_OUTPUT,			/* Rendering and writing the sample */
+	PHASE_MAX
+};
+
+struct timings {
+	uint64_t	start;		/* CLOCK_MONOTONIC ns of timings_start() */
+	uint64_t	last;		/* ... of the latest mark */
+	uint64_t	ns[PHASE_MAX];
+};
+
+/*
+ * Bus backends.  read_byte(), read_block(), and write_byte() in
+ * smbus_io.c hand every bus access to one of these; see smbus_smb.c
+ * (smb(4) ioctls) and smbus_sim.c (register image simulator).
+ *
+ * open() fills in fd and priv of the struct smbus it's handed, and
+ * close() releases them.  Everything returns 0 on success, or -1 with
+ * errno set on failure; nothing here exits.  read_block may be NULL if
+ * the backend can't do block reads at all, and a read_block() failure
+ * makes the caller fall back to byte reads rather than fail.  A block
+ * read which succeeds is still checked against byte reads, once per
+ * slave, before read_block() trusts it.
+ */
+#define SMBUS_BLOCKMAX	32		/* SMBus block transfer limit */
+
+struct smbus_backend {
+	const char	*name;
+	const char	*prefix;	/* Device path prefix, e.g. "sim:" */
+	int		needs_root;
+	int		(*open)(struct smbus *, const char *);
+	int		(*read_byte)(struct smbus *, int, u_char, uint8_t *);
+	int		(*read_block)(struct smbus *, int, u_char, u_char *, size_t);
+	int		(*write_byte)(struct smbus *, int, u_char, u_char);
+	void		(*close)(struct smbus *);
+};
+
+/*
+ * Register dump files (see dump.c).  A dump file is a dump_header
+ * followed by any number of fixed-size dump_records, one per sample, in
+ * the byte order of the host which wrote them.  Fixed-size records mean
+ * a dump file can be appended to with a single write(2) per sample, and
+ * mmap()ed and walked like an array when it's replayed.
+ */
+#define DUMP_MAGIC	"BHWMDUMP"
+#define DUMP_VERSION	1
+#define DUMP_BYTEORDER	0x01020304	/* Reads back differently if swapped */
+#define DUMP_STRLEN	64
+
+struct dump_header {
+	char		magic[8];	/* DUMP_MAGIC, not NUL-terminated */
+	uint32_t	version;	/* DUMP_VERSION */
+	uint32_t	byteorder;	/* DUMP_BYTEORDER */
+	uint32_t	recsize;	/* sizeof(struct dump_record) */
+	uint32_t	pad[11];
+};
+
+struct dump_record {
+	int64_t		sec;		/* Time of sample (UTC) */
+	int32_t		nsec;
+	uint32_t	nslaves;	/* Number of slave[]/regs[] in use */
+	char		maker[DUMP_STRLEN];	/* smbios.planar.maker */
+	char		product[DUMP_STRLEN];	/* smbios.planar.product */
+	int32_t		slave[REGMAP_SLAVES];
+	uint8_t		regs[REGMAP_SLAVES][256];
+};
@@ -0,0 +1,758 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+
+/*
+ * Sample history files (--history-log, read back with --history).  A
+ * history file is a hist_header followed by three rings of fixed-size
+ * slots, in the byte order of the host which created it:
+ *
+ *   samples  the last HIST_NSAMPLES samples, one per tick of -i or
+ *            --server, as struct sensors
+ *   minutes  the last HIST_NMINUTES 1-minute rollups: per sensor, the
+ *            minimum, maximum, and sum and count of its readings
+ *   hours    the same, for the last HIST_NHOURS hours
+ *
+ * The file's size is fixed when it's created.  The writer keeps it
+ * mapped, so history_append() is a few stores into the mapping: no
+ * allocation, no system calls, and the same amount of work however much
+ * history there is.  The rollups are brought up to date by every sample
+ * as it's appended, rather than worked out when they're read.
+ *
+ * Readers never block the writer, nor it them: every slot has a sequence
+ * lock of its own (as the shared memory snapshot does; see
+ * bsdhwmon_shm.h), and a reader which finds a slot being written retries
+ * it, or skips it if the writer has since lapped it.  History is only
+ * ever in the file, so it carries on across restarts of the writer, with
+ * a gap for however long nothing was sampling; a rollup period is only
+ * started by a sample which falls in it.
+ */
+#define HIST_MAGIC	"BHWMHIST"
+#define HIST_VERSION	1
+#define HIST_BYTEORDER	0x01020304	/* Reads back differently if swapped */
+#define HIST_NSAMPLES	10080		/* A week at -i 60 */
+#define HIST_NMINUTES	2880		/* Two days */
+#define HIST_NHOURS	8784		/* A (leap) year */
+#define HIST_CHANNELS	(VOLT_MAX + TEMP_MAX + FAN_MAX)
+#define HIST_RETRIES	1000		/* Reads of a busy slot before skipping it */
+#define HIST_ALIGN	64		/* Rings start on a cache line */
+
+struct hist_header {
+	char		magic[8];	/* HIST_MAGIC, not NUL-terminated */
+	uint32_t	version;	/* HIST_VERSION */
+	uint32_t	byteorder;	/* HIST_BYTEORDER */
+	uint32_t	samplesize;	/* sizeof(struct hist_sample) */
+	uint32_t	rollupsize;	/* sizeof(struct hist_rollup) */
+	uint32_t	nslots[HIST_RINGS];	/* Per hist_periods_e */
+	uint32_t	offset[HIST_RINGS];	/* Of each ring, from the start of the file */
+	char		maker[BCACHE_STRLEN];	/* BOARD_MAKER() of the board sampled */
+	char		product[BCACHE_STRLEN];	/* BOARD_PRODUCT() */
+	_Atomic uint64_t	head[HIST_RINGS];	/* Slots ever started in each ring */
+};
+
+/*
+ * Slot n of a ring (n counting from 0 since the file was created) is
+ * slot n % nslots.  n is kept in the slot too, so a reader can tell the
+ * slot it asked for from a later one which has replaced it.
+ */
+struct hist_sample {
+	_Atomic uint32_t	seq;	/* Odd while the slot is being written */
+	uint32_t	pad;
+	uint64_t	n;
+	struct sensors	s;
+};
+
+struct hist_rollup {
+	_Atomic uint32_t	seq;	/* Odd while the slot is being written */
+	uint32_t	pad;
+	uint64_t	n;
+	int64_t		time;		/* Start of the period (CLOCK_REALTIME, ns) */
+	int32_t		min[HIST_CHANNELS];	/* Per channel; see channels[] */
+	int32_t		max[HIST_CHANNELS];
+	int64_t		sum[HIST_CHANNELS];
+	uint32_t	count[HIST_CHANNELS];	/* Readings in the period */
+};
+
+/*
+ * Each sensor of struct sensors is a channel of the rollups, kind by
+ * kind; indexed by kind - SENSOR_VOLT.
+ */
+static const struct {
+	int		kind;		/* One of sensor_kinds_e */
+	size_t		base;		/* Channel of sensor 0 of this kind */
+	size_t		n;
+} channels[BOARD_KINDS] = {
+	{ SENSOR_VOLT,	0,			VOLT_MAX },
+	{ SENSOR_TEMP,	VOLT_MAX,		TEMP_MAX },
+	{ SENSOR_FAN,	VOLT_MAX + TEMP_MAX,	FAN_MAX },
+};
+
+/*
+ * Length of a rollup period, in ns, per hist_periods_e
+ */
+static const int64_t period_ns[HIST_RINGS] = {
+	[HIST_SAMPLES]	= 0,
+	[HIST_MINUTES]	= 60 * (int64_t)1000000000,
+	[HIST_HOURS]	= 3600 * (int64_t)1000000000,
+};
+
+struct history {
+	struct hist_header	*hdr;
+	size_t		size;		/* Of the mapping */
+	int		fd;		/* Writer only: holds the lock; else -1 */
+};
+
+/*
+ * Function prototypes
+ */
+static void	slot_begin(_Atomic uint32_t *);
+static void	slot_end(_Atomic uint32_t *);
+static int	slot_read(const _Atomic uint32_t *, void *, const void *,
+		    const size_t);
+static void *	hist_slot(const struct history *, const int, const uint64_t);
+static size_t	hist_layout(struct hist_header *);
+static int	hist_header_ok(const struct hist_header *, const size_t);
+static int32_t	sensor_get(const struct sensors *, const int, const size_t);
+static void	sensor_put(struct sensors *, const int, const size_t, const int32_t);
+static void	rollup_add(struct history *, const int, const struct sensors *);
+static void	rollup_sensors(const struct hist_rollup *, const int,
+		    struct sensors *);
+struct history *	history_open(const char *, const struct board *);
+void		history_append(struct history *, const struct sensors *);
+struct history *	history_map(const char *);
+void		history_board(const struct history *, const char **,
+		    const char **);
+ssize_t		history_read(const struct history *, const int, const int,
+		    const int64_t, const int64_t, struct sensors **);
+void		history_close(struct history *);
+
+
+/*
+ * slot_begin(_Atomic uint32_t *seq)
+ * slot_end(_Atomic uint32_t *seq)
+ *
+ * seq = Sequence lock of the slot being written
+ *
+ * Bracket every write to a slot, as shmsnap_begin() and shmsnap_end()
+ * do in shmsnap.c.  A slot a writer died in the middle of has an odd
+ * seq, which the next write to it keeps odd until it's done.
+ */
+static void
+slot_begin(_Atomic uint32_t *seq)
+{
+	uint32_t v = atomic_load_explicit(seq, memory_order_relaxed);
+
+	atomic_store_explicit(seq, v | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void
+slot_end(_Atomic uint32_t *seq)
+{
+	uint32_t v = atomic_load_explicit(seq, memory_order_relaxed);
+
+	atomic_store_explicit(seq, v + 1, memory_order_release);
+}
+
+
+/*
+ * slot_read(const _Atomic uint32_t *seq, void *dst, const void *src,
+ *           const size_t len)
+ *
+ * seq = Sequence lock of the slot
+ * dst = Where to copy the slot to
+ * src = The slot
+ * len = Its size
+ *
+ * Copies a slot the way bsdhwmon_shm_read() copies the snapshot.
+ *
+ * Returns 0 if dst is a consistent copy, or -1 if none could be made in
+ * HIST_RETRIES attempts.
+ */
+static int
+slot_read(const _Atomic uint32_t *seq, void *dst, const void *src,
+    const size_t len)
+{
+	uint32_t s1, s2;
+	int i;
+
+	for (i = 0; i < HIST_RETRIES; ++i) {
+		s1 = atomic_load_explicit(seq, memory_order_acquire);
+		if (s1 & 1) {
+			continue;
+		}
+		memcpy(dst, src, len);
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit(seq, memory_order_relaxed);
+		if (s1 == s2) {
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+
+/*
+ * hist_slot(const struct history *h, const int ring, const uint64_t n)
+ *
+ *    h = Mapped history file
+ * ring = One of hist_periods_e
+ *    n = Slot number, counting from the creation of the file
+ *
+ * Returns a pointer to the struct hist_sample (HIST_SAMPLES) or struct
+ * hist_rollup (the others) slot n is kept in.
+ */
+static void *
+hist_slot(const struct history *h, const int ring, const uint64_t n)
+{
+	const struct hist_header *hdr = h->hdr;
+	size_t size = (ring == HIST_SAMPLES ? hdr->samplesize : hdr->rollupsize);
+
+	return ((char *)h->hdr + hdr->offset[ring] + (size_t)(n % hdr->nslots[ring]) * size);
+}
+
+
+/*
+ * hist_layout(struct hist_header *hdr)
+ *
+ * hdr = Header of a new history file; everything but the board and the
+ *       heads filled in
+ *
+ * Returns the size of the file.
+ */
+static size_t
+hist_layout(struct hist_header *hdr)
+{
+	size_t off = sizeof(*hdr);
+	int ring;
+
+	memcpy(hdr->magic, HIST_MAGIC, sizeof(hdr->magic));
+	hdr->version = HIST_VERSION;
+	hdr->byteorder = HIST_BYTEORDER;
+	hdr->samplesize = sizeof(struct hist_sample);
+	hdr->rollupsize = sizeof(struct hist_rollup);
+	hdr->nslots[HIST_SAMPLES] = HIST_NSAMPLES;
+	hdr->nslots[HIST_MINUTES] = HIST_NMINUTES;
+	hdr->nslots[HIST_HOURS] = HIST_NHOURS;
+
+	for (ring = 0; ring < HIST_RINGS; ++ring) {
+		off = (off + HIST_ALIGN - 1) & ~(size_t)(HIST_ALIGN - 1);
+		hdr->offset[ring] = (uint32_t)off;
+		off += (size_t)hdr->nslots[ring] *
+		    (ring == HIST_SAMPLES ? hdr->samplesize : hdr->rollupsize);
+	}
+	return (off);
+}
+
+
+/*
+ * hist_header_ok(const struct hist_header *hdr, const size_t size)
+ *
+ *  hdr = Header at the start of a history file
+ * size = Size of the file
+ *
+ * Returns 1 if hdr describes a history file this version of bsdhwmon can
+ * use, whose rings all fit in size bytes, otherwise 0 (with errno set to
+ * EFTYPE or EINVAL).
+ */
+static int
+hist_header_ok(const struct hist_header *hdr, const size_t size)
+{
+	int ring;
+
+	if (size < sizeof(*hdr) || memcmp(hdr->magic, HIST_MAGIC, sizeof(hdr->magic)) != 0) {
+#if defined(EFTYPE)
+		errno = EFTYPE;
+#else
+		errno = EINVAL;
+#endif
+		return (0);
+	}
+
+	if (hdr->version != HIST_VERSION || hdr->byteorder != HIST_BYTEORDER ||
+	    hdr->samplesize != sizeof(struct hist_sample) ||
+	    hdr->rollupsize != sizeof(struct hist_rollup) ||
+	    memchr(hdr->maker, '\0', sizeof(hdr->maker)) == NULL ||
+	    memchr(hdr->product, '\0', sizeof(hdr->product)) == NULL) {
+		errno = EINVAL;
+		return (0);
+	}
+
+	for (ring = 0; ring < HIST_RINGS; ++ring) {
+		if (hdr->nslots[ring] == 0 || hdr->offset[ring] % HIST_ALIGN != 0 ||
+		    hdr->offset[ring] < sizeof(*hdr) || hdr->offset[ring] > size ||
+		    (size - hdr->offset[ring]) / (ring == HIST_SAMPLES ?
+		    hdr->samplesize : hdr->rollupsize) < hdr->nslots[ring]) {
+			errno = EINVAL;
+			return (0);
+		}
+	}
+	return (1);
+}
+
+
+/*
+ * sensor_get(const struct sensors *s, const int kind, const size_t i)
+ * sensor_put(struct sensors *s, const int kind, const size_t i,
+ *            const int32_t v)
+ *
+ *    s = Sample
+ * kind = One of sensor_kinds_e (not SENSOR_ANY)
+ *    i = One of the voltages/temps/fans enums
+ *    v = Value to store; RPM for fans
+ *
+ * Read and write the value of one sensor of s, whatever its kind.
+ */
+static int32_t
+sensor_get(const struct sensors *s, const int kind, const size_t i)
+{
+	switch (kind) {
+		case SENSOR_VOLT:
+			return (s->voltages[i]);
+		case SENSOR_TEMP:
+			return (s->temps[i]);
+	}
+	return ((int32_t)s->fans[i]);
+}
+
+static void
+sensor_put(struct sensors *s, const int kind, const size_t i, const int32_t v)
+{
+	switch (kind) {
+		case SENSOR_VOLT:
+			s->voltages[i] = v;
+			break;
+		case SENSOR_TEMP:
+			s->temps[i] = v;
+			break;
+		default:
+			s->fans[i] = (uint32_t)v;
+	}
+}
+
+
+/*
+ * rollup_add(struct history *h, const int ring, const struct sensors *s)
+ *
+ *    h = History file being written
+ * ring = HIST_MINUTES or HIST_HOURS
+ *    s = Sample being appended
+ *
+ * Adds s to the rollup of the period it falls in.  That's the latest
+ * rollup, unless s is from a later period, which then gets a new one.
+ * A sample from before the latest period (the clock was set back) is
+ * added to the latest one all the same, so periods never go backwards.
+ */
+static void
+rollup_add(struct history *h, const int ring, const struct sensors *s)
+{
+	struct hist_header *hdr = h->hdr;
+	struct hist_rollup *r = NULL;
+	uint64_t n = atomic_load_explicit(&hdr->head[ring], memory_order_relaxed);
+	int64_t start = s->time - s->time % period_ns[ring];
+	int32_t v;
+	size_t k, i, c;
+	int started = 0;
+
+	if (n > 0) {
+		r = hist_slot(h, ring, n - 1);
+	}
+	if (r == NULL || start > r->time) {
+		r = hist_slot(h, ring, n++);
+		slot_begin(&r->seq);
+		r->n = n - 1;
+		r->time = start;
+		memset(r->count, 0, sizeof(r->count));
+		started = 1;
+	} else {
+		slot_begin(&r->seq);
+	}
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		for (i = 0; i < channels[k].n; ++i) {
+			if (!SENSORS_VALID(s, channels[k].kind, i)) {
+				continue;
+			}
+			c = channels[k].base + i;
+			v = sensor_get(s, channels[k].kind, i);
+			if (r->count[c] == 0) {
+				r->min[c] = v;
+				r->max[c] = v;
+				r->sum[c] = 0;
+			} else if (v < r->min[c]) {
+				r->min[c] = v;
+			} else if (v > r->max[c]) {
+				r->max[c] = v;
+			}
+			r->sum[c] += v;
+			++r->count[c];
+		}
+	}
+	slot_end(&r->seq);
+
+	if (started) {
+		atomic_store_explicit(&hdr->head[ring], n, memory_order_release);
+	}
+}
+
+
+/*
+ * rollup_sensors(const struct hist_rollup *r, const int stat,
+ *                struct sensors *s)
+ *
+ *    r = Rollup
+ * stat = One of hist_stats_e
+ *    s = Filled in with that statistic of every sensor over r's period,
+ *        stamped with the start of the period
+ *
+ * A sensor with no readings in the period has none in s either.  Means
+ * are rounded to the nearest unit (millivolt, millidegree, or RPM).
+ */
+static void
+rollup_sensors(const struct hist_rollup *r, const int stat, struct sensors *s)
+{
+	int64_t sum;
+	int32_t v;
+	size_t k, i, c;
+
+	memset(s, 0, sizeof(*s));
+	s->time = r->time;
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		for (i = 0; i < channels[k].n; ++i) {
+			c = channels[k].base + i;
+			if (r->count[c] == 0) {
+				continue;
+			}
+			switch (stat) {
+				case HIST_MIN:
+					v = r->min[c];
+					break;
+				case HIST_MAX:
+					v = r->max[c];
+					break;
+				default:
+					sum = r->sum[c];
+					v = (int32_t)(sum < 0 ?
+					    -((-sum + r->count[c] / 2) / r->count[c]) :
+					    (sum + r->count[c] / 2) / r->count[c]);
+			}
+			sensor_put(s, channels[k].kind, i, v);
+			SENSORS_SET(s, channels[k].kind, i);
+		}
+	}
+}
+
+
+/*
+ * history_open(const char *path, const struct board *b)
+ *
+ * path = History file to append to; created if it doesn't exist
+ *    b = Board being sampled
+ *
+ * Opens a history file for history_append(), creating it at its full
+ * size if it's new or empty.  An existing one must have been written by
+ * this version of bsdhwmon (on a host of the same byte order), for the
+ * same board, and its sizes are kept as they are.  The file is locked,
+ * so there's only ever one writer; a second fails with EWOULDBLOCK.
+ * When bsdhwmon is setuid (the effective user isn't the real one),
+ * path isn't opened at all, as a file anywhere could otherwise be
+ * created or grown to a history file's size.
+ *
+ * Returns a handle for history_append(), or NULL with errno set (EPERM
+ * if setuid).
+ */
+struct history *
+history_open(const char *path, const struct board *b)
+{
+	struct history *h;
+	struct hist_header hdr;
+	struct stat st;
+	void *p;
+	int saved;
+
+	VERBOSE("history_open(path = %s, b = %p)\n", path, b);
+
+	if (geteuid() != getuid()) {
+		errno = EPERM;
+		return (NULL);
+	}
+
+	if ((h = calloc(1, sizeof(*h))) == NULL) {
+		return (NULL);
+	}
+
+	if ((h->fd = open(path, O_RDWR|O_CREAT, 0644)) == -1) {
+		goto fail;
+	}
+	if (flock(h->fd, LOCK_EX|LOCK_NB) == -1 || fstat(h->fd, &st) == -1) {
+		goto fail_close;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (st.st_size == 0) {
+		h->size = hist_layout(&hdr);
+		snprintf(hdr.maker, sizeof(hdr.maker), "%s", BOARD_MAKER(b));
+		snprintf(hdr.product, sizeof(hdr.product), "%s", BOARD_PRODUCT(b));
+		if (ftruncate(h->fd, (off_t)h->size) == -1) {
+			goto fail_close;
+		}
+	} else {
+		h->size = (size_t)st.st_size;
+		if (pread(h->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+			errno = EINVAL;
+			goto fail_close;
+		}
+		if (!hist_header_ok(&hdr, h->size)) {
+			goto fail_close;
+		}
+		if (strcmp(hdr.maker, BOARD_MAKER(b)) != 0 ||
+		    strcmp(hdr.product, BOARD_PRODUCT(b)) != 0) {
+			errno = EINVAL;
+			goto fail_close;
+		}
+	}
+
+	p = mmap(NULL, h->size, PROT_READ|PROT_WRITE, MAP_SHARED, h->fd, 0);
+	if (p == MAP_FAILED) {
+		goto fail_close;
+	}
+	h->hdr = p;
+
+	/*
+	 * A new file's header goes in magic last, so a reader can't take
+	 * it for a history file before it is one.  The heads (and every
+	 * slot's seq) start at 0 from ftruncate().
+	 */
+	if (st.st_size == 0) {
+		memcpy((char *)h->hdr + sizeof(hdr.magic), (char *)&hdr + sizeof(hdr.magic),
+		    offsetof(struct hist_header, head) - sizeof(hdr.magic));
+		atomic_thread_fence(memory_order_release);
+		memcpy(h->hdr->magic, hdr.magic, sizeof(hdr.magic));
+	}
+
+	VERBOSE("history_open() returning %p (%zu bytes)\n", h, h->size);
+	return (h);
+
+fail_close:
+	saved = errno;
+	close(h->fd);
+	errno = saved;
+fail:
+	saved = errno;
+	free(h);
+	errno = saved;
+	return (NULL);
+}
+
+
+/*
+ * history_append(struct history *h, const struct sensors *s)
+ *
+ * h = Handle returned by history_open()
+ * s = Sample to append; s->time says which rollup periods it's in
+ *
+ * Replaces the oldest sample in the file with s, and adds s to the
+ * rollups.
+ */
+void
+history_append(struct history *h, const struct sensors *s)
+{
+	struct hist_header *hdr = h->hdr;
+	struct hist_sample *hs;
+	uint64_t n = atomic_load_explicit(&hdr->head[HIST_SAMPLES], memory_order_relaxed);
+
+	hs = hist_slot(h, HIST_SAMPLES, n);
+	slot_begin(&hs->seq);
+	hs->n = n;
+	hs->s = *s;
+	slot_end(&hs->seq);
+	atomic_store_explicit(&hdr->head[HIST_SAMPLES], n + 1, memory_order_release);
+
+	rollup_add(h, HIST_MINUTES, s);
+	rollup_add(h, HIST_HOURS, s);
+}
+
+
+/*
+ * history_map(const char *path)
+ *
+ * path = History file to read
+ *
+ * Maps a history file read-only; it may be being written to at the same
+ * time.  See history_read().
+ *
+ * Returns a handle, or NULL with errno set.
+ */
+struct history *
+history_map(const char *path)
+{
+	struct history *h;
+	struct stat st;
+	void *p;
+	int fd, saved;
+
+	VERBOSE("history_map(path = %s)\n", path);
+
+	if ((h = calloc(1, sizeof(*h))) == NULL) {
+		return (NULL);
+	}
+	h->fd = -1;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		goto fail;
+	}
+	if (fstat(fd, &st) == -1) {
+		saved = errno;
+		close(fd);
+		errno = saved;
+		goto fail;
+	}
+	if ((size_t)st.st_size < sizeof(struct hist_header)) {
+		close(fd);
+		errno = EINVAL;
+		goto fail;
+	}
+
+	h->size = (size_t)st.st_size;
+	p = mmap(NULL, h->size, PROT_READ, MAP_SHARED, fd, 0);
+	saved = errno;
+	close(fd);
+	if (p == MAP_FAILED) {
+		errno = saved;
+		goto fail;
+	}
+	h->hdr = p;
+
+	if (!hist_header_ok(h->hdr, h->size)) {
+		saved = errno;
+		munmap(p, h->size);
+		errno = saved;
+		goto fail;
+	}
+	return (h);
+
+fail:
+	saved = errno;
+	free(h);
+	errno = saved;
+	return (NULL);
+}
+
+
+/*
+ * history_board(const struct history *h, const char **maker,
+ *               const char **product)
+ *
+ *       h = Handle returned by history_map()
+ *   maker = Set to the maker of the board the history is of
+ * product = Set to its product
+ */
+void
+history_board(const struct history *h, const char **maker, const char **product)
+{
+	*maker = h->hdr->maker;
+	*product = h->hdr->product;
+}
+
+
+/*
+ * history_read(const struct history *h, const int ring, const int stat,
+ *              const int64_t from, const int64_t to, struct sensors **out)
+ *
+ *    h = Handle returned by history_map()
+ * ring = One of hist_periods_e
+ * stat = For rollups, one of hist_stats_e
+ * from = Earliest time wanted (CLOCK_REALTIME, ns)
+ *   to = Latest time wanted
+ *  out = Set to an array of what's in the file between from and to, to
+ *        be free()d
+ *
+ * Copies out every sample, or for a rollup ring the stat of every period
+ * (stamped with its start; see rollup_sensors()), from the oldest to the
+ * latest.  The latest rollup's period is usually still going on.  A slot
+ * which the writer replaced while we were reading is left out.
+ *
+ * Returns the number of entries in *out, or -1 with errno set.
+ */
+ssize_t
+history_read(const struct history *h, const int ring, const int stat,
+    const int64_t from, const int64_t to, struct sensors **out)
+{
+	const struct hist_header *hdr = h->hdr;
+	struct hist_sample hs;
+	struct hist_rollup r;
+	struct sensors *s;
+	uint64_t head, n;
+	size_t k = 0;
+	const void *slot;
+
+	VERBOSE("history_read(h = %p, ring = %d, stat = %d, from = %" PRId64 ", to = %" PRId64 ")\n",
+		h, ring, stat, from, to);
+
+	if (ring < 0 || ring >= HIST_RINGS) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	head = atomic_load_explicit(&hdr->head[ring], memory_order_acquire);
+	n = (head > hdr->nslots[ring] ? head - hdr->nslots[ring] : 0);
+
+	if ((s = calloc((size_t)(head - n) + 1, sizeof(*s))) == NULL) {
+		return (-1);
+	}
+
+	for (; n < head; ++n) {
+		slot = hist_slot(h, ring, n);
+		if (ring == HIST_SAMPLES) {
+			if (slot_read(&((const struct hist_sample *)slot)->seq, &hs, slot, sizeof(hs)) == -1 ||
+			    hs.n != n || hs.s.time < from || hs.s.time > to) {
+				continue;
+			}
+			s[k++] = hs.s;
+		} else {
+			if (slot_read(&((const struct hist_rollup *)slot)->seq, &r, slot, sizeof(r)) == -1 ||
+			    r.n != n || r.time < from || r.time > to) {
+				continue;
+			}
+			rollup_sensors(&r, stat, &s[k++]);
+		}
+	}
+
+	*out = s;
+	VERBOSE("history_read() returning %zu\n", k);
+	return ((ssize_t)k);
+}
+
+
+/*
+ * history_close(struct history *h)
+ *
+ * h = Handle returned by history_open() or history_map(), or NULL
+ */
+void
+history_close(struct history *h)
+{
+	if (h != NULL) {
+		munmap(h->hdr, h->size);
+		if (h->fd != -1) {
+			close(h->fd);
+		}
+		free(h);
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * libbsdhwmon: board lookup, sampling, and output, without the command
+ * line around it.  global.h must be included first.
+ *
+ * The library keeps no mutable state in globals, apart from the debugging
+ * trace (trace.c).  Everything needed to sample a board (the open bus,
+ * the compiled register plan, and the register scratch space) lives in
+ * the struct hwmon returned by hwmon_open(), so any number of them can
+ * be used at once, e.g. one per thread, each on its own bus.  A single
+ * struct hwmon, struct outfmt, or struct boarddb must not be used by two
+ * threads at the same time.
+ *
+ * Nothing in the library exits.  Failures are returned as -1 or NULL
+ * with errno set.  The process-wide knobs are f_verbose (see TRACE() in
+ * global.h) and trace_ring(), debugging switches which should only be
+ * set before any threads are started.
+ */
+
+#ifndef HWMON_H
+#define HWMON_H
+
+struct hwmon;
+struct hwmon_group;
+
+/*
+ * Functions (collect.c)
+ */
+struct hwmon *	hwmon_open(const char *, const struct board *);
+int		hwmon_sample(struct hwmon *, struct sensors *);
+const struct regmap *	hwmon_regmap(const struct hwmon *);
+const struct board *	hwmon_board(const struct hwmon *);
+u_long		hwmon_xfers(const struct hwmon *);
+int		hwmon_stats_enable(struct hwmon *);
+const struct smbus_stats *	hwmon_stats(const struct hwmon *);
+void		hwmon_timings(struct hwmon *, struct timings *);
+void		hwmon_close(struct hwmon *);
+int		sensors_decode(const struct board *, const struct regmap *,
+		    struct sensors *);
+
+/*
+ * Functions (multibus.c)
+ */
+struct hwmon_group *	hwmon_group_new(struct hwmon *const *, const size_t);
+int		hwmon_group_sample(struct hwmon_group *, struct sensors *, int *);
+void		hwmon_group_free(struct hwmon_group *);
+
+/*
+ * Functions (busstats.c)
+ */
+int		stats_print(FILE *, const struct smbus_stats *, const char *);
+
+/*
+ * Functions (timings.c)
+ */
+void		timings_start(struct timings *);
+void		timings_mark(struct timings *, const int);
+int		timings_print(FILE *, const struct timings *, const int);
+
+/*
+ * Functions (trace.c)
+ */
+int		trace_ring(const size_t);
+void		trace_dump(FILE *);
+void		trace_dump_request(void);
+
+/*
+ * Functions (lookup.c)
+ */
+const struct board *	board_lookup(const char *, const char *);
+const struct boardtab *	board_table(void);
+
+/*
+ * Functions (boarddb.c)
+ */
+struct boarddb *	boarddb_open(const char *, char *, const size_t);
+const struct board *	boarddb_lookup(struct boarddb *, const char *, const char *);
+const struct boardtab *	boarddb_table(struct boarddb *);
+ssize_t		boarddb_compile(const char *, const char *, char *, const size_t);
+void		boarddb_close(struct boarddb *);
+
+/*
+ * Functions (output.c)
+ */
+const char *	get_chip_string(const size_t);
+int		list_models(FILE *, const struct boardtab *);
+struct outfmt *	outfmt_new(const struct board *, const int);
+struct outfmt *	outfmt_new_buses(const struct board *const *,
+		    const char *const *, const size_t, const int);
+struct outfmt *	outfmt_new_timed(const struct board *, const int);
+int		outfmt_stats(struct outfmt *, const struct smbus_stats *const *,
+		    const char *const *, const size_t);
+void		outfmt_free(struct outfmt *);
+const char *	sensors_render(struct outfmt *, const struct sensors *,
+		    const int, size_t *);
+int		sensors_output(struct outfmt *, const struct sensors *,
+		    const int, const int);
+int		sensors_output_file(struct outfmt *, const struct sensors *,
+		    const char *);
+int		sensors_output_series(struct outfmt *, const struct sensors *,
+		    const size_t, const int);
+
+#endif /* HWMON_H */
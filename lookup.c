@@ -0,0 +1,359 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#if defined(__FreeBSD__)
+#include <sys/sysctl.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#if defined(__FreeBSD__)
+#include <kenv.h>
+#else
+#define KENV_MVALLEN	128		/* See <kenv.h> on FreeBSD */
+#endif
+#include "global.h"
+#include "boardidx.h"		/* Generated by mkboardidx; see Makefile */
+
+/*
+ * Function prototypes
+ */
+const struct board *	board_lookup(const char *, const char *);
+const struct boardtab *	board_table(void);
+void		board_trace(const struct board *);
+static void	boottime(int64_t *, int64_t *);
+const struct board *	board_cache_load(const char *, struct boarddb *);
+int		board_cache_save(const char *, const struct board *);
+int		board_cache_flush(const char *);
+
+/*
+ * External functions (boardidx.c)
+ */
+extern size_t	boardidx_probe(const struct boardidx *, const char *,
+		    const char *);
+
+/*
+ * External functions (boarddb.c)
+ */
+extern const struct board *	boarddb_board(struct boarddb *, const size_t);
+extern uint32_t	boarddb_fingerprint(const struct boarddb *);
+extern size_t	boarddb_count(const struct boarddb *);
+
+/*
+ * External functions (output.c)
+ */
+extern const char *get_chip_string(const size_t);
+
+
+/*
+ * board_lookup(const char *maker, const char *product)
+ *
+ *   maker = ASCII string; smbios.planar.maker kenv(2)
+ * product = ASCII string; smbios.planar.product kenv(2)
+ *
+ * Looks up maker and product in the built-in board table, using the
+ * index over it generated at build time (see boardidx.c and
+ * mkboardidx.c).  Both strings must match for successful detection.
+ *
+ * If a match is found, returns a pointer to the board structure which
+ * will be used (e.g. &boardtab.boards[bidx]).
+ *
+ * Otherwise, return NULL (no match).
+ */
+const struct board *
+board_lookup(const char *maker, const char *product)
+{
+	size_t bidx;
+	const struct board *b;
+
+	VERBOSE("board_lookup(maker = %p, product = %p)\n", maker, product);
+
+	VERBOSE("\tmaker   = %s\n", maker);
+	VERBOSE("\tproduct = %s\n", product);
+
+	bidx = boardidx_probe(&boardidx, maker, product);
+	if (bidx == BOARDIDX_NONE) {
+		VERBOSE("board_lookup() returning NULL\n");
+		return (NULL);
+	}
+	b = &boardtab.boards[bidx];
+	if (strncmp(maker, BOARD_MAKER(b), KENV_MVALLEN) != 0 ||
+	    strncmp(product, BOARD_PRODUCT(b), KENV_MVALLEN) != 0) {
+		VERBOSE("board_lookup() returning NULL\n");
+		return (NULL);
+	}
+	board_trace(b);
+
+	VERBOSE("board_lookup() returning %p\n", b);
+	return (b);
+}
+
+
+/*
+ * board_table(void)
+ *
+ * Returns the built-in board table (see struct boardtab in global.h).
+ */
+const struct boardtab *
+board_table(void)
+{
+	return (&boardtab);
+}
+
+
+/*
+ * board_trace(const struct board *b)
+ *
+ * b = Board found by board_lookup() or boarddb_lookup()
+ *
+ * Shows everything in b at -v.
+ */
+void
+board_trace(const struct board *b)
+{
+	static const char *const kinds[BOARD_KINDS] = { "voltages", "temps", "fans" };
+	const struct pinmap *p;
+	const struct vcoef *v;
+	size_t k, i;
+
+	VERBOSE("\tboards struct: %p (table %p)\n", b, b->tab);
+	VERBOSE("\t\tchip  = %s\n", get_chip_string(b->chip));
+	VERBOSE("\t\tslave = 0x%02x\n", b->slave);
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		p = BOARD_PINS(b, SENSOR_VOLT + k);
+		VERBOSE("\t%s: %u pins at %u\n", kinds[k], b->npins[k], b->pins[k]);
+		for (i = 0; i < b->npins[k]; ++i) {
+			VERBOSE("\t\tb->%s[%zu] = %u, %s\n", kinds[k], i,
+				p[i].index,
+				BOARD_LABEL(b, &p[i])
+			);
+		}
+	}
+
+	v = BOARD_VCOEF(b);
+	VERBOSE("\tvcoef: %u corrections at %u\n", b->nvcoef, b->vcoef);
+	for (i = 0; i < b->nvcoef; ++i) {
+		VERBOSE("\t\tb->vcoef[%zu] = %u, %" PRId32 " mV/count, %+" PRId32 " mV\n", i,
+			v[i].index,
+			v[i].scale,
+			v[i].offset
+		);
+	}
+}
+
+
+/*
+ * boottime(int64_t *sec, int64_t *usec)
+ *
+ *  sec = Filled in with seconds part of kern.boottime
+ * usec = Filled in with microseconds part of kern.boottime
+ *
+ * Where kern.boottime isn't available both are set to 0, so a cache
+ * entry is only invalidated by a board list change or --flush-cache.
+ */
+static void
+boottime(int64_t *sec, int64_t *usec)
+{
+#if defined(__FreeBSD__)
+	struct timeval tv;
+	size_t len = sizeof(tv);
+
+	if (sysctlbyname("kern.boottime", &tv, &len, NULL, 0) == 0 &&
+	    len == sizeof(tv)) {
+		*sec = tv.tv_sec;
+		*usec = tv.tv_usec;
+		return;
+	}
+#endif
+	*sec = 0;
+	*usec = 0;
+}
+
+
+/*
+ * board_cache_load(const char *path, struct boarddb *db)
+ *
+ * path = Board cache file written by board_cache_save()
+ *   db = Board database in use (see boarddb.c), or NULL for boardlist[]
+ *
+ * Returns the board recorded in the cache file if the file is valid and
+ * still applies to this boot and this board list, so that SMBIOS probing
+ * can be skipped.  Since bsdhwmon may be setuid root and the board picks
+ * which chip registers get touched, the file must be a regular file
+ * owned by the effective user and writable by nobody else.
+ *
+ * Returns NULL if there's no usable cache (every reason is a miss, not
+ * an error; see -v output for which).
+ */
+const struct board *
+board_cache_load(const char *path, struct boarddb *db)
+{
+	struct bcache c;
+	struct stat st;
+	const struct board *b;
+	int64_t sec, usec;
+	ssize_t len;
+	int fd;
+
+	VERBOSE("board_cache_load(path = %s, db = %p)\n", path, db);
+
+	if ((fd = open(path, O_RDONLY|O_NOFOLLOW)) == -1) {
+		VERBOSE("\tmiss: open: %s\n", strerror(errno));
+		return (NULL);
+	}
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() || (st.st_mode & (S_IWGRP|S_IWOTH)) != 0) {
+		VERBOSE("\tmiss: not a regular file owned by uid %u, mode 0644 or stricter\n",
+			(u_int)geteuid());
+		close(fd);
+		return (NULL);
+	}
+
+	len = read(fd, &c, sizeof(c));
+	close(fd);
+	if (len != (ssize_t)sizeof(c)) {
+		VERBOSE("\tmiss: short read (%zd bytes)\n", len);
+		return (NULL);
+	}
+
+	if (memcmp(c.magic, BCACHE_MAGIC, sizeof(c.magic)) != 0 ||
+	    c.version != BCACHE_VERSION) {
+		VERBOSE("\tmiss: bad magic or version\n");
+		return (NULL);
+	}
+
+	if (c.fingerprint != (db != NULL ? boarddb_fingerprint(db) : boardtab.fingerprint) ||
+	    c.bidx >= (db != NULL ? boarddb_count(db) : boardtab.nboards)) {
+		VERBOSE("\tmiss: board list changed\n");
+		return (NULL);
+	}
+
+	boottime(&sec, &usec);
+	if (c.boot_sec != sec || c.boot_usec != usec) {
+		VERBOSE("\tmiss: written during a different boot\n");
+		return (NULL);
+	}
+
+	if ((b = (db != NULL ? boarddb_board(db, c.bidx) : &boardtab.boards[c.bidx])) == NULL) {
+		VERBOSE("\tmiss: board %u: %s\n", c.bidx, strerror(errno));
+		return (NULL);
+	}
+
+	if (strncmp(c.maker, BOARD_MAKER(b), sizeof(c.maker)) != 0 ||
+	    strncmp(c.product, BOARD_PRODUCT(b), sizeof(c.product)) != 0) {
+		VERBOSE("\tmiss: board %u doesn't match cached strings\n", c.bidx);
+		return (NULL);
+	}
+
+	VERBOSE("board_cache_load() returning board %u (%s %s)\n", c.bidx,
+		BOARD_MAKER(b), BOARD_PRODUCT(b));
+	return (b);
+}
+
+
+/*
+ * board_cache_save(const char *path, const struct board *b)
+ *
+ * path = Board cache file to (re)write
+ *    b = Board found by board_lookup() or boarddb_lookup(); its table
+ *        says which board list it's from
+ *
+ * Writes the cache to a temporary file next to path and renames it into
+ * place, so a concurrent board_cache_load() sees either the old or the
+ * new cache, never a partial one.
+ *
+ * path is the user's choice, so when bsdhwmon is setuid (the effective
+ * user isn't the real one) nothing is written: replacing any file the
+ * effective user can is not something to hand to whoever runs us.
+ *
+ * Returns 0 on success, or -1 with errno set (EPERM if setuid).
+ */
+int
+board_cache_save(const char *path, const struct board *b)
+{
+	struct bcache c;
+	char tmp[PATH_MAX];
+	int fd, saved;
+
+	VERBOSE("board_cache_save(path = %s, b = %p)\n", path, b);
+
+	memset(&c, 0, sizeof(c));
+	memcpy(c.magic, BCACHE_MAGIC, sizeof(c.magic));
+	c.version = BCACHE_VERSION;
+	c.fingerprint = b->tab->fingerprint;
+	c.bidx = (uint32_t)(b - b->tab->boards);
+	boottime(&c.boot_sec, &c.boot_usec);
+	snprintf(c.maker, sizeof(c.maker), "%s", BOARD_MAKER(b));
+	snprintf(c.product, sizeof(c.product), "%s", BOARD_PRODUCT(b));
+
+	if (geteuid() != getuid()) {
+		errno = EPERM;
+		return (-1);
+	}
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	if ((fd = mkstemp(tmp)) == -1) {
+		return (-1);
+	}
+
+	if (fchmod(fd, 0644) == -1 ||
+	    write(fd, &c, sizeof(c)) != (ssize_t)sizeof(c)) {
+		saved = errno;
+		close(fd);
+		unlink(tmp);
+		errno = saved;
+		return (-1);
+	}
+
+	if (close(fd) == -1 || rename(tmp, path) == -1) {
+		saved = errno;
+		unlink(tmp);
+		errno = saved;
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * board_cache_flush(const char *path)
+ *
+ * path = Board cache file to remove
+ *
+ * Refuses to remove anything when setuid, as board_cache_save() refuses
+ * to write.
+ *
+ * Returns 0 if the cache is gone (including if it never existed), or -1
+ * with errno set (EPERM if setuid).
+ */
+int
+board_cache_flush(const char *path)
+{
+	VERBOSE("board_cache_flush(path = %s)\n", path);
+
+	if (geteuid() != getuid()) {
+		errno = EPERM;
+		return (-1);
+	}
+
+	if (unlink(path) == -1 && errno != ENOENT) {
+		return (-1);
+	}
+	return (0);
+}
@@ -4,63 +4,190 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <limits.h>
 #include <sys/param.h>
-#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
-#include <kenv.h>
 #include <paths.h>
 #include <err.h>
 #include <errno.h>
-#include <osreldate.h>
 #include <sysexits.h>
+#include <signal.h>
+#if defined(__FreeBSD__)
+#include <kenv.h>
+#else
+#define KENV_MVALLEN	128		/* See <kenv.h> on FreeBSD */
+#endif
 #include "global.h"
+#include "hwmon.h"
 
 /*
  * Function prototypes
  */
 static void	USAGE(void);
+static long	parse_number(const char *, const char *, long, long);
+static void	parse_deadband(const char *, double *);
+static int64_t	parse_time(const char *, const char *, const time_t);
+static void	parse_range(const char *, int64_t *, int64_t *);
+static void	parse_rollup(const char *, int *, int *);
+static void	parse_device(char *);
+static int	smbios_get(const char *, char *);
+static int	output_format(void);
+static int	sensors_print(struct outfmt *, const struct sensors *,
+		    const long);
+static const struct board *	lookup(const char *, const char *);
+static int	replay(const char *);
+static int	history(const char *);
+static void	interval_sleep(struct timespec *, const long);
+static void	trace_signal(int);
+static void	trace_exit(void);
 
 /*
- * External functions (boards.c)
+ * External functions (lookup.c; the rest are in hwmon.h)
  */
-extern struct board *	board_lookup(const char *, const char *);
+extern const struct board *	board_cache_load(const char *, struct boarddb *);
+extern int	board_cache_save(const char *, const struct board *);
+extern int	board_cache_flush(const char *);
 
 /*
- * External functions (output.c)
+ * External functions (dump.c)
  */
-extern void	sensors_output(struct board *, struct sensors *);
-extern void	sensors_output_delim(struct board *, struct sensors *);
-extern void	sensors_output_json(struct board *, struct sensors *);
-extern void	list_models(struct board *);
+extern int	dump_open(const char *);
+extern int	dump_write(int, const char *, const char *, const struct regmap *);
+extern const struct dump_record *	dump_map(const char *, size_t *, size_t *);
+extern void	dump_unmap(const struct dump_record *, size_t);
 
 /*
- * External functions (chip_XXX.c)
+ * External functions (server.c)
  */
-extern int	w83627hf_main(int, const int, struct sensors *);
-extern int	w83792d_main(int, const int, struct sensors *);
-extern int	w83793g_main(int, const int, struct sensors *);
-extern int	x6dva_main(int, struct sensors *);
+extern int	server_run(struct hwmon *, struct sensors *, struct shmsnap *,
+		    struct history *, const long, const char *, const int,
+		    const double *);
+extern int	client_run(const char *, const int);
+extern int	client_subscribe(const char *);
 
 /*
- * External variables (boards.c)
+ * External functions (shmsnap.c)
  */
-extern struct board	boardlist;
+extern struct shmsnap *	shmsnap_create(const char *, const struct board *, const long);
+extern void	shmsnap_publish(struct shmsnap *, const struct sensors *);
+extern void	shmsnap_close(struct shmsnap *);
+
+/*
+ * External functions (history.c)
+ */
+extern struct history *	history_open(const char *, const struct board *);
+extern void	history_append(struct history *, const struct sensors *);
+extern struct history *	history_map(const char *);
+extern void	history_board(const struct history *, const char **,
+		    const char **);
+extern ssize_t	history_read(const struct history *, const int, const int,
+		    const int64_t, const int64_t, struct sensors **);
+extern void	history_close(struct history *);
+
+/*
+ * External functions (smbus_io.c)
+ */
+extern const struct smbus_backend *	smbus_backend(const char *);
 
 /*
  * Global variables
  */
 #define DEFAULT_SMBDEV	_PATH_DEV "smb0"
+#define DEFAULT_SOCKET	_PATH_VARRUN "bsdhwmon.sock"
+#define DEFAULT_SERVER_INTERVAL	5	/* Seconds, for --server without -i */
+#define DEFAULT_BOARDDB	"/usr/local/etc/bsdhwmon.db"
 
 /*
- * smbfd needs to be pre-initialised to -1 for proper error handling
- * scenarios during start-up (see comment near top of main())
+ * Long-only command line flags
  */
-static int	smbfd = -1;			/* File descriptor for /dev/smbXXX */
+enum {
+	OPT_DUMP = 256,
+	OPT_REPLAY,
+	OPT_CACHE,
+	OPT_FLUSH_CACHE,
+	OPT_OPENMETRICS,
+	OPT_TEXTFILE,
+	OPT_SERVER,
+	OPT_CLIENT,
+	OPT_HTTP,
+	OPT_SHM,
+	OPT_SUBSCRIBE,
+	OPT_DEADBAND,
+	OPT_STATS,
+	OPT_TIMINGS,
+	OPT_TRACE_RING,
+	OPT_BOARD_DB,
+	OPT_COMPILE_DB,
+	OPT_HISTORY_LOG,
+	OPT_HISTORY,
+	OPT_RANGE,
+	OPT_ROLLUP
+};
+
+static const struct option longopts[] = {
+	{ "dump",	required_argument,	NULL,	OPT_DUMP },
+	{ "replay",	required_argument,	NULL,	OPT_REPLAY },
+	{ "cache",	required_argument,	NULL,	OPT_CACHE },
+	{ "flush-cache", no_argument,		NULL,	OPT_FLUSH_CACHE },
+	{ "openmetrics", no_argument,		NULL,	OPT_OPENMETRICS },
+	{ "textfile",	required_argument,	NULL,	OPT_TEXTFILE },
+	{ "server",	optional_argument,	NULL,	OPT_SERVER },
+	{ "client",	optional_argument,	NULL,	OPT_CLIENT },
+	{ "http",	required_argument,	NULL,	OPT_HTTP },
+	{ "shm",	required_argument,	NULL,	OPT_SHM },
+	{ "subscribe",	optional_argument,	NULL,	OPT_SUBSCRIBE },
+	{ "deadband",	required_argument,	NULL,	OPT_DEADBAND },
+	{ "stats",	no_argument,		NULL,	OPT_STATS },
+	{ "timings",	no_argument,		NULL,	OPT_TIMINGS },
+	{ "trace-ring",	required_argument,	NULL,	OPT_TRACE_RING },
+	{ "board-db",	required_argument,	NULL,	OPT_BOARD_DB },
+	{ "compile-db",	required_argument,	NULL,	OPT_COMPILE_DB },
+	{ "history-log", required_argument,	NULL,	OPT_HISTORY_LOG },
+	{ "history",	required_argument,	NULL,	OPT_HISTORY },
+	{ "range",	required_argument,	NULL,	OPT_RANGE },
+	{ "rollup",	required_argument,	NULL,	OPT_ROLLUP },
+	{ NULL,		0,			NULL,	0 }
+};
+
 static int	comma_output = 0;		/* Command line flag "-c" */
 static int	json_output = 0;		/* Command line flag "-J" */
-const char *	smbdev = DEFAULT_SMBDEV;	/* Command line flag "-f", otherwise /dev/smb0 */
-int		f_verbose = 0;			/* Command line flag "-v" */
+static int	openmetrics_output = 0;		/* Command line flag "--openmetrics" */
+static const char *	textfile = NULL;	/* Command line flag "--textfile" */
+static const char *	serversock = NULL;	/* Command line flag "--server" */
+static const char *	clientsock = NULL;	/* Command line flag "--client" */
+static long	httpport = 0;			/* Command line flag "--http" */
+static const char *	shmname = NULL;		/* Command line flag "--shm" */
+static const char *	subsock = NULL;		/* Command line flag "--subscribe" */
+static int	deadband_set = 0;		/* Command line flag "--deadband" */
+static double	deadband[3] = { 0, 0, 0 };	/* C, RPM, V; see server.c */
+static long	interval = 0;			/* Command line flag "-i" */
+static long	count = 0;			/* Command line flag "-n" */
+static const char *	dumpfile = NULL;	/* Command line flag "--dump" */
+static const char *	replayfile = NULL;	/* Command line flag "--replay" */
+static const char *	cachefile = NULL;	/* Command line flag "--cache" */
+static int	flush_cache = 0;		/* Command line flag "--flush-cache" */
+static int	stats = 0;			/* Command line flag "--stats" */
+static int	timings = 0;			/* Command line flag "--timings" */
+static long	tracering = 0;			/* Command line flag "--trace-ring" */
+static const char *	boarddbfile = NULL;	/* Command line flag "--board-db" */
+static const char *	compiledb = NULL;	/* Command line flag "--compile-db" */
+static const char *	histlog = NULL;		/* Command line flag "--history-log" */
+static const char *	histfile = NULL;	/* Command line flag "--history" */
+static const char *	histrange = NULL;	/* Command line flag "--range" */
+static const char *	histrollup = NULL;	/* Command line flag "--rollup" */
+static int	list_boards = 0;		/* Command line flag "-l" */
+static struct boarddb *	db = NULL;		/* Board database, else boardlist[] */
+static volatile sig_atomic_t	quit = 0;	/* Set by SIGINT/SIGTERM with --trace-ring */
+static const char *	smbdevs[BUS_MAX];	/* Command line flag "-f", otherwise /dev/smb0 */
+static const char *	busmakers[BUS_MAX];	/* "-f DEVICE@MAKER:PRODUCT", else NULL */
+static const char *	busproducts[BUS_MAX];
+static size_t	nbus = 0;			/* Number of "-f" flags */
+const char *	board_maker = NULL;		/* Command line flag "-M" */
+const char *	board_product = NULL;		/* Command line flag "-P" */
 
 
 static void
@@ -72,25 +199,626 @@ USAGE(void)
 		"Options:\n"
 		"  -J            JSON-formatted output\n"
 		"  -c            comma-delimited output\n"
+		"  --openmetrics OpenMetrics (Prometheus) exposition output\n"
+		"  --textfile FILE\n"
+		"                atomically replace FILE with each sample instead of writing\n"
+		"                to stdout (default format: OpenMetrics)\n"
 		"  -f DEVICE     use DEVICE as smb(4) device (default: " DEFAULT_SMBDEV ")\n"
+		"  -f sim:FILE[,latency=USEC]\n"
+		"                simulate the SMBus using register images from FILE\n"
+		"  -f DEVICE@MAKER:PRODUCT\n"
+		"                DEVICE has motherboard MAKER PRODUCT on it; -f may be given\n"
+		"                up to %d times, to sample several buses at once\n"
+		"  -i SECONDS    keep running, sampling every SECONDS seconds\n"
 		"  -l            list supported motherboard ID strings\n"
+		"  -n COUNT      with -i, exit after COUNT samples (default: run forever)\n"
+		"  -M MAKER      use MAKER as motherboard maker, instead of SMBIOS\n"
+		"  -P PRODUCT    use PRODUCT as motherboard product, instead of SMBIOS\n"
+		"  --dump FILE   append raw chip registers of each sample to FILE\n"
+		"  --replay FILE decode and output samples from a --dump FILE; no SMBus access\n"
+		"  --server[=SOCKET]\n"
+		"                keep sampling (every -i seconds, default %d) and serve the\n"
+		"                latest sample on SOCKET (default: " DEFAULT_SOCKET ")\n"
+		"  --http PORT   with --server, also serve HTTP on 127.0.0.1:PORT\n"
+		"  --deadband C,RPM,V\n"
+		"                with --server, how far each kind of sensor must move to\n"
+		"                be sent to subscribers (default: 0,0,0; any change)\n"
+		"  --client[=SOCKET]\n"
+		"                get the latest sample from a --server; no SMBus access\n"
+		"  --subscribe[=SOCKET]\n"
+		"                print sensor changes pushed by a --server, in -c format\n"
+		"  --shm NAME    with -i or --server, also publish every sample in the\n"
+		"                shared memory object NAME (see bsdhwmon_shm.h)\n"
+		"  --history-log FILE\n"
+		"                with -i or --server, also record every sample in FILE, a\n"
+		"                fixed-size ring kept with 1-minute and 1-hour rollups\n"
+		"  --history FILE\n"
+		"                output the samples recorded in a --history-log FILE; no\n"
+		"                SMBus access\n"
+		"  --range FROM[,TO]\n"
+		"                with --history, only those from FROM to TO (default: now);\n"
+		"                each is seconds since the Epoch, YYYY-MM-DDTHH:MM:SSZ,\n"
+		"                now, or -N followed by s, m, h, or d (that long ago)\n"
+		"  --rollup minute|hour[,mean|min|max]\n"
+		"                with --history, output the 1-minute or 1-hour rollups\n"
+		"                instead (default: mean)\n"
+		"  --cache FILE  remember the detected motherboard in FILE across runs\n"
+		"  --flush-cache discard the --cache FILE contents and detect again\n"
+		"  --stats       count SMBus transactions and their latency per slave and\n"
+		"                register; added to OpenMetrics output, else printed to\n"
+		"                stderr after the last sample\n"
+		"  --timings     print how long each phase of a one-shot run took to stderr\n"
+		"                (as JSON with -J)\n"
+		"  --trace-ring RECORDS\n"
+		"                keep the last RECORDS lines of -v output in memory, and\n"
+		"                print them to stderr on exit or SIGUSR1\n"
+		"  --board-db FILE\n"
+		"                use the board database FILE instead of the built-in list\n"
+		"                (default: " DEFAULT_BOARDDB ", if it exists)\n"
+		"  --compile-db TEXT\n"
+		"                compile the board database TEXT into the --board-db FILE\n"
 		"  -h            print this message\n"
-		"  -v            be verbose (show debugging output)\n"
+		"  -v            be verbose (show debugging output); -vv also traces every\n"
+		"                SMBus transaction\n"
 		"\n"
 		"https://github.com/koitsu/bsdhwmon\n"
-		"Report bugs at https://github.com/koitsu/bsdhwmon/issues\n"
+		"Report bugs at https://github.com/koitsu/bsdhwmon/issues\n",
+		BUS_MAX, DEFAULT_SERVER_INTERVAL
 	);
 	exit(EX_USAGE);
 }
 
 
+/*
+ * parse_number(const char *flag, const char *str, long min, long max)
+ *
+ * flag = Command line flag being parsed (used in error messages)
+ *  str = ASCII string to convert
+ *  min = Smallest acceptable value
+ *  max = Largest acceptable value
+ *
+ * Converts a command line argument to a number, exiting with EX_USAGE
+ * if the string is not a number or falls outside of min/max.
+ *
+ * Returns the converted number.
+ */
+static long
+parse_number(const char *flag, const char *str, long min, long max)
+{
+	char *ep;
+	long n;
+
+	errno = 0;
+	n = strtol(str, &ep, 10);
+
+	if (errno != 0 || ep == str || *ep != '\0' || n < min || n > max) {
+		errx(EX_USAGE, "%s: invalid value \"%s\" (must be %ld-%ld)",
+			flag, str, min, max);
+	}
+	return (n);
+}
+
+
+/*
+ * parse_deadband(const char *str, double *db)
+ *
+ * str = Argument of --deadband: "C,RPM,V"
+ *  db = Array of 3 values; filled in
+ *
+ * Each of the three is a non-negative number; a sensor must move by
+ * more than its kind's deadband for subscribers to be sent it.  Invalid
+ * input results in exit(EX_USAGE), like parse_number().
+ */
+static void
+parse_deadband(const char *str, double *db)
+{
+	const char *p = str;
+	char *ep;
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		errno = 0;
+		db[i] = strtod(p, &ep);
+		if (errno != 0 || ep == p || !(db[i] >= 0) ||
+		    *ep != (i < 2 ? ',' : '\0')) {
+			errx(EX_USAGE, "--deadband: invalid value \"%s\" (must be C,RPM,V; e.g. 1,100,0.05)",
+				str);
+		}
+		p = ep + 1;
+	}
+}
+
+
+/*
+ * parse_time(const char *flag, const char *str, const time_t now)
+ *
+ * flag = Command line flag being parsed (used in error messages)
+ *  str = Time: seconds since the Epoch, "YYYY-MM-DDTHH:MM:SSZ" (UTC, as
+ *        --history prints it), "now", or "-N" followed by s, m, h, or d,
+ *        for N seconds, minutes, hours, or days before now
+ *  now = The current time
+ *
+ * Invalid input results in exit(EX_USAGE), like parse_number().
+ *
+ * Returns the time in nanoseconds, as in struct sensors.
+ */
+static int64_t
+parse_time(const char *flag, const char *str, const time_t now)
+{
+	static const struct {
+		char	unit;
+		int64_t	secs;
+	} units[] = {
+		{ 's',	1 },
+		{ 'm',	60 },
+		{ 'h',	3600 },
+		{ 'd',	86400 },
+	};
+	struct tm tm;
+	int64_t t = -1;
+	char *ep;
+	char z, extra;
+	long n;
+	size_t i;
+
+	if (strcmp(str, "now") == 0) {
+		t = now;
+	} else if (str[0] == '-') {
+		errno = 0;
+		n = strtol(str + 1, &ep, 10);
+		for (i = 0; i < sizeof(units) / sizeof(units[0]) && units[i].unit != *ep; ++i)
+			;
+		if (errno == 0 && ep != str + 1 && n >= 0 && n <= 1000000000 &&
+		    i < sizeof(units) / sizeof(units[0]) && ep[1] == '\0') {
+			t = MAX(now - n * units[i].secs, 0);
+		}
+	} else if (strchr(str, '-') != NULL) {
+		memset(&tm, 0, sizeof(tm));
+		if (sscanf(str, "%4d-%2d-%2dT%2d:%2d:%2d%c%c", &tm.tm_year, &tm.tm_mon,
+		    &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &z, &extra) == 7 &&
+		    z == 'Z' && tm.tm_year >= 1970) {
+			tm.tm_year -= 1900;
+			tm.tm_mon -= 1;
+			t = timegm(&tm);
+		}
+	} else {
+		errno = 0;
+		n = strtol(str, &ep, 10);
+		if (errno == 0 && ep != str && *ep == '\0' && n >= 0) {
+			t = n;
+		}
+	}
+
+	if (t < 0 || t > INT64_MAX / 1000000000) {
+		errx(EX_USAGE, "%s: invalid time \"%s\" (must be seconds since the Epoch, YYYY-MM-DDTHH:MM:SSZ, now, or -N[smhd])",
+			flag, str);
+	}
+	return (t * 1000000000);
+}
+
+
+/*
+ * parse_range(const char *str, int64_t *from, int64_t *to)
+ *
+ *  str = Argument of --range: "FROM" or "FROM,TO"; see parse_time()
+ * from = Filled in with FROM
+ *   to = Filled in with TO, or with no TO, the end of the current second
+ *
+ * Invalid input results in exit(EX_USAGE), like parse_number().
+ */
+static void
+parse_range(const char *str, int64_t *from, int64_t *to)
+{
+	char buf[64];
+	char *comma;
+	time_t now = time(NULL);
+
+	if (snprintf(buf, sizeof(buf), "%s", str) >= (int)sizeof(buf)) {
+		errx(EX_USAGE, "--range: invalid value \"%s\" (must be FROM[,TO])", str);
+	}
+	if ((comma = strchr(buf, ',')) != NULL) {
+		*comma = '\0';
+	}
+
+	*from = parse_time("--range", buf, now);
+	*to = (comma != NULL ? parse_time("--range", comma + 1, now) : (int64_t)now * 1000000000);
+	*to += 999999999;
+
+	if (*from > *to) {
+		errx(EX_USAGE, "--range: invalid value \"%s\" (FROM is after TO)", str);
+	}
+}
+
+
+/*
+ * parse_rollup(const char *str, int *ring, int *stat)
+ *
+ *  str = Argument of --rollup: "minute" or "hour", optionally followed by
+ *        ",mean", ",min", or ",max"
+ * ring = Filled in with HIST_MINUTES or HIST_HOURS
+ * stat = Filled in with one of hist_stats_e (HIST_MEAN by default)
+ *
+ * Invalid input results in exit(EX_USAGE), like parse_number().
+ */
+static void
+parse_rollup(const char *str, int *ring, int *stat)
+{
+	static const char *const rings[] = { "minute", "hour" };
+	static const char *const stats[] = { "mean", "min", "max" };
+	const char *comma = strchr(str, ',');
+	size_t len = (comma != NULL ? (size_t)(comma - str) : strlen(str));
+	size_t r, st = 0;
+
+	for (r = 0; r < 2 && (strlen(rings[r]) != len || strncmp(str, rings[r], len) != 0); ++r)
+		;
+	for (; comma != NULL && st < 3 && strcmp(comma + 1, stats[st]) != 0; ++st)
+		;
+
+	if (r == 2 || st == 3) {
+		errx(EX_USAGE, "--rollup: invalid value \"%s\" (must be minute or hour, optionally followed by ,mean ,min or ,max)",
+			str);
+	}
+	*ring = HIST_MINUTES + (int)r;
+	*stat = HIST_MEAN + (int)st;
+}
+
+
+/*
+ * parse_device(char *arg)
+ *
+ * arg = Argument of -f: "DEVICE" or "DEVICE@MAKER:PRODUCT"; split up in
+ *       place
+ *
+ * Adds a bus to smbdevs[].  With "@MAKER:PRODUCT" (split off at the last
+ * "@", so DEVICE may contain one), that board is used for this bus instead
+ * of the one from SMBIOS or -M and -P.  Invalid input results in
+ * exit(EX_USAGE), like parse_number().
+ */
+static void
+parse_device(char *arg)
+{
+	char *at, *colon;
+
+	if (nbus == BUS_MAX) {
+		errx(EX_USAGE, "-f: at most %d devices can be given", BUS_MAX);
+	}
+
+	if ((at = strrchr(arg, '@')) != NULL) {
+		if ((colon = strchr(at + 1, ':')) == NULL || at == arg) {
+			errx(EX_USAGE, "-f: invalid value \"%s\" (must be DEVICE or DEVICE@MAKER:PRODUCT)",
+				arg);
+		}
+		*at = '\0';
+		*colon = '\0';
+		busmakers[nbus] = at + 1;
+		busproducts[nbus] = colon + 1;
+	}
+	smbdevs[nbus++] = arg;
+}
+
+
+/*
+ * smbios_get(const char *name, char *buf)
+ *
+ * name = kenv(2) variable name, e.g. smbios.planar.maker
+ *  buf = Buffer of at least KENV_MVALLEN bytes to place the value in
+ *
+ * Looks up an SMBIOS string.  SMBIOS strings are only available through
+ * kenv(2), so this always fails (with ENOSYS) on anything but FreeBSD;
+ * the -M and -P flags have to be used there instead.
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
+ */
+static int
+smbios_get(const char *name, char *buf)
+{
+#if defined(__FreeBSD__)
+	return (kenv(KENV_GET, name, buf, KENV_MVALLEN) == -1 ? -1 : 0);
+#else
+	(void) name;
+	(void) buf;
+	errno = ENOSYS;
+	return (-1);
+#endif
+}
+
+
+/*
+ * output_format(void)
+ *
+ * Returns the output format chosen on the command line; one of
+ * output_formats_e (see global.h).
+ */
+static int
+output_format(void)
+{
+	if (json_output) {
+		return (OUTPUT_JSON);
+	} else if (comma_output) {
+		return (OUTPUT_DELIM);
+	} else if (openmetrics_output || textfile != NULL) {
+		return (OUTPUT_OPENMETRICS);
+	}
+	return (OUTPUT_TEXT);
+}
+
+
+/*
+ * sensors_print(struct outfmt *of, const struct sensors *s,
+ *               const long samples)
+ *
+ *      of = Output format returned by outfmt_new()
+ *       s = Pointer to sensors struct; see global.h for a definition
+ * samples = Number of this sample (starting at 1)
+ *
+ * Outputs collected sensor data to user, in the format chosen on the
+ * command line, with one write(2) to stdout (or by replacing the
+ * --textfile file).  When more than one sample is being output to stdout
+ * (-i or --replay), the samples of the plain text formats are separated
+ * by an empty line.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+sensors_print(struct outfmt *of, const struct sensors *s, const long samples)
+{
+	int format = output_format();
+
+	if (textfile != NULL) {
+		return (sensors_output_file(of, s, textfile));
+	}
+	return (sensors_output(of, s, STDOUT_FILENO,
+	    samples > 1 && (format == OUTPUT_TEXT || format == OUTPUT_DELIM)));
+}
+
+
+/*
+ * lookup(const char *maker, const char *product)
+ *
+ *   maker = ASCII string; smbios.planar.maker kenv(2)
+ * product = ASCII string; smbios.planar.product kenv(2)
+ *
+ * Looks up maker and product in the board database, if there is one,
+ * else in the built-in boardlist[].
+ *
+ * Returns the board, or NULL if there's no match.
+ */
+static const struct board *
+lookup(const char *maker, const char *product)
+{
+	if (db != NULL) {
+		return (boarddb_lookup(db, maker, product));
+	}
+	return (board_lookup(maker, product));
+}
+
+
+/*
+ * replay(const char *path)
+ *
+ * path = Dump file written with --dump
+ *
+ * Decodes and outputs every sample in a dump file, exactly as if it had
+ * just been read off the bus.  The dump file is mmap()ed, and the board
+ * lookup is only redone when the board changes from one record to the
+ * next, so this runs at the speed of the decode and output routines.
+ *
+ * Returns an exit code (EX_OK on success).
+ */
+static int
+replay(const char *path)
+{
+	const struct dump_record *recs;
+	const struct dump_record *r;
+	const struct board *mb = NULL;
+	struct outfmt *of = NULL;
+	struct regmap rm;
+	struct sensors s;
+	size_t nrecs, maplen;
+	size_t i, j;
+	int exitcode = EX_OK;
+
+	if ((recs = dump_map(path, &nrecs, &maplen)) == NULL) {
+		warn("%s", path);
+		return (EX_NOINPUT);
+	}
+
+	memset(&s, 0, sizeof(s));
+
+	for (i = 0; i < nrecs; ++i) {
+		r = &recs[i];
+
+		if (r->nslaves > REGMAP_SLAVES) {
+			warnx("%s: record %zu is corrupt", path, i);
+			exitcode = EX_DATAERR;
+			break;
+		}
+
+		if (mb == NULL ||
+		    strncmp(r->maker, recs[i - 1].maker, DUMP_STRLEN) != 0 ||
+		    strncmp(r->product, recs[i - 1].product, DUMP_STRLEN) != 0) {
+			if ((mb = lookup(r->maker, r->product)) == NULL) {
+				warnx("%s: record %zu: unsupported board \"%.*s\" \"%.*s\"",
+					path, i, DUMP_STRLEN, r->maker,
+					DUMP_STRLEN, r->product);
+				exitcode = EX_DATAERR;
+				break;
+			}
+
+			outfmt_free(of);
+			if ((of = outfmt_new(mb, output_format())) == NULL) {
+				warn("outfmt_new() failed");
+				exitcode = EX_OSERR;
+				break;
+			}
+		}
+
+		VERBOSE("replay() record %zu: time = %" PRId64 ".%09" PRId32 "\n",
+			i, r->sec, r->nsec);
+
+		rm.nslaves = r->nslaves;
+		for (j = 0; j < r->nslaves; ++j) {
+			rm.slave[j] = r->slave[j];
+			memcpy(rm.regs[j], r->regs[j], sizeof(rm.regs[j]));
+		}
+
+		if (sensors_decode(mb, &rm, &s) != 0) {
+			warnx("Internal error.  Please report this bug to the author.");
+			exitcode = EX_SOFTWARE;
+			break;
+		}
+		s.time = r->sec * 1000000000 + r->nsec;
+
+		if (sensors_print(of, &s, (long)i + 1) == -1) {
+			warn("write() to stdout failed");
+			exitcode = EX_IOERR;
+			break;
+		}
+	}
+
+	outfmt_free(of);
+	dump_unmap(recs, maplen);
+	return (exitcode);
+}
+
+
+/*
+ * history(const char *path)
+ *
+ * path = History file written with --history-log
+ *
+ * Outputs the samples in a history file (or with --rollup, the rollups)
+ * in the --range, oldest first, stamped with their times; see
+ * outfmt_new_timed() and sensors_output_series() in output.c.  The file
+ * is only read, so it may still be being written to.
+ *
+ * Returns an exit code (EX_OK on success).
+ */
+static int
+history(const char *path)
+{
+	struct history *h;
+	const struct board *mb;
+	struct outfmt *of = NULL;
+	struct sensors *s = NULL;
+	const char *hmaker, *hproduct;
+	int64_t from = 0, to = INT64_MAX;
+	int ring = HIST_SAMPLES, stat = HIST_MEAN;
+	ssize_t n;
+	int exitcode = EX_OK;
+
+	if (histrange != NULL) {
+		parse_range(histrange, &from, &to);
+	}
+	if (histrollup != NULL) {
+		parse_rollup(histrollup, &ring, &stat);
+	}
+
+	if ((h = history_map(path)) == NULL) {
+		warn("%s", path);
+		return (EX_NOINPUT);
+	}
+
+	history_board(h, &hmaker, &hproduct);
+	if ((mb = lookup(hmaker, hproduct)) == NULL) {
+		warnx("%s: unsupported board \"%s\" \"%s\"", path, hmaker, hproduct);
+		exitcode = EX_DATAERR;
+	} else if ((of = outfmt_new_timed(mb, output_format())) == NULL) {
+		warn("outfmt_new_timed() failed");
+		exitcode = EX_OSERR;
+	} else if ((n = history_read(h, ring, stat, from, to, &s)) == -1) {
+		warn("%s", path);
+		exitcode = EX_OSERR;
+	} else if (sensors_output_series(of, s, (size_t)n, STDOUT_FILENO) == -1) {
+		warn("write() to stdout failed");
+		exitcode = EX_IOERR;
+	}
+
+	free(s);
+	outfmt_free(of);
+	history_close(h);
+	return (exitcode);
+}
+
+
+/*
+ * interval_sleep(struct timespec *next, const long secs)
+ *
+ * next = Absolute CLOCK_MONOTONIC time the current sample was due
+ * secs = Interval between samples, in seconds
+ *
+ * Advances next by secs and sleeps until that point in time.  Sleeping
+ * until an absolute deadline (rather than for a fixed duration) keeps
+ * the sampling interval from drifting by however long the bus reads
+ * and output took.  If the next deadline has already passed (e.g. the
+ * process was suspended, or output blocked on a full pipe), the schedule
+ * is restarted from the current time rather than firing off a burst of
+ * samples to catch up.
+ */
+static void
+interval_sleep(struct timespec *next, const long secs)
+{
+	struct timespec now;
+	struct timespec ts;
+
+	next->tv_sec += secs;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (now.tv_sec > next->tv_sec ||
+	    (now.tv_sec == next->tv_sec && now.tv_nsec >= next->tv_nsec)) {
+		*next = now;
+		return;
+	}
+
+	ts.tv_sec = next->tv_sec - now.tv_sec;
+	ts.tv_nsec = next->tv_nsec - now.tv_nsec;
+	if (ts.tv_nsec < 0) {
+		ts.tv_sec -= 1;
+		ts.tv_nsec += 1000000000L;
+	}
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR && !quit)
+		;
+}
+
+
+/*
+ * trace_signal(int sig)
+ *
+ * sig = Signal received
+ *
+ * With --trace-ring, SIGUSR1 dumps the trace ring, and SIGINT or SIGTERM
+ * end an -i run after the current sample (so that trace_exit() runs).
+ */
+static void
+trace_signal(int sig)
+{
+	if (sig == SIGUSR1) {
+		trace_dump_request();
+	} else {
+		quit = 1;
+	}
+}
+
+
+/*
+ * trace_exit(void)
+ *
+ * atexit(3) handler dumping the --trace-ring to stderr.
+ */
+static void
+trace_exit(void)
+{
+	trace_dump(stderr);
+}
+
+
 int
 main(int argc, char *argv[])
 {
 	const char kenv_planar_maker[] = "smbios.planar.maker";
 	const char kenv_planar_product[] = "smbios.planar.product";
 	int ch;
-	int ret = 1;
 	int exitcode = EX_OK;
 	/*
 	 * product, maker, and sensors pointers need to be pre-assigned
@@ -102,24 +830,124 @@ main(int argc, char *argv[])
 	char *product = NULL;
 	char *maker = NULL;
 	struct sensors *sdata = NULL;
-	struct board *mb;
+	struct hwmon *hw[BUS_MAX] = { NULL };
+	struct hwmon_group *grp = NULL;
+	const struct board *boards[BUS_MAX];
+	const struct smbus_stats *st[BUS_MAX];
+	int errs[BUS_MAX];
+	struct outfmt *of = NULL;
+	int dumpfd = -1;
+	struct shmsnap *shm = NULL;
+	struct history *hist = NULL;
+	const struct smbus_backend *bus;
+	const struct board *mb = NULL;
+	const struct boardtab *lb;
+	char errbuf[512];
+	struct timespec next;
+	struct timings tm;
+	struct timings *tp = NULL;
+	struct sigaction sa;
+	long samples;
+	size_t i;
 
-	while ((ch = getopt(argc, argv, "Jcf:lvh?")) != -1) {
+	/*
+	 * --timings covers everything from here on, so the clock has to
+	 * start before we even know whether it was given.
+	 */
+	timings_start(&tm);
+
+	while ((ch = getopt_long(argc, argv, "JM:P:cf:i:ln:vh?", longopts, NULL)) != -1) {
 		switch (ch) {
+			case OPT_DUMP:
+				dumpfile = optarg;
+				break;
+			case OPT_REPLAY:
+				replayfile = optarg;
+				break;
+			case OPT_CACHE:
+				cachefile = optarg;
+				break;
+			case OPT_FLUSH_CACHE:
+				flush_cache = 1;
+				break;
+			case OPT_OPENMETRICS:
+				openmetrics_output = 1;
+				break;
+			case OPT_TEXTFILE:
+				textfile = optarg;
+				break;
+			case OPT_SERVER:
+				serversock = (optarg != NULL ? optarg : DEFAULT_SOCKET);
+				break;
+			case OPT_CLIENT:
+				clientsock = (optarg != NULL ? optarg : DEFAULT_SOCKET);
+				break;
+			case OPT_HTTP:
+				httpport = parse_number("--http", optarg, 1, 65535);
+				break;
+			case OPT_SHM:
+				shmname = optarg;
+				break;
+			case OPT_SUBSCRIBE:
+				subsock = (optarg != NULL ? optarg : DEFAULT_SOCKET);
+				break;
+			case OPT_DEADBAND:
+				parse_deadband(optarg, deadband);
+				deadband_set = 1;
+				break;
+			case OPT_STATS:
+				stats = 1;
+				break;
+			case OPT_TIMINGS:
+				timings = 1;
+				break;
+			case OPT_TRACE_RING:
+				tracering = parse_number("--trace-ring", optarg, 1, 1000000);
+				break;
+			case OPT_BOARD_DB:
+				boarddbfile = optarg;
+				break;
+			case OPT_COMPILE_DB:
+				compiledb = optarg;
+				break;
+			case OPT_HISTORY_LOG:
+				histlog = optarg;
+				break;
+			case OPT_HISTORY:
+				histfile = optarg;
+				break;
+			case OPT_RANGE:
+				histrange = optarg;
+				break;
+			case OPT_ROLLUP:
+				histrollup = optarg;
+				break;
 			case 'J':
 				json_output = 1;
 				break;
+			case 'M':
+				board_maker = optarg;
+				break;
+			case 'P':
+				board_product = optarg;
+				break;
 			case 'c':
 				comma_output = 1;
 				break;
 			case 'f':
-				smbdev = optarg;
+				parse_device(optarg);
+				break;
+			case 'i':
+				interval = parse_number("-i", optarg, 1, 86400);
 				break;
 			case 'l':
-				list_models(&boardlist);
+				list_boards = 1;
+				break;
+			case 'n':
+				count = parse_number("-n", optarg, 1, LONG_MAX);
 				break;
 			case 'v':
-				f_verbose = 1;
+				++f_verbose;
 				break;
 			case 'h':
 			case '?':
@@ -131,135 +959,573 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	if (nbus == 0) {
+		smbdevs[nbus++] = DEFAULT_SMBDEV;
+	}
+
+	/*
+	 * Set up the trace ring before anything traces.  Without -v it
+	 * records everything compiled in.
+	 */
+	if (tracering != 0) {
+		if (trace_ring((size_t)tracering) == -1) {
+			warn("--trace-ring");
+			exitcode = EX_OSERR;
+			goto finish;
+		}
+		if (f_verbose == 0) {
+			f_verbose = TRACE_LEVEL;
+		}
+		atexit(trace_exit);
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = trace_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGUSR1, &sa, NULL);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+	}
+
 	/*
-	 * bsdhwmon requires root access due to opening /dev/smbX
+	 * --compile-db writes the database which a later run (without it)
+	 * maps; see boarddb.c.  Neither file is ours to pick, so a setuid
+	 * bsdhwmon gives up its privileges for good first: the text is read,
+	 * and quoted in errors, and the image renamed into place, only as
+	 * far as the user running us could do it anyway.
 	 */
-	if (geteuid() != 0) {
-		warnx("Must be run as root, or setuid root.");
+	if (compiledb != NULL) {
+		if (setgid(getgid()) == -1 || setuid(getuid()) == -1) {
+			exitcode = EX_OSERR;
+			warn("dropping privileges");
+			goto finish;
+		}
+		if (boarddb_compile(compiledb, (boarddbfile != NULL ? boarddbfile : DEFAULT_BOARDDB),
+		    errbuf, sizeof(errbuf)) == -1) {
+			exitcode = (errno == EINVAL ? EX_DATAERR : EX_IOERR);
+			warnx("%s", errbuf);
+		}
+		goto finish;
+	}
+
+	/*
+	 * A board database replaces the built-in boardlist[] entirely.  If
+	 * the default one doesn't exist, or can't be used, the built-in
+	 * list is; one given with --board-db must work.
+	 *
+	 * A setuid bsdhwmon takes only the default one: a file of the
+	 * user's choosing would be read with our privileges, and a line of
+	 * it quoted back in a parse error.
+	 */
+	if (boarddbfile != NULL && geteuid() != getuid()) {
 		exitcode = EX_NOPERM;
+		warnx("--board-db can't be used when bsdhwmon is setuid.");
+		goto finish;
+	}
+
+	if ((db = boarddb_open((boarddbfile != NULL ? boarddbfile : DEFAULT_BOARDDB),
+	    errbuf, sizeof(errbuf))) == NULL) {
+		if (boarddbfile != NULL) {
+			exitcode = (errno == EINVAL ? EX_DATAERR :
+			    errno == EPERM ? EX_NOPERM : EX_NOINPUT);
+			warnx("%s", errbuf);
+			goto finish;
+		}
+		if (errno != ENOENT) {
+			warnx("%s; using the built-in board list", errbuf);
+		}
+	}
+
+	if (list_boards) {
+		if (db != NULL && (lb = boarddb_table(db)) == NULL) {
+			exitcode = EX_DATAERR;
+			warn("%s", (boarddbfile != NULL ? boarddbfile : DEFAULT_BOARDDB));
+			goto finish;
+		}
+		exitcode = (list_models(stdout, (db != NULL ? lb : board_table())) == 0 ? EX_OK : EX_IOERR);
 		goto finish;
 	}
 
 	/*
 	 * Do some basic argument conflict checking
 	 */
-	if (comma_output && json_output) {
+	if (comma_output + json_output + openmetrics_output > 1) {
 		warnx("Please choose only one output format.");
 		exitcode = EX_USAGE;
 		goto finish;
 	}
 
+	if (count != 0 && interval == 0) {
+		warnx("-n requires -i.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if (flush_cache && cachefile == NULL) {
+		warnx("--flush-cache requires --cache.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if (httpport != 0 && serversock == NULL) {
+		warnx("--http requires --server.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if (deadband_set && serversock == NULL) {
+		warnx("--deadband requires --server.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if (stats && (replayfile != NULL || histfile != NULL || clientsock != NULL || subsock != NULL)) {
+		warnx("--stats can't be combined with --replay, --history, --client, or --subscribe.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if (timings) {
+		if (interval != 0 || serversock != NULL || replayfile != NULL ||
+		    histfile != NULL || clientsock != NULL || subsock != NULL) {
+			warnx("--timings is only for one-shot runs; it can't be combined with -i, --server, --replay, --history, --client, or --subscribe.");
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+		tp = &tm;
+	}
+
+	if (shmname != NULL) {
+		if (interval == 0 && serversock == NULL) {
+			warnx("--shm requires -i or --server.");
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+		if (shmname[0] != '/') {
+			warnx("--shm NAME must start with a \"/\".");
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+	}
+
+	if (histlog != NULL && interval == 0 && serversock == NULL) {
+		warnx("--history-log requires -i or --server.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if ((histrange != NULL || histrollup != NULL) && histfile == NULL) {
+		warnx("--range and --rollup require --history.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
+	if (serversock != NULL &&
+	    (clientsock != NULL || subsock != NULL || replayfile != NULL || histfile != NULL ||
+	    dumpfile != NULL || textfile != NULL || count != 0)) {
+		warnx("--server can't be combined with --client, --subscribe, --replay, --history, --dump, --textfile, or -n.");
+		exitcode = EX_USAGE;
+		goto finish;
+	}
+
 	/*
-	 * Allocate memory for the maker and product strings, then attempt to
-	 * use kenv(2) to look up smbios.planar.maker and smbios.planar.product
-	 * values and return them; these are taken directly from SMBIOS.  If
-	 * SMBIOS strings aren't available then the user is out of luck.
-	 *
-	 * Both strings must match something in the board structure (mb),
-	 * otherwise bsdhwmon doesn't support the motherboard in question.
+	 * The server creates, chmod()s, and removes its socket at a path
+	 * the user picks; a setuid bsdhwmon mustn't do that with its
+	 * privileges.  Run it as root (e.g. from rc(8)) instead.
 	 */
-	if ((maker = calloc(1, KENV_MVALLEN)) == NULL) {
-		exitcode = errno;
-		warn("calloc() for maker failed");
+	if (serversock != NULL && geteuid() != getuid()) {
+		warnx("--server can't be used when bsdhwmon is setuid.");
+		exitcode = EX_NOPERM;
 		goto finish;
 	}
 
-	if ((product = calloc(1, KENV_MVALLEN)) == NULL) {
-		exitcode = errno;
-		warn("calloc() for product failed");
+	/*
+	 * Dump records, the shared memory snapshot, history files, and the
+	 * server's protocols all describe a single board.
+	 */
+	if (nbus > 1 && (serversock != NULL || dumpfile != NULL || shmname != NULL || histlog != NULL)) {
+		warnx("Only one -f device can be used with --server, --dump, --shm, or --history-log.");
+		exitcode = EX_USAGE;
 		goto finish;
 	}
 
-	if (kenv(KENV_GET, kenv_planar_maker, maker, KENV_MVALLEN) == -1) {
-		exitcode = errno;
-		warn("kenv() for %s failed", kenv_planar_maker);
+	/*
+	 * The client only talks to a --server over its socket, so like
+	 * --replay it needs neither root nor the SMBus.
+	 */
+	if (clientsock != NULL || subsock != NULL) {
+		if (replayfile != NULL || histfile != NULL || dumpfile != NULL || textfile != NULL ||
+		    interval != 0 || shmname != NULL ||
+		    (clientsock != NULL && subsock != NULL)) {
+			warnx("--client and --subscribe can't be combined with each other, --replay, --history, --dump, --textfile, --shm, or -i.");
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+		if (subsock != NULL) {
+			if (comma_output + json_output + openmetrics_output != 0) {
+				warnx("--subscribe updates are always in -c format.");
+				exitcode = EX_USAGE;
+				goto finish;
+			}
+			exitcode = client_subscribe(subsock);
+		} else {
+			exitcode = client_run(clientsock, output_format());
+		}
 		goto finish;
 	}
 
-	if (kenv(KENV_GET, kenv_planar_product, product, KENV_MVALLEN) == -1) {
-		exitcode = errno;
-		warn("kenv() for %s failed", kenv_planar_product);
+	/*
+	 * Replaying a dump file doesn't touch the SMBus (or SMBIOS) at all,
+	 * so it needs neither root nor any of the set-up below.
+	 */
+	if (replayfile != NULL) {
+		if (dumpfile != NULL || interval != 0 || textfile != NULL || histfile != NULL) {
+			warnx("--replay can't be combined with --dump, --textfile, --history, or -i.");
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+		exitcode = replay(replayfile);
 		goto finish;
 	}
 
-	if ((mb = board_lookup(maker, product)) == NULL) {
-		warnx("Your motherboard does not appear to be supported.  Please visit\n"
-		     "https://github.com/koitsu/bsdhwmon to see if support for your motherboard\n"
-		     "and/or system is under development.\n");
-		exitcode = EX_DATAERR;
+	/*
+	 * Neither does reading a history file.
+	 */
+	if (histfile != NULL) {
+		if (dumpfile != NULL || interval != 0 || textfile != NULL || histlog != NULL) {
+			warnx("--history can't be combined with --dump, --textfile, --history-log, or -i.");
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+		exitcode = history(histfile);
+		goto finish;
+	}
+
+	for (i = 0; i < nbus; ++i) {
+		if ((bus = smbus_backend(smbdevs[i])) == NULL) {
+			warnx("%s: SMBus device not supported on this system (see -f sim:FILE)", smbdevs[i]);
+			exitcode = EX_USAGE;
+			goto finish;
+		}
+
+		/*
+		 * bsdhwmon requires root access due to opening /dev/smbX
+		 */
+		if (bus->needs_root && geteuid() != 0) {
+			warnx("Must be run as root, or setuid root.");
+			exitcode = EX_NOPERM;
+			goto finish;
+		}
+	}
+
+	timings_mark(tp, PHASE_ARGS);
+
+	/*
+	 * The board is only detected if some bus wasn't given one with
+	 * "-f DEVICE@MAKER:PRODUCT"; i is then that bus.
+	 */
+	for (i = 0; i < nbus && busmakers[i] != NULL; ++i)
+		;
+
+	/*
+	 * With --cache, a board detected by an earlier run (during this boot,
+	 * with this board list) is used as-is; see board_cache_load() in
+	 * lookup.c.  -M and -P always bypass the cache, in both directions.
+	 */
+	if (cachefile != NULL && flush_cache && board_cache_flush(cachefile) == -1) {
+		exitcode = EX_CANTCREAT;
+		warn("%s", cachefile);
 		goto finish;
 	}
 
-	if ((sdata = calloc(1, sizeof(struct sensors))) == NULL) {
+	if (i < nbus && cachefile != NULL && board_maker == NULL && board_product == NULL) {
+		mb = board_cache_load(cachefile, db);
+	}
+
+	if (i < nbus && mb == NULL) {
+		/*
+		 * Allocate memory for the maker and product strings, then
+		 * attempt to use kenv(2) to look up smbios.planar.maker and
+		 * smbios.planar.product values and return them; these are
+		 * taken directly from SMBIOS.  If SMBIOS strings aren't
+		 * available then the user is out of luck, unless they've been
+		 * given with -M and -P (which is mainly of use with the
+		 * simulator).
+		 *
+		 * Both strings must match something in the board structure
+		 * (mb), otherwise bsdhwmon doesn't support the motherboard in
+		 * question.
+		 */
+		if ((maker = calloc(1, KENV_MVALLEN)) == NULL) {
+			exitcode = errno;
+			warn("calloc() for maker failed");
+			goto finish;
+		}
+
+		if ((product = calloc(1, KENV_MVALLEN)) == NULL) {
+			exitcode = errno;
+			warn("calloc() for product failed");
+			goto finish;
+		}
+
+		if (board_maker != NULL) {
+			snprintf(maker, KENV_MVALLEN, "%s", board_maker);
+		} else if (smbios_get(kenv_planar_maker, maker) == -1) {
+			exitcode = errno;
+			warn("kenv() for %s failed", kenv_planar_maker);
+			goto finish;
+		}
+
+		if (board_product != NULL) {
+			snprintf(product, KENV_MVALLEN, "%s", board_product);
+		} else if (smbios_get(kenv_planar_product, product) == -1) {
+			exitcode = errno;
+			warn("kenv() for %s failed", kenv_planar_product);
+			goto finish;
+		}
+		timings_mark(tp, PHASE_SMBIOS);
+
+		if ((mb = lookup(maker, product)) == NULL) {
+			warnx("Your motherboard does not appear to be supported.  Please visit\n"
+			     "https://github.com/koitsu/bsdhwmon to see if support for your motherboard\n"
+			     "and/or system is under development.\n");
+			exitcode = EX_DATAERR;
+			goto finish;
+		}
+
+		if (cachefile != NULL && board_maker == NULL && board_product == NULL &&
+		    board_cache_save(cachefile, mb) == -1) {
+			warn("%s: not caching board", cachefile);
+		}
+	}
+
+	for (i = 0; i < nbus; ++i) {
+		if (busmakers[i] == NULL) {
+			boards[i] = mb;
+		} else if ((boards[i] = lookup(busmakers[i], busproducts[i])) == NULL) {
+			warnx("%s: motherboard \"%s\" \"%s\" is not supported (see -l).",
+			     smbdevs[i], busmakers[i], busproducts[i]);
+			exitcode = EX_DATAERR;
+			goto finish;
+		}
+	}
+
+	timings_mark(tp, PHASE_LOOKUP);
+
+	if ((sdata = calloc(nbus, sizeof(struct sensors))) == NULL) {
 		exitcode = errno;
 		warn("calloc() for sdata failed");
 		goto finish;
 	}
 
 	/*
-	 * Open the device with read/write access and an exclusive lock.  The
-	 * lock is a safety mechanism in the case two bsdhwmon processes somehow
-	 * run simultaneously (one should block/wait indefinitely until the
-	 * other has closed the fd).
-	 *
-	 * I simply don't know if the smb(4) framework would handle two
-	 * programs simultaneously reading/writing to /dev/smbX.
+	 * Several buses go out as one document, with each bus tagged by its
+	 * device name; see outfmt_new_buses() in output.c.
 	 */
-	if ((smbfd = open(smbdev, O_RDWR|O_EXLOCK)) < 0) {
+	if (nbus == 1) {
+		of = outfmt_new(boards[0], output_format());
+	} else {
+		of = outfmt_new_buses(boards, smbdevs, nbus, output_format());
+	}
+	if (of == NULL) {
 		exitcode = errno;
-		warn("open() on %s failed", smbdev);
+		warn("outfmt_new() failed");
+		goto finish;
+	}
+
+	if (dumpfile != NULL && (dumpfd = dump_open(dumpfile)) == -1) {
+		exitcode = EX_CANTCREAT;
+		warn("%s", dumpfile);
 		goto finish;
 	}
 
+	timings_mark(tp, PHASE_ALLOC);
+
 	/*
-	 * Collect sensor data.
+	 * Open the devices.  For /dev/smbX this takes an exclusive lock; see
+	 * smb_open() in smbus_smb.c, so on a busy host this is where we'd
+	 * wait for it.
 	 */
-	switch (mb->chip) {
-		case CUSTOM_X6DVA:
-			ret = x6dva_main(smbfd, sdata);
-			break;
-		case WINBOND_W83792D:
-			ret = w83792d_main(smbfd, mb->slave, sdata);
-			break;
-		case WINBOND_W83793G:
-			ret = w83793g_main(smbfd, mb->slave, sdata);
-			break;
-		default:
-			warnx("Internal error.  Please report this bug to the author.");
-			exitcode = EX_SOFTWARE;
+	for (i = 0; i < nbus; ++i) {
+		if ((hw[i] = hwmon_open(smbdevs[i], boards[i])) == NULL) {
+			if (errno == EOPNOTSUPP) {
+				warnx("Internal error.  Please report this bug to the author.");
+				exitcode = EX_SOFTWARE;
+			} else {
+				exitcode = errno;
+				warn("open() on %s failed", smbdevs[i]);
+			}
 			goto finish;
+		}
+		if (stats && hwmon_stats_enable(hw[i]) == -1) {
+			exitcode = EX_OSERR;
+			warn("hwmon_stats_enable() failed");
+			goto finish;
+		}
+		st[i] = hwmon_stats(hw[i]);
 	}
+	timings_mark(tp, PHASE_OPEN);
 
 	/*
-	 * Verify that the sensor collection routine was successful (chip
-	 * validation passed, etc.).
+	 * Bus 0 is sampled in this thread (see hwmon_group_sample()), so
+	 * it's the one whose chip routine marks the sampling phases.
 	 */
-	if (ret != 0) {
-		warnx("Your motherboard is supported, but H/W chip verification failed.\n"
-		     "Please re-run bsdhwmon with the -v flag and send full output + bug\n"
-		     "report to the author.");
-		exitcode = EX_SOFTWARE;
+	hwmon_timings(hw[0], tp);
+
+	/*
+	 * With --stats, OpenMetrics output carries the counters as metric
+	 * families of their own; the other formats get a table on stderr
+	 * at the end (see below).
+	 */
+	if (stats && output_format() == OUTPUT_OPENMETRICS &&
+	    outfmt_stats(of, st, (nbus > 1 ? smbdevs : NULL), nbus) == -1) {
+		exitcode = errno;
+		warn("outfmt_stats() failed");
 		goto finish;
 	}
 
 	/*
-	 * Output collected sensor data to user.
+	 * Only now that the device is held open (and locked) can we be
+	 * sure we're the only writer of the shared memory snapshot.
 	 */
-	if (json_output) {
-		sensors_output_json(mb, sdata);
-	} else if (comma_output) {
-		sensors_output_delim(mb, sdata);
-	} else {
-		sensors_output(mb, sdata);
+	if (shmname != NULL &&
+	    (shm = shmsnap_create(shmname, boards[0],
+	    (interval != 0 ? interval : DEFAULT_SERVER_INTERVAL))) == NULL) {
+		exitcode = EX_OSERR;
+		warn("%s", shmname);
+		goto finish;
+	}
+
+	/*
+	 * The same goes for the history file, though that's locked as well.
+	 */
+	if (histlog != NULL && (hist = history_open(histlog, boards[0])) == NULL) {
+		exitcode = EX_CANTCREAT;
+		if (errno == EWOULDBLOCK) {
+			warnx("%s: already being written to by another bsdhwmon", histlog);
+		} else if (errno == EINVAL) {
+			warnx("%s: not a history file of this board, or from another version of bsdhwmon", histlog);
+		} else {
+			warn("%s", histlog);
+		}
+		goto finish;
+	}
+
+	if (serversock != NULL) {
+		exitcode = server_run(hw[0], sdata, shm, hist,
+		    (interval != 0 ? interval : DEFAULT_SERVER_INTERVAL),
+		    serversock, (int)httpport, deadband);
+		goto finish;
+	}
+
+	/*
+	 * Every bus after the first gets a worker thread of its own, so
+	 * a sample takes as long as the slowest bus; see multibus.c.
+	 */
+	if ((grp = hwmon_group_new(hw, nbus)) == NULL) {
+		exitcode = EX_OSERR;
+		warn("hwmon_group_new() failed");
+		goto finish;
+	}
+	timings_mark(tp, PHASE_ALLOC);
+
+	/*
+	 * Everything above this point (SMBIOS lookup, board detection,
+	 * memory allocation, opening the devices, and starting threads) is
+	 * done exactly once.  In interval mode (-i) the loop below re-uses
+	 * all of it, so the only per-sample cost is the bus reads and the
+	 * output itself.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (samples = 1; ; ++samples) {
+		/*
+		 * Collect sensor data, and verify that the sensor collection
+		 * routine was successful (chip validation passed, etc.) on
+		 * every bus.
+		 */
+		if (hwmon_group_sample(grp, sdata, errs) == -1) {
+			for (i = 0; i < nbus; ++i) {
+				if (errs[i] == ENXIO) {
+					warnx("Your motherboard is supported, but H/W chip verification failed on %s.\n"
+					     "Please re-run bsdhwmon with the -v flag and send full output + bug\n"
+					     "report to the author.", smbdevs[i]);
+					exitcode = EX_SOFTWARE;
+				} else if (errs[i] != 0) {
+					errno = errs[i];
+					warn("SMBus read on %s failed", smbdevs[i]);
+					exitcode = EX_IOERR;
+				}
+			}
+			goto finish;
+		}
+		/* Waiting for the other buses, if any */
+		timings_mark(tp, PHASE_COLLECT);
+
+		if (dumpfd != -1 &&
+		    dump_write(dumpfd, BOARD_MAKER(boards[0]), BOARD_PRODUCT(boards[0]),
+		    hwmon_regmap(hw[0])) == -1) {
+			exitcode = EX_IOERR;
+			warn("%s", dumpfile);
+			goto finish;
+		}
+
+		if (shm != NULL) {
+			shmsnap_publish(shm, sdata);
+		}
+
+		if (hist != NULL) {
+			history_append(hist, sdata);
+		}
+
+		/*
+		 * Output collected sensor data to user.  Each sample goes out
+		 * with its own write(2), bypassing stdio, so in interval mode
+		 * it's pushed out immediately even when stdout is a pipe.
+		 */
+		if (sensors_print(of, sdata, samples) == -1) {
+			exitcode = EX_IOERR;
+			warn("%s", textfile != NULL ? textfile : "write() to stdout failed");
+			goto finish;
+		}
+		timings_mark(tp, PHASE_OUTPUT);
+
+		if (interval == 0 || samples == count || quit) {
+			break;
+		}
+
+		interval_sleep(&next, interval);
+	}
+
+	for (i = 0; stats && output_format() != OUTPUT_OPENMETRICS && i < nbus; ++i) {
+		if (stats_print(stderr, st[i], (nbus > 1 ? smbdevs[i] : NULL)) == -1) {
+			exitcode = EX_IOERR;
+			warn("write() to stderr failed");
+			goto finish;
+		}
+	}
+
+	if (tp != NULL &&
+	    timings_print(stderr, tp, output_format() == OUTPUT_JSON) == -1) {
+		exitcode = EX_IOERR;
+		warn("write() to stderr failed");
+		goto finish;
 	}
 
 finish:
 	/*
 	 * Clean up and exit.
 	 */
-	if (smbfd != -1) {
-		close(smbfd);
+	hwmon_group_free(grp);
+	for (i = 0; i < nbus; ++i) {
+		hwmon_close(hw[i]);
+	}
+	if (dumpfd != -1) {
+		close(dumpfd);
 	}
+	outfmt_free(of);
+	shmsnap_close(shm);
+	history_close(hist);
+	boarddb_close(db);
 	free(sdata);
 	free(product);
 	free(maker);
@@ -0,0 +1,337 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * mkboardidx: build-time generator for boardidx.h, the built-in board
+ * table (struct boardtab; see global.h) made from boardlist[], and the
+ * perfect hash index over it used by board_lookup() (see lookup.c).
+ * Linked against boards.c and boardidx.c only; run by the Makefile, not
+ * installed.
+ *
+ * Usage: mkboardidx > boardidx.h
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <err.h>
+#include <sysexits.h>
+#include "global.h"
+
+#ifndef nitems
+#define nitems(x)	(sizeof((x)) / sizeof((x)[0]))	/* See <sys/param.h> on FreeBSD */
+#endif
+
+/*
+ * The table being built.  Pools are sized for the worst case, which
+ * BOARD_POOL_MAX bounds anyway.
+ */
+struct mktab {
+	char		strings[BOARD_POOL_MAX];
+	size_t		strsize;
+	struct pinmap	pins[BOARD_POOL_MAX];
+	size_t		npins;
+	struct vcoef	vcoefs[BOARD_POOL_MAX];
+	size_t		nvcoefs;
+	struct board	*boards;
+};
+
+/*
+ * Function prototypes
+ */
+static uint16_t	mk_string(struct mktab *, const char *);
+static uint16_t	mk_run(void *, size_t *, const void *, const size_t,
+		    const size_t);
+static void	mk_board(struct mktab *, const struct boarddef *, struct board *);
+static void	print_string(const char *, const int);
+int main(void);
+
+/*
+ * External functions (boardidx.c)
+ */
+extern int	boardidx_build(const struct boarddef *, const size_t, int32_t *,
+		    const uint32_t, uint32_t *);
+extern size_t	boardidx_probe(const struct boardidx *, const char *,
+		    const char *);
+extern uint32_t	boardidx_fingerprint(const struct boarddef *, const size_t);
+
+/*
+ * External variables (boards.c)
+ */
+extern const struct boarddef	boardlist[];
+
+/*
+ * Global variables
+ */
+int f_verbose = 0;	/* Referenced by global.h */
+static struct mktab tab;
+
+
+/*
+ * mk_string(struct mktab *t, const char *s)
+ *
+ * t = Table being built
+ * s = String to add
+ *
+ * Returns the offset of s in the strings pool, which has each string
+ * once.
+ */
+static uint16_t
+mk_string(struct mktab *t, const char *s)
+{
+	size_t i, len = strlen(s);
+
+	for (i = 0; i < t->strsize; i += strlen(t->strings + i) + 1) {
+		if (strcmp(t->strings + i, s) == 0) {
+			return ((uint16_t)i);
+		}
+	}
+	if (t->strsize + len + 1 > BOARD_POOL_MAX) {
+		errx(EX_DATAERR, "more than %d bytes of strings", BOARD_POOL_MAX);
+	}
+	memcpy(t->strings + t->strsize, s, len + 1);
+	t->strsize += len + 1;
+	return ((uint16_t)(t->strsize - len - 1));
+}
+
+
+/*
+ * mk_run(void *pool, size_t *npool, const void *run, const size_t n,
+ *        const size_t size)
+ *
+ *  pool = Pool of BOARD_POOL_MAX entries, *npool of them used
+ * npool = Entries used; updated
+ *   run = Entries to add, zeroed before being filled in
+ *     n = Number of entries in run
+ *  size = Size of one entry
+ *
+ * Returns the index of run in pool; boards wired alike share one run.
+ */
+static uint16_t
+mk_run(void *pool, size_t *npool, const void *run, const size_t n,
+    const size_t size)
+{
+	u_char *p = pool;
+	size_t i;
+
+	if (n == 0) {
+		return (0);
+	}
+	for (i = 0; i + n <= *npool; ++i) {
+		if (memcmp(p + i * size, run, n * size) == 0) {
+			return ((uint16_t)i);
+		}
+	}
+	if (*npool + n > BOARD_POOL_MAX) {
+		errx(EX_DATAERR, "more than %d pins or vcoef corrections", BOARD_POOL_MAX);
+	}
+	memcpy(p + *npool * size, run, n * size);
+	*npool += n;
+	return ((uint16_t)(*npool - n));
+}
+
+
+/*
+ * mk_board(struct mktab *t, const struct boarddef *d, struct board *b)
+ *
+ * t = Table being built
+ * d = Board from boardlist[]
+ * b = Filled in with d's compact form, except for tab
+ */
+static void
+mk_board(struct mktab *t, const struct boarddef *d, struct board *b)
+{
+	const struct pindef *defs[BOARD_KINDS] = { d->voltages, d->temps, d->fans };
+	struct pinmap run[VOLT_MAX + TEMP_MAX + FAN_MAX];
+	struct vcoef vrun[VOLT_MAX];
+	size_t k, n;
+
+	memset(b, 0, sizeof(*b));
+	if (d->chip > UINT8_MAX || d->slave < -1 || d->slave > 0x7f) {
+		errx(EX_DATAERR, "%s %s: bad chip or slave", d->maker, d->product);
+	}
+	b->maker = mk_string(t, d->maker);
+	b->product = mk_string(t, d->product);
+	b->chip = (uint8_t)d->chip;
+	b->slave = (int8_t)d->slave;
+
+	for (k = 0; k < BOARD_KINDS; ++k) {
+		memset(run, 0, sizeof(run));
+		for (n = 0; defs[k] != NULL && defs[k][n].label != NULL; ++n) {
+			if (n == nitems(run) || defs[k][n].index > UINT8_MAX) {
+				errx(EX_DATAERR, "%s %s: bad pin list", d->maker, d->product);
+			}
+			run[n].index = (uint8_t)defs[k][n].index;
+			run[n].label = mk_string(t, defs[k][n].label);
+		}
+		b->pins[k] = mk_run(t->pins, &t->npins, run, n, sizeof(run[0]));
+		b->npins[k] = (uint8_t)n;
+	}
+
+	memset(vrun, 0, sizeof(vrun));
+	for (n = 0; d->vcoef != NULL && d->vcoef[n].scale != 0; ++n) {
+		if (n == nitems(vrun)) {
+			errx(EX_DATAERR, "%s %s: bad vcoef list", d->maker, d->product);
+		}
+		vrun[n] = d->vcoef[n];
+	}
+	b->vcoef = mk_run(t->vcoefs, &t->nvcoefs, vrun, n, sizeof(vrun[0]));
+	b->nvcoef = (uint8_t)n;
+}
+
+
+/*
+ * print_string(const char *s, const int nul)
+ *
+ *   s = String to print
+ * nul = Non-zero to end the literal with an explicit NUL
+ *
+ * Prints s as a C string literal, escaping anything which isn't
+ * printable ASCII in octal.  The result can go in a comment too.
+ */
+static void
+print_string(const char *s, const int nul)
+{
+	putchar('"');
+	for (; *s != '\0'; ++s) {
+		if (*s == '"' || *s == '\\' || *s == '?') {	/* ? for trigraphs */
+			printf("\\%c", *s);
+		} else if (*s < ' ' || *s > '~' || *s == '*') {	/* * for comments */
+			printf("\\%03o", (u_char)*s);
+		} else {
+			putchar(*s);
+		}
+	}
+	printf("%s\"", (nul ? "\\0" : ""));
+}
+
+
+int
+main(void)
+{
+	struct boardidx ix;
+	const struct board *b;
+	int32_t *disp;
+	uint32_t *slot;
+	uint32_t fingerprint;
+	size_t n, i;
+
+	for (n = 0; boardlist[n].maker != NULL; ++n)
+		;
+	if (n == 0) {
+		errx(EX_DATAERR, "boardlist[] is empty");
+	}
+
+	if ((disp = calloc(n, sizeof(*disp))) == NULL ||
+	    (slot = calloc(n, sizeof(*slot))) == NULL ||
+	    (tab.boards = calloc(n, sizeof(*tab.boards))) == NULL) {
+		err(EX_OSERR, "calloc");
+	}
+
+	if (boardidx_build(boardlist, n, disp, (uint32_t)n, slot) == -1) {
+		err(EX_DATAERR, "boardidx_build");
+	}
+
+	/*
+	 * Check every board is found at its own index before handing the
+	 * index to the build.
+	 */
+	ix.nkeys = (uint32_t)n;
+	ix.nbuckets = (uint32_t)n;
+	ix.fingerprint = 0;
+	ix.disp = disp;
+	ix.slot = slot;
+	for (i = 0; i < n; ++i) {
+		if (boardidx_probe(&ix, boardlist[i].maker, boardlist[i].product) != i) {
+			errx(EX_SOFTWARE, "boardlist[%zu] (%s %s) not found in index",
+			    i, boardlist[i].maker, boardlist[i].product);
+		}
+	}
+
+	fingerprint = boardidx_fingerprint(boardlist, n);
+
+	for (i = 0; i < n; ++i) {
+		mk_board(&tab, &boardlist[i], &tab.boards[i]);
+	}
+
+	printf("/*\n");
+	printf(" * Generated by mkboardidx from boardlist[] in boards.c; do not edit.\n");
+	printf(" * %zu boards, %zu pins, %zu vcoef corrections, %zu bytes of strings.\n",
+	    n, tab.npins, tab.nvcoefs, tab.strsize);
+	printf(" * See struct boardtab and struct boardidx in global.h.\n");
+	printf(" */\n\n");
+
+	printf("static const char boardtab_strings[%zu] =", tab.strsize);
+	for (i = 0; i < tab.strsize; i += strlen(tab.strings + i) + 1) {
+		printf("\n\t");
+		print_string(tab.strings + i, 1);
+	}
+	printf(";\n\n");
+
+	printf("static const struct pinmap boardtab_pins[%zu] = {\n", tab.npins);
+	for (i = 0; i < tab.npins; ++i) {
+		printf("\t{ %2u, %5u },\t/* ", tab.pins[i].index, tab.pins[i].label);
+		print_string(tab.strings + tab.pins[i].label, 0);
+		printf(" */\n");
+	}
+	printf("};\n\n");
+
+	if (tab.nvcoefs == 0) {
+		printf("static const struct vcoef boardtab_vcoefs[1] = {\n");
+		printf("\t{ 0, 0, 0 }\t/* None; not referred to */\n");
+	} else {
+		printf("static const struct vcoef boardtab_vcoefs[%zu] = {\n", tab.nvcoefs);
+		for (i = 0; i < tab.nvcoefs; ++i) {
+			printf("\t{ %2u, %" PRId32 ", %" PRId32 " },\n", tab.vcoefs[i].index,
+			    tab.vcoefs[i].scale, tab.vcoefs[i].offset);
+		}
+	}
+	printf("};\n\n");
+
+	printf("static const struct boardtab boardtab;\n\n");
+
+	printf("static const struct board boardtab_boards[%zu] = {\n", n);
+	for (i = 0; i < n; ++i) {
+		b = &tab.boards[i];
+		printf("\t{ &boardtab, %5u, %5u, { %5u, %5u, %5u }, %5u, { %2u, %2u, %2u }, %2u, %2u, %d },\t/* %s %s */\n",
+		    b->maker, b->product, b->pins[0], b->pins[1], b->pins[2],
+		    b->vcoef, b->npins[0], b->npins[1], b->npins[2], b->nvcoef,
+		    b->chip, b->slave, boardlist[i].maker, boardlist[i].product);
+	}
+	printf("};\n\n");
+
+	printf("static const struct boardtab boardtab = {\n");
+	printf("\tboardtab_strings, boardtab_pins, boardtab_vcoefs, boardtab_boards,\n");
+	printf("\t%zu, 0x%08" PRIx32 "\n", n, fingerprint);
+	printf("};\n\n");
+
+	printf("static const int32_t boardidx_disp[%zu] = {", n);
+	for (i = 0; i < n; ++i) {
+		printf("%s%" PRId32 ",", (i % 8) == 0 ? "\n\t" : " ", disp[i]);
+	}
+	printf("\n};\n\n");
+
+	printf("static const uint32_t boardidx_slot[%zu] = {", n);
+	for (i = 0; i < n; ++i) {
+		printf("%s%" PRIu32 ",", (i % 8) == 0 ? "\n\t" : " ", slot[i]);
+	}
+	printf("\n};\n\n");
+
+	printf("static const struct boardidx boardidx = {\n");
+	printf("\t%zu, %zu, 0x%08" PRIx32 ", boardidx_disp, boardidx_slot\n", n, n, fingerprint);
+	printf("};\n");
+
+	if (fflush(stdout) == EOF || ferror(stdout)) {
+		err(EX_IOERR, "stdout");
+	}
+
+	free(disp);
+	free(slot);
+	free(tab.boards);
+	return (EX_OK);
+}
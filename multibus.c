@@ -0,0 +1,244 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "global.h"
+#include "hwmon.h"
+
+/*
+ * Sampling several buses at once (several "-f").  Each bus has its own
+ * struct hwmon, and every bus but the first has a worker thread of its
+ * own, which lives as long as the group does.  hwmon_group_sample()
+ * starts a round on all workers, samples the first bus itself, then
+ * waits for the workers; a round takes as long as the slowest bus, not
+ * the sum of all of them.  A group of one bus has no threads at all.
+ *
+ * Workers only ever touch their own struct hwmon and struct sensors
+ * (see hwmon.h), so the lock below only guards the round bookkeeping.
+ */
+struct hwmon_group;
+
+struct hwmon_worker {
+	struct hwmon_group	*g;
+	size_t		bus;		/* Index into h[] and s[] */
+	pthread_t	tid;
+};
+
+struct hwmon_group {
+	size_t		n;		/* Number of buses */
+	struct hwmon	*h[BUS_MAX];
+	struct sensors	*s;		/* Array of n; this round's samples */
+	int		err[BUS_MAX];	/* This round's errno per bus, or 0 */
+	pthread_mutex_t	lock;
+	pthread_cond_t	start;		/* Signalled when a round starts */
+	pthread_cond_t	done;		/* Signalled when pending hits 0 */
+	u_long		round;		/* Rounds started so far */
+	size_t		pending;	/* Workers still sampling this round */
+	int		quit;		/* Set by hwmon_group_free() */
+	size_t		nworkers;	/* Workers started (n - 1 once set up) */
+	struct hwmon_worker	worker[BUS_MAX];
+};
+
+/*
+ * Function prototypes (the rest are in hwmon.h)
+ */
+static void *	hwmon_worker_main(void *);
+
+
+/*
+ * hwmon_worker_main(void *arg)
+ *
+ * arg = struct hwmon_worker of the bus to sample
+ *
+ * Body of a worker thread: takes one sample per round, until the group
+ * is freed.
+ */
+static void *
+hwmon_worker_main(void *arg)
+{
+	struct hwmon_worker *w = arg;
+	struct hwmon_group *g = w->g;
+	u_long seen = 0;
+	int e;
+
+	pthread_mutex_lock(&g->lock);
+	for (;;) {
+		while (!g->quit && g->round == seen) {
+			pthread_cond_wait(&g->start, &g->lock);
+		}
+		if (g->quit) {
+			break;
+		}
+		seen = g->round;
+		pthread_mutex_unlock(&g->lock);
+
+		e = (hwmon_sample(g->h[w->bus], &g->s[w->bus]) == -1 ? errno : 0);
+
+		pthread_mutex_lock(&g->lock);
+		g->err[w->bus] = e;
+		if (--g->pending == 0) {
+			pthread_cond_signal(&g->done);
+		}
+	}
+	pthread_mutex_unlock(&g->lock);
+	return (NULL);
+}
+
+
+/*
+ * hwmon_group_new(struct hwmon *const *h, const size_t n)
+ *
+ * h = Array of n contexts returned by hwmon_open(), one per bus; the
+ *     group doesn't take them over (see hwmon_group_free())
+ * n = Number of buses (1 to BUS_MAX)
+ *
+ * Starts a worker thread for each bus after the first.
+ *
+ * Returns the group, or NULL with errno set.
+ */
+struct hwmon_group *
+hwmon_group_new(struct hwmon *const *h, const size_t n)
+{
+	struct hwmon_group *g;
+	size_t i;
+	int e;
+
+	VERBOSE("hwmon_group_new(h = %p, n = %zu)\n", h, n);
+
+	if (n == 0 || n > BUS_MAX) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((g = calloc(1, sizeof(*g))) == NULL) {
+		return (NULL);
+	}
+	g->n = n;
+	for (i = 0; i < n; ++i) {
+		g->h[i] = h[i];
+	}
+	if ((e = pthread_mutex_init(&g->lock, NULL)) != 0) {
+		free(g);
+		errno = e;
+		return (NULL);
+	}
+	if ((e = pthread_cond_init(&g->start, NULL)) != 0) {
+		pthread_mutex_destroy(&g->lock);
+		free(g);
+		errno = e;
+		return (NULL);
+	}
+	if ((e = pthread_cond_init(&g->done, NULL)) != 0) {
+		pthread_cond_destroy(&g->start);
+		pthread_mutex_destroy(&g->lock);
+		free(g);
+		errno = e;
+		return (NULL);
+	}
+
+	for (i = 1; i < n; ++i) {
+		g->worker[i].g = g;
+		g->worker[i].bus = i;
+		if ((e = pthread_create(&g->worker[i].tid, NULL,
+		    hwmon_worker_main, &g->worker[i])) != 0) {
+			hwmon_group_free(g);
+			errno = e;
+			return (NULL);
+		}
+		g->nworkers = i;
+	}
+	return (g);
+}
+
+
+/*
+ * hwmon_group_sample(struct hwmon_group *g, struct sensors *s, int *err)
+ *
+ *   g = Group returned by hwmon_group_new()
+ *   s = Array of one sensors struct per bus, in the order given to
+ *       hwmon_group_new(); see hwmon_sample()
+ * err = Array of one int per bus, filled in with the errno of that
+ *       bus's hwmon_sample() (0 if it succeeded), or NULL
+ *
+ * Samples every bus at once.
+ *
+ * Returns 0 if every bus was sampled, or -1 if any failed (with errno
+ * set to that of the first bus which failed).
+ */
+int
+hwmon_group_sample(struct hwmon_group *g, struct sensors *s, int *err)
+{
+	size_t i;
+	int e;
+
+	if (g->n > 1) {
+		pthread_mutex_lock(&g->lock);
+		g->s = s;
+		g->pending = g->n - 1;
+		++g->round;
+		pthread_cond_broadcast(&g->start);
+		pthread_mutex_unlock(&g->lock);
+	}
+
+	g->err[0] = (hwmon_sample(g->h[0], &s[0]) == -1 ? errno : 0);
+
+	if (g->n > 1) {
+		pthread_mutex_lock(&g->lock);
+		while (g->pending > 0) {
+			pthread_cond_wait(&g->done, &g->lock);
+		}
+		pthread_mutex_unlock(&g->lock);
+	}
+
+	for (e = 0, i = 0; i < g->n; ++i) {
+		if (err != NULL) {
+			err[i] = g->err[i];
+		}
+		if (e == 0) {
+			e = g->err[i];
+		}
+	}
+	if (e != 0) {
+		errno = e;
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * hwmon_group_free(struct hwmon_group *g)
+ *
+ * g = Group returned by hwmon_group_new(), or NULL
+ *
+ * Stops the worker threads and frees g.  The contexts given to
+ * hwmon_group_new() are left open.
+ */
+void
+hwmon_group_free(struct hwmon_group *g)
+{
+	size_t i;
+
+	if (g == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&g->lock);
+	g->quit = 1;
+	pthread_cond_broadcast(&g->start);
+	pthread_mutex_unlock(&g->lock);
+
+	for (i = 1; i <= g->nworkers; ++i) {
+		pthread_join(g->worker[i].tid, NULL);
+	}
+
+	pthread_cond_destroy(&g->done);
+	pthread_cond_destroy(&g->start);
+	pthread_mutex_destroy(&g->lock);
+	free(g);
+}
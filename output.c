@@ -3,20 +3,162 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 #include <strings.h>
 #include <stdlib.h>
 #include <inttypes.h>
-#include <sysexits.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "global.h"
 
+/*
+ * Output formats (see outfmt_new()) are compiled, once per board, into a
+ * list of items: a run of literal text (labels, padding, units, JSON
+ * punctuation, all pre-rendered from the board's pinmaps) followed by a
+ * sensor value.  Whatever text follows the last value is the tail.
+ * Rendering a sample is then just memcpy() of the literal text plus an
+ * integer conversion per value, into a buffer sized for the worst case,
+ * and a single write(2).
+ *
+ * A format may also cover several buses at once (see outfmt_new_buses()),
+ * in which case each value also says whose struct sensors it comes from,
+ * and the whole thing is still rendered as one document.
+ *
+ * A value the sample doesn't have (see struct sensors in global.h) is
+ * rendered as the format's absent[] token instead, never as 0.
+ *
+ * A format for samples from the past (see outfmt_new_timed()) also has
+ * items for the time of the sample.  It covers only one bus, so even
+ * with a time item on every line it fits in OUTFMT_ITEMS.
+ */
+#define OUTFMT_ITEMS	((VOLT_MAX + TEMP_MAX + FAN_MAX) * BUS_MAX)
+#define OUTFMT_VALMAX	32		/* Longest rendered value */
+#define ITEM_TIME	(SENSOR_FAN + 1)	/* outitem kind of a time item */
+
+enum time_styles_e {
+	TIME_ISO,	/* ISO 8601, UTC, to the second */
+	TIME_EPOCH	/* Seconds since the Epoch, to the millisecond */
+};
+
+struct outitem {
+	size_t		text;		/* Offset of literal text in pool */
+	size_t		textlen;
+	uint8_t		kind;		/* One of sensor_kinds_e, or ITEM_TIME */
+	uint8_t		index;		/* One of the voltages/temps/fans enums,
+					   or for ITEM_TIME of time_styles_e */
+	uint8_t		width;		/* Right-align value to this many chars */
+	uint8_t		bus;		/* Index into the sensors array */
+};
+
+/*
+ * OpenMetrics metric families, one per sensor kind.  Names follow the
+ * Prometheus convention of ending in the unit.
+ */
+static const struct {
+	int		kind;		/* One of sensor_kinds_e */
+	const char	*name;
+	const char	*unit;
+	const char	*help;
+} om_families[] = {
+	{ SENSOR_TEMP,	"bsdhwmon_temperature_celsius",	"celsius",	"Temperature sensor reading."	},
+	{ SENSOR_FAN,	"bsdhwmon_fan_speed_rpm",	"rpm",		"Fan speed."			},
+	{ SENSOR_VOLT,	"bsdhwmon_voltage_volts",	"volts",	"Voltage sensor reading."	},
+};
+
+/*
+ * What a value the sample doesn't have is rendered as, per
+ * output_formats_e.  OpenMetrics gauges may be NaN.
+ */
+static const char *const absent[] = {
+	[OUTPUT_TEXT]		= "N/A",
+	[OUTPUT_DELIM]		= "",
+	[OUTPUT_JSON]		= "N/A",
+	[OUTPUT_OPENMETRICS]	= "NaN",
+};
+
+struct outfmt {
+	int		format;		/* One of output_formats_e */
+	const char	*absent;	/* absent[format] */
+	size_t		absentlen;
+	int		timed;		/* outfmt_new_timed() */
+	size_t		bus;		/* Bus being compiled; see outitem */
+	size_t		nitems;
+	struct outitem	items[OUTFMT_ITEMS];
+	size_t		tail;		/* Offset of trailing text in pool */
+	size_t		taillen;
+	char		*pool;		/* All literal text */
+	size_t		poollen;
+	char		*buf;		/* Rendered sample */
+	size_t		bufsize;
+	size_t		bufbase;	/* bufsize needed without --stats */
+	size_t		eof;		/* OpenMetrics: length of tail before "# EOF" */
+	size_t		nfam;		/* OpenMetrics: families; see outfmt_family() */
+	struct {
+		size_t	item;		/* First item of the family */
+		size_t	meta;		/* Its metadata, within that item's text */
+		size_t	metalen;
+	} fam[BOARD_KINDS];
+	size_t		nstats;		/* Buses with --stats; see outfmt_stats() */
+	const struct smbus_stats *stats[BUS_MAX];
+	char		*statlabel[BUS_MAX];
+};
+
 /*
  * Function prototypes
  */
 const char *	get_chip_string(const size_t);
-void		list_models(const struct board *);
-void		sensors_output(const struct board *, const struct sensors *);
-void		sensors_output_delim(const struct board *, const struct sensors *);
-void		sensors_output_json(const struct board *, const struct sensors *);
+int		list_models(FILE *, const struct boardtab *);
+static int	outfmt_text(struct outfmt *, const char *, ...)
+		    __attribute__((format(printf, 2, 3)));
+static int	outfmt_value(struct outfmt *, const int, const size_t,
+		    const int);
+static char *	om_escape(const char *);
+static char *	json_escape(const char *);
+size_t		delim_field(char *, const size_t, const char *);
+static int	outfmt_label(struct outfmt *, const char *, const char *);
+static int	outfmt_string(struct outfmt *, const char *);
+static int	outfmt_pinmap(struct outfmt *, const struct board *,
+		    const char *, const int, const char *);
+static int	outfmt_family(struct outfmt *, const struct board *const *,
+		    const char *const *, const size_t, const int);
+static int	outfmt_json(struct outfmt *, const struct board *, const char *);
+struct outfmt *	outfmt_new(const struct board *, const int);
+struct outfmt *	outfmt_new_buses(const struct board *const *,
+		    const char *const *, const size_t, const int);
+struct outfmt *	outfmt_new_timed(const struct board *, const int);
+static struct outfmt *	outfmt_compile(const struct board *const *,
+		    const char *const *, const size_t, const int, const int);
+int		outfmt_stats(struct outfmt *, const struct smbus_stats *const *,
+		    const char *const *, const size_t);
+void		outfmt_free(struct outfmt *);
+static char *	fmt_uint(char *, uint64_t, int);
+static char *	fmt_int(char *, const int64_t, int);
+static char *	fmt_milli(char *, const int32_t, int);
+static char *	fmt_str(char *, const char *, const size_t, int);
+static char *	fmt_time(char *, const int64_t, const int);
+static char *	render_value(const struct outfmt *, const struct outitem *,
+		    const struct sensors *, char *);
+const char *	sensors_render(struct outfmt *, const struct sensors *,
+		    const int, size_t *);
+static int	write_all(int, const char *, size_t);
+int		sensors_output(struct outfmt *, const struct sensors *,
+		    const int, const int);
+int		sensors_output_file(struct outfmt *, const struct sensors *,
+		    const char *);
+int		sensors_output_series(struct outfmt *, const struct sensors *,
+		    const size_t, const int);
+
+/*
+ * External functions (busstats.c)
+ */
+extern size_t	stats_om_size(const struct smbus_stats *const *,
+		    const char *const *, const size_t);
+extern char *	stats_om_render(char *, const struct smbus_stats *const *,
+		    const char *const *, const size_t);
 
 
 /*
@@ -40,177 +182,1358 @@ get_chip_string(const size_t idx)
 
 
 /*
- * list_models(struct board *b)
+ * list_models(FILE *fp, const struct boardtab *t)
  *
- * b = Pointers to board struct; see boards.c for a definition
+ * fp = Stream to write the list to
+ *  t = Board table; see board_table() and boarddb_table()
  *
- * Outputs a list of everything in the boardlist[] struct.  This is
- * used when calling the main program with the "-l" argument.
+ * Outputs a list of every board in the table.  This is used when
+ * calling the main program with the "-l" argument.
+ *
+ * Returns 0 on success, or -1 with errno set if writing to fp failed.
  */
-void
-list_models(const struct board *b)
+int
+list_models(FILE *fp, const struct boardtab *t)
 {
-	size_t i = 0;
+	const struct board *b;
+	size_t i;
 
-	VERBOSE("list_models(b = %p)\n", b);
+	VERBOSE("list_models(fp = %p, t = %p)\n", fp, t);
 
-	printf("maker          product                chip type           slave addr\n");
-	printf("-------------  ---------------------  ------------------  -----------\n");
+	fprintf(fp, "maker          product                chip type           slave addr\n");
+	fprintf(fp, "-------------  ---------------------  ------------------  -----------\n");
 
-	while (b[i].maker != NULL) {
+	for (i = 0; i < t->nboards; ++i) {
+		b = &t->boards[i];
 		/*
 		 * For boards with multiple SMBus slave addresses or custom
 		 * methods, show "Custom" rather than the SMBus slave
 		 * address.
 		 */
-		if (b[i].slave == -1) {
-			printf("%-13s  %-21s  %-18s  Custom\n",
-				b[i].maker,
-				b[i].product,
-				get_chip_string(b[i].chip)
+		if (b->slave == -1) {
+			fprintf(fp, "%-13s  %-21s  %-18s  Custom\n",
+				BOARD_MAKER(b),
+				BOARD_PRODUCT(b),
+				get_chip_string(b->chip)
 			);
 		} else {
-			printf("%-13s  %-21s  %-18s  0x%02x\n",
-				b[i].maker,
-				b[i].product,
-				get_chip_string(b[i].chip),
-				b[i].slave
+			fprintf(fp, "%-13s  %-21s  %-18s  0x%02x\n",
+				BOARD_MAKER(b),
+				BOARD_PRODUCT(b),
+				get_chip_string(b->chip),
+				b->slave
 			);
 		}
-		++i;
 	}
-	printf("-------------  ---------------------  ------------------  -----------\n");
+	fprintf(fp, "-------------  ---------------------  ------------------  -----------\n");
 
 	VERBOSE("list_models() returning\n");
-	exit(EX_OK);
+	if (fflush(fp) == EOF || ferror(fp)) {
+		return (-1);
+	}
+	return (0);
 }
 
 
-void
-sensors_output(const struct board *b, const struct sensors *s)
+/*
+ * outfmt_text(struct outfmt *of, const char *fmt, ...)
+ *
+ *  of = Output format being built
+ * fmt = printf(3) format string
+ *
+ * Appends literal text to the pool; it becomes part of the text in front
+ * of the next value (or of the tail).
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_text(struct outfmt *of, const char *fmt, ...)
+{
+	va_list ap;
+	char *p;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len < 0) {
+		return (-1);
+	}
+
+	if ((p = realloc(of->pool, of->poollen + (size_t)len + 1)) == NULL) {
+		return (-1);
+	}
+	of->pool = p;
+
+	va_start(ap, fmt);
+	vsnprintf(of->pool + of->poollen, (size_t)len + 1, fmt, ap);
+	va_end(ap);
+	of->poollen += (size_t)len;
+	of->taillen += (size_t)len;
+	return (0);
+}
+
+
+/*
+ * outfmt_value(struct outfmt *of, const int kind, const size_t index,
+ *              const int width)
+ *
+ *    of = Output format being built
+ *  kind = One of sensor_kinds_e (not SENSOR_ANY), or ITEM_TIME
+ * index = One of the voltages/temps/fans enums, or for ITEM_TIME one of
+ *         time_styles_e
+ * width = Minimum width of the value; it's right-aligned (0 = none)
+ *
+ * Ends the current run of literal text with a sensor value (or the time
+ * of the sample).
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_value(struct outfmt *of, const int kind, const size_t index,
+    const int width)
+{
+	struct outitem *it;
+
+	if (of->nitems == OUTFMT_ITEMS || index > UINT8_MAX ||
+	    width > OUTFMT_VALMAX) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	it = &of->items[of->nitems++];
+	it->text = of->tail;
+	it->textlen = of->taillen;
+	it->kind = (uint8_t)kind;
+	it->index = (uint8_t)index;
+	it->width = (uint8_t)width;
+	it->bus = (uint8_t)of->bus;
+
+	of->tail = of->poollen;
+	of->taillen = 0;
+	return (0);
+}
+
+
+/*
+ * om_escape(const char *value)
+ *
+ * value = OpenMetrics label value
+ *
+ * Escapes value as OpenMetrics requires.  Backslash, double quote, and
+ * newline are the only characters which need escaping.
+ *
+ * Returns the escaped copy, to be free()d, or NULL with errno set.
+ */
+static char *
+om_escape(const char *value)
+{
+	char *esc, *p;
+
+	if ((esc = malloc(strlen(value) * 2 + 1)) == NULL) {
+		return (NULL);
+	}
+
+	for (p = esc; *value != '\0'; ++value) {
+		switch (*value) {
+			case '\\':
+			case '"':
+				*p++ = '\\';
+				*p++ = *value;
+				break;
+			case '\n':
+				*p++ = '\\';
+				*p++ = 'n';
+				break;
+			default:
+				*p++ = *value;
+		}
+	}
+	*p = '\0';
+	return (esc);
+}
+
+
+/*
+ * json_escape(const char *value)
+ *
+ * value = JSON string contents
+ *
+ * Escapes value for use between double quotes in JSON: backslash and
+ * double quote get a backslash in front, and control characters become
+ * \n, \t, or \u00XX.  Labels come from the board database (see
+ * boarddb.c), which allows any of them.
+ *
+ * Returns the escaped copy, to be free()d, or NULL with errno set.
+ */
+static char *
+json_escape(const char *value)
+{
+	char *esc, *p;
+
+	if ((esc = malloc(strlen(value) * 6 + 1)) == NULL) {
+		return (NULL);
+	}
+
+	for (p = esc; *value != '\0'; ++value) {
+		switch (*value) {
+			case '\\':
+			case '"':
+				*p++ = '\\';
+				*p++ = *value;
+				break;
+			case '\n':
+				*p++ = '\\';
+				*p++ = 'n';
+				break;
+			case '\t':
+				*p++ = '\\';
+				*p++ = 't';
+				break;
+			default:
+				if ((u_char)*value < 0x20) {
+					p += sprintf(p, "\\u%04x", (u_char)*value);
+				} else {
+					*p++ = *value;
+				}
+		}
+	}
+	*p = '\0';
+	return (esc);
+}
+
+
+/*
+ * delim_field(char *dst, const size_t size, const char *value)
+ *
+ *   dst = Buffer for the field, or NULL if size is 0
+ *  size = Size of dst
+ * value = Field contents
+ *
+ * Writes value as one field of a -c line, quoted the way RFC 4180 has
+ * it if it contains a comma, double quote, or line break: in double
+ * quotes, with each double quote in it doubled.  Anything else is left
+ * as it is, so the fields of the built-in boards read the same as ever.
+ * Like snprintf(), dst is always NUL-terminated (if size isn't 0), and
+ * what didn't fit is counted but not written.
+ *
+ * Returns the length of the whole field, not counting the NUL.
+ */
+size_t
+delim_field(char *dst, const size_t size, const char *value)
+{
+	const int quote = (strpbrk(value, ",\"\r\n") != NULL);
+	size_t len = 0;
+
+	if (quote && ++len < size) {
+		dst[len - 1] = '"';
+	}
+	for (; *value != '\0'; ++value) {
+		if (*value == '"' && ++len < size) {
+			dst[len - 1] = '"';
+		}
+		if (++len < size) {
+			dst[len - 1] = *value;
+		}
+	}
+	if (quote && ++len < size) {
+		dst[len - 1] = '"';
+	}
+	if (size > 0) {
+		dst[(len < size ? len : size - 1)] = '\0';
+	}
+	return (len);
+}
+
+
+/*
+ * outfmt_label(struct outfmt *of, const char *name, const char *value)
+ *
+ *    of = Output format being built
+ *  name = OpenMetrics label name
+ * value = Label value; see om_escape()
+ *
+ * Appends name="value" to the pool.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_label(struct outfmt *of, const char *name, const char *value)
+{
+	char *esc;
+	int ret;
+
+	if ((esc = om_escape(value)) == NULL) {
+		return (-1);
+	}
+	ret = outfmt_text(of, "%s=\"%s\"", name, esc);
+	free(esc);
+	return (ret);
+}
+
+
+/*
+ * outfmt_string(struct outfmt *of, const char *value)
+ *
+ *    of = Output format being built
+ * value = A label, bus name, or board name
+ *
+ * Appends value to the pool, escaped for of->format: for JSON, to go
+ * between double quotes; for -c, as a whole field (see delim_field()).
+ * The text format takes it as it is.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_string(struct outfmt *of, const char *value)
+{
+	char *esc;
+	size_t len;
+	int ret;
+
+	switch (of->format) {
+		case OUTPUT_JSON:
+			esc = json_escape(value);
+			break;
+		case OUTPUT_DELIM:
+			len = delim_field(NULL, 0, value);
+			if ((esc = malloc(len + 1)) != NULL) {
+				delim_field(esc, len + 1, value);
+			}
+			break;
+		default:
+			return (outfmt_text(of, "%s", value));
+	}
+	if (esc == NULL) {
+		return (-1);
+	}
+	ret = outfmt_text(of, "%s", esc);
+	free(esc);
+	return (ret);
+}
+
+
+/*
+ * outfmt_pinmap(struct outfmt *of, const struct board *b, const char *tag,
+ *               const int kind, const char *unit)
+ *
+ *   of = Output format being built
+ *    b = Pointer to board struct; see boards.c
+ *  tag = Bus the board is on, for formats covering several buses (see
+ *        outfmt_new_buses()), or NULL
+ * kind = Which of b's pinmaps to add; one of sensor_kinds_e
+ * unit = Unit printed after each value ("C", "RPM", "V"), or for
+ *        OUTPUT_OPENMETRICS the metric name
+ *
+ * Adds one line per pinmap entry, laid out per of->format.  With a tag,
+ * -c lines start with it, JSON is indented one more level (it's nested
+ * in an object per bus), and OpenMetrics samples get a bus label.  In a
+ * timed format, -c lines start with the time (before any tag), and
+ * OpenMetrics samples end with it.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_pinmap(struct outfmt *of, const struct board *b, const char *tag,
+    const int kind, const char *unit)
 {
+	const struct pinmap *p = BOARD_PINS(b, kind);
+	const size_t n = BOARD_NPINS(b, kind);
+	const char *label;
 	size_t i;
-	size_t enum_index;
+	int ret = 0;
 
-	VERBOSE("sensors_output(b = %p, s = %p)\n", b, s);
+	for (i = 0; ret == 0 && i < n; ++i) {
+		label = BOARD_LABEL(b, &p[i]);
+		switch (of->format) {
+			case OUTPUT_TEXT:
+				ret = outfmt_text(of, "%-20s ", label);
+				if (ret == 0) {
+					ret = outfmt_value(of, kind, p[i].index, 8);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, " %s\n", unit);
+				}
+				break;
+			case OUTPUT_DELIM:
+				if (of->timed) {
+					ret = outfmt_value(of, ITEM_TIME, TIME_ISO, 0);
+					if (ret == 0) {
+						ret = outfmt_text(of, ",");
+					}
+				}
+				if (ret == 0 && tag != NULL) {
+					ret = outfmt_string(of, tag);
+					if (ret == 0) {
+						ret = outfmt_text(of, ",");
+					}
+				}
+				if (ret == 0) {
+					ret = outfmt_string(of, label);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, ",");
+				}
+				if (ret == 0) {
+					ret = outfmt_value(of, kind, p[i].index, 0);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, ",%s\n", unit);
+				}
+				break;
+			case OUTPUT_JSON:
+				ret = outfmt_text(of, "%s\t\t\"", (tag != NULL ? "\t" : ""));
+				if (ret == 0) {
+					ret = outfmt_string(of, label);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\": \"");
+				}
+				if (ret == 0) {
+					ret = outfmt_value(of, kind, p[i].index, 0);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, " %s\"%s\n", unit,
+					    (i + 1 == n ? "" : ","));
+				}
+				break;
+			case OUTPUT_OPENMETRICS:
+				ret = outfmt_text(of, "%s{", unit);
+				if (ret == 0) {
+					ret = outfmt_label(of, "sensor", label);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, ",");
+				}
+				if (ret == 0) {
+					ret = outfmt_label(of, "board", BOARD_PRODUCT(b));
+				}
+				if (ret == 0 && tag != NULL) {
+					ret = outfmt_text(of, ",");
+					if (ret == 0) {
+						ret = outfmt_label(of, "bus", tag);
+					}
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "} ");
+				}
+				if (ret == 0) {
+					ret = outfmt_value(of, kind, p[i].index, 0);
+				}
+				if (ret == 0 && of->timed) {
+					ret = outfmt_text(of, " ");
+					if (ret == 0) {
+						ret = outfmt_value(of, ITEM_TIME, TIME_EPOCH, 0);
+					}
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\n");
+				}
+				break;
+		}
+	}
+	return (ret);
+}
 
-	for (i = 0; b->temps[i].label != NULL; ++i) {
-		enum_index = b->temps[i].index;
 
-		printf("%-20s %8zu C\n",
-			b->temps[i].label,
-			s->temps[enum_index].value
-		);
+/*
+ * outfmt_family(struct outfmt *of, const struct board *const *b,
+ *               const char *const *tags, const size_t n, const int kind)
+ *
+ *   of = Output format being built
+ *    b = Array of n board structs, one per bus
+ * tags = Array of n bus names, or NULL for a single bus without a label
+ *    n = Number of buses
+ * kind = Which sensors to add; one of sensor_kinds_e
+ *
+ * Adds an OpenMetrics metric family: its TYPE, UNIT, and HELP metadata,
+ * then one sample per pinmap entry of every board.  A family's samples
+ * must not be split up, so with several buses they're all in here, one
+ * bus after the other.  If no board has sensors of this kind, there's
+ * no family at all.
+ *
+ * Where the family starts, and where its metadata is in the text in
+ * front of its first value, is kept in of->fam[], so that
+ * sensors_output_series() can put the lines of several samples under
+ * the one copy of it.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_family(struct outfmt *of, const struct board *const *b,
+    const char *const *tags, const size_t n, const int kind)
+{
+	size_t i, f;
+
+	for (i = 0; i < n && BOARD_NPINS(b[i], kind) == 0; ++i)
+		;
+	if (i == n) {
+		return (0);
 	}
 
-	for (i = 0; b->fans[i].label != NULL; ++i) {
-		enum_index = b->fans[i].index;
+	for (f = 0; om_families[f].kind != kind; ++f)
+		;
 
-		printf("%-20s %8" PRIu32 " RPM\n",
-			b->fans[i].label,
-			s->fans[enum_index].value
-		);
+	of->fam[of->nfam].meta = of->taillen;
+	if (outfmt_text(of, "# TYPE %s gauge\n# UNIT %s %s\n# HELP %s %s\n",
+	    om_families[f].name, om_families[f].name, om_families[f].unit,
+	    om_families[f].name, om_families[f].help) == -1) {
+		return (-1);
 	}
+	of->fam[of->nfam].metalen = of->taillen - of->fam[of->nfam].meta;
+	of->fam[of->nfam].item = of->nitems;
+	++of->nfam;
+	for (i = 0; i < n; ++i) {
+		of->bus = i;
+		if (outfmt_pinmap(of, b[i], (tags != NULL ? tags[i] : NULL),
+		    kind, om_families[f].name) == -1) {
+			return (-1);
+		}
+	}
+	return (0);
+}
 
-	for (i = 0; b->voltages[i].label != NULL; ++i) {
-		enum_index = b->voltages[i].index;
 
-		printf("%-20s %8.3f V\n",
-			b->voltages[i].label,
-			s->voltages[enum_index].value
-		);
+/*
+ * outfmt_json(struct outfmt *of, const struct board *b, const char *tag)
+ *
+ *  of = Output format being built
+ *   b = Pointer to board struct; see boards.c
+ * tag = Bus the board is on, or NULL; see outfmt_pinmap()
+ *
+ * Adds the "temps", "fans", and "voltages" members of a JSON object.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+outfmt_json(struct outfmt *of, const struct board *b, const char *tag)
+{
+	const char *ind = (tag != NULL ? "\t" : "");
+	int ret;
+
+	ret = outfmt_text(of, "%s\t\"temps\": {\n", ind);
+	if (ret == 0) {
+		ret = outfmt_pinmap(of, b, tag, SENSOR_TEMP, "C");
+	}
+	if (ret == 0) {
+		ret = outfmt_text(of, "%s\t},\n%s\t\"fans\": {\n", ind, ind);
 	}
+	if (ret == 0) {
+		ret = outfmt_pinmap(of, b, tag, SENSOR_FAN, "RPM");
+	}
+	if (ret == 0) {
+		ret = outfmt_text(of, "%s\t},\n%s\t\"voltages\": {\n", ind, ind);
+	}
+	if (ret == 0) {
+		ret = outfmt_pinmap(of, b, tag, SENSOR_VOLT, "V");
+	}
+	if (ret == 0) {
+		ret = outfmt_text(of, "%s\t}\n", ind);
+	}
+	return (ret);
+}
 
-	VERBOSE("sensors_output() returning\n");
+
+/*
+ * outfmt_new(const struct board *b, const int format)
+ *
+ *      b = Pointer to board struct returned by board_lookup()
+ * format = One of output_formats_e
+ *
+ * Compiles the output layout of board b in the given format; see the
+ * top of this file.  This is done once per board, not per sample.
+ *
+ * Returns a pointer to be passed to sensors_output() and freed with
+ * outfmt_free(), or NULL with errno set.
+ */
+struct outfmt *
+outfmt_new(const struct board *b, const int format)
+{
+	return (outfmt_new_buses(&b, NULL, 1, format));
 }
 
 
-void
-sensors_output_delim(const struct board *b, const struct sensors *s)
+/*
+ * outfmt_new_buses(const struct board *const *b, const char *const *tags,
+ *                  const size_t n, const int format)
+ *
+ *      b = Array of n board structs, one per bus
+ *   tags = Array of n bus names (e.g. device paths), or NULL
+ *      n = Number of buses (1 to BUS_MAX)
+ * format = One of output_formats_e
+ *
+ * Same as outfmt_new(), for one sample of several buses merged into a
+ * single document (see hwmon_group_sample()); the sensors array passed
+ * to sensors_render() then has n entries, in the same order as b.  Each
+ * bus is tagged with its name:
+ *
+ *   text         "[TAG] MAKER PRODUCT" above each bus's lines, with an
+ *                empty line between buses
+ *   -c           TAG as an extra first field on every line
+ *   JSON         an object per bus, keyed by TAG, with a "board" member
+ *   OpenMetrics  a bus="TAG" label on every sample
+ *
+ * Without tags (only sensible with n of 1) the layout is exactly that of
+ * outfmt_new().
+ *
+ * Returns a pointer to be passed to sensors_output() and freed with
+ * outfmt_free(), or NULL with errno set.
+ */
+struct outfmt *
+outfmt_new_buses(const struct board *const *b, const char *const *tags,
+    const size_t n, const int format)
+{
+	return (outfmt_compile(b, tags, n, format, 0));
+}
+
+
+/*
+ * outfmt_new_timed(const struct board *b, const int format)
+ *
+ *      b = Pointer to board struct returned by board_lookup()
+ * format = One of output_formats_e
+ *
+ * Same as outfmt_new(), for samples from the past (see history.c), which
+ * are rendered with the time they were taken (s->time):
+ *
+ *   text         a "Time" line above the sensors, in ISO 8601 UTC
+ *   -c           the same as an extra first field on every line
+ *   JSON         a "time" member, the same again
+ *   OpenMetrics  a timestamp on every sample
+ *
+ * A series of them is best output with sensors_output_series().
+ *
+ * Returns a pointer to be passed to sensors_output_series() and freed
+ * with outfmt_free(), or NULL with errno set.
+ */
+struct outfmt *
+outfmt_new_timed(const struct board *b, const int format)
+{
+	return (outfmt_compile(&b, NULL, 1, format, 1));
+}
+
+
+/*
+ * outfmt_compile(const struct board *const *b, const char *const *tags,
+ *                const size_t n, const int format, const int timed)
+ *
+ *      b = Array of n board structs, one per bus
+ *   tags = Array of n bus names, or NULL
+ *      n = Number of buses
+ * format = One of output_formats_e
+ *  timed = Non-zero for outfmt_new_timed() (n must be 1, tags NULL)
+ *
+ * Does the work of outfmt_new_buses() and outfmt_new_timed().
+ *
+ * Returns the compiled format, or NULL with errno set.
+ */
+static struct outfmt *
+outfmt_compile(const struct board *const *b, const char *const *tags,
+    const size_t n, const int format, const int timed)
 {
+	struct outfmt *of;
+	const char *tag;
 	size_t i;
-	size_t enum_index;
+	int ret = 0;
+
+	VERBOSE("outfmt_compile(b = %p, tags = %p, n = %zu, format = %d, timed = %d)\n",
+		b, tags, n, format, timed);
 
-	VERBOSE("sensors_output_delim(b = %p, s = %p)\n", b, s);
+	if (n == 0 || n > BUS_MAX || (timed && (n != 1 || tags != NULL))) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((of = calloc(1, sizeof(*of))) == NULL) {
+		return (NULL);
+	}
+	of->format = format;
+	of->timed = timed;
 
-	for (i = 0; b->temps[i].label != NULL; ++i) {
-		enum_index = b->temps[i].index;
+	if (format >= 0 && (size_t)format < sizeof(absent) / sizeof(absent[0])) {
+		of->absent = absent[format];
+		of->absentlen = strlen(of->absent);
+	}
 
-		printf("%s,%zu,C\n",
-			b->temps[i].label,
-			s->temps[enum_index].value
-		);
+	switch (format) {
+		case OUTPUT_TEXT:
+		case OUTPUT_DELIM:
+			if (timed && format == OUTPUT_TEXT) {
+				ret = outfmt_text(of, "%-20s ", "Time");
+				if (ret == 0) {
+					ret = outfmt_value(of, ITEM_TIME, TIME_ISO, 0);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\n");
+				}
+			}
+			for (i = 0; ret == 0 && i < n; ++i) {
+				of->bus = i;
+				tag = (tags != NULL ? tags[i] : NULL);
+				if (tag != NULL && format == OUTPUT_TEXT) {
+					ret = outfmt_text(of, "%s[%s] %s %s\n",
+					    (i > 0 ? "\n" : ""), tag, BOARD_MAKER(b[i]), BOARD_PRODUCT(b[i]));
+				}
+				if (ret == 0) {
+					ret = outfmt_pinmap(of, b[i], tag, SENSOR_TEMP, "C");
+				}
+				if (ret == 0) {
+					ret = outfmt_pinmap(of, b[i], tag, SENSOR_FAN, "RPM");
+				}
+				if (ret == 0) {
+					ret = outfmt_pinmap(of, b[i], tag, SENSOR_VOLT, "V");
+				}
+			}
+			break;
+		case OUTPUT_JSON:
+			ret = outfmt_text(of, "{\n");
+			if (ret == 0 && timed) {
+				ret = outfmt_text(of, "\t\"time\": \"");
+				if (ret == 0) {
+					ret = outfmt_value(of, ITEM_TIME, TIME_ISO, 0);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\",\n");
+				}
+			}
+			for (i = 0; ret == 0 && i < n; ++i) {
+				of->bus = i;
+				if (tags == NULL) {
+					ret = outfmt_json(of, b[i], NULL);
+					continue;
+				}
+				ret = outfmt_text(of, "\t\"");
+				if (ret == 0) {
+					ret = outfmt_string(of, tags[i]);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\": {\n\t\t\"board\": \"");
+				}
+				if (ret == 0) {
+					ret = outfmt_string(of, BOARD_MAKER(b[i]));
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, " ");
+				}
+				if (ret == 0) {
+					ret = outfmt_string(of, BOARD_PRODUCT(b[i]));
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\",\n");
+				}
+				if (ret == 0) {
+					ret = outfmt_json(of, b[i], tags[i]);
+				}
+				if (ret == 0) {
+					ret = outfmt_text(of, "\t}%s\n", (i + 1 < n ? "," : ""));
+				}
+			}
+			if (ret == 0) {
+				ret = outfmt_text(of, "}\n");
+			}
+			break;
+		case OUTPUT_OPENMETRICS:
+			ret = outfmt_family(of, b, tags, n, SENSOR_TEMP);
+			if (ret == 0) {
+				ret = outfmt_family(of, b, tags, n, SENSOR_FAN);
+			}
+			if (ret == 0) {
+				ret = outfmt_family(of, b, tags, n, SENSOR_VOLT);
+			}
+			if (ret == 0) {
+				of->eof = of->taillen;
+				ret = outfmt_text(of, "# EOF\n");
+			}
+			break;
+		default:
+			errno = EINVAL;
+			ret = -1;
 	}
 
-	for (i = 0; b->fans[i].label != NULL; ++i) {
-		enum_index = b->fans[i].index;
+	/*
+	 * Worst case: a leading separator line, all literal text, and
+	 * every value at its longest.
+	 */
+	if (ret == 0) {
+		of->bufsize = 1 + of->poollen + of->nitems * OUTFMT_VALMAX;
+		of->bufbase = of->bufsize;
+		if ((of->buf = malloc(of->bufsize)) == NULL) {
+			ret = -1;
+		}
+	}
 
-		printf("%s,%" PRIu32 ",RPM\n",
-			b->fans[i].label,
-			s->fans[enum_index].value
-		);
+	if (ret == -1) {
+		outfmt_free(of);
+		return (NULL);
 	}
 
-	for (i = 0; b->voltages[i].label != NULL; ++i) {
-		enum_index = b->voltages[i].index;
+	VERBOSE("outfmt_compile() returning %p (%zu items, %zu bytes of text)\n",
+		of, of->nitems, of->poollen);
+	return (of);
+}
+
 
-		printf("%s,%.3f,V\n",
-			b->voltages[i].label,
-			s->voltages[enum_index].value
-		);
+/*
+ * outfmt_stats(struct outfmt *of, const struct smbus_stats *const *st,
+ *              const char *const *tags, const size_t n)
+ *
+ *   of = Output format returned by outfmt_new() or outfmt_new_buses()
+ *   st = Array of n bus counters, from hwmon_stats()
+ * tags = Array of n bus names, as given to outfmt_new_buses(), or NULL
+ *    n = Number of buses
+ *
+ * Has every OpenMetrics sample rendered with of also carry the SMBus
+ * transaction counters of its buses (see busstats.c), just before the
+ * "# EOF".  The counters are read when each sample is rendered.  Other
+ * formats have nowhere to put them; see stats_print() instead.
+ *
+ * Returns 0 on success, or -1 with errno set (EINVAL for a format
+ * other than OpenMetrics).
+ */
+int
+outfmt_stats(struct outfmt *of, const struct smbus_stats *const *st,
+    const char *const *tags, const size_t n)
+{
+	char *esc;
+	size_t i, len;
+
+	if (of->format != OUTPUT_OPENMETRICS || of->nstats != 0 || n > BUS_MAX) {
+		errno = EINVAL;
+		return (-1);
 	}
 
-	VERBOSE("sensors_output_delim() returning\n");
+	for (i = 0; i < n; ++i) {
+		esc = NULL;
+		if (tags != NULL && (esc = om_escape(tags[i])) == NULL) {
+			break;
+		}
+		len = (esc != NULL ? strlen(esc) + 8 : 1);
+		if ((of->statlabel[i] = malloc(len)) == NULL) {
+			free(esc);
+			break;
+		}
+		snprintf(of->statlabel[i], len, "%s%s%s", (esc != NULL ? ",bus=\"" : ""),
+		    (esc != NULL ? esc : ""), (esc != NULL ? "\"" : ""));
+		free(esc);
+		of->stats[i] = st[i];
+	}
+	of->nstats = i;
+
+	if (i < n) {
+		while (i-- > 0) {
+			free(of->statlabel[i]);
+		}
+		of->nstats = 0;
+		return (-1);
+	}
+	return (0);
 }
 
 
+/*
+ * outfmt_free(struct outfmt *of)
+ *
+ * of = Output format returned by outfmt_new(), or NULL
+ */
 void
-sensors_output_json(const struct board *b, const struct sensors *s)
+outfmt_free(struct outfmt *of)
 {
 	size_t i;
-	size_t enum_index;
 
-	VERBOSE("sensors_output_json(b = %p, s = %p)\n", b, s);
+	if (of != NULL) {
+		for (i = 0; i < of->nstats; ++i) {
+			free(of->statlabel[i]);
+		}
+		free(of->pool);
+		free(of->buf);
+		free(of);
+	}
+}
+
+
+/*
+ * fmt_uint(char *p, uint64_t v, int width)
+ *
+ *     p = Where to write the digits
+ *     v = Value
+ * width = Right-align to this many characters (0 = none)
+ *
+ * Same as sprintf(p, "%*" PRIu64, width, v), without a NUL.
+ *
+ * Returns a pointer just past the last character written.
+ */
+static char *
+fmt_uint(char *p, uint64_t v, int width)
+{
+	char tmp[20];
+	int n = 0;
+
+	do {
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v != 0);
+
+	for (; width > n; --width) {
+		*p++ = ' ';
+	}
+	while (n > 0) {
+		*p++ = tmp[--n];
+	}
+	return (p);
+}
+
+
+/*
+ * fmt_int(char *p, const int64_t v, int width)
+ *
+ *     p = Where to write the digits
+ *     v = Value
+ * width = Right-align to this many characters (0 = none)
+ *
+ * Same as sprintf(p, "%*" PRId64, width, v), without a NUL.
+ *
+ * Returns a pointer just past the last character written.
+ */
+static char *
+fmt_int(char *p, const int64_t v, int width)
+{
+	char tmp[21];
+	int n = 0;
+
+	if (v < 0) {
+		tmp[n++] = '-';
+	}
+	n = (int)(fmt_uint(tmp + n, (v < 0 ? -(uint64_t)v : (uint64_t)v), 0) - tmp);
+
+	for (; width > n; --width) {
+		*p++ = ' ';
+	}
+	memcpy(p, tmp, (size_t)n);
+	return (p + n);
+}
+
+
+/*
+ * fmt_milli(char *p, const int32_t v, int width)
+ *
+ *     p = Where to write the number
+ *     v = Value, in thousandths (e.g. millivolts)
+ * width = Right-align to this many characters (0 = none)
+ *
+ * Same as sprintf(p, "%*.3f", width, v / 1000.0), without a NUL.
+ *
+ * Returns a pointer just past the last character written.
+ */
+static char *
+fmt_milli(char *p, const int32_t v, int width)
+{
+	char tmp[OUTFMT_VALMAX + 1];
+	uint32_t m;
+	int n = 0;
+
+	m = (v < 0 ? -(uint32_t)v : (uint32_t)v);
+	if (v < 0) {
+		tmp[n++] = '-';
+	}
+	n = (int)(fmt_uint(tmp + n, m / 1000, 0) - tmp);
+	tmp[n++] = '.';
+	tmp[n++] = (char)('0' + (m / 100) % 10);
+	tmp[n++] = (char)('0' + (m / 10) % 10);
+	tmp[n++] = (char)('0' + m % 10);
+
+	for (; width > n; --width) {
+		*p++ = ' ';
+	}
+	memcpy(p, tmp, (size_t)n);
+	return (p + n);
+}
+
+
+/*
+ * fmt_str(char *p, const char *str, const size_t len, int width)
+ *
+ *     p = Where to write the string
+ *   str = String
+ *   len = Its length
+ * width = Right-align to this many characters (0 = none)
+ *
+ * Same as sprintf(p, "%*s", width, str), without a NUL.
+ *
+ * Returns a pointer just past the last character written.
+ */
+static char *
+fmt_str(char *p, const char *str, const size_t len, int width)
+{
+	for (; width > (int)len; --width) {
+		*p++ = ' ';
+	}
+	memcpy(p, str, len);
+	return (p + len);
+}
+
+
+/*
+ * fmt_time(char *p, const int64_t ns, const int style)
+ *
+ *     p = Where to write the time
+ *    ns = Time (CLOCK_REALTIME, in nanoseconds)
+ * style = One of time_styles_e
+ *
+ * Writes ns as e.g. "2024-05-01T12:00:00Z" (TIME_ISO) or
+ * "1714564800.000" (TIME_EPOCH), without a NUL.
+ *
+ * Returns a pointer just past the last character written.
+ */
+static char *
+fmt_time(char *p, const int64_t ns, const int style)
+{
+	time_t sec = (time_t)(ns / 1000000000);
+	int32_t ms = (int32_t)(ns % 1000000000 / 1000000);
+	struct tm tm;
+
+	if (ms < 0) {
+		--sec;
+		ms += 1000;
+	}
+
+	if (style == TIME_ISO && gmtime_r(&sec, &tm) != NULL) {
+		return (p + strftime(p, OUTFMT_VALMAX, "%Y-%m-%dT%H:%M:%SZ", &tm));
+	}
+
+	p = fmt_int(p, sec, 0);
+	*p++ = '.';
+	*p++ = (char)('0' + ms / 100);
+	*p++ = (char)('0' + (ms / 10) % 10);
+	*p++ = (char)('0' + ms % 10);
+	return (p);
+}
+
 
-	printf("{\n");
+/*
+ * render_value(const struct outfmt *of, const struct outitem *it,
+ *              const struct sensors *s, char *p)
+ *
+ * of = Output format
+ * it = One of its items
+ *  s = Sample it->bus of the one being rendered
+ *  p = Where to write the value
+ *
+ * Returns a pointer just past the last character written.
+ */
+static char *
+render_value(const struct outfmt *of, const struct outitem *it,
+    const struct sensors *s, char *p)
+{
+	if (it->kind == ITEM_TIME) {
+		return (fmt_time(p, s->time, it->index));
+	}
+	if (!SENSORS_VALID(s, it->kind, it->index)) {
+		return (fmt_str(p, of->absent, of->absentlen, it->width));
+	}
+	switch (it->kind) {
+		case SENSOR_TEMP:
+			return (fmt_int(p, s->temps[it->index] / 1000, it->width));
+		case SENSOR_FAN:
+			return (fmt_uint(p, s->fans[it->index], it->width));
+	}
+	return (fmt_milli(p, s->voltages[it->index], it->width));
+}
+
+
+/*
+ * sensors_render(struct outfmt *of, const struct sensors *s,
+ *                const int separate, size_t *len)
+ *
+ *       of = Output format returned by outfmt_new()
+ *        s = Pointer to sensors struct; see global.h for a definition (for
+ *            outfmt_new_buses(), an array of one per bus)
+ * separate = Non-zero to start with an empty line (between samples)
+ *      len = Filled in with the length of the rendered sample
+ *
+ * Returns a pointer to the rendered sample (not NUL-terminated), valid
+ * until the next call with the same of.
+ */
+const char *
+sensors_render(struct outfmt *of, const struct sensors *s, const int separate,
+    size_t *len)
+{
+	const struct outitem *it;
+	char *p;
+	size_t i, need;
+	int stats = 0;
+
+	/*
+	 * The --stats families grow as more registers see transactions,
+	 * so the buffer grows with them.  If it can't, the sample goes out
+	 * without them.
+	 */
+	if (of->nstats > 0) {
+		need = of->bufbase + stats_om_size(of->stats,
+		    (const char *const *)of->statlabel, of->nstats);
+		if (need > of->bufsize && (p = realloc(of->buf, need)) != NULL) {
+			of->buf = p;
+			of->bufsize = need;
+		}
+		stats = (need <= of->bufsize);
+	}
+
+	p = of->buf;
+	if (separate) {
+		*p++ = '\n';
+	}
+
+	for (i = 0; i < of->nitems; ++i) {
+		it = &of->items[i];
+
+		memcpy(p, of->pool + it->text, it->textlen);
+		p += it->textlen;
+		p = render_value(of, it, &s[it->bus], p);
+	}
+
+	if (stats) {
+		memcpy(p, of->pool + of->tail, of->eof);
+		p += of->eof;
+		p = stats_om_render(p, of->stats, (const char *const *)of->statlabel,
+		    of->nstats);
+		memcpy(p, of->pool + of->tail + of->eof, of->taillen - of->eof);
+		p += of->taillen - of->eof;
+	} else {
+		memcpy(p, of->pool + of->tail, of->taillen);
+		p += of->taillen;
+	}
+
+	*len = (size_t)(p - of->buf);
+	return (of->buf);
+}
+
+
+/*
+ * write_all(int fd, const char *p, size_t len)
+ *
+ *  fd = Descriptor to write to
+ *   p = Data
+ * len = Length of data
+ *
+ * write(2) which retries partial writes (e.g. a nearly full pipe) and
+ * EINTR.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+write_all(int fd, const char *p, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-1);
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+
+/*
+ * sensors_output(struct outfmt *of, const struct sensors *s, const int fd,
+ *                const int separate)
+ *
+ *       of = Output format returned by outfmt_new()
+ *        s = Pointer to sensors struct; see global.h for a definition
+ *       fd = Descriptor to write to (e.g. STDOUT_FILENO)
+ * separate = Non-zero to start with an empty line (between samples)
+ *
+ * Renders one sample and writes it with a single write(2).  Anything
+ * pending in stdout's stdio buffer (e.g. -v output) is flushed first, so
+ * that the two don't get out of order.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+sensors_output(struct outfmt *of, const struct sensors *s, const int fd,
+    const int separate)
+{
+	const char *p;
+	size_t len;
 
-	printf("\t\"temps\": {\n");
-	for (i = 0; b->temps[i].label != NULL; ++i) {
-		enum_index = b->temps[i].index;
+	VERBOSE("sensors_output(of = %p, s = %p, fd = %d)\n", of, s, fd);
 
-		printf("\t\t\"%s\": \"%zu C\"%s\n",
-			b->temps[i].label,
-			s->temps[enum_index].value,
-			(b->temps[i+1].label == NULL ? "" : ",")
-		);
+	p = sensors_render(of, s, separate, &len);
+
+	fflush(stdout);
+
+	if (write_all(fd, p, len) == -1) {
+		return (-1);
 	}
-	printf("\t},\n");
 
-	printf("\t\"fans\": {\n");
-	for (i = 0; b->fans[i].label != NULL; ++i) {
-		enum_index = b->fans[i].index;
+	VERBOSE("sensors_output() returning\n");
+	return (0);
+}
+
 
-		printf("\t\t\"%s\": \"%" PRIu32 " RPM\"%s\n",
-			b->fans[i].label,
-			s->fans[enum_index].value,
-			(b->fans[i+1].label == NULL ? "" : ",")
-		);
+/*
+ * sensors_output_file(struct outfmt *of, const struct sensors *s,
+ *                     const char *path)
+ *
+ *   of = Output format returned by outfmt_new()
+ *    s = Pointer to sensors struct; see global.h for a definition
+ * path = File to replace with this sample
+ *
+ * Renders one sample into a temporary file next to path, then renames it
+ * over path, so that a reader (e.g. node_exporter's textfile collector)
+ * only ever sees a complete sample.  The temporary file's name doesn't
+ * end in ".prom", so the textfile collector ignores it.
+ *
+ * A setuid bsdhwmon mustn't rename a file over whatever path it's
+ * handed, so nothing is written when the effective user isn't the real
+ * one.
+ *
+ * Returns 0 on success, or -1 with errno set (EPERM if setuid).
+ */
+int
+sensors_output_file(struct outfmt *of, const struct sensors *s,
+    const char *path)
+{
+	char tmp[PATH_MAX];
+	const char *p;
+	size_t len;
+	int fd, saved;
+
+	VERBOSE("sensors_output_file(of = %p, s = %p, path = %s)\n", of, s, path);
+
+	if (geteuid() != getuid()) {
+		errno = EPERM;
+		return (-1);
 	}
-	printf("\t},\n");
 
-	printf("\t\"voltages\": {\n");
-	for (i = 0; b->voltages[i].label != NULL; ++i) {
-		enum_index = b->voltages[i].index;
+	p = sensors_render(of, s, 0, &len);
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	if ((fd = mkstemp(tmp)) == -1) {
+		return (-1);
+	}
+
+	if (fchmod(fd, 0644) == -1 || write_all(fd, p, len) == -1) {
+		saved = errno;
+		close(fd);
+		unlink(tmp);
+		errno = saved;
+		return (-1);
+	}
 
-		printf("\t\t\"%s\": \"%.3f V\"%s\n",
-			b->voltages[i].label,
-			s->voltages[enum_index].value,
-			(b->voltages[i+1].label == NULL ? "" : ",")
-		);
+	if (close(fd) == -1 || rename(tmp, path) == -1) {
+		saved = errno;
+		unlink(tmp);
+		errno = saved;
+		return (-1);
 	}
-	printf("\t}\n");
 
-	printf("}\n");
-	VERBOSE("sensors_output_json() returning\n");
+	VERBOSE("sensors_output_file() returning\n");
+	return (0);
 }
 
+
+/*
+ * sensors_output_series(struct outfmt *of, const struct sensors *s,
+ *                       const size_t n, const int fd)
+ *
+ * of = Output format returned by outfmt_new_timed()
+ *  s = Array of n samples of its board, oldest first
+ *  n = Number of samples
+ * fd = Descriptor to write to
+ *
+ * Outputs a series of samples as one document.  Text and -c samples are
+ * separated by an empty line, and JSON objects follow one another, as
+ * with -i.  An OpenMetrics exposition can't have a family split up, nor
+ * more than one "# EOF", and every point of a metric (one sensor) must
+ * come together, in time order.  So it goes family by family instead:
+ * the family's metadata (see outfmt_family()), then sensor by sensor,
+ * its line of every sample in turn.  Text and -c samples are one
+ * write(2) each; OpenMetrics lines are written a buffer at a time.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+sensors_output_series(struct outfmt *of, const struct sensors *s,
+    const size_t n, const int fd)
+{
+	const struct outitem *it;
+	const char *r;
+	char *p;
+	size_t f, i, j, k, m, end, skip, len, linemax;
+
+	VERBOSE("sensors_output_series(of = %p, s = %p, n = %zu, fd = %d)\n", of, s, n, fd);
+
+	fflush(stdout);
+
+	if (of->format != OUTPUT_OPENMETRICS) {
+		for (j = 0; j < n; ++j) {
+			r = sensors_render(of, &s[j], j > 0 && of->format != OUTPUT_JSON, &len);
+			if (write_all(fd, r, len) == -1) {
+				return (-1);
+			}
+		}
+		return (0);
+	}
+
+	p = of->buf;
+	for (f = 0; f < of->nfam; ++f) {
+		end = (f + 1 < of->nfam ? of->fam[f + 1].item : of->nitems);
+		it = &of->items[of->fam[f].item];
+		if ((size_t)(p - of->buf) + of->fam[f].metalen > of->bufsize) {
+			if (write_all(fd, of->buf, (size_t)(p - of->buf)) == -1) {
+				return (-1);
+			}
+			p = of->buf;
+		}
+		memcpy(p, of->pool + it->text + of->fam[f].meta, of->fam[f].metalen);
+		p += of->fam[f].metalen;
+
+		/*
+		 * A line is a sensor's value item and the time item after
+		 * it.  The first item's text starts with the end of the
+		 * line before (and the metadata); that's skipped.
+		 */
+		for (i = of->fam[f].item; i < end; i = k) {
+			for (k = i + 1; k < end && of->items[k].kind == ITEM_TIME; ++k)
+				;
+			it = &of->items[i];
+			for (skip = it->textlen; skip > 0 && of->pool[it->text + skip - 1] != '\n'; --skip)
+				;
+			linemax = 1;
+			for (m = i; m < k; ++m) {
+				linemax += of->items[m].textlen + OUTFMT_VALMAX;
+			}
+
+			for (j = 0; j < n; ++j) {
+				if ((size_t)(p - of->buf) + linemax > of->bufsize) {
+					if (write_all(fd, of->buf, (size_t)(p - of->buf)) == -1) {
+						return (-1);
+					}
+					p = of->buf;
+				}
+				for (m = i; m < k; ++m) {
+					it = &of->items[m];
+					len = (m == i ? skip : 0);
+					memcpy(p, of->pool + it->text + len, it->textlen - len);
+					p += it->textlen - len;
+					p = render_value(of, it, &s[j], p);
+				}
+				*p++ = '\n';
+			}
+		}
+	}
+	if (write_all(fd, of->buf, (size_t)(p - of->buf)) == -1) {
+		return (-1);
+	}
+
+	VERBOSE("sensors_output_series() returning\n");
+	return (write_all(fd, of->pool + of->tail + of->eof, of->taillen - of->eof));
+}
@@ -0,0 +1,283 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include "global.h"
+
+/*
+ * Function prototypes
+ */
+static int	pinmap_has(const struct board *, const int, const size_t);
+ssize_t		regplan_compile(const struct regplan *, const struct board *,
+		    const size_t, struct regspan *, const size_t);
+int		regplan_run(struct smbus *, const struct regspan *, const size_t,
+		    struct regmap *);
+u_char *	regmap_regs(struct regmap *, const int);
+const u_char *	regmap_find(const struct regmap *, const int);
+
+/*
+ * External functions (smbus_io.c)
+ */
+extern int	read_byte(struct smbus *, int, const char, uint8_t *);
+extern int	read_block(struct smbus *, int, const char, u_char *, size_t);
+
+/*
+ * Global variables
+ */
+static const u_char	noregs[256];	/* Image of a slave never read (zeroes) */
+
+
+/*
+ * pinmap_has(const struct board *b, const int kind, const size_t index)
+ *
+ *     b = Pointer to board struct
+ *  kind = One of sensor_kinds_e (not SENSOR_ANY)
+ * index = One of the voltages/temps/fans enums (see global.h)
+ *
+ * Returns 1 if b wires up the pin index of kind, otherwise 0.
+ */
+static int
+pinmap_has(const struct board *b, const int kind, const size_t index)
+{
+	const struct pinmap *p = BOARD_PINS(b, kind);
+	size_t i;
+
+	for (i = 0; i < BOARD_NPINS(b, kind); ++i) {
+		if (p[i].index == index) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+
+/*
+ * regplan_compile(const struct regplan *plan, const struct board *b,
+ *                 const size_t maxgap, struct regspan *spans,
+ *                 const size_t maxspans)
+ *
+ *     plan = Register plan, terminated by an entry with width 0
+ *        b = Pointer to board struct; supplies the slave address for
+ *            SLAVE_BOARD entries, and the pinmaps of the sensors to read
+ *   maxgap = Largest run of unlisted registers that may be read anyway
+ *            to join two spans together (0 = never read unlisted registers)
+ *    spans = Array to place the compiled regspans in
+ * maxspans = Number of entries available in spans
+ *
+ * Compiles a register plan into the fewest possible bus transactions.
+ * Plan entries for sensors the board doesn't expose (i.e. not listed in
+ * b's voltage, temperature, or fan pins) are skipped entirely; there's no
+ * point in reading FAN7-FAN12 on a board which only wires up six fans.
+ * Every remaining register is marked in a per-slave bitmap, which
+ * sorts and de-duplicates them in one pass, regardless of the order (or
+ * repetition) of the plan entries.  Each bitmap is then walked from CR00
+ * to CRFF, emitting one regspan per run of consecutive registers.
+ *
+ * Reading a register which nothing is wired to is normally harmless, and
+ * one extra byte on the wire is far cheaper than an extra transaction,
+ * so runs separated by maxgap registers or fewer are merged.  Chips
+ * where that isn't safe (see chip_x6dva.c) pass a maxgap of 0.
+ *
+ * Returns the number of regspans placed in spans, or -1 with errno set
+ * to ENOSPC if the plan needs more than REGMAP_SLAVES slaves or maxspans
+ * regspans.  The built-in boards never do; one from a board database
+ * (see boarddb.c) could.
+ */
+ssize_t
+regplan_compile(const struct regplan *plan, const struct board *b,
+    const size_t maxgap, struct regspan *spans, const size_t maxspans)
+{
+	int slaves[REGMAP_SLAVES];
+	uint8_t bitmap[REGMAP_SLAVES][256 / 8];
+	size_t nslaves = 0;
+	size_t nspans = 0;
+	size_t i, s;
+	size_t reg, end, gap;
+	int addr;
+
+	VERBOSE("regplan_compile(plan = %p, b = %p, maxgap = %zu)\n",
+		plan, b, maxgap);
+
+	memset(&bitmap, 0, sizeof(bitmap));
+
+	for (i = 0; plan[i].width != 0; ++i) {
+		if (plan[i].kind != SENSOR_ANY && !pinmap_has(b, plan[i].kind, plan[i].index)) {
+			continue;
+		}
+
+		addr = (plan[i].slave == SLAVE_BOARD ? b->slave : plan[i].slave);
+
+		for (s = 0; s < nslaves && slaves[s] != addr; ++s)
+			;
+		if (s == nslaves) {
+			if (nslaves == REGMAP_SLAVES) {
+				VERBOSE("regplan_compile() too many slaves\n");
+				errno = ENOSPC;
+				return (-1);
+			}
+			slaves[nslaves++] = addr;
+		}
+
+		for (reg = plan[i].reg; reg < (size_t) plan[i].reg + plan[i].width && reg < 256; ++reg) {
+			bitmap[s][reg / 8] |= 1 << (reg % 8);
+		}
+	}
+
+	for (s = 0; s < nslaves; ++s) {
+		for (reg = 0; reg < 256; ) {
+			if ((bitmap[s][reg / 8] & (1 << (reg % 8))) == 0) {
+				++reg;
+				continue;
+			}
+
+			/*
+			 * Found the start of a run.  Extend it over every
+			 * marked register, and over gaps of up to maxgap
+			 * unmarked registers which are followed by another
+			 * marked one.
+			 */
+			end = reg;
+			for (gap = 0; end + gap + 1 < 256 && gap <= maxgap; ) {
+				if (bitmap[s][(end + gap + 1) / 8] & (1 << ((end + gap + 1) % 8))) {
+					end += gap + 1;
+					gap = 0;
+				} else {
+					++gap;
+				}
+			}
+
+			if (nspans == maxspans) {
+				VERBOSE("regplan_compile() too many spans\n");
+				errno = ENOSPC;
+				return (-1);
+			}
+			spans[nspans].slave = slaves[s];
+			spans[nspans].reg = reg;
+			spans[nspans].count = end - reg + 1;
+
+			VERBOSE("\tspans[%zu] = slave 0x%02x, CR%02zX-CR%02zX\n",
+				nspans, slaves[s], reg, end);
+
+			++nspans;
+			reg = end + 1;
+		}
+	}
+
+	VERBOSE("regplan_compile() returning %zu\n", nspans);
+	return ((ssize_t)nspans);
+}
+
+
+/*
+ * regplan_run(struct smbus *bus, const struct regspan *spans,
+ *             const size_t nspans, struct regmap *rm)
+ *
+ *    bus = Bus returned by smbus_open()
+ *  spans = Compiled plan; see regplan_compile()
+ * nspans = Number of entries in spans
+ *     rm = Pointer to regmap struct to fill in
+ *
+ * Zeroes the register images in rm, then reads each regspan off the
+ * SMBus into the image of its slave.  Spans of a single register are
+ * read with read_byte(); anything longer goes through read_block().
+ *
+ * Returns 0 on success, or -1 with errno set as soon as a read fails
+ * (rm then holds a partial sample, which shouldn't be decoded).
+ */
+int
+regplan_run(struct smbus *bus, const struct regspan *spans,
+    const size_t nspans, struct regmap *rm)
+{
+	u_char *regs;
+	size_t i;
+	int r;
+
+	VERBOSE("regplan_run(bus = %p, spans = %p, nspans = %zu, rm = %p)\n",
+		bus, spans, nspans, rm);
+
+	memset(rm, 0, sizeof(struct regmap));
+
+	for (i = 0; i < nspans; ++i) {
+		if ((regs = regmap_regs(rm, spans[i].slave)) == NULL) {
+			VERBOSE("regplan_run() returning -1\n");
+			return (-1);
+		}
+
+		if (spans[i].count == 1) {
+			r = read_byte(bus, spans[i].slave, spans[i].reg,
+				&regs[spans[i].reg]);
+		} else {
+			r = read_block(bus, spans[i].slave, spans[i].reg,
+				&regs[spans[i].reg], spans[i].count);
+		}
+		if (r == -1) {
+			VERBOSE("regplan_run() returning -1\n");
+			return (-1);
+		}
+	}
+
+	VERBOSE("regplan_run() returning 0\n");
+	return (0);
+}
+
+
+/*
+ * regmap_regs(struct regmap *rm, const int slave)
+ *
+ *    rm = Pointer to regmap struct
+ * slave = SMBus slave address
+ *
+ * Returns a pointer to the 256-register image for slave, claiming a
+ * free (zeroed) image in rm if slave doesn't have one yet.  Returns NULL
+ * with errno set to ENOSPC if there's no free image left.
+ */
+u_char *
+regmap_regs(struct regmap *rm, const int slave)
+{
+	size_t s;
+
+	for (s = 0; s < rm->nslaves; ++s) {
+		if (rm->slave[s] == slave) {
+			return (rm->regs[s]);
+		}
+	}
+
+	if (rm->nslaves == REGMAP_SLAVES) {
+		errno = ENOSPC;
+		return (NULL);
+	}
+
+	rm->slave[rm->nslaves] = slave;
+	memset(rm->regs[rm->nslaves], 0, sizeof(rm->regs[0]));
+	return (rm->regs[rm->nslaves++]);
+}
+
+
+/*
+ * regmap_find(const struct regmap *rm, const int slave)
+ *
+ *    rm = Pointer to regmap struct
+ * slave = SMBus slave address
+ *
+ * Read-only counterpart of regmap_regs(), used by the chip decode
+ * routines.  Returns a pointer to the 256-register image for slave.  If
+ * nothing was read from slave, returns an image of all zeroes (the same
+ * thing the chip routines used to see in their memset() regmap[]).
+ */
+const u_char *
+regmap_find(const struct regmap *rm, const int slave)
+{
+	size_t s;
+
+	for (s = 0; s < rm->nslaves; ++s) {
+		if (rm->slave[s] == slave) {
+			return (rm->regs[s]);
+		}
+	}
+	return (noregs);
+}
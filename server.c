@@ -0,0 +1,1063 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "global.h"
+#include "hwmon.h"
+
+/*
+ * Snapshot server (--server) and client (--client).
+ *
+ * The server owns the SMBus device, samples it every interval into a
+ * single struct sensors, and answers any number of local readers with
+ * that snapshot, so readers neither need root nor touch the bus.  It is
+ * a single poll(2) loop: listening sockets, connections, and the sample
+ * schedule all share it, and connections are non-blocking, so a slow or
+ * stuck reader can't hold up sampling (it's dropped after
+ * SERVER_TIMEOUT seconds instead).
+ *
+ * Protocol on the Unix-domain socket: the client sends a format name
+ * (see formats[] below) and a newline; the server replies with the
+ * snapshot rendered in that format and closes the connection.  Unknown
+ * formats get the connection closed without a reply.
+ *
+ * A client may instead send "subscribe" and a newline, and keep the
+ * connection open: it's sent every sensor of the board straight away,
+ * and from then on only the sensors which have moved by more than the
+ * deadband for their kind (--deadband) since they were last sent to it.
+ * Each update is in the comma-delimited (-c) format, followed by an
+ * empty line.  A subscriber which doesn't keep up never holds up
+ * sampling or other readers: it has one update's worth of buffer, and
+ * while that's still being sent, further changes only mark sensors as
+ * due, so the next update carries their latest values.
+ *
+ * The optional HTTP listener (127.0.0.1 only) takes "GET /<format>",
+ * plus "GET /metrics" for OpenMetrics, and answers with HTTP/1.0.
+ */
+#define SERVER_MAXCONN	256		/* Connections (incl. subscribers) at once */
+#define SERVER_REQMAX	1024		/* Longest request (or HTTP request head) */
+#define SERVER_TIMEOUT	5		/* Seconds a connection may take */
+#define SERVER_WARNEVERY	60		/* Failed samples in a row per warning */
+#define CLIENT_RESPMAX	65536		/* Longest response the client accepts */
+#define SUB_BUFMAX	4096		/* Subscriber update buffer */
+#define WATCH_MAX	(TEMP_MAX + FAN_MAX + VOLT_MAX)	/* Sensors per board */
+
+/*
+ * One sensor of the board, as seen by subscribers.  kind indexes the
+ * deadband array passed to server_run().
+ */
+enum watch_kinds_e {
+	WATCH_TEMP,
+	WATCH_FAN,
+	WATCH_VOLT
+};
+
+static const int watch_sensor[] = { SENSOR_TEMP, SENSOR_FAN, SENSOR_VOLT };	/* Per watch_kinds_e */
+
+struct watch {
+	int		kind;		/* One of watch_kinds_e */
+	const char	*label;		/* From the board's pinmap */
+	size_t		index;		/* Into the sensors struct, per kind */
+};
+
+struct conn {
+	int		fd;		/* -1 if slot is free */
+	int		http;		/* Accepted on the HTTP listener */
+	int		sub;		/* Subscriber */
+	time_t		deadline;	/* CLOCK_MONOTONIC seconds */
+	char		req[SERVER_REQMAX];
+	size_t		reqlen;
+	char		*resp;		/* NULL while still reading the request */
+	size_t		resplen;
+	size_t		respoff;
+	uint64_t	due;		/* Subscriber: watch[] entries to send */
+	double		sent[WATCH_MAX];	/* Subscriber: values last sent */
+};
+
+static const struct {
+	const char	*name;
+	int		format;		/* One of output_formats_e */
+	const char	*mime;
+} formats[] = {
+	{ "text",	 OUTPUT_TEXT,		"text/plain; charset=utf-8"	},
+	{ "delim",	 OUTPUT_DELIM,		"text/csv; charset=utf-8"	},
+	{ "json",	 OUTPUT_JSON,		"application/json"		},
+	{ "openmetrics", OUTPUT_OPENMETRICS,	"application/openmetrics-text; version=1.0.0; charset=utf-8" },
+};
+#define NFORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+/*
+ * Function prototypes
+ */
+static void	server_signal(int);
+static int	head_complete(const char *, const size_t);
+static int	listen_unix(const char *);
+static int	listen_http(const int);
+static int	format_lookup(const char *, const size_t);
+static int	conn_respond(struct conn *, struct outfmt **, const struct sensors *);
+static void	conn_close(struct conn *);
+static size_t	watch_list(const struct board *, struct watch *);
+static void	watch_values(const struct watch *, const size_t,
+		    const struct sensors *, double *);
+static void	sub_mark(struct conn *, const struct watch *, const size_t,
+		    const double *, const double *);
+static void	sub_render(struct conn *, const struct watch *, const size_t,
+		    const double *);
+static int	client_connect(const char *);
+int		server_run(struct hwmon *, struct sensors *, struct shmsnap *,
+		    struct history *, const long, const char *, const int,
+		    const double *);
+int		client_run(const char *, const int);
+int		client_subscribe(const char *);
+
+/*
+ * External functions (output.c)
+ */
+extern size_t	delim_field(char *, const size_t, const char *);
+
+/*
+ * External functions (shmsnap.c)
+ */
+extern void	shmsnap_publish(struct shmsnap *, const struct sensors *);
+
+/*
+ * External functions (history.c)
+ */
+extern void	history_append(struct history *, const struct sensors *);
+
+/*
+ * Global variables
+ */
+static volatile sig_atomic_t	server_quit = 0;	/* Set by SIGINT/SIGTERM */
+
+
+static void
+server_signal(int sig)
+{
+	(void) sig;
+	server_quit = 1;
+}
+
+
+/*
+ * head_complete(const char *req, const size_t len)
+ *
+ * req = HTTP request received so far
+ * len = Length of req
+ *
+ * Returns 1 if req holds the whole request head (i.e. up to the first
+ * empty line), otherwise 0.
+ */
+static int
+head_complete(const char *req, const size_t len)
+{
+	size_t i;
+
+	for (i = 1; i < len; ++i) {
+		if (req[i] == '\n' && (req[i - 1] == '\n' ||
+		    (i >= 2 && req[i - 1] == '\r' && req[i - 2] == '\n'))) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+
+/*
+ * listen_unix(const char *path)
+ *
+ * path = Unix-domain socket path
+ *
+ * Creates a listening socket at path, readable and writable by everyone
+ * (the snapshot is no more sensitive than -l output).  A leftover socket
+ * from a server which is no longer running is replaced; a live one, or
+ * anything which isn't a socket, is left alone.
+ *
+ * Returns a non-blocking listening descriptor, or -1 with errno set.
+ */
+static int
+listen_unix(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	mode_t mask;
+	int fd, probe, r, saved;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	strcpy(sun.sun_path, path);
+
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errno = EEXIST;
+			return (-1);
+		}
+		if ((probe = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+			return (-1);
+		}
+		if (connect(probe, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+			close(probe);
+			errno = EADDRINUSE;
+			return (-1);
+		}
+		close(probe);
+		unlink(path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return (-1);
+	}
+
+	/*
+	 * The mode is set by bind() itself, through the umask, rather than
+	 * by a chmod() of path afterwards, which would follow whatever had
+	 * been put there in between.
+	 */
+	mask = umask(0111);
+	r = bind(fd, (struct sockaddr *)&sun, sizeof(sun));
+	saved = errno;
+	umask(mask);
+	errno = saved;
+	if (r == -1 ||
+	    listen(fd, SERVER_MAXCONN) == -1 ||
+	    fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		saved = errno;
+		close(fd);
+		errno = saved;
+		return (-1);
+	}
+	return (fd);
+}
+
+
+/*
+ * listen_http(const int port)
+ *
+ * port = TCP port to listen on, on 127.0.0.1
+ *
+ * Returns a non-blocking listening descriptor, or -1 with errno set.
+ */
+static int
+listen_http(const int port)
+{
+	struct sockaddr_in sin;
+	int fd, on = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((uint16_t)port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		return (-1);
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+	    bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+	    listen(fd, SERVER_MAXCONN) == -1 ||
+	    fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+
+/*
+ * format_lookup(const char *name, const size_t len)
+ *
+ * name = Format name, not necessarily NUL-terminated
+ *  len = Length of name
+ *
+ * Returns the index into formats[] of the format called name, or -1.
+ */
+static int
+format_lookup(const char *name, const size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < NFORMATS; ++i) {
+		if (strlen(formats[i].name) == len &&
+		    memcmp(formats[i].name, name, len) == 0) {
+			return ((int)i);
+		}
+	}
+	return (-1);
+}
+
+
+/*
+ * conn_respond(struct conn *c, struct outfmt **of, const struct sensors *s)
+ *
+ *  c = Connection
+ * of = Compiled output formats, indexed like formats[]
+ *  s = Latest snapshot
+ *
+ * Checks whether the request on c is complete, and if it is, renders
+ * the reply into c->resp.  The reply is a copy, so a new sample being
+ * taken while it's still being sent doesn't change it.
+ *
+ * Returns 1 if a reply is ready, 2 if the client asked to subscribe
+ * (left to the caller; see sub_render()), 0 if more of the request is
+ * needed, or -1 if the connection should be dropped.
+ */
+static int
+conn_respond(struct conn *c, struct outfmt **of, const struct sensors *s)
+{
+	char hdr[256];
+	const char *body, *end, *path;
+	size_t bodylen, hdrlen = 0, pathlen;
+	int f, h;
+
+	if (c->http) {
+		/* Wait for the whole request head, then parse the request line */
+		if (!head_complete(c->req, c->reqlen)) {
+			return (c->reqlen == sizeof(c->req) ? -1 : 0);
+		}
+		if (c->reqlen < 5 || memcmp(c->req, "GET /", 5) != 0) {
+			f = -1;
+		} else {
+			path = c->req + 5;
+			end = memchr(path, ' ', c->reqlen - 5);
+			if (end == NULL) {
+				end = memchr(path, '\r', c->reqlen - 5);
+			}
+			pathlen = (end == NULL ? 0 : (size_t)(end - path));
+			if (pathlen == 7 && memcmp(path, "metrics", 7) == 0) {
+				f = format_lookup("openmetrics", 11);
+			} else {
+				f = format_lookup(path, pathlen);
+			}
+		}
+
+		if (f == -1) {
+			body = "Not found.  Try /metrics, /text, /delim, /json, or /openmetrics.\n";
+			bodylen = strlen(body);
+			h = snprintf(hdr, sizeof(hdr),
+			    "HTTP/1.0 404 Not Found\r\n"
+			    "Content-Type: text/plain\r\n"
+			    "Content-Length: %zu\r\n"
+			    "Connection: close\r\n\r\n", bodylen);
+		} else {
+			body = sensors_render(of[f], s, 0, &bodylen);
+			h = snprintf(hdr, sizeof(hdr),
+			    "HTTP/1.0 200 OK\r\n"
+			    "Content-Type: %s\r\n"
+			    "Content-Length: %zu\r\n"
+			    "Connection: close\r\n\r\n", formats[f].mime, bodylen);
+		}
+		hdrlen = (size_t)h;
+	} else {
+		if ((end = memchr(c->req, '\n', c->reqlen)) == NULL) {
+			return (c->reqlen == sizeof(c->req) ? -1 : 0);
+		}
+		pathlen = (size_t)(end - c->req);
+		if (pathlen > 0 && c->req[pathlen - 1] == '\r') {
+			--pathlen;
+		}
+		if (pathlen == 9 && memcmp(c->req, "subscribe", 9) == 0) {
+			return (2);
+		}
+		if ((f = format_lookup(c->req, pathlen)) == -1) {
+			return (-1);
+		}
+		body = sensors_render(of[f], s, 0, &bodylen);
+	}
+
+	if ((c->resp = malloc(hdrlen + bodylen)) == NULL) {
+		return (-1);
+	}
+	memcpy(c->resp, hdr, hdrlen);
+	memcpy(c->resp + hdrlen, body, bodylen);
+	c->resplen = hdrlen + bodylen;
+	c->respoff = 0;
+	return (1);
+}
+
+
+static void
+conn_close(struct conn *c)
+{
+	close(c->fd);
+	free(c->resp);
+	c->fd = -1;
+	c->resp = NULL;
+	c->reqlen = 0;
+	c->sub = 0;
+}
+
+
+/*
+ * watch_list(const struct board *mb, struct watch *w)
+ *
+ * mb = Pointer to board struct returned by board_lookup()
+ *  w = Array of WATCH_MAX entries, filled in
+ *
+ * Lists the sensors of mb in output order (temperatures, fans, then
+ * voltages, each in pinmap order), for subscribers.
+ *
+ * Returns the number of entries filled in.
+ */
+static size_t
+watch_list(const struct board *mb, struct watch *w)
+{
+	const struct pinmap *p;
+	size_t i, k, n = 0;
+
+	for (k = WATCH_TEMP; k <= WATCH_VOLT; ++k) {
+		p = BOARD_PINS(mb, watch_sensor[k]);
+		for (i = 0; i < BOARD_NPINS(mb, watch_sensor[k]) && n < WATCH_MAX; ++i, ++n) {
+			w[n].kind = (int)k;
+			w[n].label = BOARD_LABEL(mb, &p[i]);
+			w[n].index = p[i].index;
+		}
+	}
+	return (n);
+}
+
+
+/*
+ * watch_values(const struct watch *w, const size_t nw,
+ *              const struct sensors *s, double *cur)
+ *
+ *   w = Sensors, from watch_list()
+ *  nw = Number of entries in w
+ *   s = Latest sample
+ * cur = Array of nw entries; filled in with each sensor's value, or NaN
+ *       if the sample doesn't have one
+ */
+static void
+watch_values(const struct watch *w, const size_t nw, const struct sensors *s,
+    double *cur)
+{
+	size_t i;
+
+	for (i = 0; i < nw; ++i) {
+		if (!SENSORS_VALID(s, watch_sensor[w[i].kind], w[i].index)) {
+			cur[i] = NAN;
+			continue;
+		}
+		switch (w[i].kind) {
+			case WATCH_TEMP:
+				cur[i] = s->temps[w[i].index] / 1000;
+				break;
+			case WATCH_FAN:
+				cur[i] = s->fans[w[i].index];
+				break;
+			default:
+				cur[i] = s->voltages[w[i].index] / 1000.0;
+		}
+	}
+}
+
+
+/*
+ * sub_mark(struct conn *c, const struct watch *w, const size_t nw,
+ *          const double *cur, const double *deadband)
+ *
+ *        c = Subscriber
+ *        w = Sensors, from watch_list()
+ *       nw = Number of entries in w
+ *      cur = Latest values, from watch_values()
+ * deadband = Per watch_kinds_e: how far a value must move to be sent
+ *
+ * Marks as due every sensor which has moved by more than its deadband
+ * since it was last sent to c, or has come or gone.  Sensors already due
+ * stay due.
+ */
+static void
+sub_mark(struct conn *c, const struct watch *w, const size_t nw,
+    const double *cur, const double *deadband)
+{
+	double d;
+	size_t i;
+
+	for (i = 0; i < nw; ++i) {
+		d = cur[i] - c->sent[i];
+		if ((d < 0 ? -d : d) > deadband[w[i].kind] ||
+		    !isnan(cur[i]) != !isnan(c->sent[i])) {
+			c->due |= (uint64_t)1 << i;
+		}
+	}
+}
+
+
+/*
+ * sub_render(struct conn *c, const struct watch *w, const size_t nw,
+ *            const double *cur)
+ *
+ *   c = Subscriber whose buffer has been sent in full
+ *   w = Sensors, from watch_list()
+ *  nw = Number of entries in w
+ * cur = Latest values, from watch_values()
+ *
+ * Renders one update into c's buffer: every due sensor with its latest
+ * value (an empty field if there's none), in -c format (labels quoted
+ * the same way; see delim_field() in output.c), then an empty line.
+ * Sensors which don't fit are left due for the next update.
+ */
+static void
+sub_render(struct conn *c, const struct watch *w, const size_t nw,
+    const double *cur)
+{
+	static const char *const unit[] = { "C", "RPM", "V" };
+	static const int prec[] = { 0, 0, 3 };
+	size_t i, len, avail;
+	int n;
+
+	c->resplen = 0;
+	c->respoff = 0;
+	for (i = 0; i < nw; ++i) {
+		if ((c->due & ((uint64_t)1 << i)) == 0) {
+			continue;
+		}
+		avail = SUB_BUFMAX - 1 - c->resplen;
+		len = delim_field(c->resp + c->resplen, avail, w[i].label);
+		n = -1;
+		if (len < avail && isnan(cur[i])) {
+			n = snprintf(c->resp + c->resplen + len, avail - len,
+			    ",,%s\n", unit[w[i].kind]);
+		} else if (len < avail) {
+			n = snprintf(c->resp + c->resplen + len, avail - len,
+			    ",%.*f,%s\n", prec[w[i].kind], cur[i], unit[w[i].kind]);
+		}
+		if (n < 0 || (size_t)n >= avail - len) {
+			if (c->resplen == 0) {
+				c->due &= ~((uint64_t)1 << i);	/* Can never fit */
+				continue;
+			}
+			break;
+		}
+		c->resplen += len + (size_t)n;
+		c->sent[i] = cur[i];
+		c->due &= ~((uint64_t)1 << i);
+	}
+	c->resp[c->resplen++] = '\n';
+}
+
+
+/*
+ * server_run(struct hwmon *h, struct sensors *s, struct shmsnap *ss,
+ *            struct history *hist, const long interval,
+ *            const char *sockpath, const int httpport,
+ *            const double *deadband)
+ *
+ *        h = Context returned by hwmon_open()
+ *        s = Pointer to sensors struct; holds the snapshot
+ *       ss = Shared memory snapshot to publish every sample to, or NULL
+ *     hist = History file to append every sample to, or NULL
+ * interval = Seconds between samples
+ * sockpath = Unix-domain socket to listen on
+ * httpport = TCP port to listen on (127.0.0.1), or 0 for none
+ * deadband = Per watch_kinds_e (C, RPM, V): how far a sensor must move
+ *            to be sent to subscribers
+ *
+ * Runs the snapshot server until SIGINT or SIGTERM; see the top of this
+ * file.  A sample which fails (chip verification, or a bus error such
+ * as a busy controller) is reported and the previous snapshot kept,
+ * since readers are better served by a slightly old snapshot than by
+ * none, and the next one is taken on schedule.  Only the first of a run
+ * of failures, and every SERVER_WARNEVERY-th after it, is reported.
+ *
+ * Returns an exit code (EX_OK on a clean shutdown).
+ */
+int
+server_run(struct hwmon *h, struct sensors *s, struct shmsnap *ss,
+    struct history *hist, const long interval, const char *sockpath,
+    const int httpport, const double *deadband)
+{
+	const struct board *mb = hwmon_board(h);
+	const struct smbus_stats *st = hwmon_stats(h);
+	struct conn *conns, *c;
+	struct pollfd pfd[2 + SERVER_MAXCONN];
+	struct conn *cidx[2 + SERVER_MAXCONN];
+	struct outfmt *of[NFORMATS];
+	struct watch watch[WATCH_MAX];
+	double cur[WATCH_MAX];
+	char discard[64];
+	struct sigaction sa;
+	struct timespec now, next;
+	long timeout;
+	size_t i, n, nlisten, nwatch, ntimed;
+	ssize_t len;
+	u_long nfailed = 0;
+	int lfd[2] = { -1, -1 };
+	int exitcode = EX_OK;
+	int cfd, r;
+
+	VERBOSE("server_run(sockpath = %s, httpport = %d, interval = %ld)\n",
+		sockpath, httpport, interval);
+
+	memset(of, 0, sizeof(of));
+	if ((conns = calloc(SERVER_MAXCONN, sizeof(*conns))) == NULL) {
+		warn("calloc() failed");
+		return (EX_OSERR);
+	}
+	for (i = 0; i < SERVER_MAXCONN; ++i) {
+		conns[i].fd = -1;
+	}
+
+	for (i = 0; i < NFORMATS; ++i) {
+		if ((of[i] = outfmt_new(mb, formats[i].format)) == NULL) {
+			warn("outfmt_new() failed");
+			exitcode = EX_OSERR;
+			goto out;
+		}
+		/* --stats: the counters go out with every OpenMetrics reply */
+		if (st != NULL && formats[i].format == OUTPUT_OPENMETRICS &&
+		    outfmt_stats(of[i], &st, NULL, 1) == -1) {
+			warn("outfmt_stats() failed");
+			exitcode = EX_OSERR;
+			goto out;
+		}
+	}
+	nwatch = watch_list(mb, watch);
+
+	/*
+	 * Take the first sample before listening, so start-up problems are
+	 * reported the same way as without --server, and nobody is ever
+	 * handed an empty snapshot.
+	 */
+	if (hwmon_sample(h, s) == -1) {
+		if (errno == ENXIO) {
+			warnx("Your motherboard is supported, but H/W chip verification failed.");
+			exitcode = EX_SOFTWARE;
+		} else {
+			warn("SMBus read failed");
+			exitcode = EX_IOERR;
+		}
+		goto out;
+	}
+	if (ss != NULL) {
+		shmsnap_publish(ss, s);
+	}
+	if (hist != NULL) {
+		history_append(hist, s);
+	}
+	watch_values(watch, nwatch, s, cur);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	next.tv_sec += interval;
+
+	if ((lfd[0] = listen_unix(sockpath)) == -1) {
+		warn("%s", sockpath);
+		exitcode = EX_UNAVAILABLE;
+		goto out;
+	}
+	if (httpport != 0 && (lfd[1] = listen_http(httpport)) == -1) {
+		warn("127.0.0.1:%d", httpport);
+		exitcode = EX_UNAVAILABLE;
+		goto out;
+	}
+	nlisten = (httpport != 0 ? 2 : 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = server_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	while (!server_quit) {
+		n = 0;
+		for (i = 0; i < nlisten; ++i) {
+			pfd[n].fd = lfd[i];
+			pfd[n].events = POLLIN;
+			cidx[n++] = NULL;
+		}
+
+		/*
+		 * Subscribers are only polled for writing when they have
+		 * something to be sent; otherwise only for hang-ups, so idle
+		 * subscribers cost no wakeups at all.
+		 */
+		ntimed = 0;
+		for (i = 0; i < SERVER_MAXCONN; ++i) {
+			c = &conns[i];
+			if (c->fd == -1) {
+				continue;
+			}
+			if (c->sub) {
+				pfd[n].events = (c->respoff < c->resplen || c->due != 0 ?
+				    POLLOUT : POLLIN);
+			} else {
+				pfd[n].events = (c->resp == NULL ? POLLIN : POLLOUT);
+				++ntimed;
+			}
+			pfd[n].fd = c->fd;
+			cidx[n++] = c;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = (next.tv_sec - now.tv_sec) * 1000 +
+		    (next.tv_nsec - now.tv_nsec) / 1000000;
+		if (timeout < 0) {
+			timeout = 0;
+		} else if (ntimed > 0 && timeout > 1000) {
+			timeout = 1000;		/* Check connection deadlines */
+		}
+
+		if (poll(pfd, n, (int)timeout) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			warn("poll() failed");
+			exitcode = EX_OSERR;
+			break;
+		}
+
+		/*
+		 * Sample when due.  As with interval_sleep(), a missed
+		 * deadline restarts the schedule rather than catching up.
+		 */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec ||
+		    (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec)) {
+			if ((r = hwmon_sample(h, s)) == -1) {
+				if (nfailed++ % SERVER_WARNEVERY == 0) {
+					if (errno == ENXIO) {
+						warnx("H/W chip verification failed; keeping the previous sample.");
+					} else {
+						warn("SMBus read failed; keeping the previous sample");
+					}
+				}
+			} else {
+				if (nfailed > 0) {
+					warnx("Sampling again after %lu failed samples.", nfailed);
+					nfailed = 0;
+				}
+				if (ss != NULL) {
+					shmsnap_publish(ss, s);
+				}
+				if (hist != NULL) {
+					history_append(hist, s);
+				}
+				watch_values(watch, nwatch, s, cur);
+				for (i = 0; i < SERVER_MAXCONN; ++i) {
+					if (conns[i].fd != -1 && conns[i].sub) {
+						sub_mark(&conns[i], watch, nwatch, cur, deadband);
+					}
+				}
+			}
+			next.tv_sec += interval;
+			if (now.tv_sec > next.tv_sec ||
+			    (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec)) {
+				next = now;
+				next.tv_sec += interval;
+			}
+			continue;
+		}
+
+		for (i = 0; i < n; ++i) {
+			if (pfd[i].revents == 0) {
+				continue;
+			}
+			c = cidx[i];
+
+			if (c == NULL) {
+				if ((cfd = accept(pfd[i].fd, NULL, NULL)) == -1) {
+					continue;
+				}
+				for (r = 0; r < SERVER_MAXCONN && conns[r].fd != -1; ++r)
+					;
+				if (r == SERVER_MAXCONN ||
+				    fcntl(cfd, F_SETFL, O_NONBLOCK) == -1) {
+					close(cfd);
+					continue;
+				}
+				conns[r].fd = cfd;
+				conns[r].http = (pfd[i].fd == lfd[1]);
+				conns[r].deadline = now.tv_sec + SERVER_TIMEOUT;
+				continue;
+			}
+
+			if (c->sub && (pfd[i].events & POLLIN)) {
+				/* Nothing is expected from subscribers but EOF */
+				len = read(c->fd, discard, sizeof(discard));
+				if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+					conn_close(c);
+				}
+				continue;
+			}
+
+			if (c->resp == NULL) {
+				len = read(c->fd, c->req + c->reqlen,
+				    sizeof(c->req) - c->reqlen);
+				if (len <= 0) {
+					if (len == -1 && (errno == EAGAIN || errno == EINTR)) {
+						continue;
+					}
+					conn_close(c);
+					continue;
+				}
+				c->reqlen += (size_t)len;
+				switch (conn_respond(c, of, s)) {
+					case -1:
+						conn_close(c);
+						break;
+					case 2:
+						if ((c->resp = malloc(SUB_BUFMAX)) == NULL) {
+							conn_close(c);
+							break;
+						}
+						c->sub = 1;
+						c->resplen = c->respoff = 0;
+						c->due = ((uint64_t)1 << nwatch) - 1;
+						break;
+				}
+				continue;
+			}
+
+			if (c->sub && c->respoff == c->resplen) {
+				sub_render(c, watch, nwatch, cur);
+			}
+
+			len = write(c->fd, c->resp + c->respoff, c->resplen - c->respoff);
+			if (len == -1) {
+				if (errno != EAGAIN && errno != EINTR) {
+					conn_close(c);
+				}
+				continue;
+			}
+			c->respoff += (size_t)len;
+			if (!c->sub && c->respoff == c->resplen) {
+				conn_close(c);
+			}
+		}
+
+		for (i = 0; i < SERVER_MAXCONN; ++i) {
+			if (conns[i].fd != -1 && !conns[i].sub &&
+			    now.tv_sec >= conns[i].deadline) {
+				VERBOSE("server_run() dropping slow connection %d\n", conns[i].fd);
+				conn_close(&conns[i]);
+			}
+		}
+	}
+
+out:
+	for (i = 0; i < SERVER_MAXCONN; ++i) {
+		if (conns[i].fd != -1) {
+			conn_close(&conns[i]);
+		}
+	}
+	free(conns);
+	if (lfd[0] != -1) {
+		close(lfd[0]);
+		unlink(sockpath);
+	}
+	if (lfd[1] != -1) {
+		close(lfd[1]);
+	}
+	for (i = 0; i < NFORMATS; ++i) {
+		outfmt_free(of[i]);
+	}
+
+	VERBOSE("server_run() returning %d\n", exitcode);
+	return (exitcode);
+}
+
+
+/*
+ * client_connect(const char *sockpath)
+ *
+ * sockpath = Unix-domain socket of a bsdhwmon --server
+ *
+ * Returns a connected descriptor, or -1 with errno set.
+ */
+static int
+client_connect(const char *sockpath)
+{
+	struct sockaddr_un sun;
+	int fd, saved;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	strcpy(sun.sun_path, sockpath);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return (-1);
+	}
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		saved = errno;
+		close(fd);
+		errno = saved;
+		return (-1);
+	}
+	return (fd);
+}
+
+
+/*
+ * client_run(const char *sockpath, const int format)
+ *
+ * sockpath = Unix-domain socket of a bsdhwmon --server
+ *   format = One of output_formats_e
+ *
+ * Asks the server for its latest snapshot in format, and copies it to
+ * stdout with a single write(2).  Doesn't need root, and never touches
+ * the SMBus.
+ *
+ * Returns an exit code (EX_OK on success).
+ */
+int
+client_run(const char *sockpath, const int format)
+{
+	char req[32];
+	char *resp;
+	size_t i, len, off;
+	ssize_t n;
+	int fd, ret;
+
+	VERBOSE("client_run(sockpath = %s, format = %d)\n", sockpath, format);
+
+	for (i = 0; i < NFORMATS && formats[i].format != format; ++i)
+		;
+	if (i == NFORMATS) {
+		warnx("format not supported by --server");
+		return (EX_USAGE);
+	}
+	len = (size_t)snprintf(req, sizeof(req), "%s\n", formats[i].name);
+
+	if ((fd = client_connect(sockpath)) == -1) {
+		ret = (errno == ENAMETOOLONG ? EX_USAGE : EX_UNAVAILABLE);
+		warn("%s", sockpath);
+		return (ret);
+	}
+
+	if (write(fd, req, len) != (ssize_t)len) {
+		warn("%s", sockpath);
+		close(fd);
+		return (EX_IOERR);
+	}
+
+	if ((resp = malloc(CLIENT_RESPMAX)) == NULL) {
+		warn("malloc() failed");
+		close(fd);
+		return (EX_OSERR);
+	}
+
+	off = 0;
+	while (off < CLIENT_RESPMAX &&
+	    (n = read(fd, resp + off, CLIENT_RESPMAX - off)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			warn("%s", sockpath);
+			free(resp);
+			close(fd);
+			return (EX_IOERR);
+		}
+		off += (size_t)n;
+	}
+	close(fd);
+
+	if (off == 0) {
+		warnx("%s: no reply from server", sockpath);
+		free(resp);
+		return (EX_PROTOCOL);
+	}
+
+	for (len = 0; len < off; len += (size_t)n) {
+		if ((n = write(STDOUT_FILENO, resp + len, off - len)) == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			warn("write() to stdout failed");
+			free(resp);
+			return (EX_IOERR);
+		}
+	}
+
+	free(resp);
+	return (EX_OK);
+}
+
+
+/*
+ * client_subscribe(const char *sockpath)
+ *
+ * sockpath = Unix-domain socket of a bsdhwmon --server
+ *
+ * Subscribes to sensor changes (see the top of this file) and copies
+ * every update to stdout as it arrives, until interrupted or the server
+ * goes away.  Doesn't need root, and never touches the SMBus.
+ *
+ * Returns an exit code; there's no successful end to a subscription
+ * other than being interrupted.
+ */
+int
+client_subscribe(const char *sockpath)
+{
+	char buf[SUB_BUFMAX];
+	size_t off;
+	ssize_t n, w;
+	int fd, ret;
+
+	VERBOSE("client_subscribe(sockpath = %s)\n", sockpath);
+
+	if ((fd = client_connect(sockpath)) == -1) {
+		ret = (errno == ENAMETOOLONG ? EX_USAGE : EX_UNAVAILABLE);
+		warn("%s", sockpath);
+		return (ret);
+	}
+
+	if (write(fd, "subscribe\n", 10) != 10) {
+		warn("%s", sockpath);
+		close(fd);
+		return (EX_IOERR);
+	}
+
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			warn("%s", sockpath);
+			close(fd);
+			return (EX_IOERR);
+		}
+		for (off = 0; off < (size_t)n; off += (size_t)w) {
+			if ((w = write(STDOUT_FILENO, buf + off, (size_t)n - off)) == -1) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				warn("write() to stdout failed");
+				close(fd);
+				return (EX_IOERR);
+			}
+		}
+	}
+	close(fd);
+
+	warnx("%s: server closed the connection", sockpath);
+	return (EX_UNAVAILABLE);
+}
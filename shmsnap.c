@@ -0,0 +1,249 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "bsdhwmon_shm.h"
+
+/*
+ * Writer side of the shared memory snapshot (--shm); the layout and the
+ * reader side are in bsdhwmon_shm.h.  There must be only one writer per
+ * object: --shm is only allowed together with -i or --server, which hold
+ * the SMBus device open (and locked) for as long as they run.
+ */
+
+struct shmsnap {
+	struct bsdhwmon_shm	*shm;
+	const struct board	*board;
+};
+
+/*
+ * Function prototypes
+ */
+static void	shmsnap_begin(struct bsdhwmon_shm *);
+static void	shmsnap_end(struct bsdhwmon_shm *);
+static void	shmsnap_labels(struct bsdhwmon_shm_sensor *, uint32_t *,
+		    const struct board *, const int);
+struct shmsnap *	shmsnap_create(const char *, const struct board *, const long);
+void		shmsnap_publish(struct shmsnap *, const struct sensors *);
+void		shmsnap_close(struct shmsnap *);
+
+
+/*
+ * shmsnap_begin(struct bsdhwmon_shm *shm)
+ * shmsnap_end(struct bsdhwmon_shm *shm)
+ *
+ * shm = Mapped snapshot
+ *
+ * Bracket every write to shm->data: seq is odd in between, which tells
+ * readers to retry.  The release fence keeps the data stores from being
+ * seen before seq turns odd; the release store keeps them from being
+ * seen after it turns even again.
+ */
+static void
+shmsnap_begin(struct bsdhwmon_shm *shm)
+{
+	uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&shm->seq, seq | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void
+shmsnap_end(struct bsdhwmon_shm *shm)
+{
+	uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&shm->seq, seq + 1, memory_order_release);
+}
+
+
+/*
+ * shmsnap_labels(struct bsdhwmon_shm_sensor *out, uint32_t *n,
+ *                const struct board *b, const int kind)
+ *
+ *  out = Array of BSDHWMON_SHM_SENSORS sensors; labels filled in
+ *    n = Filled in with the number of sensors of kind
+ *    b = Board being sampled
+ * kind = One of sensor_kinds_e (not SENSOR_ANY)
+ */
+static void
+shmsnap_labels(struct bsdhwmon_shm_sensor *out, uint32_t *n,
+    const struct board *b, const int kind)
+{
+	const struct pinmap *p = BOARD_PINS(b, kind);
+	uint32_t i;
+
+	for (i = 0; i < BSDHWMON_SHM_SENSORS && i < BOARD_NPINS(b, kind); ++i) {
+		snprintf(out[i].label, sizeof(out[i].label), "%s", BOARD_LABEL(b, &p[i]));
+		out[i].value = 0;
+	}
+	*n = i;
+}
+
+
+/*
+ * shmsnap_create(const char *name, const struct board *b,
+ *                const long interval)
+ *
+ *     name = POSIX shared memory object name, e.g. "/bsdhwmon"
+ *        b = Board being sampled
+ * interval = Seconds between samples, published for readers
+ *
+ * Creates (or takes over) the shared memory object name, readable by
+ * everyone and writable only by us, and fills in everything about the
+ * snapshot which doesn't change from sample to sample.  As with the
+ * board cache, an existing object must be owned by the effective user,
+ * since readers trust what's in it.
+ *
+ * Returns a handle for shmsnap_publish(), or NULL with errno set.
+ */
+struct shmsnap *
+shmsnap_create(const char *name, const struct board *b, const long interval)
+{
+	struct shmsnap *ss;
+	struct bsdhwmon_shm *shm;
+	struct stat st;
+	void *p;
+	int fd, saved;
+
+	VERBOSE("shmsnap_create(name = %s, b = %p, interval = %ld)\n", name, b, interval);
+
+	if ((ss = calloc(1, sizeof(*ss))) == NULL) {
+		return (NULL);
+	}
+
+	if ((fd = shm_open(name, O_RDWR|O_CREAT, 0644)) == -1) {
+		goto fail;
+	}
+	if (fstat(fd, &st) == -1) {
+		goto fail_close;
+	}
+	if (st.st_uid != geteuid()) {
+		errno = EPERM;
+		goto fail_close;
+	}
+	if (fchmod(fd, 0644) == -1 ||
+	    ftruncate(fd, (off_t)sizeof(*shm)) == -1) {
+		goto fail_close;
+	}
+	p = mmap(NULL, sizeof(*shm), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		goto fail_close;
+	}
+	close(fd);
+
+	/*
+	 * A reader may already have the object mapped (e.g. from a previous
+	 * run), so all of this goes through the sequence lock as well.  seq
+	 * itself carries on from where it was.
+	 */
+	shm = p;
+	shmsnap_begin(shm);
+	memcpy(shm->magic, BSDHWMON_SHM_MAGIC, sizeof(shm->magic));
+	shm->version = BSDHWMON_SHM_VERSION;
+	shm->size = sizeof(*shm);
+	memset(&shm->data, 0, sizeof(shm->data));
+	snprintf(shm->data.maker, sizeof(shm->data.maker), "%s", BOARD_MAKER(b));
+	snprintf(shm->data.product, sizeof(shm->data.product), "%s", BOARD_PRODUCT(b));
+	shm->data.interval = (uint32_t)interval;
+	shmsnap_labels(shm->data.temps, &shm->data.ntemps, b, SENSOR_TEMP);
+	shmsnap_labels(shm->data.fans, &shm->data.nfans, b, SENSOR_FAN);
+	shmsnap_labels(shm->data.voltages, &shm->data.nvoltages, b, SENSOR_VOLT);
+	shmsnap_end(shm);
+
+	ss->shm = shm;
+	ss->board = b;
+	return (ss);
+
+fail_close:
+	saved = errno;
+	close(fd);
+	errno = saved;
+fail:
+	saved = errno;
+	free(ss);
+	errno = saved;
+	return (NULL);
+}
+
+
+/*
+ * shmsnap_publish(struct shmsnap *ss, const struct sensors *s)
+ *
+ * ss = Handle returned by shmsnap_create()
+ *  s = Sample just collected by hwmon_sample()
+ *
+ * Stores the sensor values, in pinmap order, which of them the sample
+ * has, and its time.  Only those change from one sample to the next, so
+ * this is a few dozen stores between the two sequence bumps.
+ */
+void
+shmsnap_publish(struct shmsnap *ss, const struct sensors *s)
+{
+	struct bsdhwmon_shm_data *d = &ss->shm->data;
+	const struct board *b = ss->board;
+	const struct pinmap *temps = BOARD_PINS(b, SENSOR_TEMP);
+	const struct pinmap *fans = BOARD_PINS(b, SENSOR_FAN);
+	const struct pinmap *volts = BOARD_PINS(b, SENSOR_VOLT);
+	uint32_t tvalid = 0, fvalid = 0, vvalid = 0;
+	uint32_t i;
+
+	for (i = 0; i < d->ntemps; ++i) {
+		tvalid |= (uint32_t)SENSORS_VALID(s, SENSOR_TEMP, temps[i].index) << i;
+	}
+	for (i = 0; i < d->nfans; ++i) {
+		fvalid |= (uint32_t)SENSORS_VALID(s, SENSOR_FAN, fans[i].index) << i;
+	}
+	for (i = 0; i < d->nvoltages; ++i) {
+		vvalid |= (uint32_t)SENSORS_VALID(s, SENSOR_VOLT, volts[i].index) << i;
+	}
+
+	shmsnap_begin(ss->shm);
+	d->time_sec = s->time / 1000000000;
+	d->time_nsec = s->time % 1000000000;
+	++d->samples;
+	d->temps_valid = tvalid;
+	d->fans_valid = fvalid;
+	d->voltages_valid = vvalid;
+	for (i = 0; i < d->ntemps; ++i) {
+		d->temps[i].value = s->temps[temps[i].index] / 1000;
+	}
+	for (i = 0; i < d->nfans; ++i) {
+		d->fans[i].value = s->fans[fans[i].index];
+	}
+	for (i = 0; i < d->nvoltages; ++i) {
+		d->voltages[i].value = s->voltages[volts[i].index] / 1000.0;
+	}
+	shmsnap_end(ss->shm);
+}
+
+
+/*
+ * shmsnap_close(struct shmsnap *ss)
+ *
+ * ss = Handle returned by shmsnap_create(), or NULL
+ *
+ * Unmaps the snapshot.  The object itself is left in place with the last
+ * sample in it: readers can tell it's no longer updated from time_sec
+ * and interval, and the next bsdhwmon --shm takes it over.
+ */
+void
+shmsnap_close(struct shmsnap *ss)
+{
+	if (ss == NULL) {
+		return;
+	}
+	munmap(ss->shm, sizeof(*ss->shm));
+	free(ss);
+}
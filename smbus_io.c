@@ -3,115 +3,530 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/param.h>
-#include <dev/smbus/smb.h>
 #include <string.h>
-#include <err.h>
-#include <osreldate.h>
-#include <sysexits.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 #include "global.h"
 
 /*
- * __FreeBSD_version checks -- history and why:
+ * Every SMBus access in bsdhwmon goes through read_byte(), read_block(),
+ * and write_byte() below.  These in turn call into a bus backend (see
+ * struct smbus_backend in global.h), chosen by smbus_open() based on the
+ * device path:
  *
- * http://www.freebsd.org/doc/en/books/porters-handbook/freebsd-versions.html
+ *   sim:FILE   Simulator; registers are served from an image file (see
+ *              smbus_sim.c).  Works on any OS, and doesn't need root.
+ *   anything   smb(4) ioctl() interface (see smbus_smb.c).  FreeBSD only.
  *
- * In __FreeBSD_version 1100070 (2015/04/25), the smb(4) driver smbcmd
- * struct was overhauled, and backwards-compatibility appears to have
- * been "lost" in favour of a different design.  Discussion/commit:
+ * Each open bus is a struct smbus (see global.h) carrying its backend,
+ * the backend's state, and its own counters, so several buses can be
+ * open at once and used from different threads.  Nothing in this file
+ * or the backends exits on a bus error; it's returned as -1 with errno
+ * set (EIO for a transaction nobody answered).
  *
- * https://reviews.freebsd.org/D1955
- * https://svnweb.freebsd.org/base?view=revision&revision=281985
+ * Timing each transaction for --stats (see smbus_stats_enable()) and the
+ * -vv trace both live off to the side, in the *_probed() functions.  A
+ * bus without either costs one test of bus->probe per transaction.
  */
 
 /*
  * Function prototypes
  */
-uint8_t		read_byte(int, int, const char);
-void		write_byte(int, int, const char, const char);
+const struct smbus_backend *	smbus_backend(const char *);
+struct smbus *	smbus_open(const char *);
+void		smbus_close(struct smbus *);
+static uint64_t	stats_now(void);
+static void	stats_record(struct smbus *, const int, const u_char,
+		    const size_t, const int, const uint64_t);
+static int	read_byte_probed(struct smbus *, int, const char, uint8_t *);
+static int	read_block_probed(struct smbus *, int, const u_char, u_char *,
+		    size_t);
+static int	read_block_check(struct smbus *, int, const u_char,
+		    const u_char *, size_t);
+static int	write_byte_probed(struct smbus *, int, const char, const char);
+int		read_byte(struct smbus *, int, const char, uint8_t *);
+int		read_block(struct smbus *, int, const char, u_char *, size_t);
+int		write_byte(struct smbus *, int, const char, const char);
+u_long		smbus_xfers(const struct smbus *);
+int		smbus_stats_enable(struct smbus *);
+const struct smbus_stats *	smbus_stats(const struct smbus *);
+
+/*
+ * External variables (smbus_XXX.c)
+ */
+extern const struct smbus_backend	smbus_sim;
+#if defined(__FreeBSD__)
+extern const struct smbus_backend	smbus_smb;
+#endif
 
 /*
  * Global variables
  */
-static char	ibuf[SMB_MAXBLOCKSIZE];		/* SMBus data buffer */
+static const struct smbus_backend *backends[] = {
+	&smbus_sim,
+#if defined(__FreeBSD__)
+	&smbus_smb,			/* Must come last; matches any path */
+#endif
+	NULL
+};
+
+
+/*
+ * smbus_backend(const char *path)
+ *
+ * path = Device path, as given with "-f"
+ *
+ * Returns a pointer to the backend which handles path, or NULL if no
+ * backend does (e.g. a /dev/smbX path on a non-FreeBSD system).
+ */
+const struct smbus_backend *
+smbus_backend(const char *path)
+{
+	size_t i;
+
+	for (i = 0; backends[i] != NULL; ++i) {
+		if (strncmp(path, backends[i]->prefix, strlen(backends[i]->prefix)) == 0) {
+			return (backends[i]);
+		}
+	}
+	return (NULL);
+}
+
+
+/*
+ * smbus_open(const char *path)
+ *
+ * path = Device path, as given with "-f"
+ *
+ * Picks the backend for path and asks it to open the bus.  The backend
+ * prefix (e.g. "sim:") is stripped before the backend sees the path.
+ *
+ * Returns a bus to pass to read_byte() and friends.  On failure,
+ * returns NULL with errno set.
+ */
+struct smbus *
+smbus_open(const char *path)
+{
+	const struct smbus_backend *b;
+	struct smbus *bus;
+	int saved;
+
+	VERBOSE("smbus_open(path = %s)\n", path);
+
+	if ((b = smbus_backend(path)) == NULL) {
+		errno = ENXIO;
+		return (NULL);
+	}
+
+	if ((bus = calloc(1, sizeof(*bus))) == NULL) {
+		return (NULL);
+	}
+	bus->backend = b;
+	bus->fd = -1;
+	bus->bread_ok = (b->read_block != NULL);
+	bus->probe = (TRACE_LEVEL >= TRACE_IO && f_verbose >= TRACE_IO);
+
+	if (b->open(bus, path + strlen(b->prefix)) == -1) {
+		saved = errno;
+		free(bus);
+		errno = saved;
+		return (NULL);
+	}
+
+	VERBOSE("smbus_open() returning %p (backend = %s)\n", bus, b->name);
+	return (bus);
+}
+
+
+/*
+ * smbus_close(struct smbus *bus)
+ *
+ * bus = Bus returned by smbus_open(), or NULL
+ */
+void
+smbus_close(struct smbus *bus)
+{
+	VERBOSE("smbus_close(bus = %p)\n", bus);
+
+	if (bus != NULL) {
+		bus->backend->close(bus);
+		free(bus->stats);
+		free(bus);
+	}
+}
+
+
+/*
+ * smbus_stats_enable(struct smbus *bus)
+ *
+ * bus = Bus returned by smbus_open()
+ *
+ * Starts keeping per-slave and per-register transaction counts and
+ * latencies on bus (--stats), from zero.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+smbus_stats_enable(struct smbus *bus)
+{
+	if (bus->stats == NULL &&
+	    (bus->stats = calloc(1, sizeof(*bus->stats))) == NULL) {
+		return (-1);
+	}
+	bus->probe = 1;
+	return (0);
+}
+
+
+/*
+ * smbus_stats(const struct smbus *bus)
+ *
+ * bus = Bus returned by smbus_open()
+ *
+ * Returns the counters kept since smbus_stats_enable(), or NULL if it
+ * wasn't called.
+ */
+const struct smbus_stats *
+smbus_stats(const struct smbus *bus)
+{
+	return (bus->stats);
+}
+
+
+/*
+ * stats_now(void)
+ *
+ * Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+static uint64_t
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+
+/*
+ * stats_record(struct smbus *bus, const int slave, const u_char reg,
+ *              const size_t bytes, const int failed, const uint64_t nsec)
+ *
+ *    bus = Bus the transaction was on
+ *  slave = SMBus slave address
+ *    reg = (First) index/register of the transaction
+ *  bytes = Bytes it transferred, if it succeeded
+ * failed = Non-zero if the backend returned -1
+ *   nsec = How long it took
+ *
+ * Adds a transaction to the bus's --stats counters (bus->stats must be
+ * set).
+ */
+static void
+stats_record(struct smbus *bus, const int slave, const u_char reg,
+    const size_t bytes, const int failed, const uint64_t nsec)
+{
+	struct smbus_stats *st = bus->stats;
+	struct smbus_regstats *rs;
+	uint64_t usec = nsec / 1000;
+	size_t i, b;
+
+	for (i = 0; i < st->nslaves && st->slave[i] != slave; ++i)
+		;
+	if (i == st->nslaves) {
+		if (i == STATS_SLAVES) {
+			++st->dropped;
+			return;
+		}
+		st->slave[st->nslaves++] = slave;
+	}
+
+	for (b = 0; b < STATS_BUCKETS - 1 && usec >= (UINT64_C(1) << b); ++b)
+		;
+
+	rs = &st->reg[i][reg];
+	++rs->xfers;
+	if (failed) {
+		++rs->failures;
+	} else {
+		rs->bytes += bytes;
+	}
+	rs->nsec += nsec;
+	++rs->hist[b];
+}
 
 
 /*
- * read_byte(int fd, int slave, const char idxreg)
+ * read_byte(struct smbus *bus, int slave, const char idxreg, uint8_t *val)
  *
- *     fd = Descriptor return from open() on a /dev/smbX device
+ *    bus = Bus returned by smbus_open()
  *  slave = SMBus slave address; see boardlist[] in boards.c
  * idxreg = Index/register to read
+ *    val = Filled in with the byte read
  *
- * Reads a byte off off the SMBus via ioctl().  See smb(4) for details.
+ * Reads a byte off off the SMBus.
  *
- * Returns byte read.  On failure, returns -1.
+ * Returns 0 on success, or -1 with errno set on failure.
  */
-uint8_t
-read_byte(int fd, int slave, const char idxreg)
+int
+read_byte(struct smbus *bus, int slave, const char idxreg, uint8_t *val)
 {
-	struct smbcmd c;
+	if (bus->probe) {
+		return (read_byte_probed(bus, slave, idxreg, val));
+	}
+	++bus->xfers;
+	return (bus->backend->read_byte(bus, slave, (u_char) idxreg, val));
+}
 
-	VERBOSE("read_byte(fd = %d, slave = 0x%02x, idxreg = 0x%02x)\n",
-		fd, slave, idxreg);
 
-	memset(&c, 0, sizeof(struct smbcmd));
+/*
+ * read_byte_probed(struct smbus *bus, int slave, const char idxreg,
+ *                  uint8_t *val)
+ *
+ * Same as read_byte(), with -vv tracing and --stats timing.
+ */
+static int
+read_byte_probed(struct smbus *bus, int slave, const char idxreg, uint8_t *val)
+{
+	uint64_t t0;
+	int r;
 
-#if (__FreeBSD_version >= 1100070)
-	c.slave = slave << 1;
-	c.rbuf = ibuf;
-	c.rcount = 1;
-#else
-	c.slave = (u_char) (slave & 0xff) << 1;
-	c.data.byte_ptr = ibuf;
-#endif
+	TRACE(TRACE_IO, "read_byte(bus = %p, slave = 0x%02x, idxreg = 0x%02x)\n",
+		bus, slave, idxreg);
+
+	++bus->xfers;
+	t0 = (bus->stats != NULL ? stats_now() : 0);
+	r = bus->backend->read_byte(bus, slave, (u_char) idxreg, val);
+	if (bus->stats != NULL) {
+		stats_record(bus, slave, (u_char) idxreg, 1, r == -1, stats_now() - t0);
+	}
+
+	TRACE(TRACE_IO, "read_byte() returning %d (0x%02x)\n", r, (r == 0 ? *val : 0));
+
+	return (r);
+}
+
+
+/*
+ * read_block(struct smbus *bus, int slave, const char idxreg, u_char *buf,
+ *            size_t len)
+ *
+ *    bus = Bus returned by smbus_open()
+ *  slave = SMBus slave address; see boardlist[] in boards.c
+ * idxreg = First index/register to read
+ *    buf = Buffer to place register contents in (at least len bytes)
+ *    len = Number of consecutive registers to read
+ *
+ * Reads registers idxreg through idxreg+len-1 off the SMBus, using as
+ * few bus transactions as possible.  Each chunk of up to SMBUS_BLOCKMAX
+ * registers is fetched with a single block read.
+ *
+ * If the backend can't do block reads (or the controller or chip turn
+ * out not to support them), block reads are disabled for as long as
+ * the bus stays open and we fall back to reading the registers one at
+ * a time via read_byte().  A chip which doesn't speak the block read
+ * protocol may well answer one anyway, with its registers shifted by a
+ * byte, so the first block read from each slave is checked against byte
+ * reads of the same registers; see read_block_check().
+ *
+ * Returns 0 on success, or -1 with errno set if a byte read failed.
+ */
+int
+read_block(struct smbus *bus, int slave, const char idxreg, u_char *buf,
+    size_t len)
+{
+	u_char reg = (u_char) idxreg;
+	size_t n;
+	size_t i;
+	int r;
+
+	TRACE(TRACE_IO, "read_block(bus = %p, slave = 0x%02x, idxreg = 0x%02x, len = %zu)\n",
+		bus, slave, reg, len);
+
+	while (len > 0) {
+		n = MIN(len, SMBUS_BLOCKMAX);
+
+		if (bus->bread_ok) {
+			++bus->xfers;
+			if ((bus->probe ? read_block_probed(bus, slave, reg, buf, n) :
+			    bus->backend->read_block(bus, slave, reg, buf, n)) == 0) {
+				if ((r = read_block_check(bus, slave, reg, buf, n)) == -1) {
+					return (-1);
+				}
+				if (r == 0) {
+					buf += n;
+					reg += n;
+					len -= n;
+					continue;
+				}
+			}
+
+			VERBOSE("read_block() block reads unusable; "
+				"falling back to byte reads\n");
+			bus->bread_ok = 0;
+		}
+
+		for (i = 0; i < n; ++i) {
+			if (read_byte(bus, slave, reg + i, &buf[i]) == -1) {
+				return (-1);
+			}
+		}
+		buf += n;
+		reg += n;
+		len -= n;
+	}
+
+	TRACE(TRACE_IO, "read_block() returning\n");
+	return (0);
+}
 
-	c.cmd = idxreg;
 
-	if (ioctl(fd, SMB_READB, &c) == -1) {
-		err(EX_IOERR, "ioctl(SMB_READB) failed");
+/*
+ * read_block_probed(struct smbus *bus, int slave, const u_char reg,
+ *                   u_char *buf, size_t len)
+ *
+ * One block read transaction (at most SMBUS_BLOCKMAX registers) of
+ * read_block(), with --stats timing.
+ */
+static int
+read_block_probed(struct smbus *bus, int slave, const u_char reg, u_char *buf,
+    size_t len)
+{
+	uint64_t t0;
+	int r;
+
+	t0 = (bus->stats != NULL ? stats_now() : 0);
+	r = bus->backend->read_block(bus, slave, reg, buf, len);
+	if (bus->stats != NULL) {
+		stats_record(bus, slave, reg, len, r == -1, stats_now() - t0);
 	}
+	return (r);
+}
 
-	VERBOSE("read_byte() returning 0x%02x\n", (u_char) ibuf[0]);
 
-	return ((u_char) ibuf[0]);
+/*
+ * read_block_check(struct smbus *bus, int slave, const u_char reg,
+ *                  const u_char *buf, size_t len)
+ *
+ *   bus = Bus returned by smbus_open()
+ * slave = SMBus slave address
+ *   reg = First register of the block read
+ *   buf = What the block read returned
+ *   len = Number of registers in buf
+ *
+ * The Winbond chips don't implement the SMBus block read protocol.
+ * Asked for one, they answer with a plain sequential read; the
+ * controller then takes the first register for the byte count, and as
+ * long as that is at least len the transfer looks fine, with every
+ * register in buf shifted by one.  Nothing about the transfer itself
+ * tells that apart from a good one, so the first block read from each
+ * slave is repeated with byte reads, and block reads are only trusted
+ * for a slave once the two agree.  A register which changed in between
+ * (a sensor reading) just means block reads aren't used, which is the
+ * safe way to be wrong.
+ *
+ * Returns 0 if buf can be used, 1 if it can't (block reads must be
+ * disabled), or -1 with errno set if a byte read failed.
+ */
+static int
+read_block_check(struct smbus *bus, int slave, const u_char reg,
+    const u_char *buf, size_t len)
+{
+	u_char val;
+	size_t i;
+
+	for (i = 0; i < bus->nbread; ++i) {
+		if (bus->bread_slave[i] == slave) {
+			return (0);
+		}
+	}
+
+	for (i = 0; i < len; ++i) {
+		if (read_byte(bus, slave, (char) (reg + i), &val) == -1) {
+			return (-1);
+		}
+		if (val != buf[i]) {
+			VERBOSE("read_block_check() slave 0x%02x register 0x%02x: "
+				"block read 0x%02x, byte read 0x%02x\n",
+				slave, (u_char) (reg + i), buf[i], val);
+			return (1);
+		}
+	}
+
+	/* Past BREAD_SLAVES slaves, every block read is checked */
+	if (bus->nbread < BREAD_SLAVES) {
+		bus->bread_slave[bus->nbread++] = slave;
+	}
+	return (0);
 }
 
 
 /*
- * write_byte(int fd, int slave, const char idxreg, const char value)
+ * smbus_xfers(const struct smbus *bus)
+ *
+ * bus = Bus returned by smbus_open()
  *
- *     fd = Descriptor return from open() on a /dev/smbX device
+ * Returns the total number of SMBus transactions issued on bus since it
+ * was opened.  Taking the difference between two calls gives the number
+ * of transactions used by a single sample.
+ */
+u_long
+smbus_xfers(const struct smbus *bus)
+{
+	return (bus->xfers);
+}
+
+
+/*
+ * write_byte(struct smbus *bus, int slave, const char idxreg,
+ *            const char value)
+ *
+ *    bus = Bus returned by smbus_open()
  *  slave = SMBus slave address; see boardlist[] in boards.c
  * idxreg = Index/register to write to
  *  value = Value to write to bus
  *
- * Writes a byte to the SMBus via ioctl().  See smb(4) for details.
+ * Writes a byte to the SMBus.
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
  */
-void
-write_byte(int fd, int slave, const char idxreg, const char value)
+int
+write_byte(struct smbus *bus, int slave, const char idxreg, const char value)
 {
-	struct smbcmd c;
-
-	VERBOSE("write_byte(fd = %d, slave = 0x%02x, idxreg = 0x%02x, value = 0x%02x)\n",
-		fd, slave, idxreg, value);
+	if (bus->probe) {
+		return (write_byte_probed(bus, slave, idxreg, value));
+	}
+	++bus->xfers;
+	return (bus->backend->write_byte(bus, slave, (u_char) idxreg, (u_char) value));
+}
 
-	memset(&c, 0, sizeof(struct smbcmd));
 
-#if (__FreeBSD_version >= 1100070)
-	c.slave = slave << 1;
-	c.wdata.byte = value;
-#else
-	c.slave = (u_char) (slave & 0xff) << 1;
-	c.data.byte = value;
-#endif
+/*
+ * write_byte_probed(struct smbus *bus, int slave, const char idxreg,
+ *                   const char value)
+ *
+ * Same as write_byte(), with -vv tracing and --stats timing.
+ */
+static int
+write_byte_probed(struct smbus *bus, int slave, const char idxreg,
+    const char value)
+{
+	uint64_t t0;
+	int r;
 
-	c.cmd = idxreg;
+	TRACE(TRACE_IO, "write_byte(bus = %p, slave = 0x%02x, idxreg = 0x%02x, value = 0x%02x)\n",
+		bus, slave, idxreg, value);
 
-	if (ioctl(fd, SMB_WRITEB, &c) == -1) {
-		err(EX_IOERR, "ioctl(SMB_WRITEB) failed");
+	++bus->xfers;
+	t0 = (bus->stats != NULL ? stats_now() : 0);
+	r = bus->backend->write_byte(bus, slave, (u_char) idxreg, (u_char) value);
+	if (bus->stats != NULL) {
+		stats_record(bus, slave, (u_char) idxreg, 1, r == -1, stats_now() - t0);
 	}
 
-	VERBOSE("write_byte() returning\n");
+	TRACE(TRACE_IO, "write_byte() returning %d\n", r);
+	return (r);
 }
-
@@ -0,0 +1,383 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/types.h>
+#include "global.h"
+
+/*
+ * Simulator bus backend.  Selected with "-f sim:FILE[,latency=USEC]".
+ *
+ * Reads are served from an in-memory 256-byte register image per slave,
+ * loaded from FILE at open time; writes go to the image.  This lets the
+ * chip routines run anywhere (no /dev/smbX, no root, no FreeBSD), which
+ * is handy for benchmarking and for checking that decode output doesn't
+ * change.  latency=USEC sleeps USEC microseconds per bus transaction, to
+ * roughly model the cost of a real SMBus controller.
+ *
+ * FILE is plain text, in the same layout as i2cdump(8) output, with a
+ * "slave" line in front of each image:
+ *
+ *   # Supermicro X7DBP
+ *   slave 0x2f
+ *        0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f
+ *   00: 5b 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00
+ *   10: 5e 5e 5d 00 c3 4b d1 ca d0 d4 c6 99 22 8a 8a 8a
+ *   ...
+ *
+ * Rows may be given in any order, and missing rows read back as 0x00.
+ * "XX" (unreadable, as printed by i2cdump) also reads back as 0x00.
+ * Anything after the 16th byte of a row, blank lines, the column header,
+ * and lines starting with "#" are ignored.  Reading from a slave with no
+ * image fails the same way a real bus does when nothing answers.
+ *
+ * Every open of a simulator bus loads its own copy of the images, so
+ * writes on one bus are never seen on another.
+ */
+#define SIM_SLAVES	8
+
+struct sim {
+	size_t		nslaves;
+	int		slaves[SIM_SLAVES];
+	u_char		images[SIM_SLAVES][256];
+	struct timespec	latency;		/* Per-transaction delay */
+};
+
+/*
+ * Function prototypes
+ */
+static void	sim_delay(const struct sim *);
+static int	sim_load(struct sim *, FILE *);
+static u_char *	sim_image(struct sim *, int);
+static int	sim_open(struct smbus *, const char *);
+static int	sim_read_byte(struct smbus *, int, u_char, uint8_t *);
+static int	sim_read_block(struct smbus *, int, u_char, u_char *, size_t);
+static int	sim_write_byte(struct smbus *, int, u_char, u_char);
+static void	sim_close(struct smbus *);
+
+/*
+ * Global variables
+ */
+
+const struct smbus_backend smbus_sim = {
+	"sim",				/* name */
+	"sim:",				/* prefix */
+	0,				/* needs_root */
+	sim_open,
+	sim_read_byte,
+	sim_read_block,
+	sim_write_byte,
+	sim_close
+};
+
+
+/*
+ * sim_delay(const struct sim *sim)
+ *
+ * sim = Simulator state of the bus
+ *
+ * Sleeps for the configured per-transaction latency, if any.
+ */
+static void
+sim_delay(const struct sim *sim)
+{
+	if (sim->latency.tv_sec != 0 || sim->latency.tv_nsec != 0) {
+		nanosleep(&sim->latency, NULL);
+	}
+}
+
+
+/*
+ * sim_load(struct sim *sim, FILE *fp)
+ *
+ * sim = Simulator state to load the images into
+ *  fp = Image file, opened for reading
+ *
+ * Parses an image file (see the top of this file for the format) into
+ * sim->images[].
+ *
+ * Returns 0 on success, or -1 with errno set to EINVAL (or EFBIG if the
+ * file has too many slaves) if the file is malformed.
+ */
+static int
+sim_load(struct sim *sim, FILE *fp)
+{
+	char line[256];
+	char *p, *ep;
+	u_char *image = NULL;
+	u_long row;
+	u_long val;
+	u_int slave;
+	size_t i;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		for (p = line; isspace((u_char) *p); ++p)
+			;
+
+		if (*p == '\0' || *p == '#') {
+			continue;
+		}
+
+		if (sscanf(p, "slave %i", &slave) == 1) {
+			if (slave > 0x7f) {
+				errno = EINVAL;
+				return (-1);
+			}
+			if (sim_image(sim, slave) == NULL) {
+				if (sim->nslaves == SIM_SLAVES) {
+					errno = EFBIG;
+					return (-1);
+				}
+				sim->slaves[sim->nslaves++] = slave;
+			}
+			image = sim_image(sim, slave);
+			continue;
+		}
+
+		/*
+		 * Row: "NN: xx xx ..."  Anything else that isn't a row (e.g.
+		 * the i2cdump column header) is skipped.
+		 */
+		row = strtoul(p, &ep, 16);
+		if (ep == p || *ep != ':') {
+			continue;
+		}
+		if (image == NULL || row > 0xf0 || (row & 0x0f) != 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+
+		p = ep + 1;
+		for (i = 0; i < 16; ++i) {
+			while (isspace((u_char) *p)) {
+				++p;
+			}
+			if (strncasecmp(p, "XX", 2) == 0) {
+				val = 0;
+				ep = p + 2;
+			} else {
+				val = strtoul(p, &ep, 16);
+				if (ep == p || val > 0xff) {
+					errno = EINVAL;
+					return (-1);
+				}
+			}
+			image[row + i] = val;
+			p = ep;
+		}
+	}
+	return (0);
+}
+
+
+/*
+ * sim_image(struct sim *sim, int slave)
+ *
+ *   sim = Simulator state of the bus
+ * slave = SMBus slave address
+ *
+ * Returns a pointer to the register image for slave, or NULL if the
+ * image file didn't have one.
+ */
+static u_char *
+sim_image(struct sim *sim, int slave)
+{
+	size_t i;
+
+	for (i = 0; i < sim->nslaves; ++i) {
+		if (sim->slaves[i] == slave) {
+			return (sim->images[i]);
+		}
+	}
+	return (NULL);
+}
+
+
+/*
+ * sim_open(struct smbus *bus, const char *spec)
+ *
+ *  bus = Bus being opened; priv is pointed at its simulator state
+ * spec = "FILE[,latency=USEC]"
+ *
+ * Loads the register images from FILE.
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
+ */
+static int
+sim_open(struct smbus *bus, const char *spec)
+{
+	char path[1024];
+	const char *opt;
+	char *ep;
+	long usec = 0;
+	size_t len;
+	struct sim *sim;
+	FILE *fp;
+	int r, saved;
+
+	if ((opt = strchr(spec, ',')) != NULL) {
+		if (strncmp(opt, ",latency=", 9) != 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+		errno = 0;
+		usec = strtol(opt + 9, &ep, 10);
+		if (errno != 0 || ep == opt + 9 || *ep != '\0' || usec < 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+		len = opt - spec;
+	} else {
+		len = strlen(spec);
+	}
+
+	if (len >= sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	memcpy(path, spec, len);
+	path[len] = '\0';
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return (-1);
+	}
+	if ((sim = calloc(1, sizeof(*sim))) == NULL) {
+		saved = errno;
+		fclose(fp);
+		errno = saved;
+		return (-1);
+	}
+
+	sim->latency.tv_sec = usec / 1000000;
+	sim->latency.tv_nsec = (usec % 1000000) * 1000;
+
+	r = sim_load(sim, fp);
+	saved = errno;
+	fclose(fp);
+	if (r == -1) {
+		free(sim);
+		errno = saved;
+		return (-1);
+	}
+
+	VERBOSE("sim_open() loaded %zu slave image(s), latency = %ld us\n",
+		sim->nslaves, usec);
+	bus->priv = sim;
+	return (0);
+}
+
+
+/*
+ * sim_read_byte(struct smbus *bus, int slave, u_char idxreg, uint8_t *val)
+ *
+ *    bus = Bus opened by sim_open()
+ *  slave = SMBus slave address
+ * idxreg = Index/register to read
+ *    val = Filled in with the register from the slave's image
+ *
+ * Returns 0 on success.  If there is no image for slave, returns -1
+ * with errno set to EIO (same as a real bus with nothing answering at
+ * that address).
+ */
+static int
+sim_read_byte(struct smbus *bus, int slave, u_char idxreg, uint8_t *val)
+{
+	struct sim *sim = bus->priv;
+	u_char *image;
+
+	if ((image = sim_image(sim, slave)) == NULL) {
+		VERBOSE("simulator: no image for slave 0x%02x\n", slave);
+		errno = EIO;
+		return (-1);
+	}
+	sim_delay(sim);
+	*val = image[idxreg];
+	return (0);
+}
+
+
+/*
+ * sim_read_block(struct smbus *bus, int slave, u_char idxreg, u_char *buf,
+ *                size_t len)
+ *
+ *    bus = Bus opened by sim_open()
+ *  slave = SMBus slave address
+ * idxreg = First index/register to read
+ *    buf = Buffer to place register contents in
+ *    len = Number of consecutive registers to read
+ *
+ * Copies registers out of the slave's image, wrapping around at CRFF
+ * (a Winbond chip's index register does the same).
+ *
+ * Returns 0 on success, or -1 with errno set to EIO if there is no
+ * image for slave; read_block() then retries byte by byte, which fails
+ * the same way.
+ */
+static int
+sim_read_block(struct smbus *bus, int slave, u_char idxreg, u_char *buf,
+    size_t len)
+{
+	struct sim *sim = bus->priv;
+	u_char *image;
+	size_t i;
+
+	if ((image = sim_image(sim, slave)) == NULL) {
+		errno = EIO;
+		return (-1);
+	}
+	sim_delay(sim);
+	for (i = 0; i < len; ++i) {
+		buf[i] = image[(idxreg + i) & 0xff];
+	}
+	return (0);
+}
+
+
+/*
+ * sim_write_byte(struct smbus *bus, int slave, u_char idxreg, u_char value)
+ *
+ *    bus = Bus opened by sim_open()
+ *  slave = SMBus slave address
+ * idxreg = Index/register to write to
+ *  value = Value to write
+ *
+ * Stores value in the slave's image.  Bank switching is not simulated.
+ *
+ * Returns 0 on success, or -1 with errno set to EIO if there is no
+ * image for slave.
+ */
+static int
+sim_write_byte(struct smbus *bus, int slave, u_char idxreg, u_char value)
+{
+	struct sim *sim = bus->priv;
+	u_char *image;
+
+	if ((image = sim_image(sim, slave)) == NULL) {
+		VERBOSE("simulator: no image for slave 0x%02x\n", slave);
+		errno = EIO;
+		return (-1);
+	}
+	sim_delay(sim);
+	image[idxreg] = value;
+	return (0);
+}
+
+
+/*
+ * sim_close(struct smbus *bus)
+ *
+ * bus = Bus opened by sim_open()
+ */
+static void
+sim_close(struct smbus *bus)
+{
+	free(bus->priv);
+	bus->priv = NULL;
+}
@@ -0,0 +1,234 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+/*
+ * smb(4) bus backend: talks to a real SMBus controller through the
+ * ioctl() interface of /dev/smbX.  FreeBSD only.
+ */
+#if defined(__FreeBSD__)
+
+#include <stdio.h>
+#include <sys/param.h>
+#include <dev/smbus/smb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <osreldate.h>
+#include "global.h"
+
+/*
+ * __FreeBSD_version checks -- history and why:
+ *
+ * http://www.freebsd.org/doc/en/books/porters-handbook/freebsd-versions.html
+ *
+ * In __FreeBSD_version 1100070 (2015/04/25), the smb(4) driver smbcmd
+ * struct was overhauled, and backwards-compatibility appears to have
+ * been "lost" in favour of a different design.  Discussion/commit:
+ *
+ * https://reviews.freebsd.org/D1955
+ * https://svnweb.freebsd.org/base?view=revision&revision=281985
+ */
+
+/*
+ * Function prototypes
+ */
+static int	smb_open(struct smbus *, const char *);
+static int	smb_read_byte(struct smbus *, int, u_char, uint8_t *);
+#if (__FreeBSD_version >= 1100070)
+static int	smb_read_block(struct smbus *, int, u_char, u_char *, size_t);
+#endif
+static int	smb_write_byte(struct smbus *, int, u_char, u_char);
+static void	smb_close(struct smbus *);
+
+/*
+ * Global variables
+ */
+
+const struct smbus_backend smbus_smb = {
+	"smb",				/* name */
+	"",				/* prefix; matches any device path */
+	1,				/* needs_root */
+	smb_open,
+	smb_read_byte,
+#if (__FreeBSD_version >= 1100070)
+	smb_read_block,
+#else
+	NULL,				/* No byte count to check; see below */
+#endif
+	smb_write_byte,
+	smb_close
+};
+
+
+/*
+ * smb_open(struct smbus *bus, const char *path)
+ *
+ *  bus = Bus being opened; fd is filled in
+ * path = Path to a /dev/smbX device
+ *
+ * Open the device with read/write access and an exclusive lock.  The
+ * lock is a safety mechanism in the case two bsdhwmon processes somehow
+ * run simultaneously (one should block/wait indefinitely until the
+ * other has closed the fd).
+ *
+ * I simply don't know if the smb(4) framework would handle two
+ * programs simultaneously reading/writing to /dev/smbX.
+ *
+ * Returns 0, or -1 on failure (errno is set).
+ */
+static int
+smb_open(struct smbus *bus, const char *path)
+{
+	if ((bus->fd = open(path, O_RDWR|O_EXLOCK)) == -1) {
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * smb_read_byte(struct smbus *bus, int slave, u_char idxreg, uint8_t *val)
+ *
+ *    bus = Bus opened by smb_open()
+ *  slave = SMBus slave address; see boardlist[] in boards.c
+ * idxreg = Index/register to read
+ *    val = Filled in with the byte read
+ *
+ * Reads a byte off off the SMBus via ioctl().  See smb(4) for details.
+ * The data buffer is on the stack, so any number of buses can be read
+ * at once.
+ *
+ * Returns 0 on success, or -1 with errno set by ioctl() on failure.
+ */
+static int
+smb_read_byte(struct smbus *bus, int slave, u_char idxreg, uint8_t *val)
+{
+	char ibuf[SMB_MAXBLOCKSIZE];	/* SMBus data buffer */
+	struct smbcmd c;
+
+	memset(&c, 0, sizeof(struct smbcmd));
+
+#if (__FreeBSD_version >= 1100070)
+	c.slave = slave << 1;
+	c.rbuf = ibuf;
+	c.rcount = 1;
+#else
+	c.slave = (u_char) (slave & 0xff) << 1;
+	c.data.byte_ptr = ibuf;
+#endif
+
+	c.cmd = idxreg;
+
+	if (ioctl(bus->fd, SMB_READB, &c) == -1) {
+		VERBOSE("ioctl(SMB_READB) failed: %s\n", strerror(errno));
+		return (-1);
+	}
+
+	*val = (u_char) ibuf[0];
+	return (0);
+}
+
+
+/*
+ * smb_read_block(struct smbus *bus, int slave, u_char idxreg, u_char *buf,
+ *                size_t len)
+ *
+ *    bus = Bus opened by smb_open()
+ *  slave = SMBus slave address; see boardlist[] in boards.c
+ * idxreg = First index/register to read
+ *    buf = Buffer to place register contents in
+ *    len = Number of consecutive registers to read (SMBUS_BLOCKMAX max)
+ *
+ * Reads a block of registers off the SMBus with a single SMB_BREAD
+ * ioctl().  Not every SMBus controller driver implements SMB_BREAD, and
+ * a chip which doesn't understand the block read protocol may hand back
+ * a byte count which doesn't match what we asked for.  It may just as
+ * well hand back one which does, with the registers shifted by a byte;
+ * read_block() in smbus_io.c catches that by checking against byte reads.
+ *
+ * Before __FreeBSD_version 1100070, smb(4) doesn't tell us how many
+ * bytes came back at all, so block reads aren't used there.
+ *
+ * Returns 0 on success.  Returns -1 in either of the above cases, in
+ * which case the caller should fall back to byte reads.
+ */
+#if (__FreeBSD_version >= 1100070)
+static int
+smb_read_block(struct smbus *bus, int slave, u_char idxreg, u_char *buf,
+    size_t len)
+{
+	struct smbcmd c;
+
+	memset(&c, 0, sizeof(struct smbcmd));
+
+	c.slave = slave << 1;
+	c.rbuf = (char *) buf;
+	c.rcount = len;
+	c.cmd = idxreg;
+
+	if (ioctl(bus->fd, SMB_BREAD, &c) == -1) {
+		return (-1);
+	}
+	if ((size_t) c.rcount != len) {
+		return (-1);
+	}
+	return (0);
+}
+#endif
+
+
+/*
+ * smb_write_byte(struct smbus *bus, int slave, u_char idxreg, u_char value)
+ *
+ *    bus = Bus opened by smb_open()
+ *  slave = SMBus slave address; see boardlist[] in boards.c
+ * idxreg = Index/register to write to
+ *  value = Value to write to bus
+ *
+ * Writes a byte to the SMBus via ioctl().  See smb(4) for details.
+ *
+ * Returns 0 on success, or -1 with errno set by ioctl() on failure.
+ */
+static int
+smb_write_byte(struct smbus *bus, int slave, u_char idxreg, u_char value)
+{
+	struct smbcmd c;
+
+	memset(&c, 0, sizeof(struct smbcmd));
+
+#if (__FreeBSD_version >= 1100070)
+	c.slave = slave << 1;
+	c.wdata.byte = value;
+#else
+	c.slave = (u_char) (slave & 0xff) << 1;
+	c.data.byte = value;
+#endif
+
+	c.cmd = idxreg;
+
+	if (ioctl(bus->fd, SMB_WRITEB, &c) == -1) {
+		VERBOSE("ioctl(SMB_WRITEB) failed: %s\n", strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+
+/*
+ * smb_close(struct smbus *bus)
+ *
+ * bus = Bus opened by smb_open()
+ *
+ * Closes the device, releasing the exclusive lock.
+ */
+static void
+smb_close(struct smbus *bus)
+{
+	close(bus->fd);
+	bus->fd = -1;
+}
+
+#endif /* __FreeBSD__ */
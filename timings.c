@@ -0,0 +1,133 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include "global.h"
+
+/*
+ * Phase timings (--timings); see struct timings in global.h.  Marks are
+ * a clock_gettime(2) each, so they're cheap enough to leave in, and
+ * cost nothing but a NULL test when --timings isn't given.
+ */
+
+/*
+ * Names of timing_phases_e, as printed
+ */
+static const char *phase_names[PHASE_MAX] = {
+	"args",
+	"smbios",
+	"lookup",
+	"alloc",
+	"open",
+	"plan",
+	"collect",
+	"decode",
+	"output",
+};
+
+/*
+ * Function prototypes
+ */
+static uint64_t	timings_now(void);
+void		timings_start(struct timings *);
+void		timings_mark(struct timings *, const int);
+int		timings_print(FILE *, const struct timings *, const int);
+
+
+/*
+ * timings_now(void)
+ *
+ * Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+static uint64_t
+timings_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+
+/*
+ * timings_start(struct timings *t)
+ *
+ * t = Timings to start
+ *
+ * Zeroes every phase; the first mark is charged the time since now.
+ */
+void
+timings_start(struct timings *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->start = t->last = timings_now();
+}
+
+
+/*
+ * timings_mark(struct timings *t, const int phase)
+ *
+ *     t = Timings started with timings_start(), or NULL
+ * phase = Phase which just ended; one of timing_phases_e
+ *
+ * Charges the time since the previous mark to phase.  A phase may be
+ * marked more than once (e.g. once per bus); the times add up.
+ */
+void
+timings_mark(struct timings *t, const int phase)
+{
+	uint64_t now;
+
+	if (t == NULL) {
+		return;
+	}
+	now = timings_now();
+	t->ns[phase] += now - t->last;
+	t->last = now;
+}
+
+
+/*
+ * timings_print(FILE *fp, const struct timings *t, const int json)
+ *
+ *    fp = Stream to print to (e.g. stderr)
+ *     t = Timings, marked up to the end of the run
+ *  json = Non-zero to print a JSON object instead of a table
+ *
+ * Prints how long each phase took, in microseconds, and the total from
+ * timings_start() to the last mark.  Anything not covered by a phase
+ * (e.g. a chip routine returning early) shows up only in the total.
+ *
+ * Returns 0 on success, or -1 if fp couldn't be written to.
+ */
+int
+timings_print(FILE *fp, const struct timings *t, const int json)
+{
+	size_t i;
+
+	if (json) {
+		fprintf(fp, "{\n\t\"timings_us\": {\n");
+		for (i = 0; i < PHASE_MAX; ++i) {
+			fprintf(fp, "\t\t\"%s\": %.3f,\n", phase_names[i],
+			    (double)t->ns[i] / 1000.0);
+		}
+		fprintf(fp, "\t\t\"total\": %.3f\n\t}\n}\n",
+		    (double)(t->last - t->start) / 1000.0);
+	} else {
+		fprintf(fp, "%-8s  %12s\n", "phase", "us");
+		for (i = 0; i < PHASE_MAX; ++i) {
+			fprintf(fp, "%-8s  %12.3f\n", phase_names[i],
+			    (double)t->ns[i] / 1000.0);
+		}
+		fprintf(fp, "%-8s  %12.3f\n", "total",
+		    (double)(t->last - t->start) / 1000.0);
+	}
+
+	fflush(fp);
+	return (ferror(fp) ? -1 : 0);
+}
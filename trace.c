@@ -0,0 +1,444 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include "global.h"
+
+/*
+ * Tracing (see TRACE() in global.h).  Normally each trace is printed to
+ * stdout as it's made.  After trace_ring(), traces are recorded into a
+ * ring buffer holding the most recent ones instead, and only printed (to
+ * whatever stream is given) by trace_dump(); bsdhwmon does that on exit,
+ * and on SIGUSR1 via trace_dump_request().
+ *
+ * A ring record is the address of the format string plus the arguments
+ * as they were passed, not the formatted text.  Making one costs a walk
+ * over the format string and a few stores; the printf(3) work is left to
+ * trace_dump(), and only done for records which get dumped.  Format
+ * strings are always literals, so the address stays good, but %s
+ * arguments often aren't and are copied into the record.
+ *
+ * Any number of threads can trace at once.  A record's slot is claimed
+ * with an atomic increment of ringhead, and guarded by a sequence number
+ * much like the one in bsdhwmon_shm.h: odd while the slot is being
+ * written, and twice (index + 1) once it holds record index.  A record
+ * whose slot is still being written by a thread which has since been
+ * lapped is dropped, as is one which changes while being dumped.
+ *
+ * Conversions are limited to what TRACE() callers use: no "*" widths,
+ * no %n and no long double.
+ */
+#define TRACE_ARGS	6		/* Most arguments kept per record */
+#define TRACE_STRLEN	64		/* Room for %s arguments per record */
+
+union trace_arg {
+	intmax_t	i;		/* %d, %i, %c */
+	uintmax_t	u;		/* %o, %u, %x, %X; %s (offset into str[]) */
+	double		d;		/* %a, %e, %f, %g */
+	const void	*p;		/* %p */
+};
+
+struct trace_entry {
+	uint64_t	nsec;		/* CLOCK_MONOTONIC */
+	const char	*fmt;
+	union trace_arg	args[TRACE_ARGS];
+	char		str[TRACE_STRLEN];	/* %s arguments, NUL-terminated */
+};
+
+struct trace_record {
+	atomic_ulong	seq;		/* See above */
+	struct trace_entry	e;
+};
+
+/*
+ * One conversion specification of a format string, split up
+ */
+struct trace_conv {
+	char		spec[16];	/* "%", flags, width and precision */
+	char		len;		/* Length modifier; 'H' is hh, 'q' is ll */
+	char		conv;		/* Conversion character, or 0 if none */
+};
+
+/*
+ * Function prototypes (trace() is in global.h)
+ */
+static uint64_t	trace_now(void);
+static const char *	trace_parse(const char *, struct trace_conv *);
+static void	trace_record(const char *, va_list);
+static void	trace_print(FILE *, const struct trace_entry *);
+int		trace_ring(const size_t);
+void		trace_dump(FILE *);
+void		trace_dump_request(void);
+
+/*
+ * Global variables
+ */
+static struct trace_record	*ring = NULL;	/* Set by trace_ring() */
+static size_t	ringsize = 0;			/* Records in ring[] */
+static atomic_ulong	ringhead;		/* Records made so far */
+static u_long	ringdumped = 0;			/* ringhead at the last dump */
+static atomic_int	dump_requested;		/* Set by trace_dump_request() */
+
+
+/*
+ * trace_now(void)
+ *
+ * Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+static uint64_t
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+
+/*
+ * trace_parse(const char *p, struct trace_conv *c)
+ *
+ * p = Conversion specification in a format string, starting at its "%"
+ * c = Filled in with its parts
+ *
+ * Returns a pointer just past the specification.
+ */
+static const char *
+trace_parse(const char *p, struct trace_conv *c)
+{
+	size_t n = 0;
+
+	c->spec[n++] = *p++;
+	while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+		if (n < sizeof(c->spec) - 1) {
+			c->spec[n++] = *p;
+		}
+		++p;
+	}
+	c->spec[n] = '\0';
+
+	c->len = 0;
+	if (*p != '\0' && strchr("hljztqL", *p) != NULL) {
+		c->len = *p++;
+		if (c->len == 'h' && *p == 'h') {
+			c->len = 'H';
+			++p;
+		} else if (c->len == 'l' && *p == 'l') {
+			c->len = 'q';
+			++p;
+		}
+	}
+
+	c->conv = *p;
+	return (*p != '\0' ? p + 1 : p);
+}
+
+
+/*
+ * trace_record(const char *fmt, va_list ap)
+ *
+ * fmt = printf(3) format string
+ *  ap = Its arguments
+ *
+ * Records a trace into the ring.  Arguments past the first TRACE_ARGS,
+ * and %s arguments which don't fit, are cut off.
+ */
+static void
+trace_record(const char *fmt, va_list ap)
+{
+	struct trace_record *r;
+	struct trace_entry *e;
+	struct trace_conv c;
+	const char *p, *s;
+	size_t n = 0, used = 0, len;
+	u_long idx, seq;
+	intmax_t i;
+	uintmax_t u;
+
+	idx = atomic_fetch_add_explicit(&ringhead, 1, memory_order_relaxed);
+	r = &ring[idx % ringsize];
+	seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+	if ((seq & 1) != 0 || seq >= (idx + 1) * 2 ||
+	    !atomic_compare_exchange_strong_explicit(&r->seq, &seq, seq | 1,
+	    memory_order_acquire, memory_order_relaxed)) {
+		return;
+	}
+
+	e = &r->e;
+	e->nsec = trace_now();
+
+	for (p = fmt; n < TRACE_ARGS && (p = strchr(p, '%')) != NULL; ) {
+		p = trace_parse(p, &c);
+		switch (c.conv) {
+			case 'd':
+			case 'i':
+				switch (c.len) {
+					case 'l': i = va_arg(ap, long); break;
+					case 'q': i = va_arg(ap, long long); break;
+					case 'j': i = va_arg(ap, intmax_t); break;
+					case 'z': i = va_arg(ap, ssize_t); break;
+					case 't': i = va_arg(ap, ptrdiff_t); break;
+					case 'H': i = (signed char)va_arg(ap, int); break;
+					case 'h': i = (short)va_arg(ap, int); break;
+					default: i = va_arg(ap, int); break;
+				}
+				e->args[n++].i = i;
+				break;
+			case 'o':
+			case 'u':
+			case 'x':
+			case 'X':
+				switch (c.len) {
+					case 'l': u = va_arg(ap, u_long); break;
+					case 'q': u = va_arg(ap, unsigned long long); break;
+					case 'j': u = va_arg(ap, uintmax_t); break;
+					case 'z': u = va_arg(ap, size_t); break;
+					case 't': u = (uintmax_t)va_arg(ap, ptrdiff_t); break;
+					case 'H': u = (u_char)va_arg(ap, u_int); break;
+					case 'h': u = (u_short)va_arg(ap, u_int); break;
+					default: u = va_arg(ap, u_int); break;
+				}
+				e->args[n++].u = u;
+				break;
+			case 'c':
+				e->args[n++].i = va_arg(ap, int);
+				break;
+			case 's':
+				if ((s = va_arg(ap, const char *)) == NULL) {
+					s = "(null)";
+				}
+				len = strlen(s);
+				if (len > TRACE_STRLEN - used - 1) {
+					len = TRACE_STRLEN - used - 1;
+				}
+				memcpy(e->str + used, s, len);
+				e->str[used + len] = '\0';
+				e->args[n++].u = used;
+				used += (used + len + 1 < TRACE_STRLEN ? len + 1 : len);
+				break;
+			case 'p':
+				e->args[n++].p = va_arg(ap, void *);
+				break;
+			case 'a':
+			case 'e':
+			case 'f':
+			case 'g':
+			case 'A':
+			case 'E':
+			case 'F':
+			case 'G':
+				e->args[n++].d = va_arg(ap, double);
+				break;
+			case '%':
+				break;
+			default:
+				/* Can't tell what the rest of the arguments are */
+				n = TRACE_ARGS;
+				break;
+		}
+	}
+
+	e->fmt = fmt;
+	atomic_store_explicit(&r->seq, (idx + 1) * 2, memory_order_release);
+}
+
+
+/*
+ * trace_print(FILE *fp, const struct trace_entry *e)
+ *
+ * fp = Stream to print to
+ *  e = Record to print
+ *
+ * Prints e as trace() would have printed it straight away, prefixed by
+ * the time it was made.  Each conversion is printed by itself, with its
+ * length modifier replaced by that of the type trace_record() kept the
+ * argument as.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static void
+trace_print(FILE *fp, const struct trace_entry *e)
+{
+	struct trace_conv c;
+	const char *p, *q;
+	char spec[32];
+	size_t n = 0;
+
+	fprintf(fp, "[%ju.%09ju] ==> ", (uintmax_t)(e->nsec / 1000000000),
+	    (uintmax_t)(e->nsec % 1000000000));
+
+	for (p = e->fmt; *p != '\0'; p = q) {
+		if (*p != '%') {
+			if ((q = strchr(p, '%')) == NULL) {
+				q = p + strlen(p);
+			}
+			fwrite(p, 1, (size_t)(q - p), fp);
+			continue;
+		}
+
+		q = trace_parse(p, &c);
+		if (c.conv == '%') {
+			putc('%', fp);
+			continue;
+		}
+		if (n >= TRACE_ARGS || c.conv == '\0' ||
+		    strchr("diouxXcspaefgAEFG", c.conv) == NULL) {
+			fwrite(p, 1, (size_t)(q - p), fp);
+			continue;
+		}
+
+		switch (c.conv) {
+			case 'd':
+			case 'i':
+				snprintf(spec, sizeof(spec), "%sj%c", c.spec, c.conv);
+				fprintf(fp, spec, e->args[n].i);
+				break;
+			case 'o':
+			case 'u':
+			case 'x':
+			case 'X':
+				snprintf(spec, sizeof(spec), "%sj%c", c.spec, c.conv);
+				fprintf(fp, spec, e->args[n].u);
+				break;
+			case 'c':
+				snprintf(spec, sizeof(spec), "%sc", c.spec);
+				fprintf(fp, spec, (int)e->args[n].i);
+				break;
+			case 's':
+				snprintf(spec, sizeof(spec), "%ss", c.spec);
+				fprintf(fp, spec, e->str + e->args[n].u);
+				break;
+			case 'p':
+				snprintf(spec, sizeof(spec), "%sp", c.spec);
+				fprintf(fp, spec, e->args[n].p);
+				break;
+			default:
+				snprintf(spec, sizeof(spec), "%s%c", c.spec, c.conv);
+				fprintf(fp, spec, e->args[n].d);
+				break;
+		}
+		++n;
+	}
+}
+#pragma GCC diagnostic pop
+
+
+/*
+ * trace(const char *fmt, ...)
+ *
+ * fmt = printf(3) format string, and its arguments
+ *
+ * Called by TRACE() (see global.h) once the trace level has been
+ * checked.  Prints the trace to stdout, or records it into the ring if
+ * there is one.  Also where a dump asked for by trace_dump_request()
+ * happens, so that it happens outside the signal handler.
+ */
+void
+trace(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (ring != NULL) {
+		trace_record(fmt, ap);
+	} else {
+		flockfile(stdout);
+		fputs("==> ", stdout);
+		vfprintf(stdout, fmt, ap);
+		funlockfile(stdout);
+	}
+	va_end(ap);
+
+	if (atomic_load_explicit(&dump_requested, memory_order_relaxed) &&
+	    atomic_exchange(&dump_requested, 0)) {
+		trace_dump(stderr);
+	}
+}
+
+
+/*
+ * trace_ring(const size_t n)
+ *
+ * n = Number of records the ring holds
+ *
+ * Sends all traces from now on into a ring buffer of the last n traces,
+ * instead of to stdout.  Must be called before any other thread traces;
+ * the ring is never freed.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+trace_ring(const size_t n)
+{
+	if ((ring = calloc(n, sizeof(*ring))) == NULL) {
+		return (-1);
+	}
+	ringsize = n;
+	return (0);
+}
+
+
+/*
+ * trace_dump(FILE *fp)
+ *
+ * fp = Stream to print to (e.g. stderr)
+ *
+ * Prints the records made since the last dump (as many of them as the
+ * ring still holds), oldest first.  Does nothing without a ring.
+ */
+void
+trace_dump(FILE *fp)
+{
+	struct trace_record *r;
+	struct trace_entry e;
+	u_long head, i, seq;
+
+	if (ring == NULL) {
+		return;
+	}
+
+	head = atomic_load_explicit(&ringhead, memory_order_acquire);
+	i = ringdumped;
+	if (head - i > ringsize) {
+		fprintf(fp, "(%lu older trace records overwritten)\n",
+		    head - i - ringsize);
+		i = head - ringsize;
+	}
+	for (; i < head; ++i) {
+		r = &ring[i % ringsize];
+		if ((seq = atomic_load_explicit(&r->seq, memory_order_acquire)) !=
+		    (i + 1) * 2) {
+			continue;
+		}
+		e = r->e;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&r->seq, memory_order_relaxed) != seq) {
+			continue;
+		}
+		trace_print(fp, &e);
+	}
+	ringdumped = head;
+	fflush(fp);
+}
+
+
+/*
+ * trace_dump_request(void)
+ *
+ * Asks for the ring to be dumped to stderr at the next trace.  Safe to
+ * call from a signal handler, which trace_dump() isn't.
+ */
+void
+trace_dump_request(void)
+{
+	atomic_store(&dump_requested, 1);
+}